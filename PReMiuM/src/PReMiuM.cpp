@@ -36,6 +36,8 @@
 #include<cstdlib>
 #include<ctime>
 #include<sstream>
+#include<fstream>
+#include<atomic>
 
 // Custom includes
 #include<MCMC/sampler.h>
@@ -53,60 +55,34 @@
 
 using std::vector;
 using std::ostringstream;
+using std::ofstream;
+using std::endl;
 using std::time;
 using std::string;
 
-RcppExport SEXP profRegr(SEXP inputString) {
-	string inputStr = Rcpp::as<string>(inputString);
-
-	/* ---------- Start the timer ------------------*/
-	time_t beginTime,currTime;
-	beginTime = time(NULL);
-	/* -----------Process the command line ---------*/
-	pReMiuMOptions options = processCommandLine(inputStr);
-
-	/* ---------- Set up the sampler object--------*/
-	// Initialise the sampler object
-	mcmcSampler<pReMiuMParams,pReMiuMOptions,
-				pReMiuMPropParams,pReMiuMData> pReMiuMSampler;
-
-	// Set the options
-	pReMiuMSampler.options(options);
-
-	// Set the model
-	pReMiuMSampler.model(&importPReMiuMData,&initialisePReMiuM,
-							&pReMiuMLogPost,true);
-
-	// Set the missing data function
-	pReMiuMSampler.updateMissingDataFn(&updateMissingPReMiuMData);
-
-	// Add the function for writing output
-	pReMiuMSampler.userOutputFn(&writePReMiuMOutput);
-
-	// Seed the random number generator
-	pReMiuMSampler.seedGenerator(options.seed());
-
-	// Set the sampler specific variables
-	pReMiuMSampler.nSweeps(options.nSweeps());
-	pReMiuMSampler.nBurn(options.nBurn());
-	pReMiuMSampler.nFilter(options.nFilter());
-	pReMiuMSampler.nProgress(options.nProgress());
-	pReMiuMSampler.reportBurnIn(options.reportBurnIn());
-
-	/* ---------- Read in the data -------- */
-	pReMiuMSampler.model().dataset().outcomeType(options.outcomeType());
-	pReMiuMSampler.model().dataset().covariateType(options.covariateType());
-	pReMiuMSampler.model().dataset().includeCAR(options.includeCAR());
-	pReMiuMSampler.importData(options.inFileName(),options.predictFileName(),options.neighbourFileName());
-	pReMiuMData dataset = pReMiuMSampler.model().dataset();
-
-	/* ---------- Add the proposals -------- */
+// Add the proposals used by the model to a sampler
+void addPReMiuMProposals(mcmcSampler<pReMiuMParams,pReMiuMOptions,
+								pReMiuMPropParams,pReMiuMData>& pReMiuMSampler,
+							const pReMiuMOptions& options,const pReMiuMData& dataset){
 
 	// Set the proposal parameters
 	pReMiuMPropParams proposalParams(options.nSweeps(),dataset.nCovariates(),
 										dataset.nFixedEffects(),dataset.nCategoriesY());
 	pReMiuMSampler.proposalParams(proposalParams);
 
+	// The updates that evaluate the response density for each subject are
+	// instantiated for the density of the outcome
+	pReMiuMResponseProposals response = responseProposals(options);
+
+	// The updates of the hyperparameters, of u and alpha and of the inactive
+	// clusters declare the parts of the parameters they read and write (see
+	// pReMiuMStatePart), so that with the parallelProposals option those that
+	// do not use the parts changed by each other are run concurrently. The
+	// other updates read and write all the parameters. The per cluster
+	// updates also use the workspace when they are run in parallel over the
+	// clusters
+	const unsigned int clusterWork = options.parallelClusters()?stateWorkspace:0;
+
 	// The gibbs update for the active V
 	pReMiuMSampler.addProposal("gibbsForVActive",1.0,1,1,&gibbsForVActive);
 
@@ -143,17 +119,25 @@ RcppExport SEXP profRegr(SEXP inputString) {
 		
 		// Update for R1
 		if(options.useIndependentNormal()){
-			pReMiuMSampler.addProposal("gibbsForR1Indep", 1.0, 1, 1, &gibbsForR1Indep);
+			pReMiuMSampler.addProposal("gibbsForR1Indep", 1.0, 1, 1, &gibbsForR1Indep,
+				stateTau|stateZ,stateR1);
 		}else if (options.useHyperpriorR1()){
-			pReMiuMSampler.addProposal("metropolisHastingsForKappa1", 1.0, 1, 1, &metropolisHastingsForKappa1);
-			pReMiuMSampler.addProposal("gibbsForR1",1.0,1,1,&gibbsForR1);
-			pReMiuMSampler.addProposal("gibbsForMu00", 1.0, 1, 1, &gibbsForMu00);
-			pReMiuMSampler.addProposal("gibbsForTau00", 1.0, 1, 1, &gibbsForTau00);
+			pReMiuMSampler.addProposal("metropolisHastingsForKappa1", 1.0, 1, 1, &metropolisHastingsForKappa1,
+				stateTau|stateR1|stateZ,stateKappa1);
+			pReMiuMSampler.addProposal("gibbsForR1",1.0,1,1,&gibbsForR1,
+				stateTau|stateKappa1|stateZ,stateR1);
+			pReMiuMSampler.addProposal("gibbsForMu00", 1.0, 1, 1, &gibbsForMu00,
+				stateMu|stateTau00|stateZ,stateMu00);
+			pReMiuMSampler.addProposal("gibbsForTau00", 1.0, 1, 1, &gibbsForTau00,
+				stateMu|stateMu00|stateZ,stateTau00);
 		}
 		else if (options.useSeparationPrior()) {
-			pReMiuMSampler.addProposal("gibbsForBetaTauS", 1.0, 1, 1, &gibbsForBetaTauS);
-			pReMiuMSampler.addProposal("metropolisHastingsForKappa1SP", 1.0, 1, 1, &metropolisHastingsForKappa1SP);
-			pReMiuMSampler.addProposal("gibbsForMu00", 1.0, 1, 1, &gibbsForMu00);
+			pReMiuMSampler.addProposal("gibbsForBetaTauS", 1.0, 1, 1, &gibbsForBetaTauS,
+				stateTau|stateZ,stateR1);
+			pReMiuMSampler.addProposal("metropolisHastingsForKappa1SP", 1.0, 1, 1, &metropolisHastingsForKappa1SP,
+				stateTau|stateZ,stateKappa1);
+			pReMiuMSampler.addProposal("gibbsForMu00", 1.0, 1, 1, &gibbsForMu00,
+				stateMu|stateTau00|stateZ,stateMu00);
 		}
 
 	}else if(options.covariateType().compare("Mixed")==0){
@@ -190,16 +174,24 @@ RcppExport SEXP profRegr(SEXP inputString) {
 		
 		// Update for R1
 		if (options.useIndependentNormal()) {
-			pReMiuMSampler.addProposal("gibbsForR1Indep", 1.0, 1, 1, &gibbsForR1Indep);
+			pReMiuMSampler.addProposal("gibbsForR1Indep", 1.0, 1, 1, &gibbsForR1Indep,
+				stateTau|stateZ,stateR1);
 		}else if (options.useHyperpriorR1()){
-			pReMiuMSampler.addProposal("metropolisHastingsForKappa1", 1.0, 1, 1, &metropolisHastingsForKappa1);
-			pReMiuMSampler.addProposal("gibbsForR1",1.0,1,1,&gibbsForR1);
-			pReMiuMSampler.addProposal("gibbsForMu00", 1.0, 1, 1, &gibbsForMu00);
-			pReMiuMSampler.addProposal("gibbsForTau00", 1.0, 1, 1, &gibbsForTau00);
+			pReMiuMSampler.addProposal("metropolisHastingsForKappa1", 1.0, 1, 1, &metropolisHastingsForKappa1,
+				stateTau|stateR1|stateZ,stateKappa1);
+			pReMiuMSampler.addProposal("gibbsForR1",1.0,1,1,&gibbsForR1,
+				stateTau|stateKappa1|stateZ,stateR1);
+			pReMiuMSampler.addProposal("gibbsForMu00", 1.0, 1, 1, &gibbsForMu00,
+				stateMu|stateTau00|stateZ,stateMu00);
+			pReMiuMSampler.addProposal("gibbsForTau00", 1.0, 1, 1, &gibbsForTau00,
+				stateMu|stateMu00|stateZ,stateTau00);
 		}else if (options.useSeparationPrior()) {
-			pReMiuMSampler.addProposal("gibbsForBetaTauS", 1.0, 1, 1, &gibbsForBetaTauS);
-			pReMiuMSampler.addProposal("metropolisHastingsForKappa1SP", 1.0, 1, 1, &metropolisHastingsForKappa1SP);
-			pReMiuMSampler.addProposal("gibbsForMu00", 1.0, 1, 1, &gibbsForMu00);
+			pReMiuMSampler.addProposal("gibbsForBetaTauS", 1.0, 1, 1, &gibbsForBetaTauS,
+				stateTau|stateZ,stateR1);
+			pReMiuMSampler.addProposal("metropolisHastingsForKappa1SP", 1.0, 1, 1, &metropolisHastingsForKappa1SP,
+				stateTau|stateZ,stateKappa1);
+			pReMiuMSampler.addProposal("gibbsForMu00", 1.0, 1, 1, &gibbsForMu00,
+				stateMu|stateTau00|stateZ,stateMu00);
 		}
 	}
 
@@ -216,11 +208,11 @@ RcppExport SEXP profRegr(SEXP inputString) {
 
 	if(options.includeResponse()){
 		// The Metropolis Hastings update for the active theta
-		pReMiuMSampler.addProposal("metropolisHastingsForThetaActive",1.0,1,1,&metropolisHastingsForThetaActive);
+		pReMiuMSampler.addProposal("metropolisHastingsForThetaActive",1.0,1,1,response.thetaProposal());
 
 		// Adaptive MH for beta
 		if(dataset.nFixedEffects()>0){
-			pReMiuMSampler.addProposal("metropolisHastingsForBeta",1.0,1,1,&metropolisHastingsForBeta);
+			pReMiuMSampler.addProposal("metropolisHastingsForBeta",1.0,1,1,response.betaProposal());
 		}
 
 		if(options.responseExtraVar()){
@@ -228,7 +220,8 @@ RcppExport SEXP profRegr(SEXP inputString) {
 			pReMiuMSampler.addProposal("metropolisHastingsForLambda",1.0,1,1,&metropolisHastingsForLambda);
 
 			// Gibbs for tauEpsilon
-			pReMiuMSampler.addProposal("gibbsForTauEpsilon",1.0,1,1,&gibbsForTauEpsilon);
+			pReMiuMSampler.addProposal("gibbsForTauEpsilon",1.0,1,1,&gibbsForTauEpsilon,
+				stateZ|stateTheta|stateBeta|stateLambda,stateTauEpsilon);
 		}
 
 		//if spatial random term
@@ -246,7 +239,8 @@ RcppExport SEXP profRegr(SEXP inputString) {
 		  }
 		      
 			//Gibbs for TauCAR
-			pReMiuMSampler.addProposal("gibbsForTauCAR", 1.0,1,1,&gibbsForTauCAR);
+			pReMiuMSampler.addProposal("gibbsForTauCAR", 1.0,1,1,&gibbsForTauCAR,
+				stateUCAR,stateTauCAR);
 		}
 
 		if(options.outcomeType().compare("Survival")==0){
@@ -260,12 +254,14 @@ RcppExport SEXP profRegr(SEXP inputString) {
 
 	// Gibbs for U
 	if(options.samplerType().compare("Truncated")!=0){
-		pReMiuMSampler.addProposal("gibbsForU",1.0,1,1,&gibbsForU);
+		pReMiuMSampler.addProposal("gibbsForU",1.0,1,1,&gibbsForU,
+			stateZ|statePsi,stateU|stateWorkspace);
 	}
 
 	// The Metropolis Hastings update for alpha
 	if(options.fixedAlpha()<=-1){
-		pReMiuMSampler.addProposal("metropolisHastingsForAlpha",1.0,1,1,&metropolisHastingsForAlpha);
+		pReMiuMSampler.addProposal("metropolisHastingsForAlpha",1.0,1,1,&metropolisHastingsForAlpha,
+			statePsi|stateZ,stateAlpha);
 	}
 
 	// The gibbs update for the inactive V
@@ -274,35 +270,43 @@ RcppExport SEXP profRegr(SEXP inputString) {
 	if(options.covariateType().compare("Discrete")==0){
 		// For discrete X data we do a mixture of Categorical and ordinal updates
 		//  Update for the inactive phi parameters
-		pReMiuMSampler.addProposal("gibbsForPhiInActive",1.0,1,1,&gibbsForPhiInActive);
+		pReMiuMSampler.addProposal("gibbsForPhiInActive",1.0,1,1,&gibbsForPhiInActive,
+			stateZ|stateGamma,statePhi|clusterWork);
 
 	}else if(options.covariateType().compare("Normal")==0){
 		// Need to add the proposals for the normal case
 		// Update for the active mu parameters
 		if (options.useNormInvWishPrior()){
 		// If Inverse Normal Inverse Wishart Prior is used
-		pReMiuMSampler.addProposal("gibbsForMuInActiveNIWP",1.0,1,1,&gibbsForMuInActiveNIWP);
+		pReMiuMSampler.addProposal("gibbsForMuInActiveNIWP",1.0,1,1,&gibbsForMuInActiveNIWP,
+			stateZ|stateTau|stateGamma,stateMu);
 		}else if (options.useIndependentNormal()) {
 		// If the independent normal conditional likelihood is used
-		pReMiuMSampler.addProposal("gibbsForMuInActiveIndep", 1.0, 1, 1, &gibbsForMuInActiveIndep);
+		pReMiuMSampler.addProposal("gibbsForMuInActiveIndep", 1.0, 1, 1, &gibbsForMuInActiveIndep,
+			stateZ|stateTau|stateGamma,stateMu);
 		}else{
 		// If independant Normal and Inverse Wishart priors are used
-		pReMiuMSampler.addProposal("gibbsForMuInActive",1.0,1,1,&gibbsForMuInActive);
+		pReMiuMSampler.addProposal("gibbsForMuInActive",1.0,1,1,&gibbsForMuInActive,
+			stateZ|stateTau|stateGamma|stateMu00|stateTau00,stateMu|clusterWork);
 		}
 
 
 		// Update for the active Sigma parameters
 		if (options.useIndependentNormal()) {
 			// If the independent normal conditional likelihood is used
-			pReMiuMSampler.addProposal("gibbsForTauInActiveIndep", 1.0, 1, 1, &gibbsForTauInActiveIndep);
+			pReMiuMSampler.addProposal("gibbsForTauInActiveIndep", 1.0, 1, 1, &gibbsForTauInActiveIndep,
+				stateZ|stateMu|stateR1,stateTau);
 		}
 		else if (options.useSeparationPrior()) {
-			pReMiuMSampler.addProposal("gibbsForTauRInActive", 1.0, 1, 1, &gibbsForTauRInActive);
-			pReMiuMSampler.addProposal("gibbsForTauSInActive", 1.0, 1, 1, &gibbsForTauSInActive);
+			pReMiuMSampler.addProposal("gibbsForTauRInActive", 1.0, 1, 1, &gibbsForTauRInActive,
+				stateZ|stateMu|stateKappa1,stateTau);
+			pReMiuMSampler.addProposal("gibbsForTauSInActive", 1.0, 1, 1, &gibbsForTauSInActive,
+				stateZ|stateMu|stateR1,stateTau);
 
 		}else {
 			// If the multivariate normal conditional likelihood is used
-			pReMiuMSampler.addProposal("gibbsForTauInActive", 1.0, 1, 1, &gibbsForTauInActive);
+			pReMiuMSampler.addProposal("gibbsForTauInActive", 1.0, 1, 1, &gibbsForTauInActive,
+				stateZ|stateMu|stateR1|stateKappa1,stateTau|clusterWork);
 		}
 		
 
@@ -310,35 +314,43 @@ RcppExport SEXP profRegr(SEXP inputString) {
 
 		// For discrete X data we do a mixture of Categorical and ordinal updates
 		//  Update for the inactive phi parameters
-		pReMiuMSampler.addProposal("gibbsForPhiInActive",1.0,1,1,&gibbsForPhiInActive);
+		pReMiuMSampler.addProposal("gibbsForPhiInActive",1.0,1,1,&gibbsForPhiInActive,
+			stateZ|stateGamma,statePhi|clusterWork);
 
 		// Need to add the proposals for the normal case
 		// Update for the active mu parameters
 		if (options.useNormInvWishPrior()){
 		// If Inverse Normal Inverse Wishart Prior is used
-		pReMiuMSampler.addProposal("gibbsForMuInActiveNIWP",1.0,1,1,&gibbsForMuInActiveNIWP);
+		pReMiuMSampler.addProposal("gibbsForMuInActiveNIWP",1.0,1,1,&gibbsForMuInActiveNIWP,
+			stateZ|stateTau|stateGamma,stateMu);
 		}else if (options.useIndependentNormal()) {
 		// If the independent normal conditional likelihood is used
-		pReMiuMSampler.addProposal("gibbsForMuInActiveIndep", 1.0, 1, 1, &gibbsForMuInActiveIndep);
+		pReMiuMSampler.addProposal("gibbsForMuInActiveIndep", 1.0, 1, 1, &gibbsForMuInActiveIndep,
+			stateZ|stateTau|stateGamma,stateMu);
 		}else{
 		// If independant Normal and Inverse Wishart priors are used
-		pReMiuMSampler.addProposal("gibbsForMuInActive",1.0,1,1,&gibbsForMuInActive);
+		pReMiuMSampler.addProposal("gibbsForMuInActive",1.0,1,1,&gibbsForMuInActive,
+			stateZ|stateTau|stateGamma|stateMu00|stateTau00,stateMu|clusterWork);
 		}
 
 
 		// Update for the active Sigma parameters
 		if (options.useIndependentNormal()) {
 			// If the independent normal conditional likelihood is used
-			pReMiuMSampler.addProposal("gibbsForTauInActiveIndep", 1.0, 1, 1, &gibbsForTauInActiveIndep);
+			pReMiuMSampler.addProposal("gibbsForTauInActiveIndep", 1.0, 1, 1, &gibbsForTauInActiveIndep,
+				stateZ|stateMu|stateR1,stateTau);
 		}
 		else if (options.useSeparationPrior()) {
-			pReMiuMSampler.addProposal("gibbsForTauRInActive", 1.0, 1, 1, &gibbsForTauRInActive);
-			pReMiuMSampler.addProposal("gibbsForTauSInActive", 1.0, 1, 1, &gibbsForTauSInActive);
+			pReMiuMSampler.addProposal("gibbsForTauRInActive", 1.0, 1, 1, &gibbsForTauRInActive,
+				stateZ|stateMu|stateKappa1,stateTau);
+			pReMiuMSampler.addProposal("gibbsForTauSInActive", 1.0, 1, 1, &gibbsForTauSInActive,
+				stateZ|stateMu|stateR1,stateTau);
 
 		}
 		else {
 			// If the multivariate normal conditional likelihood is used
-			pReMiuMSampler.addProposal("gibbsForTauInActive", 1.0, 1, 1, &gibbsForTauInActive);
+			pReMiuMSampler.addProposal("gibbsForTauInActive", 1.0, 1, 1, &gibbsForTauInActive,
+				stateZ|stateMu|stateR1|stateKappa1,stateTau|clusterWork);
 		}
 		
 	}
@@ -349,7 +361,8 @@ RcppExport SEXP profRegr(SEXP inputString) {
 		firstSweep=1+(unsigned int)(options.nBurn()/10);
 		if(options.varSelectType().compare("Continuous")!=0){
 			// Gibbs update for gamma
-			pReMiuMSampler.addProposal("gibbsForGammaInActive",1.0,1,firstSweep,&gibbsForGammaInActive);
+			pReMiuMSampler.addProposal("gibbsForGammaInActive",1.0,1,firstSweep,&gibbsForGammaInActive,
+				stateZ|stateGamma|statePhi|stateMu|stateTau,stateGamma|statePhi|stateMu);
 		}
 
 	}
@@ -366,10 +379,12 @@ RcppExport SEXP profRegr(SEXP inputString) {
 
 	if(options.includeResponse()){
 		// The Metropolis Hastings update for the inactive theta
-		pReMiuMSampler.addProposal("gibbsForThetaInActive",1.0,1,1,&gibbsForThetaInActive);
+		pReMiuMSampler.addProposal("gibbsForThetaInActive",1.0,1,1,&gibbsForThetaInActive,
+			stateZ,stateTheta|clusterWork);
 		if(options.outcomeType().compare("Survival")==0&&!options.weibullFixedShape()) {
 			pReMiuMSampler.addProposal("gibbsForNu",1.0,1,1,&gibbsForNu);
-			pReMiuMSampler.addProposal("gibbsForNuInActive",1.0,1,1,&gibbsForNuInActive);
+			pReMiuMSampler.addProposal("gibbsForNuInActive",1.0,1,1,&gibbsForNuInActive,
+				stateZ,stateNu);
 
 		}
 	}
@@ -403,36 +418,406 @@ RcppExport SEXP profRegr(SEXP inputString) {
 
 
 	// Gibbs update for the allocation parameters
-	pReMiuMSampler.addProposal("gibbsForZ",1.0,1,1,&gibbsForZ);
+	pReMiuMSampler.addProposal("gibbsForZ",1.0,1,1,response.zProposal());
+
+}
+
+// Collect the traces that a sampler kept in memory (outputFormat "memory")
+// into an R list, named by the suffix of the file they replace (for example
+// "z" for <stem>_z.txt). Each trace holds the values of all the records and
+// the end of each record within them.
+Rcpp::List memoryTraces(mcmcSampler<pReMiuMParams,pReMiuMOptions,
+								pReMiuMPropParams,pReMiuMData>& pReMiuMSampler){
+
+	vector<mcmcOutputFile*>& outFiles = pReMiuMSampler.outFiles();
+	const string& fileStem = pReMiuMSampler.outFileStem();
+	Rcpp::List traces;
+	for(unsigned int i=0;i<outFiles.size();i++){
+		mcmcOutputFile& outFile = *(outFiles[i]);
+		if(!outFile.inMemory()){
+			continue;
+		}
+		// Finish the last record
+		outFile.close();
+		string name = outFile.fileName().substr(fileStem.size()+1);
+		name = name.substr(0,name.rfind(".txt"));
+		const vector<double>& values = outFile.values();
+		Rcpp::IntegerVector recordEnd(outFile.recordEnd().begin(),outFile.recordEnd().end());
+		if(outFile.integerValues()){
+			traces.push_back(Rcpp::List::create(Rcpp::Named("values")=Rcpp::IntegerVector(values.begin(),values.end()),
+					Rcpp::Named("recordEnd")=recordEnd),name);
+		}else{
+			traces.push_back(Rcpp::List::create(Rcpp::Named("values")=Rcpp::NumericVector(values.begin(),values.end()),
+					Rcpp::Named("recordEnd")=recordEnd),name);
+		}
+	}
+	return traces;
+}
+
+// Return the checkpoint file chain k (0 based) is resumed from, given the
+// checkpoint file of the run (of the first chain if there are several
+// chains), or an empty string if the name is not that of a first chain
+string chainCheckpointFileName(const string& fileName,const unsigned int& k,
+		const unsigned int& nChains){
+	if(nChains==1){
+		return fileName;
+	}
+	string firstSuffix = "_chain1_checkpoint.bin";
+	if(fileName.size()<firstSuffix.size()||
+			fileName.compare(fileName.size()-firstSuffix.size(),firstSuffix.size(),firstSuffix)!=0){
+		return "";
+	}
+	ostringstream chainFileName;
+	chainFileName << fileName.substr(0,fileName.size()-firstSuffix.size()) <<
+			"_chain" << k+1 << "_checkpoint.bin";
+	return chainFileName.str();
+}
+
+// Called through R_ToplevelExec, so that an interrupt does not jump out of
+// the sampler
+void checkPReMiuMInterrupt(void*){
+	R_CheckUserInterrupt();
+}
+
+// Return whether the user has interrupted the run from R, which can only be
+// checked from the main thread
+bool pReMiuMUserInterrupt(){
+	return R_ToplevelExec(&checkPReMiuMInterrupt,NULL)==FALSE;
+}
+
+// Run the chains in segments of monitorEvery sweeps (rounded up to a multiple
+// of nFilter), checking between the segments whether the monitored statistics
+// have converged. The burn in ends once their split R-hat over its last half
+// is below targetRhat, and sampling ends once their effective sample size,
+// pooled over the chains, is at least targetESS (and their split R-hat is
+// below targetRhat). Statistics that do not vary are ignored. The sweeps at
+// which the burn in and sampling ended, and the final diagnostics, are
+// written to <output>_convergence.txt and returned for the log file.
+string runMonitoredPReMiuM(vector<mcmcSampler<pReMiuMParams,pReMiuMOptions,
+								pReMiuMPropParams,pReMiuMData> >& pReMiuMSamplers,
+							const pReMiuMOptions& options){
+
+	unsigned int nChains = pReMiuMSamplers.size();
+	unsigned int nFilter = options.nFilter();
+	unsigned int segment = ((options.monitorEvery()+nFilter-1)/nFilter)*nFilter;
+	double targetESS = options.targetESS();
+	double targetRhat = options.targetRhat();
+	ostringstream logStr;
+
+	for(unsigned int k=0;k<nChains;k++){
+		pReMiuMSamplers[k].startRun();
+	}
+
+	// The convergence is also checked at the sweep a run is resumed from, as
+	// the run that wrote the checkpoint could have ended there
+	unsigned int sweep = pReMiuMSamplers[0].sweep();
+	while(true){
+		unsigned int nBurn = pReMiuMSamplers[0].nBurn();
+		if(sweep>0&&sweep%segment==0){
+			// Check the convergence of each statistic
+			bool inBurnIn = sweep<nBurn;
+			bool rhatMet = true,essMet = true;
+			unsigned int nStatistics = pReMiuMSamplers[0].monitor().size();
+			for(unsigned int i=0;i<nStatistics;i++){
+				vector<const mcmcBatchMeans*> chains(nChains);
+				for(unsigned int k=0;k<nChains;k++){
+					chains[k]=&(pReMiuMSamplers[k].monitor()[i]);
+				}
+				double rHat = splitRhat(chains,inBurnIn);
+				if(targetRhat>0&&!std::isnan(rHat)&&!(rHat<targetRhat)){
+					rhatMet=false;
+				}
+				double ess = pooledESS(chains);
+				if(!std::isnan(ess)&&!(ess>=targetESS)){
+					essMet=false;
+				}
+			}
+			if(inBurnIn){
+				if(targetRhat>0&&rhatMet&&nStatistics>0){
+					for(unsigned int k=0;k<nChains;k++){
+						pReMiuMSamplers[k].endBurnIn();
+					}
+					nBurn = sweep;
+					logStr << "Burn in ended at sweep " << sweep << endl;
+				}
+			}else if(targetESS>0&&rhatMet&&essMet&&nStatistics>0&&
+					sweep>nBurn&&sweep<nBurn+pReMiuMSamplers[0].nSweeps()){
+				for(unsigned int k=0;k<nChains;k++){
+					pReMiuMSamplers[k].endSampling();
+				}
+				logStr << "Sampling ended at sweep " << sweep << endl;
+			}
+		}
+		if(sweep>=nBurn+pReMiuMSamplers[0].nSweeps()){
+			break;
+		}
 
+		unsigned int nextSweep = (sweep/segment+1)*segment;
+		if(sweep<nBurn&&nextSweep>nBurn){
+			nextSweep=nBurn;
+		}
+		// The first chain is run by the main thread
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nChains) schedule(static,1)
+#endif
+		for(int k=0;k<(int)nChains;k++){
+			pReMiuMSamplers[k].runSweeps(nextSweep);
+		}
+		if(pReMiuMSamplers[0].interrupted()){
+			break;
+		}
+		sweep = pReMiuMSamplers[0].sweep();
+	}
 
-	/* ---------- Initialise the output files -----*/
-	pReMiuMSampler.initialiseOutputFiles(options.outFileStem());
+	for(unsigned int k=0;k<nChains;k++){
+		pReMiuMSamplers[k].finishRun();
+	}
+
+	// The final diagnostics
+	const char* statisticNames[] = {"logPosterior","nClusters","alpha"};
+	ostringstream convergenceStr;
+	convergenceStr << "nBurn " << pReMiuMSamplers[0].nBurn() << endl;
+	convergenceStr << "nSweeps " << pReMiuMSamplers[0].nSweeps() << endl;
+	convergenceStr << "statistic ess rhat" << endl;
+	for(unsigned int i=0;i<pReMiuMSamplers[0].monitor().size()&&i<3;i++){
+		vector<const mcmcBatchMeans*> chains(nChains);
+		for(unsigned int k=0;k<nChains;k++){
+			chains[k]=&(pReMiuMSamplers[k].monitor()[i]);
+		}
+		convergenceStr << statisticNames[i] << " " << pooledESS(chains) << " " <<
+				splitRhat(chains,false) << endl;
+	}
+	string convergenceFileName = options.outFileStem()+"_convergence.txt";
+	ofstream convergenceFile(convergenceFileName.c_str());
+	convergenceFile << convergenceStr.str();
+	convergenceFile.close();
 
-	/* ---------- Write the log file ------------- */
-	// The standard log file
-	pReMiuMSampler.writeLogFile();
+	logStr << "Convergence diagnostics:" << endl << convergenceStr.str() << endl;
+	return logStr.str();
 
-	/* ---------- Initialise the chain ---- */
-	pReMiuMSampler.initialiseChain();
+}
 
-	pReMiuMHyperParams hyperParams = pReMiuMSampler.chain().currentState().parameters().hyperParams();
-	unsigned int nClusInit = pReMiuMSampler.chain().currentState().parameters().workNClusInit();
+// Run the sampler for the options in inputStr. If data is not null the data
+// set is taken from this R list (see importPReMiuMDataFromR) rather than read
+// from the input files
+SEXP runPReMiuM(const string& inputStr,const Rcpp::List* data){
+
+	/* ---------- Start the timer ------------------*/
+	time_t beginTime,currTime;
+	beginTime = time(NULL);
+	/* -----------Process the command line ---------*/
+	pReMiuMOptions options = processCommandLine(inputStr);
+
+	/* ---------- Set up the sampler objects--------*/
+	// One sampler for each chain, they only differ in their seed and output
+	// file stem
+	unsigned int nChains = options.nChains();
+	vector<mcmcSampler<pReMiuMParams,pReMiuMOptions,
+				pReMiuMPropParams,pReMiuMData> > pReMiuMSamplers(nChains);
+
+	// Raised when the user interrupts the run, to stop all the chains
+	std::atomic<bool> stopRun(false);
+
+	pReMiuMData dataset;
+	for(unsigned int k=0;k<nChains;k++){
+		mcmcSampler<pReMiuMParams,pReMiuMOptions,
+					pReMiuMPropParams,pReMiuMData>& pReMiuMSampler = pReMiuMSamplers[k];
+
+		// Set the options
+		pReMiuMSampler.options(options);
+
+		// Set the model
+		pReMiuMSampler.model(&importPReMiuMData,&initialisePReMiuM,
+								&pReMiuMLogPost,true);
+
+		// Set the missing data function
+		pReMiuMSampler.updateMissingDataFn(&updateMissingPReMiuMData);
+
+		// Add the function for writing output
+		pReMiuMSampler.userOutputFn(&writePReMiuMOutput);
+
+		// Add the function giving the statistics monitored for convergence
+		if(options.monitorConvergence()){
+			pReMiuMSampler.monitorFn(&pReMiuMMonitorStatistics);
+		}
+
+		// Seed the random number generator, the chains after the first are
+		// seeded with consecutive values, or with xoshiro256++ use the
+		// substreams that follow the one of the first chain
+		pReMiuMSampler.rndGenerator().engine(options.rngType());
+		if(k==0){
+			pReMiuMSampler.seedGenerator(options.seed());
+		}else if(pReMiuMSampler.rndGenerator().canJump()){
+			pReMiuMSampler.seedGenerator(pReMiuMSamplers[0].seed());
+			for(unsigned int j=0;j<k;j++){
+				pReMiuMSampler.rndGenerator().jump();
+			}
+		}else{
+			pReMiuMSampler.seedGenerator(pReMiuMSamplers[0].seed()+k);
+		}
+
+		// Set the sampler specific variables
+		pReMiuMSampler.nSweeps(options.nSweeps());
+		pReMiuMSampler.nBurn(options.nBurn());
+		pReMiuMSampler.nFilter(options.nFilter());
+		pReMiuMSampler.nProgress(options.nProgress());
+		pReMiuMSampler.reportBurnIn(options.reportBurnIn());
+		// Only the first chain reports its progress, as R can only be called
+		// from the main thread
+		pReMiuMSampler.reportProgress(k==0);
+		pReMiuMSampler.recordTimings(options.recordTimings());
+		pReMiuMSampler.parallelProposals(options.parallelProposals(),options.nThreads());
+		if(options.writeStatus()){
+			pReMiuMSampler.statusEvery(options.nProgress());
+			pReMiuMSampler.statusFn(&pReMiuMStatusStatistics);
+		}
+		// The first chain checks whether the user has interrupted the run
+		// and stops the others
+		if(k==0){
+			pReMiuMSampler.interruptFn(&pReMiuMUserInterrupt);
+		}
+		pReMiuMSampler.stopFlag(&stopRun);
+		pReMiuMSampler.asyncOutput(options.asyncOutput());
+		// Checkpoints are only written for output files on disk
+		if(options.outputFormat().compare("memory")!=0){
+			pReMiuMSampler.checkpointEvery(options.checkpointEvery());
+		}
+
+		/* ---------- Read in the data -------- */
+		// The data is only read once, the other chains get a copy (each chain
+		// imputes its own missing values)
+		if(k==0){
+			pReMiuMSampler.model().dataset().outcomeType(options.outcomeType());
+			pReMiuMSampler.model().dataset().covariateType(options.covariateType());
+			pReMiuMSampler.model().dataset().includeCAR(options.includeCAR());
+			pReMiuMSampler.model().dataset().useDataCache(options.dataCache());
+			pReMiuMSampler.model().dataset().useCompactX(options.compactCovariates(),options.singlePrecisionCovariates());
+			if(data){
+				dataset = pReMiuMSampler.model().dataset();
+				importPReMiuMDataFromR(*data,dataset);
+				pReMiuMSampler.importData(dataset,options.inFileName(),options.predictFileName(),options.neighbourFileName());
+			}else{
+				pReMiuMSampler.importData(options.inFileName(),options.predictFileName(),options.neighbourFileName());
+				dataset = pReMiuMSampler.model().dataset();
+			}
+		}else{
+			pReMiuMSampler.importData(dataset,options.inFileName(),options.predictFileName(),options.neighbourFileName());
+		}
+
+		/* ---------- Add the proposals -------- */
+		addPReMiuMProposals(pReMiuMSampler,options,dataset);
+
+		/* ---------- Initialise the output files -----*/
+		if(nChains>1){
+			ostringstream chainStem;
+			chainStem << options.outFileStem() << "_chain" << k+1;
+			pReMiuMSampler.initialiseOutputFiles(chainStem.str());
+		}else{
+			pReMiuMSampler.initialiseOutputFiles(options.outFileStem());
+		}
+
+		/* ---------- Write the log file ------------- */
+		// The standard log file
+		pReMiuMSampler.writeLogFile();
+
+		/* ---------- Initialise the chain ---- */
+		pReMiuMSampler.initialiseChain();
+
+		/* ---------- Resume from a checkpoint ---- */
+		if(options.resumeFileName().compare("")!=0){
+			string resumeFileName = chainCheckpointFileName(options.resumeFileName(),k,nChains);
+			if(resumeFileName.compare("")==0||!pReMiuMSampler.resume(resumeFileName)){
+				Rprintf("The run could not be resumed from the checkpoint %s\n",
+						(resumeFileName.compare("")==0?options.resumeFileName():resumeFileName).c_str());
+				for(unsigned int j=0;j<=k;j++){
+					pReMiuMSamplers[j].closeOutputFiles();
+				}
+				return Rcpp::wrap(1);
+			}
+			ostringstream resumeStr;
+			resumeStr << "Resumed from checkpoint " << resumeFileName << " at sweep " <<
+					pReMiuMSampler.resumeSweep() << endl << endl;
+			pReMiuMSampler.appendToLogFile(resumeStr.str());
+		}
+	}
+
+	vector<pReMiuMHyperParams> hyperParams(nChains);
+	vector<unsigned int> nClusInit(nChains),maxNClusters(nChains);
+	for(unsigned int k=0;k<nChains;k++){
+		hyperParams[k] = pReMiuMSamplers[k].chain().currentState().parameters().hyperParams();
+		nClusInit[k] = pReMiuMSamplers[k].chain().currentState().parameters().workNClusInit();
+		// The following is only used if the sampler type is truncated
+		maxNClusters[k] = pReMiuMSamplers[k].chain().currentState().parameters().maxNClusters();
+	}
 
-	// The following is only used if the sampler type is truncated
-	unsigned int maxNClusters = pReMiuMSampler.chain().currentState().parameters().maxNClusters();
 	/* ---------- Run the sampler --------- */
-	// Note: in this function the output gets written
-	pReMiuMSampler.run();
+	// Note: in this function the output gets written. The first chain is
+	// run by the main thread.
+	string convergenceStr;
+	if(options.monitorConvergence()){
+		convergenceStr = runMonitoredPReMiuM(pReMiuMSamplers,options);
+	}else{
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nChains) schedule(static,1)
+#endif
+		for(int k=0;k<(int)nChains;k++){
+			pReMiuMSamplers[k].run();
+		}
+	}
 
 	/* -- End the clock time and write the full run details to log file --*/
 	currTime = time(NULL);
     	double timeInSecs=(double)currTime-(double)beginTime;
-	string tmpStr = storeLogFileData(options,dataset,hyperParams,nClusInit,maxNClusters,timeInSecs);
-	pReMiuMSampler.appendToLogFile(tmpStr);
+	bool memoryOutput = options.outputFormat().compare("memory")==0;
+	Rcpp::List chainTraces;
+	for(unsigned int k=0;k<nChains;k++){
+		// The burn in and sampling may have been ended early by the convergence
+		// monitor
+		unsigned int nSweepsDone = pReMiuMSamplers[k].nBurn()+pReMiuMSamplers[k].nSweeps();
+		string tmpStr = storeLogFileData(options,dataset,hyperParams[k],nClusInit[k],maxNClusters[k],
+				nSweepsDone,timeInSecs);
+		pReMiuMSamplers[k].appendToLogFile(tmpStr);
+		if(options.monitorConvergence()){
+			pReMiuMSamplers[k].appendToLogFile(convergenceStr);
+		}
+		const pReMiuMParams& finalParams = pReMiuMSamplers[k].chain().currentState().parameters();
+		ostringstream capacityStr;
+		capacityStr << "Peak cluster capacity: " << finalParams.workClusterCapacity() <<
+				" (grown " << finalParams.workNCapacityResizes() << " times)" << endl;
+		pReMiuMSamplers[k].appendToLogFile(capacityStr.str());
+		if(pReMiuMSamplers[k].interrupted()){
+			ostringstream interruptStr;
+			interruptStr << "Interrupted at sweep " << pReMiuMSamplers[k].sweep() << endl;
+			pReMiuMSamplers[k].appendToLogFile(interruptStr.str());
+		}
+
+		/* ---------- Write the summary of the predictions -- */
+		writePReMiuMPredictSummary(pReMiuMSamplers[k]);
+
+		/* ---------- Return the traces kept in memory -- */
+		if(memoryOutput){
+			ostringstream chainName;
+			chainName << "chain" << k+1;
+			chainTraces.push_back(memoryTraces(pReMiuMSamplers[k]),chainName.str());
+		}
 
-	/* ---------- Clean Up ---------------- */
-	pReMiuMSampler.closeOutputFiles();
+		/* ---------- Clean Up ---------------- */
+		pReMiuMSamplers[k].closeOutputFiles();
+	}
+
+	// The output of an interrupted run is complete up to the sweep at which
+	// it stopped
+	if(pReMiuMSamplers[0].interrupted()){
+		Rprintf("The run was interrupted at sweep %i\n",pReMiuMSamplers[0].sweep());
+		return Rcpp::wrap(2);
+	}
+
+	if(memoryOutput){
+		if(nChains==1){
+			return chainTraces[0];
+		}
+		return chainTraces;
+	}
 
 	//int err = 0;
 	return Rcpp::wrap(0);
@@ -442,3 +827,17 @@ RcppExport SEXP profRegr(SEXP inputString) {
 
 }
 
+RcppExport SEXP profRegr(SEXP inputString) {
+
+	string inputStr = Rcpp::as<string>(inputString);
+	return runPReMiuM(inputStr,NULL);
+
+}
+
+RcppExport SEXP profRegrData(SEXP inputString, SEXP data) {
+
+	string inputStr = Rcpp::as<string>(inputString);
+	Rcpp::List dataList(data);
+	return runPReMiuM(inputStr,&dataList);
+
+}
@@ -7,7 +7,15 @@ double Gamma(double);
 
 RcppExport SEXP profRegr(SEXP inputString);
 
-RcppExport SEXP calcDisSimMat(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects, SEXP onlyLS);
+RcppExport SEXP profRegrData(SEXP inputString, SEXP data);
+
+RcppExport SEXP calcDisSimMat(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects, SEXP onlyLS, SEXP nThreads, SEXP compact);
+RcppExport SEXP calcApproxLSSweep(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects, SEXP pairI, SEXP pairJ, SEXP nThreads);
+
+RcppExport SEXP calcAvgRiskProfile(SEXP traces, SEXP settings, SEXP nThreads);
+
+RcppExport SEXP calcPAMClustering(SEXP disSimMat, SEXP nSubjects, SEXP maxNClusters, SEXP nThreads);
+RcppExport SEXP compactDisSimCounts(SEXP disSimMat);
 
 RcppExport SEXP pYGivenZW(SEXP betaIn,SEXP thetaIn,SEXP zAlloc,SEXP sigmaBeta,
 		SEXP sigmaTheta, SEXP dofTheta, SEXP dofBeta, SEXP nSubjects,
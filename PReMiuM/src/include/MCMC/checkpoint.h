@@ -0,0 +1,306 @@
+/// \file checkpoint.h
+/// \brief Header file defining the archives used to write and read sampler
+/// checkpoints.
+
+/// \note (C) Copyright David Hastie and Silvia Liverani, 2012.
+
+/// PReMiuM++ is free software; you can redistribute it and/or modify it under the
+/// terms of the GNU Lesser General Public License as published by the Free Software
+/// Foundation; either version 3 of the License, or (at your option) any later
+/// version.
+
+/// PReMiuM++ is distributed in the hope that it will be useful, but WITHOUT ANY
+/// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+/// PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+
+/// You should have received a copy of the GNU Lesser General Public License
+/// along with PReMiuM++ in the documentation directory. If not, see
+/// <http://www.gnu.org/licenses/>.
+
+/// The external linear algebra library Eigen, parts of which are included  in the
+/// lib directory is released under the LGPL3+ licence. See comments in file headers
+/// for details.
+
+/// The Boost C++ header library, parts of which are included in the  lib directory
+/// is released under the Boost Software Licence, Version 1.0, a copy  of which is
+/// included in the documentation directory.
+
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+// Standard includes
+#include<vector>
+#include<string>
+#include<fstream>
+#include<cstdint>
+#include<type_traits>
+
+#ifdef _WIN32
+#include<io.h>
+#include<fcntl.h>
+#include<share.h>
+#include<sys/stat.h>
+#else
+#include<unistd.h>
+#endif
+
+#include<Eigen/Core>
+
+using std::string;
+using std::vector;
+
+/// \brief Cut an existing file back to a given length, used to discard the
+/// output written after the checkpoint a run is resumed from
+/// \param[in] fileName The name of the file
+/// \param[in] length The length in bytes the file is cut back to
+/// \return Whether the file could be cut back
+inline bool mcmcTruncateFile(const string& fileName,const long long int& length){
+#ifdef _WIN32
+	int fd=-1;
+	if(_sopen_s(&fd,fileName.c_str(),_O_RDWR|_O_BINARY,_SH_DENYNO,_S_IREAD|_S_IWRITE)!=0){
+		return false;
+	}
+	bool truncated = _chsize_s(fd,length)==0;
+	_close(fd);
+	return truncated;
+#else
+	return truncate(fileName.c_str(),(off_t)length)==0;
+#endif
+}
+
+/// \class mcmcCheckpointWriter checkpoint.h "MCMC/checkpoint.h"
+/// \brief Archive writing the state of a sampler to a binary checkpoint file
+/// \note The classes being checkpointed define a member function template
+/// serialise(Archive& ar) applying ar & x to each of their members, which is
+/// used both to write (with this class) and to read (with
+/// mcmcCheckpointReader) the checkpoint. Numbers are written in the byte
+/// order of the machine, so a checkpoint is only meant to be resumed on the
+/// same kind of machine. Containers are written as a uint64 length followed
+/// by their elements, Eigen matrices as uint64 rows and columns followed by
+/// the elements in column major order.
+class mcmcCheckpointWriter{
+
+	public:
+		/// \brief Explicit constructor
+		/// \param[in] fileName The name of the checkpoint file
+		mcmcCheckpointWriter(const string& fileName) :
+				_file(fileName.c_str(),std::ios::out|std::ios::binary) {}
+
+		/// \brief Return whether this archive reads the values
+		bool loading() const{
+			return false;
+		}
+
+		/// \brief Return whether all the values have been written
+		bool good() const{
+			return _file.good();
+		}
+
+		/// \brief Member function to close the file
+		void close(){
+			_file.close();
+		}
+
+		/// \brief Write an object of a class with a serialise member function
+		template<class T>
+		typename std::enable_if<std::is_class<T>::value,mcmcCheckpointWriter&>::type
+		operator&(T& obj){
+			obj.serialise(*this);
+			return *this;
+		}
+
+		template<class T>
+		typename std::enable_if<std::is_arithmetic<T>::value,mcmcCheckpointWriter&>::type
+		operator&(T& val){
+			_file.write((const char*)&val,sizeof(T));
+			return *this;
+		}
+
+		mcmcCheckpointWriter& operator&(bool& val){
+			uint8_t byte = val?1:0;
+			return *this & byte;
+		}
+
+		mcmcCheckpointWriter& operator&(string& str){
+			uint64_t len = str.size();
+			*this & len;
+			_file.write(str.data(),len);
+			return *this;
+		}
+
+		template<class T>
+		mcmcCheckpointWriter& operator&(vector<T>& vec){
+			uint64_t len = vec.size();
+			*this & len;
+			for(uint64_t i=0;i<len;i++){
+				*this & vec[i];
+			}
+			return *this;
+		}
+
+		mcmcCheckpointWriter& operator&(vector<bool>& vec){
+			uint64_t len = vec.size();
+			*this & len;
+			for(uint64_t i=0;i<len;i++){
+				bool val = vec[i];
+				*this & val;
+			}
+			return *this;
+		}
+
+		template<class Scalar,int Rows,int Cols,int Options,int MaxRows,int MaxCols>
+		mcmcCheckpointWriter& operator&(Eigen::Matrix<Scalar,Rows,Cols,Options,MaxRows,MaxCols>& mat){
+			uint64_t nRows = mat.rows(),nCols = mat.cols();
+			*this & nRows & nCols;
+			if(mat.size()>0){
+				_file.write((const char*)mat.data(),mat.size()*sizeof(Scalar));
+			}
+			return *this;
+		}
+
+	private:
+		/// \brief The checkpoint file
+		std::ofstream _file;
+
+};
+
+/// \class mcmcCheckpointReader checkpoint.h "MCMC/checkpoint.h"
+/// \brief Archive reading the state of a sampler from a binary checkpoint
+/// file written by mcmcCheckpointWriter
+/// \note Once a read fails (or a length is larger than what is left of the
+/// file) the archive stops reading and good() returns false, leaving the
+/// values that were not read unchanged.
+class mcmcCheckpointReader{
+
+	public:
+		/// \brief Explicit constructor
+		/// \param[in] fileName The name of the checkpoint file
+		mcmcCheckpointReader(const string& fileName) :
+				_file(fileName.c_str(),std::ios::in|std::ios::binary), _nBytesLeft(0) {
+			if(_file.is_open()){
+				_file.seekg(0,std::ios::end);
+				_nBytesLeft = (uint64_t)_file.tellg();
+				_file.seekg(0,std::ios::beg);
+			}
+		}
+
+		/// \brief Return whether this archive reads the values
+		bool loading() const{
+			return true;
+		}
+
+		/// \brief Return whether all the values have been read
+		bool good() const{
+			return _file.is_open()&&_file.good();
+		}
+
+		/// \brief Return whether the whole file has been read
+		bool atEnd() const{
+			return _nBytesLeft==0;
+		}
+
+		/// \brief Member function to close the file
+		void close(){
+			_file.close();
+		}
+
+		/// \brief Read an object of a class with a serialise member function
+		template<class T>
+		typename std::enable_if<std::is_class<T>::value,mcmcCheckpointReader&>::type
+		operator&(T& obj){
+			obj.serialise(*this);
+			return *this;
+		}
+
+		template<class T>
+		typename std::enable_if<std::is_arithmetic<T>::value,mcmcCheckpointReader&>::type
+		operator&(T& val){
+			readBytes((char*)&val,sizeof(T));
+			return *this;
+		}
+
+		mcmcCheckpointReader& operator&(bool& val){
+			uint8_t byte = val?1:0;
+			*this & byte;
+			val = byte!=0;
+			return *this;
+		}
+
+		mcmcCheckpointReader& operator&(string& str){
+			uint64_t len = readLength(1);
+			str.resize(len);
+			if(len>0){
+				readBytes(&(str[0]),len);
+			}
+			return *this;
+		}
+
+		template<class T>
+		mcmcCheckpointReader& operator&(vector<T>& vec){
+			uint64_t len = readLength(1);
+			vec.resize(len);
+			for(uint64_t i=0;i<len&&good();i++){
+				*this & vec[i];
+			}
+			return *this;
+		}
+
+		mcmcCheckpointReader& operator&(vector<bool>& vec){
+			uint64_t len = readLength(1);
+			vec.resize(len);
+			for(uint64_t i=0;i<len&&good();i++){
+				bool val=false;
+				*this & val;
+				vec[i]=val;
+			}
+			return *this;
+		}
+
+		template<class Scalar,int Rows,int Cols,int Options,int MaxRows,int MaxCols>
+		mcmcCheckpointReader& operator&(Eigen::Matrix<Scalar,Rows,Cols,Options,MaxRows,MaxCols>& mat){
+			uint64_t nRows = readLength(0),nCols = readLength(0);
+			if(!good()||(nCols>0&&nRows>_nBytesLeft/sizeof(Scalar)/nCols)){
+				_file.setstate(std::ios::failbit);
+				return *this;
+			}
+			mat.resize(nRows,nCols);
+			if(mat.size()>0){
+				readBytes((char*)mat.data(),mat.size()*sizeof(Scalar));
+			}
+			return *this;
+		}
+
+	private:
+		/// \brief The checkpoint file
+		std::ifstream _file;
+
+		/// \brief The number of bytes of the file that have not been read
+		uint64_t _nBytesLeft;
+
+		/// \brief Private member function to read nBytes bytes
+		void readBytes(char* out,const uint64_t& nBytes){
+			if(!good()||nBytes>_nBytesLeft){
+				_file.setstate(std::ios::failbit);
+				return;
+			}
+			_file.read(out,nBytes);
+			_nBytesLeft-=nBytes;
+		}
+
+		/// \brief Private member function to read the length of a container,
+		/// which fails if the file is too short to hold that many elements of
+		/// at least minBytes bytes each
+		uint64_t readLength(const uint64_t& minBytes){
+			uint64_t len=0;
+			*this & len;
+			if(!good()||len*minBytes>_nBytesLeft){
+				_file.setstate(std::ios::failbit);
+				return 0;
+			}
+			return len;
+		}
+
+};
+
+#endif /*CHECKPOINT_H_*/
@@ -0,0 +1,184 @@
+/// \file compressedStream.h
+/// \brief Header file defining stream buffers for reading and writing gzip files.
+
+/// \note (C) Copyright David Hastie and Silvia Liverani, 2012.
+
+/// PReMiuM++ is free software; you can redistribute it and/or modify it under the
+/// terms of the GNU Lesser General Public License as published by the Free Software
+/// Foundation; either version 3 of the License, or (at your option) any later
+/// version.
+
+/// PReMiuM++ is distributed in the hope that it will be useful, but WITHOUT ANY
+/// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+/// PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+
+/// You should have received a copy of the GNU Lesser General Public License
+/// along with PReMiuM++ in the documentation directory. If not, see
+/// <http://www.gnu.org/licenses/>.
+
+/// The external linear algebra library Eigen, parts of which are included  in the
+/// lib directory is released under the LGPL3+ licence. See comments in file headers
+/// for details.
+
+/// The Boost C++ header library, parts of which are included in the  lib directory
+/// is released under the Boost Software Licence, Version 1.0, a copy  of which is
+/// included in the documentation directory.
+
+
+#ifndef COMPRESSEDSTREAM_H_
+#define COMPRESSEDSTREAM_H_
+
+// Standard includes
+#include<streambuf>
+#include<string>
+#include<vector>
+
+#include<zlib.h>
+
+using std::string;
+using std::vector;
+
+/// \class gzipOutputBuffer compressedStream.h "MCMC/compressedStream.h"
+/// \brief Stream buffer writing a gzip file, so that a std::ostream using it
+/// writes exactly the same bytes as to a std::ofstream, but compressed
+/// \note Flushing the stream (for example with endl) only hands the buffered
+/// bytes to zlib, it does not end the compressed block, so that flushing
+/// after each line costs nothing in compression.
+class gzipOutputBuffer : public std::streambuf{
+
+	public:
+		/// \brief Default constructor
+		gzipOutputBuffer() : _gzFile(NULL), _buffer(1<<16) {}
+
+		/// \brief Destructor
+		~gzipOutputBuffer(){
+			close();
+		}
+
+		/// \brief Member function to open the file
+		/// \param[in] fileName The name of the file
+		/// \param[in] append Whether the data is appended (as a new gzip member)
+		/// to an existing file
+		/// \return Whether the file could be opened
+		bool open(const string& fileName,const bool& append=false){
+			close();
+			_gzFile = gzopen(fileName.c_str(),append?"ab6":"wb6");
+			setp(&(_buffer[0]),&(_buffer[0])+_buffer.size());
+			return _gzFile!=NULL;
+		}
+
+		/// \brief Member function to write the buffered bytes and end the
+		/// current gzip member, so that the file is complete up to this point
+		/// (later writes start a new member)
+		/// \return The length of the file, or -1 if it could not be written
+		long long int finish(){
+			if(!_gzFile||!writeBuffer()||gzflush(_gzFile,Z_FINISH)!=Z_OK){
+				return -1;
+			}
+			return (long long int)gzoffset(_gzFile);
+		}
+
+		/// \brief Member function to write the buffered bytes and close the file
+		void close(){
+			if(_gzFile){
+				writeBuffer();
+				gzclose(_gzFile);
+				_gzFile = NULL;
+			}
+		}
+
+	protected:
+		int overflow(int c){
+			if(!writeBuffer()){
+				return traits_type::eof();
+			}
+			if(c!=traits_type::eof()){
+				*pptr()=(char)c;
+				pbump(1);
+			}
+			return traits_type::not_eof(c);
+		}
+
+		int sync(){
+			return writeBuffer()?0:-1;
+		}
+
+	private:
+		/// \brief The underlying gzip file
+		gzFile _gzFile;
+
+		/// \brief The bytes that have not been handed to zlib yet
+		vector<char> _buffer;
+
+		/// \brief Private member function to hand the buffered bytes to zlib
+		bool writeBuffer(){
+			int nBytes = (int)(pptr()-pbase());
+			if(nBytes>0){
+				if(!_gzFile||gzwrite(_gzFile,pbase(),nBytes)!=nBytes){
+					return false;
+				}
+				pbump(-nBytes);
+			}
+			return true;
+		}
+
+};
+
+/// \class gzipInputBuffer compressedStream.h "MCMC/compressedStream.h"
+/// \brief Stream buffer reading a gzip file, files that are not compressed
+/// are read as they are
+class gzipInputBuffer : public std::streambuf{
+
+	public:
+		/// \brief Default constructor
+		gzipInputBuffer() : _gzFile(NULL), _buffer(1<<16) {}
+
+		/// \brief Destructor
+		~gzipInputBuffer(){
+			close();
+		}
+
+		/// \brief Member function to open the file
+		/// \param[in] fileName The name of the file
+		/// \return Whether the file could be opened
+		bool open(const string& fileName){
+			close();
+			_gzFile = gzopen(fileName.c_str(),"rb");
+			setg(&(_buffer[0]),&(_buffer[0]),&(_buffer[0]));
+			return _gzFile!=NULL;
+		}
+
+		/// \brief Member function to close the file
+		void close(){
+			if(_gzFile){
+				gzclose(_gzFile);
+				_gzFile = NULL;
+			}
+		}
+
+	protected:
+		int underflow(){
+			if(gptr()<egptr()){
+				return traits_type::to_int_type(*gptr());
+			}
+			if(!_gzFile){
+				return traits_type::eof();
+			}
+			int nBytes = gzread(_gzFile,&(_buffer[0]),(unsigned int)_buffer.size());
+			if(nBytes<=0){
+				return traits_type::eof();
+			}
+			setg(&(_buffer[0]),&(_buffer[0]),&(_buffer[0])+nBytes);
+			return traits_type::to_int_type(*gptr());
+		}
+
+	private:
+		/// \brief The underlying gzip file
+		gzFile _gzFile;
+
+		/// \brief The decompressed bytes that have not been read yet
+		vector<char> _buffer;
+
+};
+
+#endif /*COMPRESSEDSTREAM_H_*/
@@ -0,0 +1,269 @@
+/// \file convergence.h
+/// \brief Header file defining the streaming statistics used to monitor the
+/// convergence of Markov chain Monte Carlo samplers.
+
+/// \note (C) Copyright David Hastie and Silvia Liverani, 2012.
+
+/// PReMiuM++ is free software; you can redistribute it and/or modify it under the
+/// terms of the GNU Lesser General Public License as published by the Free Software
+/// Foundation; either version 3 of the License, or (at your option) any later
+/// version.
+
+/// PReMiuM++ is distributed in the hope that it will be useful, but WITHOUT ANY
+/// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+/// PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+
+/// You should have received a copy of the GNU Lesser General Public License
+/// along with PReMiuM++ in the documentation directory. If not, see
+/// <http://www.gnu.org/licenses/>.
+
+/// The external linear algebra library Eigen, parts of which are included  in the
+/// lib directory is released under the LGPL3+ licence. See comments in file headers
+/// for details.
+
+/// The Boost C++ header library, parts of which are included in the  lib directory
+/// is released under the Boost Software Licence, Version 1.0, a copy  of which is
+/// included in the documentation directory.
+
+
+#ifndef CONVERGENCE_H_
+#define CONVERGENCE_H_
+
+// Standard includes
+#include<vector>
+#include<cmath>
+#include<limits>
+
+using std::vector;
+
+/// \class mcmcBatchMeans convergence.h "MCMC/convergence.h"
+/// \brief Class keeping the batch means of the trace of one statistic of
+/// one chain, in constant memory
+/// \note The trace is cut into consecutive batches of equal size, of which
+/// only the mean and the sum of squared deviations from the mean are kept,
+/// updated by Welford's method. Once there are 2*nMinBatches complete
+/// batches, neighbouring batches are merged and the batch size is doubled,
+/// so there are always between nMinBatches and 2*nMinBatches batches (the
+/// values of an incomplete last batch are not used). Chains given the same
+/// number of values have the same batches, so that the batches can be
+/// combined across chains.
+class mcmcBatchMeans{
+
+	public:
+		/// \brief Default constructor
+		mcmcBatchMeans() : _batchSize(1), _partialMean(0.0), _partialSumSqDev(0.0),
+				_nPartial(0) {}
+
+		/// \brief The smallest number of batches kept once the batches merge
+		static unsigned int nMinBatches(){
+			return 32;
+		}
+
+		/// \brief Member function to add the next value of the trace
+		void add(const double& x){
+			_nPartial++;
+			double delta = x-_partialMean;
+			_partialMean+=delta/_nPartial;
+			_partialSumSqDev+=delta*(x-_partialMean);
+			if(_nPartial<_batchSize){
+				return;
+			}
+			_mean.push_back(_partialMean);
+			_sumSqDev.push_back(_partialSumSqDev);
+			_partialMean=0.0;
+			_partialSumSqDev=0.0;
+			_nPartial=0;
+			if(_mean.size()==2*nMinBatches()){
+				// Merging two batches of the same size adds the deviations of
+				// their means from the mean of the merged batch
+				for(unsigned int i=0;i<nMinBatches();i++){
+					double d = _mean[2*i+1]-_mean[2*i];
+					_sumSqDev[i]=_sumSqDev[2*i]+_sumSqDev[2*i+1]+0.5*d*d*_batchSize;
+					_mean[i]=0.5*(_mean[2*i]+_mean[2*i+1]);
+				}
+				_mean.resize(nMinBatches());
+				_sumSqDev.resize(nMinBatches());
+				_batchSize*=2;
+			}
+		}
+
+		/// \brief Member function to remove all the values
+		void clear(){
+			_batchSize=1;
+			_mean.clear();
+			_sumSqDev.clear();
+			_partialMean=0.0;
+			_partialSumSqDev=0.0;
+			_nPartial=0;
+		}
+
+		/// \brief Return the number of complete batches
+		unsigned int nBatches() const{
+			return _mean.size();
+		}
+
+		/// \brief Return the number of values in each batch
+		unsigned int batchSize() const{
+			return _batchSize;
+		}
+
+		/// \brief Return the mean of the values of batch i
+		double mean(const unsigned int& i) const{
+			return _mean[i];
+		}
+
+		/// \brief Return the sum of squared deviations of the values of batch
+		/// i from their mean
+		double sumSqDev(const unsigned int& i) const{
+			return _sumSqDev[i];
+		}
+
+		/// \brief Return the mean and the sample variance of the values of
+		/// batches first to last-1
+		/// \note The mean is that of the batch means, and the sum of squared
+		/// deviations adds the deviations of the batch means from it
+		void meanAndVariance(const unsigned int& first,const unsigned int& last,
+				double& mean,double& var) const{
+			mean=0.0;
+			for(unsigned int i=first;i<last;i++){
+				mean+=_mean[i];
+			}
+			mean/=(double)(last-first);
+			double sumSqDev=0.0,sumSqBatchDev=0.0;
+			for(unsigned int i=first;i<last;i++){
+				double d = _mean[i]-mean;
+				sumSqDev+=_sumSqDev[i];
+				sumSqBatchDev+=d*d;
+			}
+			double n = (double)(last-first)*_batchSize;
+			var = (sumSqDev+sumSqBatchDev*_batchSize)/(n-1.0);
+		}
+
+		/// \brief Return the effective sample size of the complete batches,
+		/// estimated by batch means
+		/// \return The effective sample size, 0 if there are fewer than 8
+		/// batches or NaN if the statistic does not vary
+		/// \note While the batches hold fewer than the square root of the
+		/// number of values, consecutive batches are grouped so that the
+		/// batch means are not too correlated (the oldest batches that do
+		/// not fill a group are left out)
+		double ess() const{
+			unsigned int nB = nBatches();
+			unsigned int groupSize = (unsigned int)(sqrt((double)nB*_batchSize)/_batchSize);
+			if(groupSize<1){
+				groupSize=1;
+			}
+			unsigned int nGroups = nB/groupSize;
+			if(nGroups<8){
+				return 0.0;
+			}
+			unsigned int first = nB-nGroups*groupSize;
+			double groupLength = (double)groupSize*_batchSize;
+			double n = nGroups*groupLength;
+			double mean,var;
+			meanAndVariance(first,nB,mean,var);
+			if(!(var>0.0)){
+				return std::numeric_limits<double>::quiet_NaN();
+			}
+			vector<double> groupMean(nGroups,0.0);
+			for(unsigned int i=first;i<nB;i++){
+				groupMean[(i-first)/groupSize]+=_mean[i];
+			}
+			double varBatchMeans=0.0;
+			for(unsigned int g=0;g<nGroups;g++){
+				double d = groupMean[g]/groupSize-mean;
+				varBatchMeans+=d*d;
+			}
+			varBatchMeans*=groupLength/(double)(nGroups-1);
+			if(!(varBatchMeans>0.0)){
+				return n;
+			}
+			return n*var/varBatchMeans;
+		}
+
+		/// \brief Member function to write or read the batches in a checkpoint
+		template<class Archive>
+		void serialise(Archive& ar){
+			ar & _batchSize & _mean & _sumSqDev & _partialMean & _partialSumSqDev & _nPartial;
+		}
+
+	private:
+		/// \brief The number of values in each batch
+		unsigned int _batchSize;
+
+		/// \brief The mean and sum of squared deviations from the mean of the
+		/// values of each complete batch
+		vector<double> _mean,_sumSqDev;
+
+		/// \brief The mean and sum of squared deviations from the mean of the
+		/// values of the incomplete last batch, and the number of these values
+		double _partialMean,_partialSumSqDev;
+		unsigned int _nPartial;
+
+};
+
+/// \brief Return the effective sample size of a statistic pooled over the
+/// chains, the sum of the effective sample sizes of the chains
+/// \param[in] chains The batch means of the statistic in each chain
+/// \return The pooled effective sample size, or NaN if the statistic does
+/// not vary
+inline double pooledESS(const vector<const mcmcBatchMeans*>& chains){
+	double ess=0.0;
+	bool varies=false;
+	for(unsigned int k=0;k<chains.size();k++){
+		double chainESS = chains[k]->ess();
+		if(!std::isnan(chainESS)){
+			ess+=chainESS;
+			varies=true;
+		}
+	}
+	return varies?ess:std::numeric_limits<double>::quiet_NaN();
+}
+
+/// \brief Return the split R-hat of a statistic (Gelman et al., Bayesian Data
+/// Analysis, 3rd edition) over the complete batches of the chains
+/// \param[in] chains The batch means of the statistic in each chain
+/// \param[in] lastHalf Whether only the last half of the batches is used
+/// (as during the burn in)
+/// \return The split R-hat, where the batches used of each chain are split
+/// into two sequences. It is infinite if there are fewer than 4 batches for
+/// each sequence, or NaN if the statistic does not vary
+inline double splitRhat(const vector<const mcmcBatchMeans*>& chains,const bool& lastHalf){
+	unsigned int nB = chains[0]->nBatches();
+	unsigned int first = lastHalf?nB/2:0;
+	// An even number of batches is used, leaving out the oldest
+	first+=(nB-first)%2;
+	unsigned int half = (nB-first)/2;
+	if(half<4){
+		return std::numeric_limits<double>::infinity();
+	}
+	double n = (double)half*chains[0]->batchSize();
+	vector<double> means,vars;
+	for(unsigned int k=0;k<chains.size();k++){
+		for(unsigned int h=0;h<2;h++){
+			double mean,var;
+			chains[k]->meanAndVariance(first+h*half,first+(h+1)*half,mean,var);
+			means.push_back(mean);
+			vars.push_back(var);
+		}
+	}
+	unsigned int nSeq = means.size();
+	double meanOfMeans=0.0,W=0.0;
+	for(unsigned int j=0;j<nSeq;j++){
+		meanOfMeans+=means[j];
+		W+=vars[j];
+	}
+	meanOfMeans/=(double)nSeq;
+	W/=(double)nSeq;
+	double BOverN=0.0;
+	for(unsigned int j=0;j<nSeq;j++){
+		BOverN+=(means[j]-meanOfMeans)*(means[j]-meanOfMeans);
+	}
+	BOverN/=(double)(nSeq-1);
+	if(!(W>0.0)){
+		return BOverN>0.0?std::numeric_limits<double>::infinity():std::numeric_limits<double>::quiet_NaN();
+	}
+	return sqrt(((n-1.0)/n*W+BOverN)/W);
+}
+
+#endif /*CONVERGENCE_H_*/
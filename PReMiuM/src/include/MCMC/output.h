@@ -0,0 +1,669 @@
+/// \file output.h
+/// \brief Header file defining classes for writing Markov chain Monte Carlo sampler output.
+
+/// \note (C) Copyright David Hastie and Silvia Liverani, 2012.
+
+/// PReMiuM++ is free software; you can redistribute it and/or modify it under the
+/// terms of the GNU Lesser General Public License as published by the Free Software
+/// Foundation; either version 3 of the License, or (at your option) any later
+/// version.
+
+/// PReMiuM++ is distributed in the hope that it will be useful, but WITHOUT ANY
+/// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+/// PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+
+/// You should have received a copy of the GNU Lesser General Public License
+/// along with PReMiuM++ in the documentation directory. If not, see
+/// <http://www.gnu.org/licenses/>.
+
+/// The external linear algebra library Eigen, parts of which are included  in the
+/// lib directory is released under the LGPL3+ licence. See comments in file headers
+/// for details.
+
+/// The Boost C++ header library, parts of which are included in the  lib directory
+/// is released under the Boost Software Licence, Version 1.0, a copy  of which is
+/// included in the documentation directory.
+
+
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+// Standard includes
+#include<vector>
+#include<string>
+#include<fstream>
+#include<cstring>
+#include<cstdint>
+#include<type_traits>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<ostream>
+
+// Custom includes
+#include<MCMC/compressedStream.h>
+#include<MCMC/checkpoint.h>
+
+using std::string;
+using std::vector;
+
+/// \class mcmcOutputItem output.h "MCMC/output.h"
+/// \brief A value, separator or stream manipulator waiting to be written to
+/// a trace file by the output writer thread
+/// \note The type of each value is kept, so that the writer thread formats
+/// it exactly as it would have been formatted by the sampler thread
+class mcmcOutputItem{
+
+	public:
+		enum itemType {signedValue,unsignedValue,realValue,charValue,separator,manipulator};
+
+		itemType type;
+		long long int signedVal;
+		unsigned long long int unsignedVal;
+		double realVal;
+		string str;
+		std::ostream& (*manip)(std::ostream&);
+
+		template<class T>
+		static mcmcOutputItem value(const T& val){
+			mcmcOutputItem item;
+			if(std::is_floating_point<T>::value){
+				item.type=realValue;
+			}else if(std::is_same<T,char>::value||std::is_same<T,signed char>::value||std::is_same<T,unsigned char>::value){
+				item.type=charValue;
+			}else if(std::is_signed<T>::value){
+				item.type=signedValue;
+			}else{
+				item.type=unsignedValue;
+			}
+			item.signedVal=(long long int)val;
+			item.unsignedVal=(unsigned long long int)val;
+			item.realVal=(double)val;
+			return item;
+		}
+
+		static mcmcOutputItem text(const string& str){
+			mcmcOutputItem item;
+			item.type=separator;
+			item.str=str;
+			return item;
+		}
+
+		static mcmcOutputItem endOfRecord(std::ostream& (*manip)(std::ostream&)){
+			mcmcOutputItem item;
+			item.type=manipulator;
+			item.manip=manip;
+			return item;
+		}
+
+};
+
+class mcmcOutputWriter;
+
+/// \class mcmcOutputFile output.h "MCMC/output.h"
+/// \brief Class for a single trace file written by the sampler
+/// \note In text mode the values are written exactly as they would be to
+/// a std::ofstream. In binary mode the string separators are discarded and
+/// each line (terminated by a stream manipulator such as endl) is written as
+/// a little endian uint32 record length followed by that many fixed width
+/// values, either int32 or float64. The binary file starts with the 8 byte
+/// magic string "PReMiuMB" followed by six uint32 values: the format version,
+/// the value type (0 for int32, 1 for float64), nSweeps, nBurn, nFilter and
+/// reportBurnIn. In memory mode nothing is written to disk, the values of
+/// each record are appended to a buffer that is reserved for the expected
+/// number of records and can be returned to the caller after the run.
+/// Text and binary files can be gzip compressed, in which case ".gz" is
+/// appended to their name. In delta mode (for integer traces whose values
+/// change little between records, such as the allocations) each record
+/// holds the number of values that changed since the previous record
+/// followed by the index and new value of each of them, so the first
+/// record lists all the values. In text mode these are written on one line
+/// separated by spaces, in binary mode they are the int32 values of the
+/// record.
+/// Once an output writer is set (text and binary modes only), the values
+/// of each record are collected on the calling thread and the complete
+/// record is handed to the writer, which formats and writes it on its own
+/// thread.
+/// A file resumed from a checkpoint is cut back to the length it had at the
+/// checkpoint (see checkpoint) and the records are appended to it, without
+/// a new binary header. A compressed file gets a new gzip member and a delta
+/// encoded file starts again with a record listing all the values, so both
+/// decode to the same values as a file written in one go.
+class mcmcOutputFile{
+
+	public:
+		/// \brief Explicit constructor
+		/// \param[in] fileName The name of the text file, the extension is
+		/// replaced by ".bin" in binary mode
+		/// \param[in] format The output format, "text", "binary" or "memory"
+		/// \param[in] integerValues Whether the values are written as int32
+		/// (otherwise float64) in binary mode
+		/// \param[in] nSweeps The number of sweeps after the burn in
+		/// \param[in] nBurn The number of burn in sweeps
+		/// \param[in] nFilter The frequency with which the output is written
+		/// \param[in] reportBurnIn Whether the burn in is written
+		/// \param[in] compress Whether the file is gzip compressed (ignored in
+		/// memory mode)
+		/// \param[in] delta Whether the records are delta encoded (ignored in
+		/// memory mode)
+		/// \param[in] resumeOffset The length of the file at the checkpoint the
+		/// run is resumed from, or -1 to write a new file
+		mcmcOutputFile(const string& fileName,const string& format,const bool& integerValues,
+				const unsigned int& nSweeps,const unsigned int& nBurn,
+				const unsigned int& nFilter,const bool& reportBurnIn,
+				const bool& compress=false,const bool& delta=false,
+				const long long int& resumeOffset=-1) :
+					_fileName(fileName), _binary(format.compare("binary")==0),
+					_inMemory(format.compare("memory")==0),
+					_integerValues(integerValues), _compress(compress&&!_inMemory),
+					_delta(delta&&!_inMemory), _record(), _file(NULL),
+					_nRecords(0), _writer(NULL) {
+			if(_inMemory){
+				_nRecords = (nSweeps+(reportBurnIn?nBurn:0))/(nFilter>0?nFilter:1)+1;
+				_recordEnd.reserve(_nRecords);
+			}else if(_binary){
+				string binFileName = fileName;
+				size_t pos = binFileName.rfind(".txt");
+				if(pos!=string::npos){
+					binFileName.replace(pos,4,".bin");
+				}
+				if(!openFile(binFileName,resumeOffset)){
+					_file.write("PReMiuMB",8);
+					writeUInt32(1);
+					writeUInt32(_integerValues?0:1);
+					writeUInt32(nSweeps);
+					writeUInt32(nBurn);
+					writeUInt32(nFilter);
+					writeUInt32(reportBurnIn?1:0);
+				}
+			}else{
+				openFile(fileName,resumeOffset);
+			}
+		}
+
+		/// \brief Destructor
+		~mcmcOutputFile(){};
+
+		/// \brief Write a numeric value
+		template<class T>
+		typename std::enable_if<std::is_arithmetic<T>::value,mcmcOutputFile&>::type
+		operator<<(const T& val){
+			if(_inMemory){
+				_values.push_back((double)val);
+			}else if(_writer){
+				_pending.push_back(mcmcOutputItem::value(val));
+			}else if(_binary||_delta){
+				_record.push_back((double)val);
+			}else{
+				_file << val;
+			}
+			return *this;
+		}
+
+		/// \brief Write a separator (ignored in binary, delta and memory mode)
+		mcmcOutputFile& operator<<(const char* str){
+			if(_binary||_delta){
+				return *this;
+			}
+			if(_writer){
+				_pending.push_back(mcmcOutputItem::text(str));
+			}else if(!_inMemory){
+				_file << str;
+			}
+			return *this;
+		}
+
+		/// \brief Write a separator (ignored in binary, delta and memory mode)
+		mcmcOutputFile& operator<<(const string& str){
+			if(_binary||_delta){
+				return *this;
+			}
+			if(_writer){
+				_pending.push_back(mcmcOutputItem::text(str));
+			}else if(!_inMemory){
+				_file << str;
+			}
+			return *this;
+		}
+
+		/// \brief Apply a stream manipulator, which ends the current record in
+		/// binary, delta and memory mode, with an output writer it hands the
+		/// record over to the writer
+		mcmcOutputFile& operator<<(std::ostream& (*manip)(std::ostream&)){
+			if(_inMemory){
+				endMemoryRecord();
+			}else if(_writer){
+				_pending.push_back(mcmcOutputItem::endOfRecord(manip));
+				pushPending();
+			}else if(_binary||_delta){
+				endRecord(manip);
+			}else{
+				manip(_file);
+			}
+			return *this;
+		}
+
+		/// \brief Member function to close the file
+		/// \note With an output writer, the writer must have been stopped
+		/// (see mcmcOutputWriter::stop) before the file is closed
+		void close(){
+			if(_inMemory){
+				if(_values.size()>(_recordEnd.size()>0?_recordEnd.back():0)){
+					endMemoryRecord();
+				}
+				return;
+			}
+			if(_pending.size()>0){
+				writeItems(_pending);
+				_pending.clear();
+			}
+			_writer=NULL;
+			if((_binary||_delta)&&_record.size()>0){
+				endRecord(NULL);
+			}
+			_file.flush();
+			if(_compress){
+				_gzipBuffer.close();
+			}else{
+				_fileBuffer.close();
+			}
+		}
+
+		/// \brief Member function to write everything written so far to disk,
+		/// used when the sampler writes a checkpoint
+		/// \note With an output writer, the writer must have written all the
+		/// queued records (see mcmcOutputWriter::wait) first
+		/// \return The length of the file, or -1 in memory mode or if the file
+		/// could not be written
+		long long int checkpoint(){
+			if(_inMemory){
+				return -1;
+			}
+			_file.flush();
+			if(_compress){
+				return _gzipBuffer.finish();
+			}
+			if(!_file.good()){
+				return -1;
+			}
+			return (long long int)_fileBuffer.pubseekoff(0,std::ios::cur,std::ios::out);
+		}
+
+		/// \brief Member function to set the writer that writes the records
+		/// on its own thread, ignored in memory mode
+		/// \param[in] writer The output writer, or NULL to write the records
+		/// on the calling thread
+		void setWriter(mcmcOutputWriter* writer){
+			if(!_inMemory){
+				_writer=writer;
+			}
+		}
+
+		/// \brief Member function to write a sequence of items, used by the
+		/// output writer thread
+		/// \param[in] items The items of one or more records
+		void writeItems(const vector<mcmcOutputItem>& items){
+			for(vector<mcmcOutputItem>::const_iterator it=items.begin();it!=items.end();++it){
+				if(_binary||_delta){
+					if(it->type==mcmcOutputItem::manipulator){
+						endRecord(it->manip);
+					}else if(it->type!=mcmcOutputItem::separator){
+						_record.push_back(it->realVal);
+					}
+					continue;
+				}
+				switch(it->type){
+					case mcmcOutputItem::signedValue:
+						_file << it->signedVal;
+						break;
+					case mcmcOutputItem::unsignedValue:
+						_file << it->unsignedVal;
+						break;
+					case mcmcOutputItem::realValue:
+						_file << it->realVal;
+						break;
+					case mcmcOutputItem::charValue:
+						_file << (char)it->signedVal;
+						break;
+					case mcmcOutputItem::separator:
+						_file << it->str;
+						break;
+					case mcmcOutputItem::manipulator:
+						it->manip(_file);
+						break;
+				}
+			}
+		}
+
+		/// \brief Return the name of the text file
+		const string& fileName() const{
+			return _fileName;
+		}
+
+		/// \brief Return the name of the file on disk (with the extension of
+		/// the format, empty in memory mode)
+		const string& diskFileName() const{
+			return _diskFileName;
+		}
+
+		/// \brief Return whether the values are kept in memory
+		bool inMemory() const{
+			return _inMemory;
+		}
+
+		/// \brief Return whether the values are integers
+		bool integerValues() const{
+			return _integerValues;
+		}
+
+		/// \brief Return the values of all the records kept in memory
+		const vector<double>& values() const{
+			return _values;
+		}
+
+		/// \brief Return the end (one past the last value) of each record kept
+		/// in memory
+		const vector<unsigned int>& recordEnd() const{
+			return _recordEnd;
+		}
+
+	private:
+		/// \brief The name of the text file
+		string _fileName;
+
+		/// \brief The name of the file on disk
+		string _diskFileName;
+
+		/// \brief Whether the binary format is written
+		bool _binary;
+
+		/// \brief Whether the values are kept in memory instead of written
+		bool _inMemory;
+
+		/// \brief Whether the values are int32 (otherwise float64) in binary mode
+		bool _integerValues;
+
+		/// \brief Whether the file is gzip compressed
+		bool _compress;
+
+		/// \brief Whether the records are delta encoded
+		bool _delta;
+
+		/// \brief The values of the record currently being written in binary
+		/// or delta mode
+		vector<double> _record;
+
+		/// \brief The values of the previous record in delta mode
+		vector<double> _previous;
+
+		/// \brief The values of the current record in little endian byte order
+		vector<unsigned char> _buffer;
+
+		/// \brief The buffer of an uncompressed file
+		std::filebuf _fileBuffer;
+
+		/// \brief The buffer of a compressed file
+		gzipOutputBuffer _gzipBuffer;
+
+		/// \brief The stream writing to the file
+		std::ostream _file;
+
+		/// \brief The expected number of records in memory mode
+		unsigned int _nRecords;
+
+		/// \brief The values of all the records in memory mode
+		vector<double> _values;
+
+		/// \brief The end of each record in _values in memory mode
+		vector<unsigned int> _recordEnd;
+
+		/// \brief The writer the records are handed to (NULL if the records
+		/// are written on the calling thread)
+		mcmcOutputWriter* _writer;
+
+		/// \brief The items of the record currently being collected for the
+		/// writer
+		vector<mcmcOutputItem> _pending;
+
+		/// \brief Private member function to hand the pending record to the
+		/// writer (defined after mcmcOutputWriter)
+		void pushPending();
+
+		/// \brief Private member function to end the current record in memory
+		/// mode, the buffer is reserved for all the records once the length of
+		/// the first is known
+		void endMemoryRecord(){
+			_recordEnd.push_back(_values.size());
+			if(_recordEnd.size()==1){
+				_values.reserve(_nRecords*_values.size());
+			}
+		}
+
+		/// \brief Private member function to open the file the stream writes to
+		/// \param[in] name The name of the file (without the .gz extension)
+		/// \param[in] resumeOffset The length the existing file is cut back to
+		/// before appending to it, or -1 to write a new file
+		/// \return Whether the file is appended to (a missing file is written
+		/// from the start)
+		bool openFile(const string& name,const long long int& resumeOffset){
+			std::ios::openmode mode = _binary?std::ios::out|std::ios::binary:std::ios::out;
+			_diskFileName = _compress?name+".gz":name;
+			// The records written after the checkpoint are discarded
+			bool resume = resumeOffset>=0&&mcmcTruncateFile(_diskFileName,resumeOffset);
+			if(resume){
+				mode|=std::ios::app;
+			}
+			if(_compress){
+				_gzipBuffer.open(_diskFileName,resume);
+				_file.rdbuf(&_gzipBuffer);
+			}else{
+				_fileBuffer.open(_diskFileName.c_str(),mode);
+				_file.rdbuf(&_fileBuffer);
+				if(resume){
+					_fileBuffer.pubseekoff(0,std::ios::end,std::ios::out);
+				}
+			}
+			return resume;
+		}
+
+		/// \brief Private member function to end the current record in binary
+		/// or delta mode
+		/// \param[in] manip The manipulator that ends a line of a text file
+		/// (a new line is written if NULL)
+		void endRecord(std::ostream& (*manip)(std::ostream&)){
+			if(_delta){
+				vector<double> changes(1,0.0);
+				for(unsigned int i=0;i<_record.size();i++){
+					if(i>=_previous.size()||_record[i]!=_previous[i]){
+						changes.push_back((double)i);
+						changes.push_back(_record[i]);
+					}
+				}
+				changes[0]=(double)((changes.size()-1)/2);
+				_previous.swap(_record);
+				_record.swap(changes);
+				if(!_binary){
+					for(unsigned int i=0;i<_record.size();i++){
+						_file << (long long int)_record[i];
+						if(i<_record.size()-1){
+							_file << " ";
+						}
+					}
+					if(manip){
+						manip(_file);
+					}else{
+						_file << "\n";
+					}
+					_record.clear();
+					return;
+				}
+			}
+			writeRecord();
+		}
+
+		/// \brief Private member function to write a little endian uint32
+		void writeUInt32(const uint32_t& val){
+			unsigned char bytes[4];
+			for(unsigned int k=0;k<4;k++){
+				bytes[k]=(unsigned char)((val>>(8*k))&0xFF);
+			}
+			_file.write((const char*)bytes,4);
+		}
+
+		/// \brief Private member function to write the current record
+		void writeRecord(){
+			unsigned int nVals = _record.size();
+			unsigned int width = _integerValues?4:8;
+			_buffer.resize(nVals*width);
+			for(unsigned int i=0;i<nVals;i++){
+				uint64_t bits;
+				if(_integerValues){
+					int32_t intVal=(int32_t)_record[i];
+					uint32_t uintVal;
+					memcpy(&uintVal,&intVal,4);
+					bits=uintVal;
+				}else{
+					memcpy(&bits,&(_record[i]),8);
+				}
+				for(unsigned int k=0;k<width;k++){
+					_buffer[i*width+k]=(unsigned char)((bits>>(8*k))&0xFF);
+				}
+			}
+			writeUInt32(nVals);
+			if(nVals>0){
+				_file.write((const char*)&(_buffer[0]),_buffer.size());
+			}
+			_record.clear();
+		}
+
+};
+
+/// \class mcmcOutputWriter output.h "MCMC/output.h"
+/// \brief Class for a thread that writes the records of the trace files in
+/// the background
+/// \note The records are kept in a bounded queue. When the queue is full
+/// the sampler thread waits until the writer has caught up, so the memory
+/// used is limited however slow the disk is. The records of each file are
+/// written in the order they were queued, and the buffers of the written
+/// records are reused for later records. The writer thread only writes to
+/// the files, it never calls R.
+class mcmcOutputWriter{
+
+	public:
+		/// \brief Explicit constructor, starts the writer thread
+		/// \param[in] capacity The maximum number of records in the queue
+		mcmcOutputWriter(const unsigned int& capacity) :
+				_capacity(capacity>0?capacity:1), _stop(false), _busy(false) {
+			_thread = std::thread(&mcmcOutputWriter::run,this);
+		}
+
+		/// \brief Destructor, the queued records are written first
+		~mcmcOutputWriter(){
+			stop();
+		}
+
+		/// \brief Member function to queue a record, waits while the queue is
+		/// full
+		/// \param[in] file The file the record belongs to
+		/// \param[in,out] items The items of the record, on return an empty
+		/// buffer (possibly reused from an earlier record)
+		void push(mcmcOutputFile* file,vector<mcmcOutputItem>& items){
+			std::unique_lock<std::mutex> lock(_mutex);
+			while(_queue.size()>=_capacity){
+				_notFull.wait(lock);
+			}
+			_queue.push_back(outputJob());
+			_queue.back().file=file;
+			_queue.back().items.swap(items);
+			if(_free.size()>0){
+				items.swap(_free.back());
+				_free.pop_back();
+			}
+			_notEmpty.notify_one();
+		}
+
+		/// \brief Member function to wait until all the queued records have
+		/// been written
+		void wait(){
+			std::unique_lock<std::mutex> lock(_mutex);
+			while(_queue.size()>0||_busy){
+				_idle.wait(lock);
+			}
+		}
+
+		/// \brief Member function to write all the queued records and end
+		/// the writer thread
+		void stop(){
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stop=true;
+			}
+			_notEmpty.notify_one();
+			if(_thread.joinable()){
+				_thread.join();
+			}
+		}
+
+	private:
+		/// \brief A queued record
+		struct outputJob{
+			mcmcOutputFile* file;
+			vector<mcmcOutputItem> items;
+		};
+
+		/// \brief The maximum number of records in the queue
+		unsigned int _capacity;
+
+		/// \brief Whether the writer thread ends once the queue is empty
+		bool _stop;
+
+		/// \brief Whether the writer thread is writing a record
+		bool _busy;
+
+		/// \brief The queued records
+		std::deque<outputJob> _queue;
+
+		/// \brief The buffers of the written records
+		vector<vector<mcmcOutputItem> > _free;
+
+		std::mutex _mutex;
+		std::condition_variable _notEmpty,_notFull,_idle;
+		std::thread _thread;
+
+		/// \brief Private member function run by the writer thread
+		void run(){
+			std::unique_lock<std::mutex> lock(_mutex);
+			while(true){
+				while(_queue.size()==0&&!_stop){
+					_notEmpty.wait(lock);
+				}
+				if(_queue.size()==0){
+					break;
+				}
+				outputJob job;
+				job.file=_queue.front().file;
+				job.items.swap(_queue.front().items);
+				_queue.pop_front();
+				_busy=true;
+				_notFull.notify_one();
+				lock.unlock();
+
+				job.file->writeItems(job.items);
+				job.items.clear();
+
+				lock.lock();
+				_busy=false;
+				_free.push_back(vector<mcmcOutputItem>());
+				_free.back().swap(job.items);
+				_idle.notify_all();
+			}
+		}
+
+};
+
+inline void mcmcOutputFile::pushPending(){
+	_writer->push(this,_pending);
+}
+
+#endif /*OUTPUT_H_*/
@@ -79,6 +79,44 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			_proposalFirstSweep = firstSweep;
 			_nTry=0;
 			_nAccept=0;
+			_nTimed=0;
+			_timeInSecs=0.0;
+			_readParts=~0u;
+			_writeParts=~0u;
+		}
+
+		/// \brief Member function to declare the parts of the state that the
+		/// proposal reads and writes
+		/// \param[in] reads The bit mask of the parts of the state read by the
+		/// proposal
+		/// \param[in] writes The bit mask of the parts of the state written by
+		/// the proposal
+		/// \note The meaning of the bits is defined by the model. By default a
+		/// proposal reads and writes all the parts of the state, so it never
+		/// runs at the same time as another proposal.
+		void stateParts(const unsigned int& reads,const unsigned int& writes){
+			_readParts=reads;
+			_writeParts=writes;
+		}
+
+		/// \brief Member function to return the parts of the state read by
+		/// the proposal
+		unsigned int readParts() const{
+			return _readParts;
+		}
+
+		/// \brief Member function to return the parts of the state written by
+		/// the proposal
+		unsigned int writeParts() const{
+			return _writeParts;
+		}
+
+		/// \brief Member function to return whether the result depends on
+		/// the order in which this proposal and another one are used, that is
+		/// whether one of them writes a part of the state the other uses
+		bool conflictsWith(const mcmcProposal& other) const{
+			return (_writeParts&(other._readParts|other._writeParts))!=0||
+					(other._writeParts&_readParts)!=0;
 		}
 
 		/// \brief Member function to set the function for calculating proposed
@@ -158,6 +196,36 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			return _nAccept;
 		}
 
+		/// \brief Member function to set the number of tries of the proposal
+		/// (used when the sampler is resumed from a checkpoint)
+		void nTry(const unsigned int& n){
+			_nTry=n;
+		}
+
+		/// \brief Member function to set the number of acceptances of the
+		/// proposal (used when the sampler is resumed from a checkpoint)
+		void nAccept(const unsigned int& n){
+			_nAccept=n;
+		}
+
+		/// \brief Member function to add to the time spent in the proposal
+		/// \param[in] timeInSecs The wall time of one use of the proposal
+		void addTime(const double& timeInSecs){
+			_timeInSecs+=timeInSecs;
+			_nTimed++;
+		}
+
+		/// \brief Member function to return the total wall time spent in the
+		/// proposal (only recorded if the sampler records timings)
+		double timeInSecs() const{
+			return _timeInSecs;
+		}
+
+		/// \brief Member function to return the number of timed uses of the proposal
+		unsigned int nTimed() const{
+			return _nTimed;
+		}
+
 	private:
 		string _proposalName;
 
@@ -171,6 +239,13 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 		unsigned int _nTry;
 		unsigned int _nAccept;
 
+		/// \var _nTimed
+		/// \brief The number of times the use of the move has been timed
+		/// \var _timeInSecs
+		/// \brief The total wall time spent in the move
+		unsigned int _nTimed;
+		double _timeInSecs;
+
 		/// \brief Pointer to user function to propose new model parameters
 		void (*_updateParameters)(mcmcChain<modelParamType>&,
 								unsigned int &,
@@ -188,6 +263,13 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 		/// \brief The first sweep at which the proposal should be attempted
 		unsigned int _proposalFirstSweep;
 
+		/// \var _readParts
+		/// \brief The bit mask of the parts of the state read by the proposal
+		/// \var _writeParts
+		/// \brief The bit mask of the parts of the state written by the proposal
+		unsigned int _readParts;
+		unsigned int _writeParts;
+
 };
 
 #endif /* PROPOSAL_H_ */
@@ -40,6 +40,11 @@
 #include<fstream>
 #include<sstream>
 #include<cstdint>
+#include<cstdio>
+#include<chrono>
+#include<atomic>
+#include<map>
+#include<exception>
 
 #include<Rcpp.h>
 
@@ -48,6 +53,9 @@
 #include<MCMC/model.h>
 #include<MCMC/chain.h>
 #include<MCMC/proposal.h>
+#include<MCMC/output.h>
+#include<MCMC/checkpoint.h>
+#include<MCMC/convergence.h>
 
 using std::string;
 using std::vector;
@@ -68,7 +76,23 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			_nBurn = 0;
 			_nFilter = 1;
 			_reportBurnIn = false;
+			_reportProgress = true;
+			_recordTimings = false;
+			_asyncOutput = false;
+			_outputWriter = NULL;
 			_outFileStem = "output";
+			_checkpointEvery = 0;
+			_resumeSweep = 0;
+			_sweep = 0;
+			_burnInEnd = 0;
+			_monitorStatistics = NULL;
+			_statusEvery = 0;
+			_statusStatistics = NULL;
+			_userInterrupt = NULL;
+			_stopRun = NULL;
+			_interrupted = false;
+			_parallelProposals = false;
+			_nProposalThreads = 1;
 		}
 
 		/// \brief Explicit constructor
@@ -84,11 +108,31 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			_nBurn = nBurn;
 			_nFilter = nFilter;
 			_reportBurnIn = false;
+			_reportProgress = true;
+			_recordTimings = false;
+			_asyncOutput = false;
+			_outputWriter = NULL;
 			_outFileStem = "output";
+			_checkpointEvery = 0;
+			_resumeSweep = 0;
+			_sweep = 0;
+			_burnInEnd = 0;
+			_monitorStatistics = NULL;
+			_statusEvery = 0;
+			_statusStatistics = NULL;
+			_userInterrupt = NULL;
+			_stopRun = NULL;
+			_interrupted = false;
+			_parallelProposals = false;
+			_nProposalThreads = 1;
 		}
 
 		/// \brief Destructor
-		~mcmcSampler(){};
+		~mcmcSampler(){
+			if(_outputWriter){
+				delete _outputWriter;
+			}
+		};
 
 		/// \brief Member function to set the number of sweeps for the sampler
 		/// \param[in] nS The number of sweeps
@@ -96,6 +140,10 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			_nSweeps = nS;
 		}
 
+		unsigned int nSweeps() const{
+			return _nSweeps;
+		}
+
 		/// \brief Member function to set the number of burn in sweeps for the sampler
 		/// \param[in] nB The number of burn in sweeps
 		void nBurn(const unsigned int& nB){
@@ -135,6 +183,154 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			return _reportBurnIn;
 		}
 
+		/// \brief Member function returning whether the state at the end of
+		/// the given sweep is written to the output
+		/// \param[in] sweep The sweep number (0 for the initial state)
+		bool isOutputSweep(const unsigned int& sweep) const{
+			return (_reportBurnIn||sweep>_nBurn)&&(sweep%_nFilter==0);
+		}
+
+		/// \brief Member function to define whether the progress of the sampler
+		/// is printed
+		/// \param[in] repProgress true if the progress is printed, false otherwise
+		/// \note This must be false for samplers that are run on a thread other
+		/// than the main thread
+		void reportProgress(const bool& repProgress){
+			_reportProgress = repProgress;
+		}
+
+		/// \brief Member function to define whether the wall time spent in
+		/// each proposal and in the other steps of a sweep is recorded
+		/// \param[in] recTimings true if the timings are recorded, false otherwise
+		void recordTimings(const bool& recTimings){
+			_recordTimings = recTimings;
+		}
+
+		/// \brief Member function to define whether the output files are
+		/// written by a background thread
+		/// \param[in] async true if the records are written in the background,
+		/// false if they are written at the end of each sweep
+		void asyncOutput(const bool& async){
+			_asyncOutput = async;
+		}
+
+		/// \brief Member function to set the frequency of the checkpoints
+		/// \param[in] nCheckpoint The number of sweeps between checkpoints (0
+		/// if no checkpoints are written)
+		/// \note The checkpoint is written to the output file stem followed by
+		/// _checkpoint.bin, replacing the previous one
+		void checkpointEvery(const unsigned int& nCheckpoint){
+			_checkpointEvery = nCheckpoint;
+		}
+
+		/// \brief Return the sweep the sampler was resumed from (0 if the run
+		/// was not resumed)
+		unsigned int resumeSweep() const{
+			return _resumeSweep;
+		}
+
+		/// \brief Return the length an output file had at the checkpoint the
+		/// run was resumed from, to be given to the mcmcOutputFile constructor
+		/// \param[in] fileName The name of the output file
+		/// \return The length of the file, or -1 if it is written from the start
+		long long int resumeOffset(const string& fileName) const{
+			if(fileName.compare(0,_outFileStem.size(),_outFileStem)!=0){
+				return -1;
+			}
+			std::map<string,long long int>::const_iterator it=_resumeOffsets.find(fileName.substr(_outFileStem.size()));
+			if(it==_resumeOffsets.end()){
+				return -1;
+			}
+			return it->second;
+		}
+
+		/// \brief Member function to set the user function giving the
+		/// statistics that are monitored for convergence
+		/// \param[in] f Pointer to the user function, which sets its vector
+		/// argument to the statistics of the current state (the log
+		/// posterior is up to date when it is called)
+		/// \note The statistics are recorded every nFilter sweeps, during the
+		/// burn in as well, and the record is restarted once the burn in ends
+		void monitorFn(void (*f)(const mcmcSampler<modelParamType,optionType,propParamType,dataType>&,
+									vector<double>&)){
+			_monitorStatistics = f;
+		}
+
+		/// \brief Member function to set the frequency of the status file
+		/// \param[in] nStatus The number of sweeps between the updates of the
+		/// status file (0 if it is not written)
+		/// \note The status file is the output file stem followed by
+		/// _status.txt. Each line holds a name and a value: the state of the
+		/// run, the sweep, the sweeps per second, the log posterior, the
+		/// statistics of the user function and the acceptance rates. It is
+		/// written to a temporary file which then replaces the previous one,
+		/// so it can be read at any time while the sampler runs.
+		void statusEvery(const unsigned int& nStatus){
+			_statusEvery = nStatus;
+		}
+
+		/// \brief Member function to set the user function writing the model
+		/// specific lines of the status file
+		/// \param[in] f Pointer to the user function, which writes one name
+		/// and value per line to its stream argument
+		void statusFn(void (*f)(const mcmcSampler<modelParamType,optionType,propParamType,dataType>&,
+									std::ostream&)){
+			_statusStatistics = f;
+		}
+
+		/// \brief Member function to set the user function checking whether
+		/// the user has interrupted the run
+		/// \param[in] f Pointer to the user function, which returns true if
+		/// the run has been interrupted
+		/// \note The function is called at most every quarter of a second,
+		/// between sweeps. It must only be set for the sampler run on the main
+		/// thread if it calls R.
+		void interruptFn(bool (*f)()){
+			_userInterrupt = f;
+		}
+
+		/// \brief Member function to set the flag shared by the samplers of
+		/// the chains of a run, which is raised when one of them has been
+		/// interrupted so that they all stop
+		/// \param[in] stop Pointer to the flag (NULL if the sampler is not
+		/// stopped by the other samplers)
+		void stopFlag(std::atomic<bool>* stop){
+			_stopRun = stop;
+		}
+
+		/// \brief Return whether the run has been interrupted, in which case
+		/// it ended at the last sweep that has been run
+		bool interrupted() const{
+			return _interrupted;
+		}
+
+		/// \brief Return the batch means of each monitored statistic, since the
+		/// start of the run during the burn in or since its end afterwards
+		const vector<mcmcBatchMeans>& monitor() const{
+			return _monitor;
+		}
+
+		/// \brief Return the last sweep that has been run
+		unsigned int sweep() const{
+			return _sweep;
+		}
+
+		/// \brief Member function to end the burn in at the last sweep that
+		/// has been run, the number of sweeps after the burn in is unchanged
+		void endBurnIn(){
+			_nBurn = _sweep;
+			_burnInEnd = _sweep;
+			for(unsigned int i=0;i<_monitor.size();i++){
+				_monitor[i].clear();
+			}
+		}
+
+		/// \brief Member function to end the run at the last sweep that has
+		/// been run
+		void endSampling(){
+			_nSweeps = _sweep>_nBurn?_sweep-_nBurn:0;
+		}
+
 
 		/// \brief Member function to set the model options
 		/// \param[in] modelOpts An object of optionsType
@@ -166,6 +362,10 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 
 		/// \brief Member function to close the output files
 		void closeOutputFiles(){
+			if(_outputWriter){
+				delete _outputWriter;
+				_outputWriter = NULL;
+			}
 			_logFile.close();
 			for(unsigned int i=0;i<_outFiles.size();i++){
 				(*(_outFiles[i])).close();
@@ -177,7 +377,7 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			return _outFileStem;
 		}
 
-		vector<std::ofstream*>& outFiles(){
+		vector<mcmcOutputFile*>& outFiles(){
 			return _outFiles;
 		}
 
@@ -212,6 +412,11 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			return _chain;
 		}
 
+		/// \brief Return the chain
+		mcmcChain<modelParamType>& chain(){
+			return _chain;
+		}
+
 		/// \brief Set the missing data function for the model
 		void updateMissingDataFn(void (*f)(baseGeneratorType&,
 										modelParamType&,
@@ -227,7 +432,23 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 						void (*updateFn)(mcmcChain<modelParamType>&,
 										unsigned int&,unsigned int&,
 										const mcmcModel<modelParamType,optionType,dataType>&,
-										propParamType&, baseGeneratorType&));
+										propParamType&, baseGeneratorType&),
+						const unsigned int& reads=~0u,
+						const unsigned int& writes=~0u);
+
+		/// \brief Member function to set whether the proposals of a sweep
+		/// that do not conflict are run concurrently
+		/// \param[in] parallel Whether the proposals are run concurrently
+		/// \param[in] nThreads The number of threads running the proposals
+		/// \note The proposals conflict unless they have declared the parts
+		/// of the state they read and write, see addProposal. Each proposal
+		/// then draws from its own random number substream, so the results
+		/// do not depend on nThreads but differ from those of a sampler
+		/// running the proposals one after the other.
+		void parallelProposals(const bool& parallel,const unsigned int& nThreads){
+			_parallelProposals = parallel;
+			_nProposalThreads = nThreads>0?nThreads:1;
+		}
 
 		/// \brief Member function to seed the random number generator
 		/// \param[in] seedValue The seed value to use (if 0 is used the clock is
@@ -242,6 +463,16 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			_rndGenerator.seed(_seed);
 		}
 
+		/// \brief Return the random number generator
+		baseGeneratorType& rndGenerator(){
+			return _rndGenerator;
+		}
+
+		/// \brief Return the seed of the random number generator
+		uint_fast32_t seed() const{
+			return _seed;
+		}
+
 		/// \brief Member function to initialise the MCMC chain
 		void initialiseChain(){
 			modelParamType tmpModelParams;
@@ -266,6 +497,16 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 			_model.importData(dataFilePath,predictFilePath,neighFilePath);
 		}
 
+		/// \brief Member function to use data that has already been imported
+		/// \param[in] dataset The imported data
+		/// \param[in] dataFilePath The file path where the data is stored
+		void importData(const dataType& dataset,const string& dataFilePath,const string& predictFilePath, const string& neighFilePath){
+			_dataFilePath=dataFilePath;
+			_predictFilePath=predictFilePath;
+			_neighFilePath=neighFilePath;
+			_model.dataset()=dataset;
+		}
+
 		/// \brief Member function to updateMissingData the data
 		void updateMissingData(){
 			if(_model.hasMissingData()){
@@ -278,7 +519,23 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 		void writeLogFile();
 
 		// Full comments with function definition below
-		void run();
+		bool resume(const string& fileName);
+
+		// Full comments with function definition below
+		void startRun();
+
+		// Full comments with function definition below
+		void runSweeps(const unsigned int& lastSweep);
+
+		// Full comments with function definition below
+		void finishRun();
+
+		/// \brief Member function to run the sampler for all its sweeps
+		void run(){
+			startRun();
+			runSweeps(_nBurn+_nSweeps);
+			finishRun();
+		}
 
 		/// \brief Member function to get the history of the mcmcChain associated
 		/// with the sampler
@@ -340,6 +597,124 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 		/// during the burn in period
 		bool _reportBurnIn;
 
+		/// \brief Boolean to indicate whether the progress is printed
+		bool _reportProgress;
+
+		/// \brief Boolean to indicate whether the timings are recorded
+		bool _recordTimings;
+
+		/// \brief Boolean to indicate whether the output files are written by
+		/// a background thread
+		bool _asyncOutput;
+
+		/// \brief The background writer of the output files (NULL until the
+		/// first output is written, and for synchronous output)
+		mcmcOutputWriter* _outputWriter;
+
+		/// \brief The number of sweeps between checkpoints (0 for none)
+		unsigned int _checkpointEvery;
+
+		/// \brief The sweep of the checkpoint the run was resumed from (0 for
+		/// a new run)
+		unsigned int _resumeSweep;
+
+		/// \brief The length of each output file at that checkpoint, by the
+		/// name of the file without the output file stem
+		std::map<string,long long int> _resumeOffsets;
+
+		/// \brief The last sweep that has been run
+		unsigned int _sweep;
+
+		/// \brief The sweep at which the burn in was ended early (0 if it was
+		/// not)
+		unsigned int _burnInEnd;
+
+		/// \brief Pointer to user function giving the monitored statistics
+		/// (NULL if nothing is monitored)
+		void (*_monitorStatistics)(const mcmcSampler<modelParamType,optionType,propParamType,dataType>&,
+									vector<double>&);
+
+		/// \brief The number of sweeps between the updates of the status file
+		/// (0 for none)
+		unsigned int _statusEvery;
+
+		/// \brief Pointer to user function writing the model specific lines
+		/// of the status file (NULL for none)
+		void (*_statusStatistics)(const mcmcSampler<modelParamType,optionType,propParamType,dataType>&,
+									std::ostream&);
+
+		/// \brief Pointer to user function checking whether the run has been
+		/// interrupted (NULL if it is not checked)
+		bool (*_userInterrupt)();
+
+		/// \brief The flag raised to stop the samplers of all the chains (NULL
+		/// if there is none)
+		std::atomic<bool>* _stopRun;
+
+		/// \brief Boolean to indicate whether the run has been interrupted
+		bool _interrupted;
+
+		/// \var _parallelProposals
+		/// \brief Whether the proposals that do not conflict are run concurrently
+		/// \var _nProposalThreads
+		/// \brief The number of threads running the proposals concurrently
+		bool _parallelProposals;
+		unsigned int _nProposalThreads;
+
+		/// \var _dueProposals
+		/// \brief The indices of the proposals used at the current sweep
+		/// \var _dueSeeds
+		/// \brief The seeds of the random number substreams of these proposals
+		/// \var _dueLevels
+		/// \brief The level in which each of these proposals is run
+		/// \var _levelTasks
+		/// \brief The positions in _dueProposals of the proposals of a level
+		vector<unsigned int> _dueProposals;
+		vector<uint32_t> _dueSeeds;
+		vector<unsigned int> _dueLevels;
+		vector<unsigned int> _levelTasks;
+
+		/// \brief The exceptions thrown by the proposals of a level
+		vector<std::exception_ptr> _levelErrors;
+
+		/// \var _runStartTime
+		/// \brief The wall time at which the run started
+		/// \var _statusTime
+		/// \brief The wall time at which the status file was last written
+		/// \var _interruptCheckTime
+		/// \brief The wall time at which the interruption was last checked
+		std::chrono::steady_clock::time_point _runStartTime,_statusTime,_interruptCheckTime;
+
+		/// \brief The sweep at which the status file was last written
+		unsigned int _statusSweep;
+
+		/// \brief The batch means of each monitored statistic
+		vector<mcmcBatchMeans> _monitor;
+
+		/// \brief The monitored statistics of the current sweep
+		vector<double> _monitorValues;
+
+		/// \brief The last finite value of each monitored statistic
+		vector<double> _lastMonitorValues;
+
+		/// \var _missingDataTime
+		/// \brief The wall time spent updating the missing data
+		/// \var _logPostTime
+		/// \brief The wall time spent computing the log posterior at the end
+		/// of each sweep
+		/// \var _writeOutputTime
+		/// \brief The wall time spent writing the output
+		double _missingDataTime,_logPostTime,_writeOutputTime;
+
+		/// \brief The number of sweeps for which the log posterior was computed
+		unsigned int _nLogPost;
+
+		/// \var _nMissingData
+		/// \brief The number of updates of the missing data in this run
+		/// \var _nWriteOutput
+		/// \brief The number of times the output was written in this run
+		unsigned int _nMissingData,_nWriteOutput;
+
 		/// \brief Pointer to user function to process the output
 		void (*_writeOutput)(mcmcSampler<modelParamType,optionType,propParamType,dataType>&,
 								const unsigned int&);
@@ -355,7 +730,7 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 		/// \brief File object for writing the log of the run
 		std::ofstream _logFile;
 
-		vector<std::ofstream*> _outFiles;
+		vector<mcmcOutputFile*> _outFiles;
 
 		/// \brief Private member function for writing the output of the sampler
 		/// \note This is a just a wrapper for the user supplied function
@@ -364,6 +739,26 @@ template<class modelParamType,class optionType,class propParamType,class dataTyp
 		/// \brief Private member function for writing the acceptance rates of the sampler
 		void writeAcceptanceRates();
 
+		// Full comments with function definition below
+		void writeCheckpoint(const unsigned int& sweep);
+
+		/// \brief Private member function for writing the recorded timings
+		void writeTimings();
+
+		// Full comments with function definition below
+		void writeStatus(const string& runState);
+
+		// Full comments with function definition below
+		bool stopRequested();
+
+		// Full comments with function definition below
+		void runConcurrentProposals(const unsigned int& sweep,randomUniform& unifRand);
+
+		/// \brief Private member function returning the wall time elapsed since start
+		static double secondsSince(const std::chrono::steady_clock::time_point& start){
+			return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+		}
+
 
 };
 
@@ -433,6 +828,14 @@ void mcmcSampler<modelParamType,optionType,propParamType,dataType>::
 /// \param[in] updateFrequency Frequency in proposal attempts that the proposal
 /// parameters are updated (for adaptive proposals)
 /// \param[in] updateFn Pointer to the function for updating the chain
+/// \param[in] reads The bit mask of the parts of the state read by the
+/// proposal (by default all of them)
+/// \param[in] writes The bit mask of the parts of the state written by the
+/// proposal (by default all of them)
+/// \note The parts of the state are only used to decide which proposals
+/// can be run concurrently, and their meaning is defined by the model. A
+/// proposal must declare every part it reads or writes, including the
+/// parts of the proposal parameters shared with other proposals.
 template<class modelParamType,class optionType,class propParamType,class dataType>
 void mcmcSampler<modelParamType,optionType,propParamType,dataType>::
 	addProposal(const string& propName,const double& weight,
@@ -441,7 +844,9 @@ void mcmcSampler<modelParamType,optionType,propParamType,dataType>::
 				void (*updateFn)(mcmcChain<modelParamType>&,
 								unsigned int&, unsigned int&,
 								const mcmcModel<modelParamType,optionType,dataType>&,
-								propParamType&, baseGeneratorType&)){
+								propParamType&, baseGeneratorType&),
+				const unsigned int& reads,
+				const unsigned int& writes){
 	// Adding a proposal to the sampler
 
 	// First define a temporary object of type mcmcProposal
@@ -454,6 +859,9 @@ void mcmcSampler<modelParamType,optionType,propParamType,dataType>::
 	// parameters
 	tmpProposal.updateFunction(updateFn);
 
+	// and the parts of the state it reads and writes
+	tmpProposal.stateParts(reads,writes);
+
 	// Finally we add this proposal to the vector of proposals for this sampler
 	_proposalVec.push_back(tmpProposal);
 
@@ -498,6 +906,19 @@ void mcmcSampler<modelParamType,optionType,propParamType,dataType>::writeOutput(
 	// Write the output
 	(*_writeOutput)(*this,sweep);
 
+	// With asynchronous output, the files (which are opened by the user
+	// function at the first call) hand their records over to the writer
+	// thread. The queue holds enough records for a good number of sweeps,
+	// after which the sampler waits for the writer.
+	if(_asyncOutput){
+		if(!_outputWriter){
+			_outputWriter = new mcmcOutputWriter(1024);
+		}
+		for(unsigned int i=0;i<_outFiles.size();i++){
+			_outFiles[i]->setWriter(_outputWriter);
+		}
+	}
+
 }
 
 template<class modelParamType,class optionType,class propParamType,class dataType>
@@ -515,12 +936,287 @@ void mcmcSampler<modelParamType,optionType,propParamType,dataType>::writeAccepta
 
 }
 
-/// \brief Member function to run the sampler
+template<class modelParamType,class optionType,class propParamType,class dataType>
+void mcmcSampler<modelParamType,optionType,propParamType,dataType>::writeTimings(){
+
+	// Write the wall time spent in each step of the sampler, both into its
+	// own file and into the log file
+	string timingsFileName = _outFileStem + "_timings.txt";
+	std::ofstream timingsFile(timingsFileName.c_str());
+	ostringstream tmpStr;
+	timingsFile << "Step Calls TotalSecs SecsPerCall" << endl;
+	typename vector<mcmcProposal<modelParamType,optionType,propParamType,dataType> >::iterator it;
+	for(it=_proposalVec.begin();it<_proposalVec.end();++it){
+		double perCall = it->nTimed()>0?it->timeInSecs()/(double)it->nTimed():0.0;
+		timingsFile << it->proposalName() << " " << it->nTimed() << " " << it->timeInSecs() << " " << perCall << endl;
+		tmpStr << "Proposal Type: " << it->proposalName() << ", Time (secs): " << it->timeInSecs() << endl;
+	}
+	// The calls counted are those made in this run, which can have ended
+	// early or been resumed
+	timingsFile << "updateMissingData " << _nMissingData << " " << _missingDataTime << " " << (_nMissingData>0?_missingDataTime/(double)_nMissingData:0.0) << endl;
+	timingsFile << "logPosterior " << _nLogPost << " " << _logPostTime << " " << (_nLogPost>0?_logPostTime/(double)_nLogPost:0.0) << endl;
+	timingsFile << "writeOutput " << _nWriteOutput << " " << _writeOutputTime << " " << (_nWriteOutput>0?_writeOutputTime/(double)_nWriteOutput:0.0) << endl;
+	tmpStr << "Missing data update, Time (secs): " << _missingDataTime << endl;
+	tmpStr << "Log posterior, Time (secs): " << _logPostTime << endl;
+	tmpStr << "Writing output, Time (secs): " << _writeOutputTime << endl;
+	timingsFile.close();
+	appendToLogFile(tmpStr.str());
+
+}
+
+/// \brief Private member function to write a checkpoint at the end of a sweep
+/// \param[in] sweep The sweep that has just been completed
+/// \note The checkpoint holds the sweep, the random number generator, the
+/// chain state, the proposal parameters, the numbers of tries and
+/// acceptances of each proposal, the data (with the current values of the
+/// missing covariates) and the length of each output file. It is
+/// written to a temporary file which then replaces the previous checkpoint,
+/// so a run stopped while writing it still has the previous one.
+template<class modelParamType,class optionType,class propParamType,class dataType>
+void mcmcSampler<modelParamType,optionType,propParamType,dataType>::writeCheckpoint(const unsigned int& sweep){
+
+	// Everything written up to this sweep has to be on disk before the
+	// file lengths are taken
+	if(_outputWriter){
+		_outputWriter->wait();
+	}
+	// The names are kept without the output file stem, so that the files
+	// can be moved along with the checkpoint
+	vector<string> fileNames,diskFileNames;
+	vector<long long int> fileLengths;
+	for(unsigned int i=0;i<_outFiles.size();i++){
+		const string& fileName = _outFiles[i]->fileName();
+		const string& diskFileName = _outFiles[i]->diskFileName();
+		long long int fileLength = _outFiles[i]->checkpoint();
+		if(fileLength>=0&&fileName.compare(0,_outFileStem.size(),_outFileStem)==0&&
+				diskFileName.compare(0,_outFileStem.size(),_outFileStem)==0){
+			fileNames.push_back(fileName.substr(_outFileStem.size()));
+			diskFileNames.push_back(diskFileName.substr(_outFileStem.size()));
+			fileLengths.push_back(fileLength);
+		}
+	}
+
+	// The acceptance rates in the log carry on from the checkpoint
+	vector<uint32_t> nTry,nAccept;
+	for(unsigned int k=0;k<_proposalVec.size();k++){
+		nTry.push_back(_proposalVec[k].nTry());
+		nAccept.push_back(_proposalVec[k].nAccept());
+	}
+
+	string checkpointFileName = _outFileStem + "_checkpoint.bin";
+	string tmpFileName = checkpointFileName + ".tmp";
+	mcmcCheckpointWriter checkpoint(tmpFileName);
+	string magic = "PReMiuMC";
+	uint32_t version = 2;
+	uint32_t checkpointSweep = sweep;
+	checkpoint & magic & version & checkpointSweep;
+	_rndGenerator.serialise(checkpoint);
+	_chain.currentState().serialise(checkpoint);
+	_proposalParams.serialise(checkpoint);
+	checkpoint & nTry & nAccept;
+	_model.dataset().serialise(checkpoint);
+	checkpoint & _burnInEnd & _monitor & _lastMonitorValues;
+	checkpoint & fileNames & diskFileNames & fileLengths;
+	bool written = checkpoint.good();
+	checkpoint.close();
+
+	if(written){
+		std::remove(checkpointFileName.c_str());
+		written = std::rename(tmpFileName.c_str(),checkpointFileName.c_str())==0;
+	}
+	// R can only be called from the main thread
+	if(!written&&_reportProgress){
+		Rprintf("The checkpoint at sweep %i could not be written to %s\n",sweep,checkpointFileName.c_str());
+	}
+
+}
+
+/// \brief Member function to resume the sampler from a checkpoint
+/// \param[in] fileName The checkpoint file written by a run with the same
+/// options (apart from the number of sweeps)
+/// \return Whether the checkpoint could be read, if not the sampler is
+/// left unchanged
+/// \note This is called once the chain has been initialised. The run then
+/// continues with the sweep after the checkpoint, and the output files are
+/// cut back to their length at the checkpoint and appended to.
+template<class modelParamType,class optionType,class propParamType,class dataType>
+bool mcmcSampler<modelParamType,optionType,propParamType,dataType>::resume(const string& fileName){
+
+	// Everything is read into copies, which only replace the sampler state
+	// once the whole checkpoint has been read
+	mcmcCheckpointReader checkpoint(fileName);
+	string magic;
+	uint32_t version=0,checkpointSweep=0;
+	checkpoint & magic & version & checkpointSweep;
+	if(!checkpoint.good()||magic.compare("PReMiuMC")!=0||version!=2){
+		return false;
+	}
+	baseGeneratorType rndGenerator(_rndGenerator);
+	mcmcState<modelParamType> state;
+	state = _chain.currentState();
+	propParamType proposalParams;
+	proposalParams = _proposalParams;
+	dataType dataset(_model.dataset());
+	uint32_t burnInEnd=0;
+	vector<mcmcBatchMeans> monitor;
+	vector<double> lastMonitorValues;
+	vector<uint32_t> nTry,nAccept;
+	vector<string> fileNames,diskFileNames;
+	vector<long long int> fileLengths;
+	rndGenerator.serialise(checkpoint);
+	state.serialise(checkpoint);
+	proposalParams.serialise(checkpoint);
+	checkpoint & nTry & nAccept;
+	dataset.serialise(checkpoint);
+	checkpoint & burnInEnd & monitor & lastMonitorValues;
+	checkpoint & fileNames & diskFileNames & fileLengths;
+	if(!checkpoint.good()||!checkpoint.atEnd()||fileNames.size()!=fileLengths.size()||
+			diskFileNames.size()!=fileLengths.size()||nTry.size()!=_proposalVec.size()||
+			nAccept.size()!=_proposalVec.size()){
+		return false;
+	}
+	checkpoint.close();
+
+	_rndGenerator = rndGenerator;
+	_chain.currentState(state);
+	_proposalParams = proposalParams;
+	for(unsigned int k=0;k<_proposalVec.size();k++){
+		_proposalVec[k].nTry(nTry[k]);
+		_proposalVec[k].nAccept(nAccept[k]);
+	}
+	_model.dataset() = dataset;
+	_resumeSweep = checkpointSweep;
+	_burnInEnd = burnInEnd;
+	if(_burnInEnd>0){
+		_nBurn = _burnInEnd;
+	}
+	_monitor = monitor;
+	_lastMonitorValues = lastMonitorValues;
+	_resumeOffsets.clear();
+	for(unsigned int i=0;i<fileNames.size();i++){
+		_resumeOffsets[fileNames[i]] = fileLengths[i];
+		// The files are cut back here as well as when they are opened, as
+		// they are not opened again if the run ends before the next output
+		string diskFileName = _outFileStem + diskFileNames[i];
+		if(!mcmcTruncateFile(diskFileName,fileLengths[i])){
+			_resumeOffsets[fileNames[i]] = -1;
+		}
+	}
+	return true;
+
+}
+
+/// \brief Private member function to write the status file at the end of a
+/// sweep
+/// \param[in] runState The state of the run, running, finished or
+/// interrupted
+/// \note The sweeps per second are given over the whole run and over the
+/// sweeps since the previous status. The log posterior is that of the last
+/// sweep for which it was computed.
+template<class modelParamType,class optionType,class propParamType,class dataType>
+void mcmcSampler<modelParamType,optionType,propParamType,dataType>::writeStatus(const string& runState){
+
+	std::chrono::steady_clock::time_point now=std::chrono::steady_clock::now();
+	double elapsedSecs = std::chrono::duration<double>(now-_runStartTime).count();
+	double recentSecs = std::chrono::duration<double>(now-_statusTime).count();
+	string statusFileName = _outFileStem + "_status.txt";
+	string tmpFileName = statusFileName + ".tmp";
+	std::ofstream statusFile(tmpFileName.c_str());
+	statusFile << "state " << runState << endl;
+	statusFile << "sweep " << _sweep << endl;
+	statusFile << "nSweepsTotal " << _nBurn+_nSweeps << endl;
+	statusFile << "elapsedSecs " << elapsedSecs << endl;
+	statusFile << "sweepsPerSec " << (elapsedSecs>0?(double)(_sweep-_resumeSweep)/elapsedSecs:0.0) << endl;
+	statusFile << "recentSweepsPerSec " << (recentSecs>0?(double)(_sweep-_statusSweep)/recentSecs:0.0) << endl;
+	statusFile << "logPosterior " << _chain.currentState().logPosterior() << endl;
+	if(_statusStatistics){
+		(*_statusStatistics)(*this,statusFile);
+	}
+	typename vector<mcmcProposal<modelParamType,optionType,propParamType,dataType> >::iterator it;
+	for(it=_proposalVec.begin();it<_proposalVec.end();++it){
+		statusFile << "acceptRate_" << it->proposalName() << " " << it->acceptanceRate() << endl;
+	}
+	bool written = statusFile.good();
+	statusFile.close();
+
+	// The rename replaces the previous status in one step, where it can not
+	// replace an existing file the previous status is removed first
+	if(written&&std::rename(tmpFileName.c_str(),statusFileName.c_str())!=0){
+		std::remove(statusFileName.c_str());
+		std::rename(tmpFileName.c_str(),statusFileName.c_str());
+	}
+	_statusTime = now;
+	_statusSweep = _sweep;
+
+}
+
+/// \brief Private member function returning whether the run has to stop
+/// before the next sweep
+/// \note The user function checking for an interruption is called at most
+/// every quarter of a second, and raises the stop flag shared with the
+/// samplers of the other chains.
+template<class modelParamType,class optionType,class propParamType,class dataType>
+bool mcmcSampler<modelParamType,optionType,propParamType,dataType>::stopRequested(){
+
+	if(_userInterrupt&&secondsSince(_interruptCheckTime)>=0.25){
+		_interruptCheckTime = std::chrono::steady_clock::now();
+		if((*_userInterrupt)()){
+			_interrupted = true;
+			if(_stopRun){
+				_stopRun->store(true);
+			}
+		}
+	}
+	if(_stopRun&&_stopRun->load()){
+		_interrupted = true;
+	}
+	return _interrupted;
+
+}
+
+/// \brief Member function to start the run of the sampler, writing the
+/// output of the initial state
+template<class modelParamType,class optionType,class propParamType,class dataType>
+void mcmcSampler<modelParamType,optionType,propParamType,dataType>::startRun(){
+
+	// The timings are only recorded if requested
+	_missingDataTime=0.0;
+	_logPostTime=0.0;
+	_writeOutputTime=0.0;
+	_nLogPost=0;
+	_nMissingData=0;
+	_nWriteOutput=0;
+	_sweep=_resumeSweep;
+	_interrupted=false;
+	_runStartTime=std::chrono::steady_clock::now();
+	_statusTime=_runStartTime;
+	_interruptCheckTime=_runStartTime;
+	_statusSweep=_sweep;
+
+	// Write the output of initialisation before sampler begins (a resumed
+	// run has already written it)
+	if(_resumeSweep==0){
+		std::chrono::steady_clock::time_point startTime;
+		if(_recordTimings){
+			startTime=std::chrono::steady_clock::now();
+		}
+		writeOutput(0);
+		_nWriteOutput++;
+		if(_recordTimings){
+			_writeOutputTime+=secondsSince(startTime);
+		}
+	}
+
+}
+
+/// \brief Member function to run the sampler up to a given sweep
+/// \param[in] lastSweep The last sweep to run (at most nBurn+nSweeps)
 /// \note This is the main function that does all the work. The function
 /// itself is commented with normal C++ style comments to explain what
-/// it does
+/// it does. The run can be split into several calls, for example to
+/// monitor the convergence of several chains between the calls.
 template<class modelParamType,class optionType,class propParamType,class dataType>
-void mcmcSampler<modelParamType,optionType,propParamType,dataType>::run(){
+void mcmcSampler<modelParamType,optionType,propParamType,dataType>::runSweeps(const unsigned int& lastSweep){
 	// This is the main function that runs the sampler
 
 	// Define a uniform random number generator
@@ -528,40 +1224,210 @@ void mcmcSampler<modelParamType,optionType,propParamType,dataType>::run(){
 
 	// This is the main sampler
 	// We loop over the sweeps
-
-	// Write the output of initialisation before sampler begins
-	writeOutput(0);
-	for(unsigned int sweep=1; sweep<=_nBurn+_nSweeps; sweep++){
-		if(sweep==1||sweep%_nProgress==0){
+	std::chrono::steady_clock::time_point startTime;
+	unsigned int endSweep = lastSweep<_nBurn+_nSweeps?lastSweep:_nBurn+_nSweeps;
+	for(unsigned int sweep=_sweep+1; sweep<=endSweep; sweep++){
+		// An interrupted run ends at the last sweep that has been completed
+		if(stopRequested()){
+			break;
+		}
+		if(_reportProgress&&(sweep==1||sweep%_nProgress==0)){
 			Rprintf("Sweep: %i\n",sweep);
 		}
 		// Update the missing data (this will only do anything if the
 		// _model.hasMissingData flag is true)
+		if(_recordTimings){
+			startTime=std::chrono::steady_clock::now();
+		}
 		updateMissingData();
+		_nMissingData++;
+		if(_recordTimings){
+			_missingDataTime+=secondsSince(startTime);
+		}
 
 		// At each sweep we loop over the proposals
-		typename vector<mcmcProposal<modelParamType,optionType,propParamType,dataType> >::iterator it;
-		for(it=_proposalVec.begin(); it<_proposalVec.end(); it++){
-			// Only use this proposal if it is due to be tried at this sweep
-			if(sweep >= it->proposalFirstSweep() && sweep % it->proposalFrequency()==0){
-
-				// Only try this proposal with probability as defined
-				if(unifRand(_rndGenerator)<it->proposalWeight()){
-
-					// Update the chain state
-					it->updateParameters(_chain,_model,_rndGenerator);
+		if(_parallelProposals){
+			runConcurrentProposals(sweep,unifRand);
+		}else{
+			typename vector<mcmcProposal<modelParamType,optionType,propParamType,dataType> >::iterator it;
+			for(it=_proposalVec.begin(); it<_proposalVec.end(); it++){
+				// Only use this proposal if it is due to be tried at this sweep
+				if(sweep >= it->proposalFirstSweep() && sweep % it->proposalFrequency()==0){
+
+					// Only try this proposal with probability as defined
+					if(unifRand(_rndGenerator)<it->proposalWeight()){
+
+						// Update the chain state
+						if(_recordTimings){
+							startTime=std::chrono::steady_clock::now();
+						}
+						it->updateParameters(_chain,_model,_rndGenerator);
+						if(_recordTimings){
+							it->addTime(secondsSince(startTime));
+						}
+					}
 				}
-			}
 
+			}
 		}
 
 		// At the end of the sweep make sure the log posterior is up to date.
-		_chain.currentState().logPosterior(_model.logPosterior(_chain.currentState().parameters()));
+		// The proposals do not use the stored log posterior, so it is only
+		// needed (and only computed) for the sweeps that are written out or
+		// monitored, or reported in the status file
+		bool monitorSweep = _monitorStatistics&&sweep%_nFilter==0;
+		bool statusSweep = _statusEvery>0&&sweep%_statusEvery==0;
+		if(isOutputSweep(sweep)||monitorSweep||statusSweep){
+			if(_recordTimings){
+				startTime=std::chrono::steady_clock::now();
+			}
+			_chain.currentState().logPosterior(_model.logPosterior(_chain.currentState().parameters()));
+			_nLogPost++;
+			if(_recordTimings){
+				_logPostTime+=secondsSince(startTime);
+			}
+		}
+		if(monitorSweep){
+			// A value that is not finite (such as a log posterior of -inf)
+			// is replaced by the last finite value, so that all chains keep
+			// the same number of values
+			(*_monitorStatistics)(*this,_monitorValues);
+			_monitor.resize(_monitorValues.size());
+			_lastMonitorValues.resize(_monitorValues.size(),0.0);
+			for(unsigned int i=0;i<_monitorValues.size();i++){
+				if(std::isfinite(_monitorValues[i])){
+					_lastMonitorValues[i]=_monitorValues[i];
+				}
+				_monitor[i].add(_lastMonitorValues[i]);
+			}
+		}
+		_sweep=sweep;
+		// The statistics of the burn in are not used once it has ended
+		if(sweep==_nBurn){
+			for(unsigned int i=0;i<_monitor.size();i++){
+				_monitor[i].clear();
+			}
+		}
+		if(_recordTimings){
+			startTime=std::chrono::steady_clock::now();
+		}
 
 		// Now write the output (this is controlled by the user defined function
 		writeOutput(sweep);
+		_nWriteOutput++;
+		if(_checkpointEvery>0&&sweep%_checkpointEvery==0){
+			writeCheckpoint(sweep);
+		}
+		if(statusSweep){
+			writeStatus("running");
+		}
+		if(_recordTimings){
+			_writeOutputTime+=secondsSince(startTime);
+		}
+	}
+
+	// An interrupted run can be resumed from the last sweep that was run
+	if(_interrupted&&_checkpointEvery>0&&_sweep>0&&_sweep%_checkpointEvery!=0){
+		writeCheckpoint(_sweep);
+	}
+
+}
+
+/// \brief Member function to use the proposals of a sweep, running those
+/// that do not conflict concurrently
+/// \param[in] sweep The current sweep
+/// \param[in] unifRand The uniform distribution used to decide whether each
+/// proposal is tried
+/// \note Which proposals are tried, and the seed of the random number
+/// substream of each of them, are drawn from the main generator in the order
+/// the proposals were added. Each proposal is placed in the level after the
+/// last level of the earlier proposals it conflicts with, and the proposals
+/// of a level are run concurrently. As none of the proposals of a level
+/// reads or writes a part of the state written by another one, the sweep
+/// gives the same state as using them one after the other in their order
+/// with the same random numbers. Each proposal leaves the posterior
+/// invariant, so the sweep does too, and the results do not depend on the
+/// number of threads.
+template<class modelParamType,class optionType,class propParamType,class dataType>
+void mcmcSampler<modelParamType,optionType,propParamType,dataType>::runConcurrentProposals(
+		const unsigned int& sweep,randomUniform& unifRand){
+
+	// Decide which proposals are tried at this sweep, and their levels
+	_dueProposals.clear();
+	_dueSeeds.clear();
+	_dueLevels.clear();
+	unsigned int nLevels=0;
+	for(unsigned int k=0;k<_proposalVec.size();k++){
+		mcmcProposal<modelParamType,optionType,propParamType,dataType>& proposal = _proposalVec[k];
+		if(sweep>=proposal.proposalFirstSweep()&&sweep%proposal.proposalFrequency()==0&&
+				unifRand(_rndGenerator)<proposal.proposalWeight()){
+			unsigned int level=0;
+			for(unsigned int j=0;j<_dueProposals.size();j++){
+				if(_dueLevels[j]>=level&&proposal.conflictsWith(_proposalVec[_dueProposals[j]])){
+					level=_dueLevels[j]+1;
+				}
+			}
+			_dueProposals.push_back(k);
+			_dueSeeds.push_back(_rndGenerator());
+			_dueLevels.push_back(level);
+			if(level>=nLevels){
+				nLevels=level+1;
+			}
+		}
 	}
+
+	// Run the levels in turn. A level with a single proposal is run on this
+	// thread, so the proposal can use all the threads itself
+	for(unsigned int level=0;level<nLevels;level++){
+		_levelTasks.clear();
+		for(unsigned int j=0;j<_dueProposals.size();j++){
+			if(_dueLevels[j]==level){
+				_levelTasks.push_back(j);
+			}
+		}
+		unsigned int nTasks=_levelTasks.size();
+		_levelErrors.assign(nTasks,std::exception_ptr());
+		#pragma omp parallel for num_threads(_nProposalThreads) schedule(dynamic,1) if(nTasks>1)
+		for(unsigned int t=0;t<nTasks;t++){
+			unsigned int j=_levelTasks[t];
+			mcmcProposal<modelParamType,optionType,propParamType,dataType>& proposal = _proposalVec[_dueProposals[j]];
+			baseGeneratorType proposalGenerator = _rndGenerator.substream(_dueSeeds[j]);
+			// An exception must not leave the parallel region, so it is
+			// thrown again once the level has finished
+			try{
+				std::chrono::steady_clock::time_point startTime;
+				if(_recordTimings){
+					startTime=std::chrono::steady_clock::now();
+				}
+				proposal.updateParameters(_chain,_model,proposalGenerator);
+				if(_recordTimings){
+					proposal.addTime(secondsSince(startTime));
+				}
+			}catch(...){
+				_levelErrors[t]=std::current_exception();
+			}
+		}
+		for(unsigned int t=0;t<nTasks;t++){
+			if(_levelErrors[t]){
+				std::rethrow_exception(_levelErrors[t]);
+			}
+		}
+	}
+
+}
+
+/// \brief Member function to finish the run of the sampler, writing the
+/// acceptance rates and timings to the log file and the final status
+template<class modelParamType,class optionType,class propParamType,class dataType>
+void mcmcSampler<modelParamType,optionType,propParamType,dataType>::finishRun(){
+
 	writeAcceptanceRates();
+	if(_recordTimings){
+		writeTimings();
+	}
+	if(_statusEvery>0){
+		writeStatus(_interrupted?"interrupted":"finished");
+	}
 
 }
 
@@ -116,6 +116,12 @@ template<class modelParamType> class mcmcState {
 			return *this;
 		}
 
+		/// \brief Member function to write or read the state in a checkpoint
+		template<class Archive>
+		void serialise(Archive& ar){
+			ar & _logPosterior & _logLikelihood & _logPrior;
+			_parameters.serialise(ar);
+		}
 
 	private:
 		/// \brief The underlying MCMC state
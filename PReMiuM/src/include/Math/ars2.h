@@ -46,7 +46,7 @@ expon_(const double *x, const double *emax)            /* exponential without un
 	intersection_(double *x1,  double *y1, double *yp1, double *x2,        double *y2,
 		double *yp2, double *z1, double *hz1, const double *eps, int *ifault)
 	{
-	static double dh, y12, y21;
+	static thread_local double dh, y12, y21;
 
 	/* first test for non-concavity */
 	y12 = *y1 + *yp1 * (*x2 - *x1);
@@ -128,10 +128,10 @@ expon_(const double *x, const double *emax)            /* exponential without un
 	double d__1, d__2;
 
 	/* Local variables */
-	static int i__, j;
-	static double u;
-	static bool horiz;
-	static double dh;
+	static thread_local int i__, j;
+	static thread_local double u;
+	static thread_local bool horiz;
+	static thread_local double dh;
 
 	/* Parameter adjustments */
 	--huz;
@@ -428,17 +428,17 @@ x[0]=0.00001;
 	bool test = false;
 
 	/* System generated locals */
-	static int i__1;
-	static double d__1, d__2;
+	static thread_local int i__1;
+	static thread_local double d__1, d__2;
 
 	/* Local variables */
-	static double alcu, hulb, huub;
-	static int iipt, ihpx, ilow, ihuz, i__, ihigh, iscum;
-	static bool horiz;
-	static double cu;
-	static int nn, ix, iz;
-	static double huzmax, eps;
-	static int ihx;
+	static thread_local double alcu, hulb, huub;
+	static thread_local int iipt, ihpx, ilow, ihuz, i__, ihigh, iscum;
+	static thread_local bool horiz;
+	static thread_local double cu;
+	static thread_local int nn, ix, iz;
+	static thread_local double huzmax, eps;
+	static thread_local int ihx;
 
 	/* Parameter adjustments */
 	--rwv;
@@ -593,9 +593,9 @@ x[0]=0.00001;
 	//    double log(doublereal);
 
 	/* Local variables */
-	static double sign, logdu, logtg;
-	static bool horiz;
-	static double eh;
+	static thread_local double sign, logdu, logtg;
+	static thread_local bool horiz;
+	static thread_local double eh;
 	//    extern doublereal expon_(doublereal *, doublereal *);
 
 
@@ -680,7 +680,7 @@ void spl1_(const int *ns, int *n,       int *ilow,      int *ihigh,      int *ip
            double *z__,   double *huz,  double *huzmax,
 	       const int *lb, double *xlb,  double *hulb,    const int *ub,  double *xub,  double *huub, double *beta,  int *ifault,  const double *emax,
            const  double *eps,  double *alcu,
-           pReMiuMParams params,
+           const pReMiuMParams& params,
            const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
            const unsigned int& iSub,
            void (*evalhxhprimax)(const pReMiuMParams&,const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>&, const unsigned int&, const double&, double*, double*),
@@ -690,11 +690,11 @@ void spl1_(const int *ns, int *n,       int *ilow,      int *ihigh,      int *ip
 						//  (usually (not necessarily) is something wrong if this number is reached)
 
 	/* Local variables */
-	static double alhl, alhu;
-	static int i__, j, n1;
-	static double u1, u2, fx;
-	static bool sampld;
-	static double alu1;
+	static thread_local double alhl, alhu;
+	static thread_local int i__, j, n1;
+	static thread_local double u1, u2, fx;
+	static thread_local bool sampld;
+	static thread_local double alu1;
 
         //Necesario para poder utilizar los generadores de numeros aleatorios del R
 	//GetRNGstate();
@@ -780,21 +780,21 @@ void spl1_(const int *ns, int *n,       int *ilow,      int *ihigh,      int *ip
 		attempts++;
 	}    /** end of while (! sampld) **/
         //Necesario al terminar de utilizar los generadores de numeros aleatorios del R
-	PutRNGstate();
+	//PutRNGstate();
 	if (attempts >= max_attempt) Rprintf("Trap in ARS: Maximum number of attempts reached by routine spl1_");
 	return;
 	} /* end of the routine spl1_ */
 
    void sample_(int *iwv, double *rwv, double *beta, int *ifault,
-             pReMiuMParams params,
+             const pReMiuMParams& params,
              const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
              const unsigned int& iSub,
              void (*evalhxhprimax)(const pReMiuMParams&,const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>&, const unsigned int&,const double&, double*, double*),
              baseGeneratorType& rndGenerator)
 {
-    static int iipt, ihpx, ihuz, iscum;
-	static int lb, ub;
-	static int nn, ns, ix, iz, ihx;
+    static thread_local int iipt, ihpx, ihuz, iscum;
+	static thread_local int lb, ub;
+	static thread_local int nn, ns, ix, iz, ihx;
 
 	/* Parameter adjustments */
 	--rwv;
@@ -158,6 +158,27 @@ double logPdfMultivarNormal(const unsigned int& sizeX, const VectorXd& x,const V
 	return -0.5*((double)sizeX*log(2*pi<double>())-logDetPrecMat+tmp);
 }
 
+// Log density of each column of X (one observation per column) for a
+// multivariate normal. The centred block is multiplied by the square root of
+// the precision as a single matrix product
+void logPdfMultivarNormalBlock(const MatrixXd& X,const VectorXd& meanVec,const MatrixXd& sqrtPrecMat,
+		const double& logDetPrecMat,VectorXd& logPdf){
+	// If S is the (upper triangular matrix) square root of the precision P, then S'S=P
+
+	MatrixXd work = sqrtPrecMat*(X.colwise()-meanVec);
+	double constTerm = (double)X.rows()*log(2*pi<double>())-logDetPrecMat;
+	logPdf = (-0.5*(constTerm+work.colwise().squaredNorm().transpose().array())).matrix();
+}
+
+// Log density of each column of X (one observation per column) for
+// independent normals with standard deviations sigma
+void logPdfIndepNormalBlock(const MatrixXd& X,const VectorXd& meanVec,const VectorXd& sigma,VectorXd& logPdf){
+
+	ArrayXXd standardised = (X.colwise()-meanVec).array().colwise()/sigma.array();
+	double constTerm = -0.5*(double)X.rows()*log(2*pi<double>())-sigma.array().log().sum();
+	logPdf = (constTerm-0.5*standardised.square().colwise().sum().transpose()).matrix();
+}
+
 //when separation strategy is used to sample sigma_c
 double logPdfMultivarNormalSS(const unsigned int& sizeX, const VectorXd& x, const VectorXd& meanVec, const MatrixXd& TauS, const double& logDetTauS, const MatrixXd& sqrtPrecMat, const double& logDetPrecMat) {
 	// If S is the (upper triangular matrix) square root of the precision P, then S'S=P
@@ -179,20 +200,23 @@ double logPdfInverseWishart(const unsigned int& dimA, const MatrixXd& inverseA,
 		- (0.5*kappa*(double)dimA*log(2.0) + logMultivarGammaFn(kappa / 2.0, dimA));
 }
 
-double logPdfIntrinsicCAR(const vector<double>& x, const vector<vector<unsigned int> >& Neighbours, const double& precision){
+// The neighbours are in compressed sparse row form: the (0 based) neighbours
+// of i are neighbourIndex[neighbourStart[i]] to neighbourIndex[neighbourStart[i+1]-1]
+double logPdfIntrinsicCAR(const vector<double>& x, const vector<unsigned int>& neighbourStart,
+		const vector<unsigned int>& neighbourIndex, const double& precision){
 	// compute xtPx with P the precision Matrix of the intrinsic CAR
 	double sumCAR1 = 0.0;
 	double sumCAR2 = 0.0;
 	int n=x.size();
+	const unsigned int* index = neighbourIndex.empty()?NULL:&neighbourIndex[0];
 	for (int i=0; i<n; i++){
 		double xi = x[i];
-		int nNeighi = (Neighbours[i]).size();
+		unsigned int kStart = neighbourStart[i], kEnd = neighbourStart[i+1];
+		int nNeighi = kEnd-kStart;
 		sumCAR1+= xi*xi*nNeighi;
-		for (int j = 0; j<nNeighi; j++){
-			unsigned int nj = Neighbours[i][j];
-			double xj = x[nj-1];
-			sumCAR2+=xi*xj;
-	        }
+		for (unsigned int k = kStart; k<kEnd; k++){
+			sumCAR2+=xi*x[index[k]];
+		}
 	}
 	double xtPx=sumCAR1-sumCAR2;
 
@@ -32,7 +32,11 @@
 
 #include<string>
 #include<iostream>
+#include<sstream>
 #include<limits>
+#include<vector>
+#include<cstdint>
+#include<random>
 
 #include<boost/random.hpp>
 #include<boost/math/distributions/normal.hpp>
@@ -46,9 +50,253 @@ using namespace Eigen;
 using std::vector;
 using std::string;
 
+/// \class xoshiro256pp random.h "Math/random.h"
+/// \brief The xoshiro256++ generator of Blackman and Vigna, which is much
+/// smaller and faster than the mersenne twister and can jump ahead 2^128 draws,
+/// so that independent substreams can be taken from one seed. Like mt19937 it
+/// returns 32 bit values (the upper half of each 64 bit output).
+class xoshiro256pp{
+
+	public:
+		typedef uint32_t result_type;
+
+		/// \brief Constructor, seeding the state through splitmix64
+		xoshiro256pp(const uint32_t& seedValue = 5489u){
+			seed(seedValue);
+		}
+
+		/// \brief Member function to seed the generator
+		void seed(const uint32_t& seedValue){
+			uint64_t x = seedValue;
+			for(unsigned int k=0;k<4;k++){
+				x += 0x9e3779b97f4a7c15ULL;
+				uint64_t z = x;
+				z = (z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+				z = (z^(z>>27))*0x94d049bb133111ebULL;
+				_s[k] = z^(z>>31);
+			}
+		}
+
+		/// \brief Member function to seed the whole state from a seed sequence
+		void seed(std::seed_seq& seedSeq){
+			uint32_t words[8];
+			seedSeq.generate(words,words+8);
+			for(unsigned int k=0;k<4;k++){
+				_s[k] = ((uint64_t)words[2*k]<<32)|words[2*k+1];
+			}
+			// The all zero state is the one state the generator can not leave
+			if((_s[0]|_s[1]|_s[2]|_s[3])==0){
+				_s[0]=1;
+			}
+		}
+
+		static result_type min BOOST_PREVENT_MACRO_SUBSTITUTION (){
+			return 0;
+		}
+
+		static result_type max BOOST_PREVENT_MACRO_SUBSTITUTION (){
+			return 0xFFFFFFFFu;
+		}
+
+		result_type operator()(){
+			return (result_type)(next()>>32);
+		}
+
+		/// \brief Member function to advance the generator by 2^128 draws
+		void jump(){
+			static const uint64_t jumpPoly[4] = {0x180ec6d33cfd0abaULL,0xd5a61266f0c9392cULL,
+				0xa9582618e03fc9aaULL,0x39abdc4529b1661cULL};
+			uint64_t s[4] = {0,0,0,0};
+			for(unsigned int k=0;k<4;k++){
+				for(unsigned int b=0;b<64;b++){
+					if(jumpPoly[k]&((uint64_t)1<<b)){
+						for(unsigned int m=0;m<4;m++){
+							s[m]^=_s[m];
+						}
+					}
+					next();
+				}
+			}
+			for(unsigned int m=0;m<4;m++){
+				_s[m]=s[m];
+			}
+		}
+
+		/// \brief Member function to write or read the state of the generator
+		/// in a checkpoint
+		template<class Archive>
+		void serialise(Archive& ar){
+			for(unsigned int k=0;k<4;k++){
+				ar & _s[k];
+			}
+		}
+
+	private:
+		uint64_t _s[4];
+
+		static uint64_t rotl(const uint64_t& x,int k){
+			return (x<<k)|(x>>(64-k));
+		}
+
+		uint64_t next(){
+			uint64_t result = rotl(_s[0]+_s[3],23)+_s[0];
+			uint64_t t = _s[1]<<17;
+			_s[2]^=_s[0];
+			_s[3]^=_s[1];
+			_s[1]^=_s[2];
+			_s[0]^=_s[3];
+			_s[2]^=t;
+			_s[3]=rotl(_s[3],45);
+			return result;
+		}
+
+};
+
+/// \class pReMiuMGenerator random.h "Math/random.h"
+/// \brief The underlying random number generator, which is either the mersenne
+/// twister mt19937 (the default, good for U(0,1) in up to 623 dimensions) or
+/// xoshiro256++. The engine is chosen at run time, when the member function
+/// drawing from it is selected, so a draw does not branch on the engine. The
+/// fill member function draws a whole array from the engine directly.
+class pReMiuMGenerator{
+
+	public:
+		typedef uint32_t result_type;
+
+		/// \brief Default constructor, using mt19937
+		pReMiuMGenerator(){
+			useXoshiro(false);
+		}
+
+		/// \brief Constructor, using mt19937 seeded with seedValue
+		explicit pReMiuMGenerator(const uint32_t& seedValue) : _mt(seedValue){
+			useXoshiro(false);
+		}
+
+		/// \brief Return the name of the engine
+		string engine() const{
+			return _useXoshiro?"xoshiro256++":"mt19937";
+		}
+
+		/// \brief Set the engine, "mt19937" or "xoshiro256++" (the generator
+		/// needs seeding afterwards)
+		void engine(const string& engineName){
+			useXoshiro(engineName.compare("xoshiro256++")==0);
+		}
+
+		/// \brief Return whether the engine can jump ahead
+		bool canJump() const{
+			return _useXoshiro;
+		}
+
+		/// \brief Member function to seed the generator
+		void seed(const uint32_t& seedValue){
+			if(_useXoshiro){
+				_xoshiro.seed(seedValue);
+			}else{
+				_mt.seed(seedValue);
+			}
+		}
+
+		static result_type min BOOST_PREVENT_MACRO_SUBSTITUTION (){
+			return 0;
+		}
+
+		static result_type max BOOST_PREVENT_MACRO_SUBSTITUTION (){
+			return 0xFFFFFFFFu;
+		}
+
+		result_type operator()(){
+			return (this->*_draw)();
+		}
+
+		/// \brief Member function to move xoshiro256++ on to its next
+		/// independent substream (2^128 draws ahead)
+		/// \note The mersenne twister has no cheap jump, and is left unchanged
+		void jump(){
+			if(_useXoshiro){
+				_xoshiro.jump();
+			}
+		}
+
+		/// \brief Return a generator with the same engine for a task run
+		/// alongside others, whose seedValue is drawn from this generator
+		/// \note Neither engine can jump to an arbitrary substream cheaply, so
+		/// the whole state of the new generator is filled from a seed
+		/// sequence of seedValue rather than from seedValue alone as seed
+		/// does. The substreams of different seeds are then unrelated, and
+		/// with the periods of both engines they do not overlap in practice.
+		pReMiuMGenerator substream(const uint32_t& seedValue) const{
+			pReMiuMGenerator out;
+			out.useXoshiro(_useXoshiro);
+			std::seed_seq seedSeq{seedValue};
+			if(_useXoshiro){
+				out._xoshiro.seed(seedSeq);
+			}else{
+				out._mt.seed(seedSeq);
+			}
+			return out;
+		}
+
+		/// \brief Member function to fill out[0..n-1] with draws from dist, which
+		/// gives the same values as n single draws
+		template<class distType>
+		void fill(distType& dist,double* out,const unsigned int& n){
+			if(_useXoshiro){
+				for(unsigned int i=0;i<n;i++){
+					out[i]=dist(_xoshiro);
+				}
+			}else{
+				for(unsigned int i=0;i<n;i++){
+					out[i]=dist(_mt);
+				}
+			}
+		}
+
+		/// \brief Member function to write or read the state of the generator
+		/// in a checkpoint, the mersenne twister state is kept in its text form
+		template<class Archive>
+		void serialise(Archive& ar){
+			ar & _useXoshiro;
+			useXoshiro(_useXoshiro);
+			string mtState;
+			if(!ar.loading()){
+				std::ostringstream mtStream;
+				mtStream << _mt;
+				mtState = mtStream.str();
+			}
+			ar & mtState;
+			if(ar.loading()){
+				std::istringstream mtStream(mtState);
+				mtStream >> _mt;
+			}
+			_xoshiro.serialise(ar);
+		}
+
+	private:
+		/// \brief Select the engine and the member function drawing from it
+		void useXoshiro(const bool& useXoshiro){
+			_useXoshiro=useXoshiro;
+			_draw=useXoshiro?&pReMiuMGenerator::drawXoshiro:&pReMiuMGenerator::drawMt;
+		}
+
+		result_type drawMt(){
+			return _mt();
+		}
+
+		result_type drawXoshiro(){
+			return _xoshiro();
+		}
+
+		boost::random::mt19937 _mt;
+		xoshiro256pp _xoshiro;
+		bool _useXoshiro;
+		result_type (pReMiuMGenerator::*_draw)();
+
+};
+
 // Define the underlying random number generator
-// mt19937 is the mersenne twister which is good for U(0,1) in up to 623 dimensions
-typedef boost::random::mt19937 baseGeneratorType;
+typedef pReMiuMGenerator baseGeneratorType;
 
 // Define the uniform random number generator
 typedef boost::random::uniform_real_distribution<> randomUniform;
@@ -61,6 +309,15 @@ typedef boost::random::student_t_distribution<> randomStudentsT;
 
 // Univariate distributions
 
+// Fill out with U(0,1) draws
+void fillUniformRand(baseGeneratorType& rndGenerator,vector<double>& out){
+	randomUniform unifRand(0,1);
+	if(!out.empty()){
+		rndGenerator.fill(unifRand,&(out[0]),out.size());
+	}
+}
+
+
 
 double betaRand(baseGeneratorType& rndGenerator,const double& a,const double& b){
 
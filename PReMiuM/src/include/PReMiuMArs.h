@@ -24,21 +24,50 @@
 //using namespace itpp;
 using namespace std;
 
+// Working storage for the adaptive rejection sampler. The sampler only reads
+// the parameters through a const reference, and the point and hull buffers are
+// kept here so that repeated calls (e.g. once per subject per sweep for uCAR)
+// do not reallocate them
+class arsWorkspace{
+	public:
+		arsWorkspace() : ns(0), m(0) {};
+
+		/// \brief Size the buffers for at most nsMax hull points and mStart
+		/// starting points
+		void resize(const int& nsMax,const int& mStart){
+			if(ns!=nsMax||m!=mStart){
+				ns=nsMax;
+				m=mStart;
+				iwv.resize(ns+7);
+				rwv.resize(6*(ns+1)+9);
+				x.resize(m);
+				hx.resize(m);
+				hpx.resize(m);
+			}
+		}
+
+		int ns,m;
+		vector<int> iwv;
+		vector<double> rwv;
+		vector<double> x,hx,hpx;
+};
+
 
 // Adaptive rejection sampler for spatial CAR model
-double ARSsampleCAR(pReMiuMParams params,
+double ARSsampleCAR(const pReMiuMParams& params,
                  const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
                  const unsigned int& iSub,
                  void (*evalhxhprimax)(const pReMiuMParams&,const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>&, const unsigned int&,const double&, double*, double*),
-                 baseGeneratorType& rndGenerator)
+                 baseGeneratorType& rndGenerator,
+                 arsWorkspace& workspace)
 {
 	//initialise sampler
 	const int ns=200; // ns=100 originally
-	vector<double> xTmp;
 	double ui=0, xlb, xub;
 	int lb, ub;
 	const int m = 5;
-	xTmp.resize(m);
+	workspace.resize(ns,m);
+	vector<double>& xTmp = workspace.x;
 	ui=params.uCAR(iSub);
 
 // Aurore initially had put
@@ -59,8 +88,8 @@ double ARSsampleCAR(pReMiuMParams params,
 	    lb=0; //false
 	    ub=0; //false
 	double* x = &xTmp[0];
-	double hx[m];
-	double hpx[m];
+	double* hx = &(workspace.hx[0]);
+	double* hpx = &(workspace.hpx[0]);
 	double y1=0;
 	double y2=0;
     for (int i=0; i<m; i++){
@@ -69,8 +98,8 @@ double ARSsampleCAR(pReMiuMParams params,
         hpx[i]=y2;
     }
     double emax=64;
-    int iwv[ns+7];
-    double rwv[6*(ns+1)+9];
+    int* iwv = &(workspace.iwv[0]);
+    double* rwv = &(workspace.rwv[0]);
     int ifault=0;
 
     initial_(&ns, &m, &emax, x, hx, hpx, &lb, &xlb, &ub, &xub, &ifault, iwv, rwv);
@@ -95,20 +124,21 @@ double ARSsampleCAR(pReMiuMParams params,
     }//end of no error u=in subroutine initial
 }
 
-double ARSsampleNu(pReMiuMParams params,
+double ARSsampleNu(const pReMiuMParams& params,
                  const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
                  const unsigned int& cluster,
                  void (*evalhxhprimax)(const pReMiuMParams&,const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>&, const unsigned int&,const double&, double*, double*),
-                 baseGeneratorType& rndGenerator)
+                 baseGeneratorType& rndGenerator,
+                 arsWorkspace& workspace)
 {
 	//initialise sampler
 	const int ns=30; // number of attempts (max_attempts = ns*3)
-	vector<double> xTmp;
 	//double ui=0;
 	double xlb, xub;
 	int lb, ub;
 	const int m = 7;
-	xTmp.resize(m);
+	workspace.resize(ns,m);
+	vector<double>& xTmp = workspace.x;
 	//ui=params.nu(cluster);	
 	xlb=0;
 	xub=0;
@@ -124,8 +154,8 @@ double ARSsampleNu(pReMiuMParams params,
 //std::cout<<xTmp[0]<<" "<<xTmp[1]<<" "<<xTmp[2]<<" "<<xTmp[3]<<" "<<xTmp[4]<<" "<<std::endl;
 // can try to remove some of these points on the x axis to improve efficiency
 	double* x = &xTmp[0];
-	double hx[m];
-	double hpx[m];
+	double* hx = &(workspace.hx[0]);
+	double* hpx = &(workspace.hpx[0]);
 	double y1=0;
 	double y2=0;
     for (int i=0; i<m; i++){
@@ -143,8 +173,8 @@ double ARSsampleNu(pReMiuMParams params,
 //std::cout<<"y "<<hx[0]<<" "<<hx[1]<<" "<<hx[2]<<" "<<hx[3]<<" "<<hx[4]<<" "<<std::endl;
 
     double emax=64;
-    int iwv[ns+7];
-    double rwv[6*(ns+1)+9];
+    int* iwv = &(workspace.iwv[0]);
+    double* rwv = &(workspace.rwv[0]);
     int ifault=0;
 
     initial_(&ns, &m, &emax, x, hx, hpx, &lb, &xlb, &ub, &xub, &ifault, iwv, rwv);
@@ -35,6 +35,9 @@
 #include<fstream>
 #include<string>
 #include<stdexcept>
+#include<limits>
+#include<algorithm>
+#include<cstdint>
 
 using std::vector;
 using std::ifstream;
@@ -46,7 +49,7 @@ class pReMiuMData{
 
 	public:
 		/// \brief Default constructor
-		pReMiuMData(): _nSubjects(0), _nCovariates(0), _nDiscreteCovs(0), _nContinuousCovs(0), _nFixedEffects(0), _nCategoriesY(0), _nPredictSubjects(0), _includeCAR(false), _includeuCARinit(false) {};
+		pReMiuMData(): _nSubjects(0), _nCovariates(0), _nDiscreteCovs(0), _nContinuousCovs(0), _nFixedEffects(0), _nCategoriesY(0), _nPredictSubjects(0), _includeCAR(false), _includeuCARinit(false), _useDataCache(false), _compactX(false), _singlePrecisionX(false), _nPackedDiscreteX(0), _nPackedContinuousX(0), _packedDiscreteXBytes(0) {};
 
 		/// \brief Default destructor
 		~pReMiuMData(){};
@@ -164,7 +167,7 @@ class pReMiuMData{
 
 
 		/// \brief Return the vector of the number of categories
-		vector<unsigned int> nCategories() const{
+		const vector<unsigned int>& nCategories() const{
 			return _nCategories;
 		}
 
@@ -306,6 +309,8 @@ class pReMiuMData{
 		}
 
 		/// \brief Return the covariate matrix
+		/// \note this is empty once the covariates have been packed (see
+		/// packCovariates)
 		const vector<vector<int> >& discreteX() const{
 			return _discreteX;
 		}
@@ -317,15 +322,37 @@ class pReMiuMData{
 
 		/// \brief Return the jth covariate for subject i
 		int discreteX(const unsigned int& i,const unsigned int& j) const{
+			if(_compactX){
+				size_t k=(size_t)i*_nPackedDiscreteX+j;
+				if(_packedDiscreteXBytes==1){
+					return _packedDiscreteX8[k];
+				}else if(_packedDiscreteXBytes==2){
+					return _packedDiscreteX16[k];
+				}
+				return _packedDiscreteX32[k];
+			}
 			return _discreteX[i][j];
 		}
 
 		/// \brief Set the jth covariate for subject i
 		void discreteX(const unsigned int& i,const unsigned int& j,const int& x){
+			if(_compactX){
+				size_t k=(size_t)i*_nPackedDiscreteX+j;
+				if(_packedDiscreteXBytes==1){
+					_packedDiscreteX8[k]=(uint8_t)x;
+				}else if(_packedDiscreteXBytes==2){
+					_packedDiscreteX16[k]=(uint16_t)x;
+				}else{
+					_packedDiscreteX32[k]=x;
+				}
+				return;
+			}
 			_discreteX[i][j]=x;
 		}
 
 		/// \brief Return the covariate matrix
+		/// \note this is empty once the covariates have been packed (see
+		/// packCovariates)
 		const vector<vector<double> >& continuousX() const{
 			return _continuousX;
 		}
@@ -337,15 +364,33 @@ class pReMiuMData{
 
 		/// \brief Return the jth covariate for subject i
 		double continuousX(const unsigned int& i,const unsigned int& j) const{
+			if(_compactX){
+				size_t k=(size_t)i*_nPackedContinuousX+j;
+				if(_singlePrecisionX){
+					return (double)_packedContinuousXFloat[k];
+				}
+				return _packedContinuousX[k];
+			}
 			return _continuousX[i][j];
 		}
 
 		/// \brief Set the jth covariate for subject i
 		void continuousX(const unsigned int& i,const unsigned int& j,const double& x){
+			if(_compactX){
+				size_t k=(size_t)i*_nPackedContinuousX+j;
+				if(_singlePrecisionX){
+					_packedContinuousXFloat[k]=(float)x;
+				}else{
+					_packedContinuousX[k]=x;
+				}
+				return;
+			}
 			_continuousX[i][j]=x;
 		}
 
 		/// \brief Return the missing covariate matrix
+		/// \note this is empty once the covariates have been packed (see
+		/// packCovariates)
 		const vector<vector<bool> >& missingX() const{
 			return _missingX;
 		}
@@ -357,6 +402,10 @@ class pReMiuMData{
 
 		/// \brief Return the jth covariate for subject i
 		bool missingX(const unsigned int& i,const unsigned int& j) const{
+			if(_compactX){
+				size_t k=(size_t)i*_nCovariates+j;
+				return (_missingXBits[k>>6]>>(k&63))&1;
+			}
 			return _missingX[i][j];
 		}
 
@@ -370,6 +419,33 @@ class pReMiuMData{
 			return _nContinuousCovariatesNotMissing;
 		}
 
+		/// \brief Return the number of distinct patterns of missing continuous
+		/// covariates
+		unsigned int nMissingPatterns() const{
+			return _missingPatternObserved.size();
+		}
+
+		/// \brief Return the missing pattern id of subject i
+		unsigned int missingPattern(const unsigned int& i) const{
+			return _missingPattern[i];
+		}
+
+		/// \brief Return the missing pattern id of each subject
+		vector<unsigned int>& missingPattern(){
+			return _missingPattern;
+		}
+
+		/// \brief Return the (continuous) indices of the covariates observed in
+		/// missing pattern p
+		const vector<unsigned int>& missingPatternObserved(const unsigned int& p) const{
+			return _missingPatternObserved[p];
+		}
+
+		/// \brief Return the observed covariate indices of each missing pattern
+		vector<vector<unsigned int> >& missingPatternObserved(){
+			return _missingPatternObserved;
+		}
+
 		/// \brief Return the fixed effects matrix
 		const vector<vector<double> >& W() const{
 			return _W;
@@ -430,59 +506,54 @@ class pReMiuMData{
 		unsigned int censoring(const unsigned int& i) const{
 			return _censoring[i];
 		}
-		/// \brief Return the vector of lists of neighbours
-		const vector<vector<unsigned int> >& neighbours() const{
-			return _neighbours;
-		}
-
-		/// \brief Return the vector of lists of neighbours
-		vector<vector<unsigned int> >& neighbours() {
-			return _neighbours;
+		/// \brief Return the offsets of the neighbours of each subject in
+		/// neighbourIndex(), the neighbours of subject i are at positions
+		/// neighbourStart()[i] to neighbourStart()[i+1]-1
+		const vector<unsigned int>& neighbourStart() const{
+			return _neighbourStart;
 		}
 
-		/// \brief Return the list of neighbours for subject i
-		vector<unsigned int> neighbours(const unsigned int& i) const{
-			return _neighbours[i];
+		/// \brief Return the (0 based) neighbours of all subjects, concatenated
+		const vector<unsigned int>& neighbourIndex() const{
+			return _neighbourIndex;
 		}
 
-		/// \brief Return the j-th neighbour for subject i
-		unsigned int neighbours(const unsigned int& i, const unsigned& j) const{
-			return _neighbours[i][j];
+		/// \brief Return the (0 based) j-th neighbour for subject i
+		unsigned int neighbour(const unsigned int& i, const unsigned& j) const{
+			return _neighbourIndex[_neighbourStart[i]+j];
 		}
 
-		/// \brief Set the vector of lists of neighbours
+		/// \brief Set the neighbours from the lists of (1 based, as in the
+		/// neighbourhood file) neighbours of each subject
 		void neighbours(const vector<vector<unsigned int> >&  neighvec){
-			_neighbours = neighvec;
-		}
-
-		/// \brief Set the list of neighbours for subject i
-		void neighbours(const vector<unsigned int>&  neighvec, const unsigned int& i){
-			_neighbours[i] = neighvec;
-		}
-
-		/// \brief Return the number of neighbours for all subjects
-		const vector<unsigned int>& nNeighbours() const{
-			return _nNeighbours;
-		}
-
-		/// \brief Return the number of neighbours for all subjects
-		vector<unsigned int>& nNeighbours(){
-			return _nNeighbours;
+			unsigned int nSbj = neighvec.size();
+			_neighbourStart.assign(nSbj+1,0);
+			for(unsigned int i=0;i<nSbj;i++){
+				_neighbourStart[i+1]=_neighbourStart[i]+neighvec[i].size();
+			}
+			_neighbourIndex.resize(_neighbourStart[nSbj]);
+			for(unsigned int i=0;i<nSbj;i++){
+				for(unsigned int j=0;j<neighvec[i].size();j++){
+					_neighbourIndex[_neighbourStart[i]+j]=neighvec[i][j]-1;
+				}
+			}
 		}
 
 		/// \brief Return the number of neighbours for subject i
 		unsigned int nNeighbours(const unsigned int& i) const{
-			return _nNeighbours[i];
+			return _neighbourStart[i+1]-_neighbourStart[i];
 		}
 
-		/// \brief Set the number of neighbours for all subjects
-		void nNeighbours(const vector<unsigned int>& nNeigh){
-			_nNeighbours=nNeigh;
+		/// \brief Return the subjects (0 based) of each colour of the neighbourhood
+		/// graph, no two neighbours share a colour
+		const vector<vector<unsigned int> >& neighbourColours() const{
+			return _neighbourColours;
 		}
 
-		/// \brief Set the number of neighbours for subject i
-		void nNeighbours(const unsigned int& nNeigh, const unsigned int& i ){
-			_nNeighbours[i]=nNeigh;
+		/// \brief Return the subjects (0 based) of each colour of the neighbourhood
+		/// graph
+		vector<vector<unsigned int> >& neighbourColours(){
+			return _neighbourColours;
 		}
 
 		/// \brief Set includeCAR
@@ -500,6 +571,134 @@ class pReMiuMData{
 			return _includeCAR;
 		}
 
+		/// \brief Set whether the input files are read through a binary cache
+		void useDataCache(const bool& useCache){
+			_useDataCache=useCache;
+		}
+
+		/// \brief Return whether the input files are read through a binary cache
+		bool useDataCache() const{
+			return _useDataCache;
+		}
+
+		/// \brief Set whether the covariates are packed once they have been
+		/// read, and whether the continuous covariates are then held in
+		/// single precision
+		void useCompactX(const bool& compact,const bool& singlePrecision){
+			_compactX=compact||singlePrecision;
+			_singlePrecisionX=singlePrecision;
+		}
+
+		/// \brief Return whether the covariates are packed
+		bool useCompactX() const{
+			return _compactX;
+		}
+
+		/// \brief Return whether the packed continuous covariates are held in
+		/// single precision
+		bool singlePrecisionX() const{
+			return _singlePrecisionX;
+		}
+
+		/// \brief Return the number of bytes each packed discrete covariate
+		/// takes (0 if they are not packed)
+		unsigned int packedDiscreteXBytes() const{
+			return _packedDiscreteXBytes;
+		}
+
+		/// \brief Pack the covariates of a complete data set (the missing values
+		/// replaced) into contiguous subject major arrays, and free the matrices
+		/// they were read into. The missing indicators become a bitset, the
+		/// discrete covariates take the narrowest of 8, 16 or 32 bits that holds
+		/// all the categories, and the continuous covariates are held in single
+		/// precision if asked for. The working copies of the parameters then
+		/// share these arrays rather than copy them (see pReMiuMParams::workCovariates).
+		void packCovariates(){
+			if(!_compactX){
+				return;
+			}
+			unsigned int nRows=_nSubjects+_nPredictSubjects;
+			_nPackedDiscreteX=0;
+			_nPackedContinuousX=0;
+			if(_covariateType.compare("Discrete")==0){
+				_nPackedDiscreteX=_nCovariates;
+			}else if(_covariateType.compare("Normal")==0){
+				_nPackedContinuousX=_nCovariates;
+			}else if(_covariateType.compare("Mixed")==0){
+				_nPackedDiscreteX=_nDiscreteCovs;
+				_nPackedContinuousX=_nContinuousCovs;
+			}
+
+			size_t nCells=(size_t)nRows*_nCovariates;
+			_missingXBits.assign((nCells+63)/64,0);
+			for(unsigned int i=0;i<nRows;i++){
+				for(unsigned int j=0;j<_nCovariates;j++){
+					if(_missingX[i][j]){
+						size_t k=(size_t)i*_nCovariates+j;
+						_missingXBits[k>>6]|=(uint64_t)1<<(k&63);
+					}
+				}
+			}
+
+			// The width is chosen from the number of categories, and widened
+			// if a value read does not fit in it
+			long long int minX=0,maxX=0;
+			for(unsigned int j=0;j<_nPackedDiscreteX;j++){
+				if((long long int)_nCategories[j]-1>maxX){
+					maxX=(long long int)_nCategories[j]-1;
+				}
+			}
+			for(unsigned int i=0;i<nRows;i++){
+				for(unsigned int j=0;j<_nPackedDiscreteX;j++){
+					minX=std::min(minX,(long long int)_discreteX[i][j]);
+					maxX=std::max(maxX,(long long int)_discreteX[i][j]);
+				}
+			}
+			if(minX>=0&&maxX<=std::numeric_limits<uint8_t>::max()){
+				_packedDiscreteXBytes=1;
+			}else if(minX>=0&&maxX<=std::numeric_limits<uint16_t>::max()){
+				_packedDiscreteXBytes=2;
+			}else{
+				_packedDiscreteXBytes=4;
+			}
+			size_t nDiscreteCells=(size_t)nRows*_nPackedDiscreteX;
+			_packedDiscreteX8.assign(_packedDiscreteXBytes==1?nDiscreteCells:0,0);
+			_packedDiscreteX16.assign(_packedDiscreteXBytes==2?nDiscreteCells:0,0);
+			_packedDiscreteX32.assign(_packedDiscreteXBytes==4?nDiscreteCells:0,0);
+			size_t nContinuousCells=(size_t)nRows*_nPackedContinuousX;
+			_packedContinuousXFloat.assign(_singlePrecisionX?nContinuousCells:0,0);
+			_packedContinuousX.assign(_singlePrecisionX?0:nContinuousCells,0);
+
+			// The rows are freed as they are packed
+			for(unsigned int i=0;i<nRows;i++){
+				for(unsigned int j=0;j<_nPackedDiscreteX;j++){
+					discreteX(i,j,_discreteX[i][j]);
+				}
+				for(unsigned int j=0;j<_nPackedContinuousX;j++){
+					continuousX(i,j,_continuousX[i][j]);
+				}
+				vector<int>().swap(_discreteX[i]);
+				vector<double>().swap(_continuousX[i]);
+				vector<bool>().swap(_missingX[i]);
+			}
+			vector<vector<int> >().swap(_discreteX);
+			vector<vector<double> >().swap(_continuousX);
+			vector<vector<bool> >().swap(_missingX);
+		}
+
+		/// \brief Member function to write or read the covariates in a
+		/// checkpoint, only these change during the run (the missing values
+		/// are imputed at each sweep)
+		template<class Archive>
+		void serialise(Archive& ar){
+			if(_compactX){
+				ar & _packedDiscreteX8 & _packedDiscreteX16 & _packedDiscreteX32;
+				ar & _packedContinuousX & _packedContinuousXFloat;
+			}else{
+				ar & _discreteX & _continuousX;
+			}
+		}
+
 	private:
 		/// \brief The number of subjects
 		unsigned int _nSubjects;
@@ -559,6 +758,11 @@ class pReMiuMData{
 		/// \brief A matrix of the number of non missing covariates for each subject
 		vector<unsigned int> _nContinuousCovariatesNotMissing;
 
+		/// \brief The pattern of missing continuous covariates of each subject,
+		/// identified by the continuous covariates observed in that pattern
+		vector<unsigned int> _missingPattern;
+		vector<vector<unsigned int> > _missingPatternObserved;
+
 		/// \brief A matrix of the fixed effects covariates
 		/// \note This may need to changed to be signed or double
 		vector<vector<double> > _W;
@@ -575,17 +779,44 @@ class pReMiuMData{
 		/// \brief A vector of n for each individual (only used in the survival model)
 		vector<unsigned int> _censoring;
 
-		/// \brief A vector of vector of neighbours for each subject
-		vector<vector<unsigned int> > _neighbours;
+		/// \brief The neighbours in compressed sparse row form: the (0 based)
+		/// neighbours of subject i are _neighbourIndex[_neighbourStart[i]] to
+		/// _neighbourIndex[_neighbourStart[i+1]-1]
+		vector<unsigned int> _neighbourStart;
+		vector<unsigned int> _neighbourIndex;
 
-		/// \brief A containing the number of neighbours for each subject
-		vector<unsigned int> _nNeighbours;
+		/// \brief The subjects of each colour of a colouring of the neighbourhood graph
+		vector<vector<unsigned int> > _neighbourColours;
 
 		/// \brief Is the CAR term is included
 		bool _includeCAR;
 
 		/// \brief Is the CAR term is included
 		bool _includeuCARinit;
+
+		/// \brief Are the input files read through a binary cache
+		bool _useDataCache;
+
+		/// \brief Are the covariates packed, and are the packed continuous
+		/// covariates in single precision (see packCovariates)
+		bool _compactX;
+		bool _singlePrecisionX;
+
+		/// \brief The packed covariates, subject major with _nPackedDiscreteX
+		/// and _nPackedContinuousX entries for each subject. Only the array of
+		/// the width used is allocated.
+		unsigned int _nPackedDiscreteX;
+		unsigned int _nPackedContinuousX;
+		unsigned int _packedDiscreteXBytes;
+		vector<uint8_t> _packedDiscreteX8;
+		vector<uint16_t> _packedDiscreteX16;
+		vector<int> _packedDiscreteX32;
+		vector<double> _packedContinuousX;
+		vector<float> _packedContinuousXFloat;
+
+		/// \brief The packed missing indicators, bit i*_nCovariates+j is set if
+		/// the jth covariate of subject i is missing
+		vector<uint64_t> _missingXBits;
 };
 
 
@@ -42,6 +42,12 @@
 #include<algorithm>
 #include<iterator>
 #include<cstdint>
+#include<cstdio>
+#include<map>
+#include<random>
+#include<chrono>
+
+#include<sys/stat.h>
 
 #include<Eigen/Core>
 #include<Eigen/Cholesky>
@@ -65,6 +71,7 @@ using std::istringstream;
 using std::string;
 using std::endl;
 using std::stringstream;
+using std::map;
 
 // Process the command line run time options
 pReMiuMOptions processCommandLine(string inputStr){
@@ -100,6 +107,15 @@ pReMiuMOptions processCommandLine(string inputStr){
 			Rprintf("--nFilter=<unsigned int>\n\tThe frequency (in sweeps) with which to write\n\tthe output to file (1)\n");
 			Rprintf("--nClusInit=<unsigned int>\n\tThe number of clusters individuals should be\n\tinitially randomly assigned to (Unif[50,60])\n");
 			Rprintf("--seed=<unsigned int>\n\tThe value for the seed for the random number\n\tgenerator (current time)\n");
+			Rprintf("--nThreads=<unsigned int>\n\tThe number of threads used for the allocation\n\tupdate. Ignored if not compiled with OpenMP (1)\n");
+			Rprintf("--nChains=<unsigned int>\n\tThe number of independent chains, run in parallel\n\tif compiled with OpenMP. With mt19937 chain k is seeded\n\twith seed+k-1, with xoshiro256++ all chains use seed and chain k\n\tjumps 2^128(k-1) draws ahead. Chain k is written to the\n\toutput stem followed by _chain<k> (1)\n");
+			Rprintf("--rng=<string>\n\tThe random number generator 'mt19937' or 'xoshiro256++'. With\n\txoshiro256++ chain k uses the substream 2^128(k-1) draws after seed (mt19937)\n");
+			Rprintf("--checkpointEvery=<unsigned int>\n\tThe frequency (in sweeps) with which the state of the\n\tsampler is written to <output>_checkpoint.bin, 0 for never.\n\tIgnored with outputFormat 'memory' (0)\n");
+			Rprintf("--resume=<string>\n\tThe checkpoint file the run is resumed from, appending to the\n\toutput files. With nChains>1 this is the checkpoint of the first\n\tchain, <output>_chain1_checkpoint.bin (Run not resumed)\n");
+			Rprintf("--monitorEvery=<unsigned int>\n\tThe frequency (in sweeps) with which the convergence of the\n\tlog posterior, number of clusters and alpha is checked,\n\tif targetESS or targetRhat is set (100)\n");
+			Rprintf("--targetESS=<double>\n\tSampling ends once the effective sample size of the monitored\n\tstatistics, pooled over the chains, reaches this value, 0 for never (0)\n");
+			Rprintf("--targetRhat=<double>\n\tBurn in ends once the split R-hat of the monitored statistics,\n\tover the last half of the burn in, is below this value. Sampling\n\tonly ends early once it is below this value too, 0 for never (0)\n");
+			Rprintf("--outputFormat=<string>\n\tThe format of the output trace files 'text', 'binary' or 'memory'.\n\tBinary files have extension .bin, with 'memory' the traces are\n\treturned to R instead of written (text)\n");
 			Rprintf("--yModel=<string>\n\tThe model type for the outcome variable. Options are\n\tcurrently 'Bernoulli','Poisson','Binomial', 'Categorical', 'Survival', 'Normal' and 'Quantile' (Bernoulli)\n");
 			Rprintf("--xModel=<string>\n\tThe model type for the covariates. Options are\n\tcurrently 'Discrete', 'Normal' and 'Mixed' (Discrete)\n");
 			Rprintf("--sampler=<string>\n\tThe sampler type to be used. Options are\n\tcurrently 'SliceDependent', 'SliceIndependent' and 'Truncated' (SliceDependent)\n");
@@ -110,9 +126,21 @@ pReMiuMOptions processCommandLine(string inputStr){
 			Rprintf("--extraYVar\n\tIf included extra Gaussian variance is included in the\n\tresponse model (not included).\n");
 			Rprintf("--varSelect=<string>\n\tThe type of variable selection to be used 'None',\n\t'BinaryCluster' or 'Continuous' (None)\n");
 			Rprintf("--entropy\n\tIf included then we compute allocation entropy (not included)\n");
+			Rprintf("--predictSummary\n\tIf included the posterior mean and variance of the predicted response\n\tof each prediction subject are written to the _predictSummary file\n\t(not included)\n");
+			Rprintf("--timings\n\tIf included then the wall time of each proposal is recorded\n\tand written to the _timings.txt file and the log (not included)\n");
+			Rprintf("--dataCache\n\tIf included the parsed input files are kept in a binary .cache file next\n\tto them, which is read instead while their contents are unchanged (not included)\n");
+			Rprintf("--compressOutput\n\tIf included the output files are gzip compressed, with .gz appended to\n\ttheir names (not included)\n");
+			Rprintf("--deltaZ\n\tIf included the allocations are written to the _zDelta file, where each\n\tsweep only lists the subjects whose allocation changed (not included)\n");
+			Rprintf("--asyncOutput\n\tIf included the output files are written by a background thread,\n\tso the sampler does not wait for the disk (not included)\n");
 			Rprintf("--predictType=<string>\n\tThe type of predictions to be used 'RaoBlackwell' or 'random' (RaoBlackwell)\n");
 			Rprintf("--weibullFixedShape=<bool>\n\tWhether the shape parameter of the Weibull distribution is fixed.\n");
 			Rprintf("--PoissonCARadaptive=<bool>\n\tWhether the adaptive rejection sampler or the random walk Metropolis are used for the Poisson outcome with spatial random effects.\n");
+			Rprintf("--chromaticCAR\n\tIf included the spatial random effects of non neighbouring subjects are updated\n\ttogether, colour by colour of the neighbourhood graph (not included)\n");
+			Rprintf("--parallelClusters\n\tIf included the updates of phi, mu, Tau, theta and nu are run for the clusters in\n\tparallel over nThreads, each cluster with its own random numbers (not included)\n");
+			Rprintf("--parallelProposals\n\tIf included the updates of a sweep that do not use the parameters changed\n\tby each other are run concurrently over nThreads, each with its own\n\trandom numbers (not included)\n");
+			Rprintf("--compactCovariates\n\tIf included the covariates are held in compact storage: the missing indicators\n\tas bits, the discrete covariates in 8 or 16 bits and a single copy shared by the\n\tdata and the sampler (not included)\n");
+			Rprintf("--singlePrecisionCovariates\n\tIf included the continuous covariates are held in compact storage in single\n\tprecision (not included)\n");
+			Rprintf("--status\n\tIf included the progress of the run (sweeps per second, number of clusters,\n\tlog posterior and acceptance rates) is written every nProgress sweeps\n\tto the _status.txt file, which is replaced atomically (not included)\n");
 		}else{
 			while(currArg < argc){
 				inString.assign(inputStrings[currArg]);
@@ -120,6 +148,15 @@ pReMiuMOptions processCommandLine(string inputStr){
 					size_t pos = inString.find("=")+1;
 					string inFileName = inString.substr(pos,inString.size()-pos);
 					options.inFileName(inFileName);
+				}else if(inString.find("--outputFormat")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string outputFormat = inString.substr(pos,inString.size()-pos);
+					if(outputFormat.compare("text")!=0&&outputFormat.compare("binary")!=0&&outputFormat.compare("memory")!=0){
+						// Illegal output format entered
+						wasError=true;
+						break;
+					}
+					options.outputFormat(outputFormat);
 				}else if(inString.find("--output")!=string::npos){
 					size_t pos = inString.find("=")+1;
 					string outFileStem = inString.substr(pos,inString.size()-pos);
@@ -128,6 +165,8 @@ pReMiuMOptions processCommandLine(string inputStr){
 					size_t pos = inString.find("=")+1;
 					string hyperParamFileName = inString.substr(pos,inString.size()-pos);
 					options.hyperParamFileName(hyperParamFileName);
+				}else if(inString.find("--predictSummary")!=string::npos){
+					options.predictSummary(true);
 				}else if(inString.find("--predict")!=string::npos){
 					size_t pos = inString.find("=")+1;
 					string predictFileName = inString.substr(pos,inString.size()-pos);
@@ -164,6 +203,26 @@ pReMiuMOptions processCommandLine(string inputStr){
 					string tmpStr = inString.substr(pos,inString.size()-pos);
 					uint_fast32_t rndSeed=(uint_fast32_t)atoi(tmpStr.c_str());
 					options.seed(rndSeed);
+				}else if(inString.find("--nThreads")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string tmpStr = inString.substr(pos,inString.size()-pos);
+					int nThreads = atoi(tmpStr.c_str());
+					if(nThreads<1){
+						// Illegal number of threads entered
+						wasError=true;
+						break;
+					}
+					options.nThreads((unsigned int)nThreads);
+				}else if(inString.find("--nChains")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string tmpStr = inString.substr(pos,inString.size()-pos);
+					int nChains = atoi(tmpStr.c_str());
+					if(nChains<1){
+						// Illegal number of chains entered
+						wasError=true;
+						break;
+					}
+					options.nChains((unsigned int)nChains);
 				}else if(inString.find("--yModel")!=string::npos){
 					size_t pos = inString.find("=")+1;
 					string outcomeType = inString.substr(pos,inString.size()-pos);
@@ -260,6 +319,69 @@ pReMiuMOptions processCommandLine(string inputStr){
 					options.varSelectType(varSelectType);
 				}else if(inString.find("--entropy")!=string::npos){
 					options.computeEntropy(true);
+				}else if(inString.find("--timings")!=string::npos){
+					options.recordTimings(true);
+				}else if(inString.find("--dataCache")!=string::npos){
+					options.dataCache(true);
+				}else if(inString.find("--compressOutput")!=string::npos){
+					options.compressOutput(true);
+				}else if(inString.find("--deltaZ")!=string::npos){
+					options.deltaZ(true);
+				}else if(inString.find("--asyncOutput")!=string::npos){
+					options.asyncOutput(true);
+				}else if(inString.find("--rng")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string rngType = inString.substr(pos,inString.size()-pos);
+					if(rngType.compare("mt19937")!=0&&rngType.compare("xoshiro256++")!=0){
+						// Illegal random number generator entered
+						wasError=true;
+						break;
+					}
+					options.rngType(rngType);
+				}else if(inString.find("--checkpointEvery")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string tmpStr = inString.substr(pos,inString.size()-pos);
+					int checkpointEvery = atoi(tmpStr.c_str());
+					if(checkpointEvery<0){
+						// Illegal checkpoint frequency entered
+						wasError=true;
+						break;
+					}
+					options.checkpointEvery((unsigned int)checkpointEvery);
+				}else if(inString.find("--resume")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string resumeFileName = inString.substr(pos,inString.size()-pos);
+					options.resumeFileName(resumeFileName);
+				}else if(inString.find("--monitorEvery")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string tmpStr = inString.substr(pos,inString.size()-pos);
+					int monitorEvery = atoi(tmpStr.c_str());
+					if(monitorEvery<1){
+						// Illegal monitoring frequency entered
+						wasError=true;
+						break;
+					}
+					options.monitorEvery((unsigned int)monitorEvery);
+				}else if(inString.find("--targetESS")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string tmpStr = inString.substr(pos,inString.size()-pos);
+					double targetESS=(double)atof(tmpStr.c_str());
+					if(targetESS<0){
+						// Illegal effective sample size entered
+						wasError=true;
+						break;
+					}
+					options.targetESS(targetESS);
+				}else if(inString.find("--targetRhat")!=string::npos){
+					size_t pos = inString.find("=")+1;
+					string tmpStr = inString.substr(pos,inString.size()-pos);
+					double targetRhat=(double)atof(tmpStr.c_str());
+					if(targetRhat!=0&&targetRhat<=1){
+						// Illegal R-hat entered
+						wasError=true;
+						break;
+					}
+					options.targetRhat(targetRhat);
 				}else if(inString.find("--predType")!=string::npos){
 					size_t pos = inString.find("=")+1;
 					string predictType = inString.substr(pos,inString.size()-pos);
@@ -271,6 +393,18 @@ pReMiuMOptions processCommandLine(string inputStr){
 					options.predictType(predictType);
 				}else if(inString.find("--PoissonCARadaptive")!=string::npos){
 					options.PoissonCARadaptive(true);
+				}else if(inString.find("--chromaticCAR")!=string::npos){
+					options.chromaticCAR(true);
+				}else if(inString.find("--parallelClusters")!=string::npos){
+					options.parallelClusters(true);
+				}else if(inString.find("--parallelProposals")!=string::npos){
+					options.parallelProposals(true);
+				}else if(inString.find("--compactCovariates")!=string::npos){
+					options.compactCovariates(true);
+				}else if(inString.find("--singlePrecisionCovariates")!=string::npos){
+					options.singlePrecisionCovariates(true);
+				}else if(inString.find("--status")!=string::npos){
+					options.writeStatus(true);
 				}else if(inString.find("--weibullFixedShape")!=string::npos){
 					options.weibullFixedShape(true);
 		                }else if(inString.find("--useNormInvWishPrior")!=string::npos){
@@ -305,17 +439,574 @@ pReMiuMOptions processCommandLine(string inputStr){
 
 }
 
+// Reads the white space separated tokens of the PReMiuM input files. The
+// file is read in large blocks and the numbers are parsed in place with
+// strtod, which is much faster than formatted extraction from an ifstream.
+// If the cache is used the tokens are also written, as they are read, to a
+// binary file with ".cache" appended to the file name. Consecutive numbers
+// are stored as arrays of doubles, other tokens keep their text. The cache
+// header holds the size, modification time and contents hash of the file,
+// and a checksum of the cache follows the tokens. A later run reads the
+// tokens back from the cache if the file has the same size and modification
+// time, the contents are only hashed again when the modification time has
+// changed.
+class pReMiuMTokenReader{
+
+	public:
+		pReMiuMTokenReader() : _fromCache(false), _toCache(false), _pos(0), _end(0),
+			_type(textToken), _value(0.0), _runLeft(0), _textSize(0), _textHash(0),
+			_bodyHash(0), _fileMTime(0) {};
+
+		~pReMiuMTokenReader(){
+			close();
+		};
+
+		/// \brief Open the file, and its cache if useCache is true
+		void open(const string& filename,const bool& useCache){
+			_buffer.resize((1<<20)+1);
+			_pos=0;
+			_end=0;
+			_fromCache=false;
+			_toCache=false;
+			_runLeft=0;
+			_run.clear();
+			_in.open(filename.c_str(),std::ios::in|std::ios::binary);
+			if(!_in.is_open()||!useCache){
+				return;
+			}
+
+			uint64_t fileSize=0;
+			int64_t fileMTime=0;
+			fileStatus(filename,fileSize,fileMTime);
+			_cacheName=filename+".cache";
+			if(readCache(fileSize,fileMTime)){
+				_in.close();
+				_fromCache=true;
+				return;
+			}
+
+			// Write a new cache alongside, it is only put in place once all of
+			// the tokens have been written. The name of the file being written
+			// is unique, so that runs started together on the same input do
+			// not write to the same file.
+			_tmpName=tmpCacheName();
+			_cacheOut.open(_tmpName.c_str(),std::ios::out|std::ios::binary|std::ios::trunc);
+			if(_cacheOut.is_open()){
+				_toCache=true;
+				_outBuffer.clear();
+				_textSize=0;
+				_textHash=fnvBasis;
+				_bodyHash=fnvBasis;
+				_fileMTime=fileMTime;
+				// The header is written once the contents hash is known
+				string header(cacheHeaderSize,'\0');
+				_cacheOut.write(header.data(),cacheHeaderSize);
+			}
+		}
+
+		/// \brief Whether the file was opened
+		bool is_open() const{
+			return _in.is_open()||_fromCache;
+		}
+
+		/// \brief Close the file, completing the cache if one is being written
+		void close(){
+			if(_toCache){
+				// Any tokens that were not read still go in the cache
+				while(next()){
+					cacheToken(_type);
+				}
+				flushRun();
+				flushCache();
+				_cacheOut.write((const char*)&_bodyHash,sizeof(uint64_t));
+				_cacheOut.seekp(0);
+				_cacheOut.write(cacheMagic(),cacheMagicSize);
+				_cacheOut.write((const char*)&_textSize,sizeof(uint64_t));
+				_cacheOut.write((const char*)&_fileMTime,sizeof(int64_t));
+				_cacheOut.write((const char*)&_textHash,sizeof(uint64_t));
+				bool ok=_cacheOut.good();
+				_cacheOut.close();
+				if(ok){
+					std::remove(_cacheName.c_str());
+					ok=(std::rename(_tmpName.c_str(),_cacheName.c_str())==0);
+				}
+				if(!ok){
+					std::remove(_tmpName.c_str());
+				}
+				_toCache=false;
+			}
+			if(_in.is_open()){
+				_in.close();
+			}
+			_fromCache=false;
+		}
+
+		pReMiuMTokenReader& operator>>(double& x){
+			if(next()){
+				x=_value;
+				cacheToken(numberToken);
+			}
+			return *this;
+		}
+
+		pReMiuMTokenReader& operator>>(int& x){
+			if(next()){
+				x=(int)_value;
+				cacheToken(numberToken);
+			}
+			return *this;
+		}
+
+		pReMiuMTokenReader& operator>>(unsigned int& x){
+			if(next()){
+				x=(unsigned int)_value;
+				cacheToken(numberToken);
+			}
+			return *this;
+		}
+
+		pReMiuMTokenReader& operator>>(string& x){
+			if(next()){
+				if(_type==numberToken&&_fromCache){
+					ostringstream tmpStr;
+					tmpStr.precision(17);
+					tmpStr << _value;
+					_text=tmpStr.str();
+				}
+				x=_text;
+				cacheToken(textToken);
+			}
+			return *this;
+		}
+
+	private:
+		enum { numberToken=0, textToken=1 };
+		static const char* cacheMagic(){
+			return "PRMCACH2";
+		}
+		static const size_t cacheMagicSize=8;
+		static const size_t cacheHeaderSize=cacheMagicSize+3*sizeof(uint64_t);
+		static const size_t maxRunSize=1<<16;
+		static const uint64_t fnvBasis=14695981039346656037ULL;
+
+		static bool isSpace(const char& ch){
+			return ch==' '||ch=='\n'||ch=='\t'||ch=='\r'||ch=='\v'||ch=='\f';
+		}
+
+		/// \brief Add n bytes to an FNV-1a hash
+		static void fnvHash(uint64_t& hash,const char* src,size_t n){
+			for(size_t k=0;k<n;k++){
+				hash=(hash^(unsigned char)src[k])*1099511628211ULL;
+			}
+		}
+
+		/// \brief The size and modification time of a file
+		static void fileStatus(const string& filename,uint64_t& fileSize,int64_t& fileMTime){
+			struct stat fileStat;
+			if(stat(filename.c_str(),&fileStat)==0){
+				fileSize=(uint64_t)fileStat.st_size;
+				fileMTime=(int64_t)fileStat.st_mtime;
+			}
+		}
+
+		/// \brief A name for the cache being written that no other run uses
+		string tmpCacheName() const{
+			std::random_device rd;
+			uint64_t stamp=std::chrono::high_resolution_clock::now().time_since_epoch().count();
+			ostringstream tmpStr;
+			tmpStr << _cacheName << "." << std::hex << rd() << (uint32_t)stamp << ".tmp";
+			return tmpStr.str();
+		}
+
+		/// \brief Load the tokens of the cache into the buffer, if the cache
+		/// is complete and was written for the contents of the open file
+		bool readCache(const uint64_t& fileSize,const int64_t& fileMTime){
+			ifstream cacheFile(_cacheName.c_str(),std::ios::in|std::ios::binary);
+			if(!cacheFile.is_open()){
+				return false;
+			}
+			char magic[cacheMagicSize];
+			uint64_t cacheSize=0,cacheHash=0;
+			int64_t cacheMTime=0;
+			cacheFile.read(magic,cacheMagicSize);
+			cacheFile.read((char*)&cacheSize,sizeof(uint64_t));
+			cacheFile.read((char*)&cacheMTime,sizeof(int64_t));
+			cacheFile.read((char*)&cacheHash,sizeof(uint64_t));
+			if(!cacheFile.good()||string(magic,cacheMagicSize)!=string(cacheMagic(),cacheMagicSize)||
+					cacheSize!=fileSize){
+				return false;
+			}
+			if(cacheMTime!=fileMTime){
+				// The file has been touched, the cache is still used if its
+				// contents are the same
+				uint64_t textSize=0,textHash=0;
+				contentsHash(textSize,textHash);
+				if(textSize!=cacheSize||textHash!=cacheHash){
+					return false;
+				}
+			}
+			cacheFile.seekg(0,std::ios::end);
+			uint64_t totalSize=cacheFile.tellg();
+			if(totalSize<cacheHeaderSize+sizeof(uint64_t)){
+				return false;
+			}
+			size_t bodySize=totalSize-cacheHeaderSize-sizeof(uint64_t);
+			vector<char> body(bodySize+1);
+			uint64_t checksum=0;
+			cacheFile.seekg(cacheHeaderSize);
+			cacheFile.read(&body[0],bodySize);
+			cacheFile.read((char*)&checksum,sizeof(uint64_t));
+			uint64_t bodyHash=fnvBasis;
+			fnvHash(bodyHash,&body[0],bodySize);
+			if(!cacheFile.good()||bodyHash!=checksum){
+				return false;
+			}
+			_buffer.swap(body);
+			_pos=0;
+			_end=bodySize;
+			return true;
+		}
+
+		/// \brief Read the next block of the file into the buffer, which is
+		/// kept null terminated so that strtod stops at its end
+		bool fill(){
+			if(_fromCache){
+				return false;
+			}
+			_pos=0;
+			_end=0;
+			if(_in.good()){
+				_in.read(&_buffer[0],_buffer.size()-1);
+				_end=_in.gcount();
+				hashText(&_buffer[0],_end);
+			}
+			_buffer[_end]='\0';
+			return _end>0;
+		}
+
+		/// \brief Add the text read from the file to the hash of its contents
+		/// written to the cache header
+		void hashText(const char* src,size_t n){
+			if(_toCache){
+				fnvHash(_textHash,src,n);
+				_textSize+=n;
+			}
+		}
+
+		/// \brief Copy n bytes from the file, returns false if there are not
+		/// enough left
+		bool readBytes(char* dst,size_t n){
+			while(n>0){
+				if(_pos==_end&&!fill()){
+					return false;
+				}
+				size_t nCopy=std::min(n,_end-_pos);
+				std::copy(&_buffer[_pos],&_buffer[_pos]+nCopy,dst);
+				_pos+=nCopy;
+				dst+=nCopy;
+				n-=nCopy;
+			}
+			return true;
+		}
+
+		/// \brief Read the next token, returns false at the end of the file
+		bool next(){
+			if(_fromCache){
+				if(_runLeft==0){
+					char type;
+					if(!readBytes(&type,1)){
+						return false;
+					}
+					if(type==numberToken){
+						uint32_t runSize=0;
+						if(!readBytes((char*)&runSize,sizeof(uint32_t))||runSize==0){
+							return false;
+						}
+						_runLeft=runSize;
+					}else{
+						_type=textToken;
+						uint32_t len=0;
+						if(!readBytes((char*)&len,sizeof(uint32_t))){
+							return false;
+						}
+						_text.resize(len);
+						if(len>0&&!readBytes(&_text[0],len)){
+							return false;
+						}
+						_value=strtod(_text.c_str(),NULL);
+						return true;
+					}
+				}
+				_runLeft--;
+				_type=numberToken;
+				return readBytes((char*)&_value,sizeof(double));
+			}
+
+			// Skip the white space
+			while(true){
+				if(_pos==_end&&!fill()){
+					return false;
+				}
+				if(!isSpace(_buffer[_pos])){
+					break;
+				}
+				_pos++;
+			}
+			// Find the end of the token, a token that runs to the end of the
+			// buffer is moved to its start and the rest of the block read
+			size_t tokenEnd=_pos;
+			while(true){
+				while(tokenEnd<_end&&!isSpace(_buffer[tokenEnd])){
+					tokenEnd++;
+				}
+				if(tokenEnd<_end||!_in.good()){
+					break;
+				}
+				size_t len=_end-_pos;
+				if(len+1==_buffer.size()){
+					_buffer.resize(2*_buffer.size());
+				}
+				std::copy(_buffer.begin()+_pos,_buffer.begin()+_end,_buffer.begin());
+				_pos=0;
+				_end=len;
+				tokenEnd=len;
+				_in.read(&_buffer[_end],_buffer.size()-1-_end);
+				hashText(&_buffer[_end],_in.gcount());
+				_end+=_in.gcount();
+				_buffer[_end]='\0';
+			}
+			const char* start=&_buffer[_pos];
+			size_t len=tokenEnd-_pos;
+			_text.assign(start,len);
+			char* endPtr;
+			_value=strtod(start,&endPtr);
+			_type=(endPtr==start+len) ? numberToken : textToken;
+			_pos=tokenEnd;
+			return true;
+		}
+
+		/// \brief Write the current token to the cache, as it was read
+		void cacheToken(const char& readAs){
+			if(!_toCache){
+				return;
+			}
+			// Only tokens that are numbers and were read as numbers are stored
+			// parsed, in runs of consecutive numbers. Anything else keeps its
+			// text.
+			if(readAs==numberToken&&_type==numberToken){
+				_run.push_back(_value);
+				if(_run.size()==maxRunSize){
+					flushRun();
+				}
+			}else{
+				flushRun();
+				char type=textToken;
+				uint32_t len=_text.size();
+				writeBytes(&type,1);
+				writeBytes((const char*)&len,sizeof(uint32_t));
+				writeBytes(_text.data(),len);
+			}
+			if(_outBuffer.size()>=_buffer.size()){
+				flushCache();
+			}
+		}
+
+		/// \brief Write the pending run of numbers to the cache
+		void flushRun(){
+			if(_run.empty()){
+				return;
+			}
+			char type=numberToken;
+			uint32_t runSize=_run.size();
+			writeBytes(&type,1);
+			writeBytes((const char*)&runSize,sizeof(uint32_t));
+			writeBytes((const char*)&_run[0],runSize*sizeof(double));
+			_run.clear();
+		}
+
+		void writeBytes(const char* src,size_t n){
+			fnvHash(_bodyHash,src,n);
+			_outBuffer.insert(_outBuffer.end(),src,src+n);
+		}
+
+		void flushCache(){
+			if(!_outBuffer.empty()){
+				_cacheOut.write(&_outBuffer[0],_outBuffer.size());
+				_outBuffer.clear();
+			}
+		}
+
+		/// \brief The size and FNV-1a hash of the contents of the open file,
+		/// which is left positioned at the start
+		void contentsHash(uint64_t& fileSize,uint64_t& fileHash){
+			fileSize=0;
+			fileHash=fnvBasis;
+			while(fill()){
+				fnvHash(fileHash,&_buffer[0],_end);
+				fileSize+=_end;
+			}
+			_in.clear();
+			_in.seekg(0);
+			_pos=0;
+			_end=0;
+		}
+
+		ifstream _in;
+		ofstream _cacheOut;
+		string _cacheName;
+		string _tmpName;
+		vector<char> _buffer;
+		vector<char> _outBuffer;
+		bool _fromCache;
+		bool _toCache;
+		size_t _pos;
+		size_t _end;
+		char _type;
+		double _value;
+		string _text;
+		/// \brief The numbers left in the current run read from the cache
+		uint32_t _runLeft;
+		/// \brief The numbers waiting to be written to the cache as a run
+		vector<double> _run;
+		uint64_t _textSize;
+		uint64_t _textHash;
+		uint64_t _bodyHash;
+		int64_t _fileMTime;
+};
+
+// Completes the data set once the values have been read, whether from the
+// input files or from R: the missing covariates are replaced by their means,
+// the missing patterns are numbered, the neighbourhood graph is stored
+// and coloured, and the covariates are packed if asked for
+void completePReMiuMData(const vector<vector<unsigned int> >& neighbours,pReMiuMData& dataset){
+
+	unsigned int nSubjects=dataset.nSubjects();
+	unsigned int nCovariates=dataset.nCovariates();
+	unsigned int nDiscreteCovs=dataset.nDiscreteCovs();
+	unsigned int nPredictSubjects=dataset.nPredictSubjects();
+	vector<vector<int> >& discreteX=dataset.discreteX();
+	vector<vector<double> >& continuousX=dataset.continuousX();
+	const vector<vector<bool> >& missingX=dataset.missingX();
+	string covariateType = dataset.covariateType();
+
+	/// Initially we just replace missing values by their means
+	vector<double> meanX(nCovariates,0);
+	vector<unsigned int> nXNotMissing(nCovariates,0);
+	for(unsigned int i=0;i<nSubjects;i++){
+		for(unsigned int j=0;j<nCovariates;j++){
+			if(!missingX[i][j]){
+				if(covariateType.compare("Discrete")==0){
+					meanX[j]+=(double)discreteX[i][j];
+				}else if(covariateType.compare("Normal")==0){
+					meanX[j]+=continuousX[i][j];
+				}else if(covariateType.compare("Mixed")==0){
+					if (j < nDiscreteCovs) {
+						meanX[j]+=(double)discreteX[i][j];
+					} else {
+						meanX[j]+=continuousX[i][j-nDiscreteCovs];
+					}
+				}
+				nXNotMissing[j]+=1;
+			}
+		}
+	}
+	for(unsigned int j=0;j<nCovariates;j++){
+		meanX[j]=meanX[j]/(double)nXNotMissing[j];
+	}
+
+	for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
+		for(unsigned int j=0;j<nCovariates;j++){
+			if(missingX[i][j]){
+				if(covariateType.compare("Discrete")==0){
+					discreteX[i][j]=(int)meanX[j];
+				}else if(covariateType.compare("Normal")==0){
+					continuousX[i][j]=meanX[j];
+				}else if(covariateType.compare("Mixed")==0){
+					if (j < nDiscreteCovs) {
+						discreteX[i][j]=(int)meanX[j];
+					} else {
+						continuousX[i][j-nDiscreteCovs]=(double)meanX[j-nDiscreteCovs];
+					}
+				}
+			}
+		}
+	}
+
+	// Number the patterns of missing continuous covariates, so that the
+	// marginal precision of the observed covariates can be shared by the
+	// subjects with the same pattern
+	if(covariateType.compare("Normal")==0||covariateType.compare("Mixed")==0){
+		unsigned int jStart=0;
+		if(covariateType.compare("Mixed")==0){
+			jStart=nDiscreteCovs;
+		}
+		vector<unsigned int>& missingPattern=dataset.missingPattern();
+		vector<vector<unsigned int> >& missingPatternObserved=dataset.missingPatternObserved();
+		map<vector<bool>,unsigned int> patternIds;
+		missingPattern.resize(nSubjects+nPredictSubjects);
+		missingPatternObserved.clear();
+		for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
+			vector<bool> pattern(missingX[i].begin()+jStart,missingX[i].end());
+			map<vector<bool>,unsigned int>::iterator it=patternIds.find(pattern);
+			if(it==patternIds.end()){
+				vector<unsigned int> observed;
+				for(unsigned int j=0;j<pattern.size();j++){
+					if(!pattern[j]){
+						observed.push_back(j);
+					}
+				}
+				it=patternIds.insert(make_pair(pattern,(unsigned int)missingPatternObserved.size())).first;
+				missingPatternObserved.push_back(observed);
+			}
+			missingPattern[i]=it->second;
+		}
+	}
+
+	if (dataset.includeCAR()){
+        dataset.neighbours(neighbours);
+
+        // Greedy colouring of the neighbourhood graph, so that the spatial
+        // random effects of one colour can be updated at the same time
+        vector<vector<unsigned int> >& neighbourColours=dataset.neighbourColours();
+        neighbourColours.clear();
+        vector<int> colour(nSubjects,-1);
+        vector<bool> colourUsed;
+        for(unsigned int i1=0;i1<nSubjects;i1++){
+            colourUsed.assign(neighbourColours.size()+1,false);
+            for(unsigned int k=0;k<dataset.nNeighbours(i1);k++){
+                unsigned int nk=dataset.neighbour(i1,k);
+                if(nk<nSubjects&&colour[nk]>=0){
+                    colourUsed[colour[nk]]=true;
+                }
+            }
+            unsigned int col=0;
+            while(colourUsed[col]){
+                col++;
+            }
+            if(col==neighbourColours.size()){
+                neighbourColours.push_back(vector<unsigned int>());
+            }
+            colour[i1]=col;
+            neighbourColours[col].push_back(i1);
+        }
+	}
+
+	// Only now that the missing values have been replaced and the patterns
+	// numbered can the covariates be packed
+	dataset.packCovariates();
+}
+
 // Read the PReMiuM data set
 void importPReMiuMData(const string& fitFilename,const string& predictFilename, const string& neighboursFilename, pReMiuMData& dataset){
 
-	ifstream inputFile,predictFile;
-	inputFile.open(fitFilename.c_str());
+	pReMiuMTokenReader inputFile,predictFile;
+	inputFile.open(fitFilename,dataset.useDataCache());
 	if(!inputFile.is_open()){
 		Rprintf("Input file not found\n");
 	//	exit(-1);
 	}
 	if(predictFilename.compare("")!=0){
-		predictFile.open(predictFilename.c_str());
+		predictFile.open(predictFilename,dataset.useDataCache());
 		if(!predictFile.is_open()){
 			Rprintf("Prediction covariate file not found\n");
 	//		exit(-1);
@@ -343,8 +1034,6 @@ void importPReMiuMData(const string& fitFilename,const string& predictFilename,
 	vector<double>& logOffset=dataset.logOffset();
 	vector<unsigned int>& nTrials=dataset.nTrials();
 	vector<unsigned int>& censoring=dataset.censoring();
-	vector<vector<unsigned int> >& neighbours=dataset.neighbours();
-	vector<unsigned int>& nNeighbours=dataset.nNeighbours();
 	bool& includeCAR=dataset.includeCAR();
 
 	bool wasError=false;
@@ -428,8 +1117,6 @@ void importPReMiuMData(const string& fitFilename,const string& predictFilename,
 	}
 	missingX.resize(nSubjects+nPredictSubjects);
 	nContinuousCovariatesNotMissing.resize(nSubjects+nPredictSubjects);
-	vector<double> meanX(nCovariates,0);
-	vector<unsigned int> nXNotMissing(nCovariates,0);
 	for(unsigned int i=0;i<nSubjects;i++){
 		if(outcomeType.compare("Normal")==0||outcomeType.compare("Survival")==0||outcomeType.compare("Quantile")==0){
 			inputFile >> continuousY[i];
@@ -450,8 +1137,6 @@ void importPReMiuMData(const string& fitFilename,const string& predictFilename,
 				inputFile >> discreteX[i][j];
 				// -999 is missing data indicator
 				if(discreteX[i][j]!=-999){
-					meanX[j]+=(double)discreteX[i][j];
-					nXNotMissing[j]+=1;
 					missingX[i][j]=false;
 				}
 			}else if(covariateType.compare("Normal")==0){
@@ -459,24 +1144,18 @@ void importPReMiuMData(const string& fitFilename,const string& predictFilename,
 				// -999 is missing data indicator
 				if(fabs(continuousX[i][j]+999)>0.00000000001){
 					nContinuousCovariatesNotMissing[i]++;
-					meanX[j]+=continuousX[i][j];
-					nXNotMissing[j]+=1;
 					missingX[i][j]=false;
 				}
 			}else if(covariateType.compare("Mixed")==0){
 				if (j < nDiscreteCovs) {
 					inputFile >> discreteX[i][j];
 					if(discreteX[i][j]!=-999){
-						meanX[j]+=(double)discreteX[i][j];
-						nXNotMissing[j]+=1;
 						missingX[i][j]=false;
 					}
 				} else {
 					inputFile >> continuousX[i][j-nDiscreteCovs];
 					if(fabs(continuousX[i][j-nDiscreteCovs]+999)>0.00000000001){
 						nContinuousCovariatesNotMissing[i]++;
-						meanX[j]+=continuousX[i][j-nDiscreteCovs];
-						nXNotMissing[j]+=1;
 						missingX[i][j]=false;
 					}
 				}
@@ -541,36 +1220,15 @@ void importPReMiuMData(const string& fitFilename,const string& predictFilename,
 	}
 
 
-	/// Initially we just replace missing values by their means
-	for(unsigned int j=0;j<nCovariates;j++){
-		meanX[j]=meanX[j]/(double)nXNotMissing[j];
-	}
-
-	for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
-		for(unsigned int j=0;j<nCovariates;j++){
-			if(missingX[i][j]){
-				if(covariateType.compare("Discrete")==0){
-					discreteX[i][j]=(int)meanX[j];
-				}else if(covariateType.compare("Normal")==0){
-					continuousX[i][j]=meanX[j];
-				}else if(covariateType.compare("Mixed")==0){
-					if (j < nDiscreteCovs) {
-						discreteX[i][j]=(int)meanX[j];
-					} else {
-						continuousX[i][j-nDiscreteCovs]=(double)meanX[j-nDiscreteCovs];
-					}
-				}
-			}
-		}
-	}
-
 	inputFile.close();
 	if(predictFile.is_open()){
 		predictFile.close();
 	}
 
 	//Fill nNeighbours and Neighbours
+	vector<vector<unsigned int> > neighbours;
 	if (includeCAR){
+        vector<unsigned int> nNeighbours;
         ifstream neighFile;
         neighFile.open(neighboursFilename.c_str());
 
@@ -606,6 +1264,8 @@ void importPReMiuMData(const string& fitFilename,const string& predictFilename,
         neighFile.close();
 	}
 
+	completePReMiuMData(neighbours,dataset);
+
 	// Return if there was an error
 	if(wasError){
 		Rprintf("Please use:\n");
@@ -616,6 +1276,171 @@ void importPReMiuMData(const string& fitFilename,const string& predictFilename,
 
 }
 
+// Fill the PReMiuM data set from a list built by profRegr in R, instead of
+// reading it from the input files. The list holds the same values as the
+// input file (see importPReMiuMData), with the covariates as a numeric
+// nSubjects x nCovariates matrix X (and nPredictSubjects x nCovariates
+// matrix predictX) using -999 for missing values, the fixed effects as a
+// numeric matrix W and the extra outcome column (offset, number of trials or
+// censoring) as outcomeT. For the spatial model, neighbours is a list giving
+// the (1 based) neighbours of each subject.
+void importPReMiuMDataFromR(const Rcpp::List& data, pReMiuMData& dataset){
+
+	unsigned int& nSubjects=dataset.nSubjects();
+	unsigned int& nCovariates=dataset.nCovariates();
+	unsigned int& nDiscreteCovs=dataset.nDiscreteCovs();
+	unsigned int& nContinuousCovs=dataset.nContinuousCovs();
+	unsigned int& nFixedEffects=dataset.nFixedEffects();
+	unsigned int& nCategoriesY=dataset.nCategoriesY();
+	unsigned int& nPredictSubjects=dataset.nPredictSubjects();
+	vector<unsigned int>& nCategories=dataset.nCategories();
+	vector<unsigned int>& discreteY=dataset.discreteY();
+	vector<double>& continuousY=dataset.continuousY();
+	vector<vector<int> >& discreteX=dataset.discreteX();
+	vector<vector<double> >& continuousX=dataset.continuousX();
+	vector<string>& covNames=dataset.covariateNames();
+	vector<vector<bool> >& missingX=dataset.missingX();
+	vector<unsigned int>& nContinuousCovariatesNotMissing=dataset.nContinuousCovariatesNotMissing();
+	vector<vector<double> >& W=dataset.W();
+	vector<string>& confNames=dataset.fixedEffectNames();
+	string outcomeType = dataset.outcomeType();
+	string covariateType = dataset.covariateType();
+	vector<double>& logOffset=dataset.logOffset();
+	vector<unsigned int>& nTrials=dataset.nTrials();
+	vector<unsigned int>& censoring=dataset.censoring();
+	bool includeCAR=dataset.includeCAR();
+
+	// The vectors and matrices below point at the memory held by R, the
+	// values are copied straight into the data set
+	SEXP tmpSEXP;
+	tmpSEXP=data["covNames"];
+	covNames=Rcpp::as<vector<string> >(tmpSEXP);
+	tmpSEXP=data["fixedEffectNames"];
+	confNames=Rcpp::as<vector<string> >(tmpSEXP);
+	tmpSEXP=data["nCategories"];
+	vector<unsigned int> nCategoriesR=Rcpp::as<vector<unsigned int> >(tmpSEXP);
+	tmpSEXP=data["y"];
+	Rcpp::NumericVector y(tmpSEXP);
+	tmpSEXP=data["X"];
+	Rcpp::NumericMatrix X(tmpSEXP);
+	tmpSEXP=data["W"];
+	Rcpp::NumericMatrix WR(tmpSEXP);
+	tmpSEXP=data["outcomeT"];
+	Rcpp::NumericVector outcomeT(tmpSEXP);
+	tmpSEXP=data["predictX"];
+	Rcpp::NumericMatrix predictX(tmpSEXP);
+
+	nSubjects=y.size();
+	nCovariates=covNames.size();
+	nFixedEffects=confNames.size();
+	nPredictSubjects=predictX.nrow();
+	if(covariateType.compare("Mixed")==0){
+		tmpSEXP=data["nDiscreteCovs"];
+		nDiscreteCovs=Rcpp::as<unsigned int>(tmpSEXP);
+		nContinuousCovs=nCovariates-nDiscreteCovs;
+	}else{
+		nDiscreteCovs=0;
+		nContinuousCovs=0;
+	}
+	if(outcomeType.compare("Categorical")==0){
+		tmpSEXP=data["nCategoriesY"];
+		nCategoriesY=Rcpp::as<unsigned int>(tmpSEXP)-1;
+	}else{
+		nCategoriesY=1;
+	}
+
+	nCategories.assign(nCovariates,0);
+	if(covariateType.compare("Discrete")==0){
+		for(unsigned int j=0;j<nCovariates;j++){
+			nCategories[j]=nCategoriesR[j];
+		}
+	}else if(covariateType.compare("Mixed")==0){
+		for(unsigned int j=0;j<nDiscreteCovs;j++){
+			nCategories[j]=nCategoriesR[j];
+		}
+	}
+
+	discreteY.resize(nSubjects);
+	continuousY.resize(nSubjects);
+	discreteX.resize(nSubjects+nPredictSubjects);
+	continuousX.resize(nSubjects+nPredictSubjects);
+	W.resize(nSubjects);
+	if(outcomeType.compare("Poisson")==0){
+		logOffset.resize(nSubjects);
+	}
+	if(outcomeType.compare("Binomial")==0){
+		nTrials.resize(nSubjects);
+	}
+	if(outcomeType.compare("Survival")==0){
+		censoring.resize(nSubjects);
+	}
+	missingX.resize(nSubjects+nPredictSubjects);
+	nContinuousCovariatesNotMissing.assign(nSubjects+nPredictSubjects,0);
+	for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
+		// The fitting subjects come first, followed by the predictive subjects
+		const Rcpp::NumericMatrix& XR=(i<nSubjects)?X:predictX;
+		unsigned int iR=(i<nSubjects)?i:i-nSubjects;
+		if(covariateType.compare("Discrete")==0 || covariateType.compare("Normal")==0){
+			discreteX[i].resize(nCovariates);
+			continuousX[i].resize(nCovariates);
+		} else if(covariateType.compare("Mixed")==0){
+			discreteX[i].resize(nDiscreteCovs);
+			continuousX[i].resize(nContinuousCovs);
+		}
+		missingX[i].resize(nCovariates);
+		for(unsigned int j=0;j<nCovariates;j++){
+			double x=XR(iR,j);
+			bool isMissing=fabs(x+999)<=0.00000000001;
+			missingX[i][j]=isMissing;
+			if(covariateType.compare("Discrete")==0||(covariateType.compare("Mixed")==0&&j<nDiscreteCovs)){
+				discreteX[i][j]=(int)x;
+			}else if(covariateType.compare("Normal")==0){
+				continuousX[i][j]=x;
+			}else{
+				continuousX[i][j-nDiscreteCovs]=x;
+			}
+			if(!isMissing&&(covariateType.compare("Normal")==0||(covariateType.compare("Mixed")==0&&j>=nDiscreteCovs))){
+				nContinuousCovariatesNotMissing[i]++;
+			}
+		}
+	}
+
+	for(unsigned int i=0;i<nSubjects;i++){
+		if(outcomeType.compare("Normal")==0||outcomeType.compare("Survival")==0||outcomeType.compare("Quantile")==0){
+			continuousY[i]=y[i];
+		}else{
+			discreteY[i]=(unsigned int)y[i];
+		}
+		W[i].resize(nFixedEffects);
+		for(unsigned int j=0;j<nFixedEffects;j++){
+			W[i][j]=WR(i,j);
+		}
+		if(outcomeType.compare("Poisson")==0){
+			logOffset[i]=log(outcomeT[i]);
+		}
+		if(outcomeType.compare("Binomial")==0){
+			nTrials[i]=(unsigned int)outcomeT[i];
+		}
+		if(outcomeType.compare("Survival")==0){
+			censoring[i]=(unsigned int)outcomeT[i];
+		}
+	}
+
+	vector<vector<unsigned int> > neighbours;
+	if(includeCAR){
+		tmpSEXP=data["neighbours"];
+		Rcpp::List neighboursR(tmpSEXP);
+		neighbours.resize(nSubjects);
+		for(unsigned int i=0;i<nSubjects;i++){
+			tmpSEXP=neighboursR[i];
+			neighbours[i]=Rcpp::as<vector<unsigned int> >(tmpSEXP);
+		}
+	}
+
+	completePReMiuMData(neighbours,dataset);
+
+}
+
 // Function to read the hyper parameters from file
 void readHyperParamsFromFile(const string& filename,pReMiuMHyperParams& hyperParams){
 
@@ -1029,9 +1854,9 @@ void initialisePReMiuM(baseGeneratorType& rndGenerator,
 		params.maxNClusters(maxNClusters,covariateType, useIndependentNormal, useSeparationPrior);
 	}
 
-	// Copy the dataset X matrix to a working object in params
-	params.workDiscreteX(dataset.discreteX());
-	params.workContinuousX(dataset.continuousX());
+	// Copy the dataset X matrix to a working object in params, or share it
+	// if it is packed
+	params.workCovariates(dataset);
 
 	// Now initialise the actual parameters
 	randomGamma gammaRand(hyperParams.shapeAlpha(),1.0/hyperParams.rateAlpha());
@@ -1046,33 +1871,38 @@ void initialisePReMiuM(baseGeneratorType& rndGenerator,
 	params.dPitmanYor(dPitmanYor);	
 
 	vector<unsigned int> nXInCluster(maxNClusters,0);
+	vector<vector<unsigned int> > clusterMembers(maxNClusters);
 	unsigned int maxZ=0;
 	params.workNClusInit(nClusInit);
 	if (hyperParams.initAlloc().empty()){
 		for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
 			int c=(int) nClusInit*unifRand(rndGenerator);
-			params.z(i,c,covariateType,useIndependentNormal);
+			params.z(i,c,options.covariateTypeId(),useIndependentNormal);
 			if(c>(int)maxZ){
 				maxZ=c;
 			}
 			if(i<nSubjects){
 				nXInCluster[c]++;
+				clusterMembers[c].push_back(i);
 			}
 		}
 	} else {
 		for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
 			int c = hyperParams.initAlloc(i);
-			params.z(i,c,covariateType,useIndependentNormal);
+			params.z(i,c,options.covariateTypeId(),useIndependentNormal);
 			if(c>(int)maxZ){
 				maxZ=c;
 			}
 			if(i<nSubjects){
 				nXInCluster[c]++;
+				clusterMembers[c].push_back(i);
 			}
 		}
 	}
 
 	params.workNXInCluster(nXInCluster);
+	params.workClusterMembers(clusterMembers);
+	params.workSufficientStats(useIndependentNormal);
 	params.workMaxZi(maxZ);
 
 
@@ -2101,6 +2931,7 @@ void initialisePReMiuM(baseGeneratorType& rndGenerator,
 				params.beta(j,k,-2.0+4.0*unifRand(rndGenerator));
 			}
 		}
+		params.workComputeLinearPredictor(dataset.W());
 
 		if(outcomeType.compare("Normal")==0||outcomeType.compare("Quantile")==0){
 			randomGamma gammaRand(hyperParams.shapeSigmaSqY(),1.0/hyperParams.scaleSigmaSqY());
@@ -2200,6 +3031,147 @@ void initialisePReMiuM(baseGeneratorType& rndGenerator,
 
 }
 
+// The predicted responses of the prediction subjects at the current sweep,
+// computed from their expected theta as in calcPredictions (with no fixed
+// effect contribution and an offset or number of trials of 1). Categorical
+// responses have a probability for each category, the reference first.
+vector<vector<double> > pReMiuMPredictedY(const pReMiuMParams& params,
+		const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model){
+
+	const pReMiuMData& dataset = model.dataset();
+	pReMiuMOutcomeType outcomeType = model.options().outcomeTypeId();
+	unsigned int nPredictSubjects = params.nPredictSubjects();
+	unsigned int nCategoriesY = params.nCategoriesY();
+
+	// Survival times are restricted to the largest observed time
+	double restrictedMeanSurvival=0.0;
+	if(outcomeType==outcomeSurvival){
+		for(unsigned int i=0;i<dataset.nSubjects();i++){
+			if(dataset.continuousY(i)>restrictedMeanSurvival){
+				restrictedMeanSurvival=dataset.continuousY(i);
+			}
+		}
+	}
+
+	vector<vector<double> > predictedY(nPredictSubjects);
+	for(unsigned int j=0;j<nPredictSubjects;j++){
+		const vector<double>& expectedTheta = params.workPredictExpectedTheta()[j];
+		switch(outcomeType){
+			case outcomeBernoulli:
+			case outcomeBinomial:
+				predictedY[j].assign(1,1.0/(1.0+exp(-expectedTheta[0])));
+				break;
+			case outcomePoisson:
+				predictedY[j].assign(1,exp(expectedTheta[0]));
+				break;
+			case outcomeNormal:
+			case outcomeQuantile:
+				predictedY[j].assign(1,expectedTheta[0]);
+				break;
+			case outcomeSurvival:
+			{
+				double nu = params.nu(0);
+				double survivalTime = exp(-expectedTheta[0]/nu)*tgamma(1.0+1.0/nu);
+				predictedY[j].assign(1,survivalTime<restrictedMeanSurvival?survivalTime:restrictedMeanSurvival);
+				break;
+			}
+			case outcomeCategorical:
+			{
+				predictedY[j].assign(nCategoriesY+1,1.0);
+				double total=1.0;
+				for(unsigned int k=0;k<nCategoriesY;k++){
+					predictedY[j][k+1]=exp(expectedTheta[k]);
+					total+=predictedY[j][k+1];
+				}
+				for(unsigned int k=0;k<=nCategoriesY;k++){
+					predictedY[j][k]/=total;
+				}
+				break;
+			}
+		}
+	}
+	return predictedY;
+
+}
+
+// Write the running moments of the predicted responses to the _predictSummary
+// file of a sampler, if it has one. The first record is the number of sweeps
+// and each following record has the means and then the variances of the
+// predicted response of one prediction subject.
+void writePReMiuMPredictSummary(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropParams,pReMiuMData>& sampler){
+
+	vector<mcmcOutputFile*>& outFiles = sampler.outFiles();
+	string fileName = sampler.outFileStem() + "_predictSummary.txt";
+	mcmcOutputFile* summaryFile=NULL;
+	for(unsigned int i=0;i<outFiles.size();i++){
+		if(outFiles[i]->fileName().compare(fileName)==0){
+			summaryFile=outFiles[i];
+		}
+	}
+	if(!summaryFile){
+		return;
+	}
+
+	const pReMiuMParams& params = sampler.chain().currentState().parameters();
+	unsigned int nSamples = params.workNPredictSamples();
+	const vector<vector<double> >& meanY = params.workPredictMeanY();
+	const vector<vector<double> >& sumSqDevY = params.workPredictSumSqDevY();
+	*summaryFile << nSamples << endl;
+	for(unsigned int j=0;j<meanY.size();j++){
+		for(unsigned int k=0;k<meanY[j].size();k++){
+			*summaryFile << meanY[j][k] << " ";
+		}
+		for(unsigned int k=0;k<sumSqDevY[j].size();k++){
+			*summaryFile << (nSamples>1?sumSqDevY[j][k]/(nSamples-1):0.0);
+			if(k<sumSqDevY[j].size()-1){
+				*summaryFile << " ";
+			}
+		}
+		*summaryFile << endl;
+	}
+
+}
+
+// The statistics monitored for the convergence of the sampler: the log
+// posterior, the number of non-empty clusters and alpha
+void pReMiuMMonitorStatistics(const mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropParams,pReMiuMData>& sampler,
+								vector<double>& statistics){
+
+	const mcmcState<pReMiuMParams>& state = sampler.chain().currentState();
+	const pReMiuMParams& params = state.parameters();
+	const vector<unsigned int>& nXInCluster = params.workNXInCluster();
+	unsigned int nNotEmpty=0;
+	for(unsigned int c=0;c<nXInCluster.size();c++){
+		if(nXInCluster[c]>0){
+			nNotEmpty++;
+		}
+	}
+	statistics.resize(3);
+	statistics[0]=state.logPosterior();
+	statistics[1]=(double)nNotEmpty;
+	statistics[2]=params.alpha();
+
+}
+
+// The model specific lines of the status file: the number of non-empty
+// clusters, the number of clusters represented by the sampler and alpha
+void pReMiuMStatusStatistics(const mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropParams,pReMiuMData>& sampler,
+								std::ostream& statusStream){
+
+	const pReMiuMParams& params = sampler.chain().currentState().parameters();
+	const vector<unsigned int>& nXInCluster = params.workNXInCluster();
+	unsigned int nNotEmpty=0;
+	for(unsigned int c=0;c<nXInCluster.size();c++){
+		if(nXInCluster[c]>0){
+			nNotEmpty++;
+		}
+	}
+	statusStream << "nClusters " << nNotEmpty << endl;
+	statusStream << "maxNClusters " << params.maxNClusters() << endl;
+	statusStream << "alpha " << params.alpha() << endl;
+
+}
+
 // Write the sampler output
 void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropParams,pReMiuMData>& sampler,
 								const unsigned int& sweep){
@@ -2208,10 +3180,10 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 	bool reportBurnIn = sampler.reportBurnIn();
 	unsigned int nBurn = sampler.nBurn();
 	unsigned int nFilter = sampler.nFilter();
-	vector<ofstream*>& outFiles = sampler.outFiles();
+	vector<mcmcOutputFile*>& outFiles = sampler.outFiles();
 
 	// Check if we need to do anything
-	if((reportBurnIn||((!reportBurnIn)&&sweep>nBurn))&&(sweep%nFilter==0)){
+	if(sampler.isOutputSweep(sweep)){
 		const pReMiuMParams& params = sampler.chain().currentState().parameters();
 
 		unsigned int nSubjects = params.nSubjects();
@@ -2221,203 +3193,219 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 		unsigned int nDiscreteCovs=params.nDiscreteCovs();
 		unsigned int nContinuousCovs=params.nContinuousCovs();
 		unsigned int nCategoriesY = params.nCategoriesY();
-		string covariateType = sampler.model().dataset().covariateType();
+		pReMiuMCovariateType covariateType = sampler.model().options().covariateTypeId();
 		bool includeResponse = sampler.model().options().includeResponse();
 		bool includeCAR = sampler.model().options().includeCAR();
 		bool responseExtraVar = sampler.model().options().responseExtraVar();
 		double fixedAlpha = sampler.model().options().fixedAlpha();
-		string outcomeType = sampler.model().options().outcomeType();
+		pReMiuMOutcomeType outcomeType = sampler.model().options().outcomeTypeId();
 		bool computeEntropy = sampler.model().options().computeEntropy();
-		unsigned int nFixedEffects = params.nFixedEffects(outcomeType);
+		unsigned int nFixedEffects = params.nFixedEffects(sampler.model().options().outcomeType());
 		string varSelectType = sampler.model().options().varSelectType();
 		string predictType = sampler.model().options().predictType();
 		bool weibullFixedShape = sampler.model().options().weibullFixedShape();
 		bool useHyperpriorR1 = sampler.model().options().useHyperpriorR1();
 		bool useIndependentNormal= sampler.model().options().useIndependentNormal();
 		bool useSeparationPrior = sampler.model().options().useSeparationPrior();
+		// With a cluster specific shape of the Weibull there is no predicted
+		// survival time from the expected theta
+		bool predictSummary = sampler.model().options().predictSummary()&&includeResponse&&
+				nPredictSubjects>0&&(outcomeType!=outcomeSurvival||weibullFixedShape);
 
 		const pReMiuMData& dataset = sampler.model().dataset();
 		pReMiuMPropParams& proposalParams = sampler.proposalParams();
 
 		vector<unsigned int> nCategories;
-		if(covariateType.compare("Discrete")==0||covariateType.compare("Mixed")==0){
+		if(covariateType==covariateDiscrete||covariateType==covariateMixed){
 			nCategories = params.nCategories();
 		}
 
-		// Check if the files are already open
+		// Check if the files are already open (a resumed run appends to the
+		// files written up to its checkpoint)
 		if(outFiles.size()==0){
+			unsigned int nSweeps = sampler.nSweeps();
+			string outputFormat = sampler.model().options().outputFormat();
+			// Compression and delta encoding only apply to files on disk
+			bool compressOutput = sampler.model().options().compressOutput()&&outputFormat.compare("memory")!=0;
+			bool deltaZ = sampler.model().options().deltaZ()&&outputFormat.compare("memory")!=0;
 			string fileStem =sampler.outFileStem();
 			string fileName = fileStem + "_nClusters.txt";
-			outFiles.push_back(new ofstream(fileName.c_str()));
+			outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,true,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 			fileName = fileStem + "_psi.txt";
-			outFiles.push_back(new ofstream(fileName.c_str()));
-			if(covariateType.compare("Discrete")==0){
+			outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
+			if(covariateType==covariateDiscrete){
 				fileName = fileStem + "_phi.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
-			}else if(covariateType.compare("Normal")==0){
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
+			}else if(covariateType==covariateNormal){
 				fileName = fileStem + "_mu.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				fileName = fileStem + "_Sigma.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				if (useHyperpriorR1||useIndependentNormal) {
 					fileName = fileStem + "_R1.txt";	
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
 				if (useHyperpriorR1 ) {
 					fileName = fileStem + "_kappa1.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_mu00.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_Sigma00.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_kappa1Prop.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				} 
 
 				if (useSeparationPrior) {
 					fileName = fileStem + "_mu00.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_SigmaR.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_SigmaS.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_SigmaSProp.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_kappa1.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_kappa1Prop.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 				}
 
-			}else if(covariateType.compare("Mixed")==0){
+			}else if(covariateType==covariateMixed){
 				fileName = fileStem + "_phi.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				fileName = fileStem + "_mu.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				fileName = fileStem + "_Sigma.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				if (useHyperpriorR1|| useIndependentNormal) {
 					fileName = fileStem + "_R1.txt";	
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
 				if (useHyperpriorR1) {
 					fileName = fileStem + "_kappa1.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_mu00.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_Sigma00.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_kappa1Prop.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				} 
 
 				if (useSeparationPrior) {
 					fileName = fileStem + "_mu00.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_SigmaR.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_SigmaS.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_SigmaSProp.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_kappa1.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 					fileName = fileStem + "_kappa1Prop.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 
 				}
 			}
-			fileName = fileStem + "_z.txt";
-			outFiles.push_back(new ofstream(fileName.c_str()));
+			fileName = fileStem + (deltaZ?"_zDelta.txt":"_z.txt");
+			outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,true,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,deltaZ,sampler.resumeOffset(fileName)));
 			fileName = fileStem + "_entropy.txt";
-			outFiles.push_back(new ofstream(fileName.c_str()));
+			outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 			fileName = fileStem + "_alpha.txt";
-			outFiles.push_back(new ofstream(fileName.c_str()));
+			outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 			fileName = fileStem + "_logPost.txt";
-			outFiles.push_back(new ofstream(fileName.c_str()));
+			outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 			fileName = fileStem + "_nMembers.txt";
-			outFiles.push_back(new ofstream(fileName.c_str()));
+			outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,true,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 			if(fixedAlpha<=-1){
 				fileName = fileStem + "_alphaProp.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 			}
 			if(includeResponse){
 				fileName = fileStem + "_theta.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				fileName = fileStem + "_beta.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				fileName = fileStem + "_thetaProp.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				fileName = fileStem + "_betaProp.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
-				if(outcomeType.compare("Normal")==0||outcomeType.compare("Quantile")==0){
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
+				if(outcomeType==outcomeNormal||outcomeType==outcomeQuantile){
 					fileName = fileStem + "_sigmaSqY.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
-				if(outcomeType.compare("Survival")==0){
+				if(outcomeType==outcomeSurvival){
 					fileName = fileStem + "_nu.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
 				if(responseExtraVar){
 					fileName = fileStem + "_epsilon.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 					fileName = fileStem + "_sigmaEpsilon.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 					fileName = fileStem + "_epsilonProp.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
 				if(nPredictSubjects>0){
 					fileName = fileStem + "_predictThetaRaoBlackwell.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
 				if (includeCAR){
 					fileName = fileStem + "_TauCAR.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 					fileName = fileStem + "_uCAR.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
 			}
 			if(varSelectType.compare("None")!=0){
 				fileName = fileStem + "_omega.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				fileName = fileStem + "_rho.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				fileName = fileStem + "_rhoOmegaProp.txt";
-				outFiles.push_back(new ofstream(fileName.c_str()));
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				if(varSelectType.compare("Continuous")!=0){
 					fileName = fileStem + "_gamma.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
-				if(covariateType.compare("Discrete")==0){
+				if(covariateType==covariateDiscrete){
 					fileName = fileStem + "_nullPhi.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
-				}else if(covariateType.compare("Normal")==0){
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
+				}else if(covariateType==covariateNormal){
 					fileName = fileStem + "_nullMu.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
-				}else if(covariateType.compare("Mixed")==0){
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
+				}else if(covariateType==covariateMixed){
 					fileName = fileStem + "_nullPhi.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 					fileName = fileStem + "_nullMu.txt";
-					outFiles.push_back(new ofstream(fileName.c_str()));
+					outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
 				}
 			}
+			// The summary is only written at the end of the run (by
+			// writePReMiuMPredictSummary), so it is the last file
+			if(predictSummary){
+				fileName = fileStem + "_predictSummary.txt";
+				outFiles.push_back(new mcmcOutputFile(fileName,outputFormat,false,nSweeps,nBurn,nFilter,reportBurnIn,compressOutput,false,sampler.resumeOffset(fileName)));
+			}
 		}
 
 		// File indices
@@ -2432,9 +3420,9 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 		int r=0;
 		nClustersInd=r++;
 		psiInd=r++;
-		if(covariateType.compare("Discrete")==0){
+		if(covariateType==covariateDiscrete){
 			phiInd=r++;
-		}else if(covariateType.compare("Normal")==0){
+		}else if(covariateType==covariateNormal){
 			muInd=r++;
 			SigmaInd=r++;
 			if (useHyperpriorR1||useIndependentNormal) R1Ind=r++;
@@ -2452,7 +3440,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 				kappa1Ind = r++;
 				kappa1PropInd = r++;
 			}
-		}else if(covariateType.compare("Mixed")==0){
+		}else if(covariateType==covariateMixed){
 			phiInd=r++;
 			muInd=r++;
 			SigmaInd=r++;
@@ -2486,10 +3474,10 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 			betaInd=r++;
 			thetaPropInd=r++;
 			betaPropInd=r++;
-			if(outcomeType.compare("Normal")==0||outcomeType.compare("Quantile")==0){
+			if(outcomeType==outcomeNormal||outcomeType==outcomeQuantile){
 				sigmaSqYInd=r++;
 			}
-			if(outcomeType.compare("Survival")==0){
+			if(outcomeType==outcomeSurvival){
 				nuInd=r++;
 			}
 			if(responseExtraVar){
@@ -2513,11 +3501,11 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 			if(varSelectType.compare("Continuous")!=0){
 				gammaInd=r++;
 			}
-			if(covariateType.compare("Discrete")==0){
+			if(covariateType==covariateDiscrete){
 				nullPhiInd=r++;
-			}else if (covariateType.compare("Normal")==0){
+			}else if (covariateType==covariateNormal){
 				nullMuInd=r++;
-			}else if (covariateType.compare("Mixed")==0){
+			}else if (covariateType==covariateMixed){
 				nullPhiInd=r++;
 				nullMuInd=r++;
 			}
@@ -2532,7 +3520,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 			*(outFiles[psiInd]) << exp(params.logPsi(c));
 			if(includeResponse){
 				// Print theta
-				if(outcomeType.compare("Categorical")==0){
+				if(outcomeType==outcomeCategorical){
 					for (unsigned int k=0;k<nCategoriesY;k++){
 						*(outFiles[thetaInd]) << params.theta(c,k);
 						if (k<(nCategoriesY-1)) {
@@ -2565,7 +3553,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 
 		unsigned int maxNCategories=0;
 
-		if(covariateType.compare("Discrete")==0){
+		if(covariateType==covariateDiscrete){
 			for(unsigned int j=0;j<nCovariates;j++){
 				if(nCategories[j]>maxNCategories){
 					maxNCategories=nCategories[j];
@@ -2591,7 +3579,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 				}
 			}
 			*(outFiles[phiInd]) << endl;
-		}else if(covariateType.compare("Normal")==0){
+		}else if(covariateType==covariateNormal){
 			// To make the output comparable with discrete, we will write the
 			// output grouped by covariate (for each cluster)
 			for(unsigned int j=0;j<nCovariates;j++){
@@ -2742,7 +3730,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 			}
 
 
-		}else if(covariateType.compare("Mixed")==0){
+		}else if(covariateType==covariateMixed){
 			for(unsigned int j=0;j<nDiscreteCovs;j++){
 				if(nCategories[j]>maxNCategories){
 					maxNCategories=nCategories[j];
@@ -2921,7 +3909,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 
 
 		if(includeResponse){
-			if(outcomeType.compare("Categorical")==0){
+			if(outcomeType==outcomeCategorical){
 				// Print beta
 				for(unsigned int j=0;j<nFixedEffects;j++){
 					for (unsigned int k=0;k<nCategoriesY;k++){
@@ -2932,10 +3920,10 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 					}
 				}
 			} else {
-				if(outcomeType.compare("Normal")==0||outcomeType.compare("Quantile")==0){
+				if(outcomeType==outcomeNormal||outcomeType==outcomeQuantile){
 					*(outFiles[sigmaSqYInd]) << params.sigmaSqY() << endl;
 				}
-				if(outcomeType.compare("Survival")==0){
+				if(outcomeType==outcomeSurvival){
 				// Print parameter nu for each cluster
 					if (weibullFixedShape){
 						*(outFiles[nuInd]) << params.nu(0) << endl;
@@ -3008,6 +3996,12 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 			}
 		}
 
+		// Add the predicted responses of the sweeps after the burn in to
+		// their running moments
+		if(predictSummary&&sweep>nBurn){
+			sampler.chain().currentState().parameters().addWorkPredictY(pReMiuMPredictedY(params,sampler.model()));
+		}
+
 		// Print alpha
 		if(fixedAlpha<=-1||sweep==0){
 			*(outFiles[alphaInd]) << params.alpha() << endl;
@@ -3043,15 +4037,13 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 				}
 				if(responseExtraVar){
 					vector<double> meanVec(nSubjects,0.0);
-					if(outcomeType.compare("Poisson")==0){
+					if(outcomeType==outcomePoisson){
 						meanVec=dataset.logOffset();
 					}
 					for(unsigned int i=0;i<nSubjects;i++){
 						int zi = params.z(i);
 						double meanVal = meanVec[i]+params.theta(zi,0);
-						for(unsigned int j=0;j<nFixedEffects;j++){
-							meanVal+=params.beta(j,0)*dataset.W(i,j);
-						}
+						meanVal+=params.workLinearPredictor(i,0);
 						double eps=params.lambda(i)-meanVal;
 						*(outFiles[epsilonInd]) << eps;
 						if(i<nSubjects-1){
@@ -3095,7 +4087,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 					*(outFiles[rhoInd]) << endl;
 				}
 				if(sweep!=0){ // this was "==0", it might be worth double checking 
-					if(covariateType.compare("Discrete")==0){
+					if(covariateType==covariateDiscrete){
 						for(unsigned int p=0;p<maxNCategories;p++){
 							if(p<nCategories[j]){
 								*(outFiles[nullPhiInd]) << exp(params.logNullPhi(j,p));
@@ -3110,7 +4102,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 							}
 
 						}
-					}else if(covariateType.compare("Normal")==0){
+					}else if(covariateType==covariateNormal){
 						*(outFiles[nullMuInd]) << params.nullMu(j);
 						if(j<nCovariates-1){
 							*(outFiles[nullMuInd]) << " ";
@@ -3118,7 +4110,7 @@ void writePReMiuMOutput(mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropPara
 							*(outFiles[nullMuInd]) << endl;
 						}
 
-					}else if(covariateType.compare("Mixed")==0){
+					}else if(covariateType==covariateMixed){
 						if (j < nDiscreteCovs){
 							for(unsigned int p=0;p<maxNCategories;p++){
 								if(p<nCategories[j]){
@@ -3181,6 +4173,7 @@ string storeLogFileData(const pReMiuMOptions& options,
 								const pReMiuMHyperParams& hyperParams,
 								const unsigned int& nClusInit,
 								const unsigned int& maxNClusters,
+								const unsigned int& nSweepsDone,
 								const double& timeInSecs){
 
 	ostringstream tmpStr;
@@ -3199,6 +4192,36 @@ string storeLogFileData(const pReMiuMOptions& options,
 	}else{
 		tmpStr << endl;
 	}
+	tmpStr << "Number of threads: " << options.nThreads();
+#ifndef _OPENMP
+	tmpStr << " (ignored, compiled without OpenMP)";
+#endif
+	tmpStr << endl;
+	tmpStr << "Parallel updates of the clusters: " << (options.parallelClusters()?"True":"False") << endl;
+	tmpStr << "Concurrent proposals: " << (options.parallelProposals()?"True":"False") << endl;
+	tmpStr << "Number of chains: " << options.nChains() << endl;
+	tmpStr << "Output format: " << options.outputFormat() << endl;
+	tmpStr << "Record timings: " << (options.recordTimings()?"True":"False") << endl;
+	tmpStr << "Status file: " << (options.writeStatus()?"True":"False") << endl;
+	tmpStr << "Data cache: " << (options.dataCache()?"True":"False") << endl;
+	tmpStr << "Compact covariates: " << (options.compactCovariates()||options.singlePrecisionCovariates()?"True":"False");
+	if(options.singlePrecisionCovariates()){
+		tmpStr << " (single precision)";
+	}
+	tmpStr << endl;
+	tmpStr << "Compressed output: " << (options.compressOutput()?"True":"False") << endl;
+	tmpStr << "Delta encoded allocations: " << (options.deltaZ()?"True":"False") << endl;
+	tmpStr << "Asynchronous output: " << (options.asyncOutput()?"True":"False") << endl;
+	tmpStr << "Random number generator: " << options.rngType() << endl;
+	tmpStr << "Checkpoint every: " << options.checkpointEvery() << " sweeps" << endl;
+	if(options.resumeFileName().compare("")!=0){
+		tmpStr << "Resumed from: " << options.resumeFileName() << endl;
+	}
+	if(options.monitorConvergence()){
+		tmpStr << "Convergence checked every: " << options.monitorEvery() << " sweeps" << endl;
+		tmpStr << "Target effective sample size: " << options.targetESS() << endl;
+		tmpStr << "Target split R-hat: " << options.targetRhat() << endl;
+	}
 	tmpStr << "Covariates: " << endl;
 	if(options.covariateType().compare("Mixed")==0){
 		tmpStr << "Number of discrete covariates: " << dataset.nDiscreteCovs() << endl;
@@ -3253,6 +4276,9 @@ string storeLogFileData(const pReMiuMOptions& options,
 	}else{
 		tmpStr << "Compute allocation entropy: False" << endl;
 	}
+	if(options.predictSummary()){
+		tmpStr << "Prediction summary: True" << endl;
+	}
 
 	tmpStr << "Model for X: " << options.covariateType() << endl;
 	tmpStr << "Variable selection: " << options.varSelectType() << endl;
@@ -3339,13 +4365,15 @@ string storeLogFileData(const pReMiuMOptions& options,
 	}
 
 	if(options.includeCAR()){
+		tmpStr << "Chromatic update of the spatial random effects: " << (options.chromaticCAR()?"True":"False") << endl;
+		tmpStr << "Number of colours of the neighbourhood graph: " << dataset.neighbourColours().size() << endl;
 		tmpStr << "shapeTauCAR: " << endl;
 		tmpStr << hyperParams.shapeTauCAR() << endl;
 		tmpStr << "rateTauCAR:" << endl;
 		tmpStr << hyperParams.rateTauCAR() << endl;
 	}
 
-	tmpStr << endl << options.nSweeps()+options.nBurn() << " sweeps done in " <<
+	tmpStr << endl << nSweepsDone << " sweeps done in " <<
 				timeInSecs << " seconds" << endl;
 
 	return tmpStr.str();
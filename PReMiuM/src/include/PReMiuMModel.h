@@ -38,6 +38,7 @@
 #include<numeric>
 #include<limits>
 #include<map>
+#include<algorithm>
 
 #include<boost/math/distributions/normal.hpp>
 #include<boost/math/distributions/gamma.hpp>
@@ -899,6 +900,34 @@ class pReMiuMHyperParams{
 
 };
 
+/// \brief The parts of the parameters (with the working values kept up to
+/// date with them) that the proposals declare they read or write, as bits
+/// of a mask. Proposals with no declared parts read and write all of them.
+/// Only used when the proposals of a sweep are run concurrently.
+enum pReMiuMStatePart {
+	statePsi=1u<<0,			// v and logPsi
+	stateU=1u<<1,			// u and workMinUi
+	stateAlpha=1u<<2,
+	stateZ=1u<<3,			// z, workMaxZi, the members and the capacity
+	statePhi=1u<<4,			// logPhi and workLogPhiStar
+	stateMu=1u<<5,			// mu and workMuStar
+	stateTau=1u<<6,			// Tau, TauR, TauS, Tau_Indep, Sigma and their factorisations
+	stateGamma=1u<<7,		// gamma, rho, omega, nullPhi and nullMu
+	stateTheta=1u<<8,
+	stateBeta=1u<<9,		// beta and workLinearPredictor
+	stateLambda=1u<<10,
+	stateTauEpsilon=1u<<11,
+	stateUCAR=1u<<12,
+	stateTauCAR=1u<<13,
+	stateNu=1u<<14,
+	stateSigmaSqY=1u<<15,
+	stateKappa1=1u<<16,
+	stateR1=1u<<17,			// R1, R1_Indep and beta_taus
+	stateMu00=1u<<18,
+	stateTau00=1u<<19,
+	stateWorkspace=1u<<20	// the workspace of the proposal parameters
+};
+
 
 /// \class pReMiuMParams PReMiuMModel.h "PReMiuMModel.h"
 /// \brief A class for PReMiuM parameters
@@ -906,7 +935,7 @@ class pReMiuMParams{
 
 	public:
 		/// \brief Default constructor
-		pReMiuMParams(){};
+		pReMiuMParams() : _workSharedX(NULL), _workNPredictSamples(0) {};
 
 		/// \brief Destructor
 		~pReMiuMParams(){};
@@ -940,6 +969,8 @@ class pReMiuMParams{
 				maxNClusters=nClusInit;
 			}
 			_maxNClusters = maxNClusters;
+			_workClusterCapacity = maxNClusters;
+			_workNCapacityResizes = 0;
 
 			// Resize all the objects and set to 0
 			_logPsi.resize(maxNClusters);
@@ -948,7 +979,6 @@ class pReMiuMParams{
 			}
 			_v.resize(maxNClusters);
 			_logPhi.resize(maxNClusters);
-			_workLogPhiStar.resize(maxNClusters);
 			_mu.resize(maxNClusters);
 			_workMuStar.resize(maxNClusters);
 			_Sigma_blank.resize(maxNClusters);
@@ -1023,7 +1053,6 @@ class pReMiuMParams{
 
 				if (covariateType.compare("Discrete")==0) {
 					_logPhi[c].resize(nCovariates);
-					_workLogPhiStar[c].resize(nCovariates);
 				} else if (covariateType.compare("Normal")==0) {
 					_mu[c].setZero(nCovariates);
 					_workMuStar[c].setZero(nCovariates);
@@ -1052,7 +1081,6 @@ class pReMiuMParams{
 
 				} else if (covariateType.compare("Mixed")==0) {
 					_logPhi[c].resize(nDiscreteCov);
-					_workLogPhiStar[c].resize(nDiscreteCov);
 					_mu[c].setZero(nContinuousCov);
 					_workMuStar[c].setZero(nContinuousCov);
 					_Sigma_blank[c] = false;
@@ -1089,14 +1117,12 @@ class pReMiuMParams{
 							_logNullPhi[j].resize(nCategories[j]);
 						}
 						_logPhi[c][j].resize(nCategories[j]);
-						_workLogPhiStar[c][j].resize(nCategories[j]);
 						for(unsigned int p=0;p<nCategories[j];p++){
 							// We set logPhi to 0.0 so that we can call
 							// normal member function above when we actually
 							// initialise (allowing workLogPXiGivenZi to be
 							// correctly calculated)
 							_logPhi[c][j][p]=0.0;
-							_workLogPhiStar[c][j][p]=0.0;
 							if(c==0){
 								_logNullPhi[j][p]=0.0;
 							}
@@ -1110,6 +1136,21 @@ class pReMiuMParams{
 				}
 			}
 
+			// The working phi star values are stored contiguously, cluster
+			// major, with each covariate padded to the largest number of
+			// categories
+			_workNLogPhiStarCovs = 0;
+			_workLogPhiStarStride = 0;
+			if (covariateType.compare("Discrete")==0||covariateType.compare("Mixed")==0){
+				_workNLogPhiStarCovs = nDiscrCovs;
+				for(unsigned int j=0;j<nDiscrCovs;j++){
+					if(nCategories[j]>_workLogPhiStarStride){
+						_workLogPhiStarStride=nCategories[j];
+					}
+				}
+			}
+			_workLogPhiStar.assign(maxNClusters*_workNLogPhiStarCovs*_workLogPhiStarStride,0.0);
+
 			_theta.resize(maxNClusters);
 			for (unsigned int c=0;c<maxNClusters;c++){
 				_theta[c].resize(nCategoriesY);
@@ -1120,29 +1161,53 @@ class pReMiuMParams{
 			}
 			_u.resize(nSubjects+nPredictSubjects,0.0);
 			_lambda.resize(nSubjects);
+			_workLinearPredictor.assign(nCategoriesY,vector<double>(nSubjects,0.0));
 			_z.resize(nSubjects+nPredictSubjects);
 			_rho.resize(nCovariates);
 			_omega.resize(nCovariates);
 			_workNXInCluster.resize(maxNClusters,0);
-			_workDiscreteX.resize(nSubjects+nPredictSubjects);
-			_workContinuousX.resize(nSubjects+nPredictSubjects);
+			_workClusterMembers.resize(maxNClusters);
+			_workNuNEvents.resize(maxNClusters,0.0);
+			_workNuSumEventLogT.resize(maxNClusters,0.0);
+			_workNuLogT.resize(maxNClusters);
+			_workNuRate.resize(maxNClusters);
+			if (covariateType.compare("Normal")==0){
+				_workNSuffStatCovs=nCovariates;
+			} else if (covariateType.compare("Mixed")==0){
+				_workNSuffStatCovs=nContinuousCov;
+			} else {
+				_workNSuffStatCovs=0;
+			}
+			_workXShift.setZero(_workNSuffStatCovs);
+			if(_workNSuffStatCovs>0){
+				_workSumX.resize(maxNClusters);
+				_workSumXXt.resize(maxNClusters);
+				_workSumXSq.resize(maxNClusters);
+				for (unsigned int c=0;c<maxNClusters;c++){
+					_workSumX[c].setZero(_workNSuffStatCovs);
+					if (useIndependentNormal){
+						_workSumXSq[c].setZero(_workNSuffStatCovs);
+					} else {
+						_workSumXXt[c].setZero(_workNSuffStatCovs,_workNSuffStatCovs);
+					}
+				}
+			}
+			if (covariateType.compare("Discrete")==0||covariateType.compare("Normal")==0){
+				_workNDiscreteX=nCovariates;
+			} else {
+				_workNDiscreteX=nDiscreteCov;
+			}
 			_workLogPXiGivenZi.resize(nSubjects);
 			_workPredictExpectedTheta.resize(nPredictSubjects);
 			for (unsigned int i=0;i<nPredictSubjects;i++){
 				_workPredictExpectedTheta[i].resize(nCategoriesY);
 			}
 			_workEntropy.resize(nSubjects+nPredictSubjects,0);
-			for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
-				if (covariateType.compare("Discrete")==0||covariateType.compare("Normal")==0){
-					_workDiscreteX[i].resize(nCovariates,0);
-					_workContinuousX[i].resize(nCovariates,0);
-				} else {
-					_workDiscreteX[i].resize(nDiscreteCov,0);
-					_workContinuousX[i].resize(nContinuousCov,0);
-				}
-				if(i<nSubjects){
-					_workLogPXiGivenZi[i]=0;
-				}
+			_workNPredictSamples=0;
+			_workPredictMeanY.clear();
+			_workPredictSumSqDevY.clear();
+			for(unsigned int i=0;i<nSubjects;i++){
+				_workLogPXiGivenZi[i]=0;
 			}
 			_uCAR.resize(nSubjects);
 			if (weibullFixedShape) {
@@ -1162,10 +1227,18 @@ class pReMiuMParams{
 				const string covariateType, const bool useIndependentNormal, const bool useSeparationPrior){
 			_maxNClusters=nClus;
 
-			// Check if we need to do a resize of the
-			// number of various vectors
-			unsigned int prevNClus = _logPsi.size();
+			// The per cluster objects are only resized when the number of
+			// clusters goes beyond their capacity, which then grows by half
+			// (and never shrinks), so that the clusters that become active
+			// again reuse the objects already allocated for them
+			unsigned int prevNClus = _workClusterCapacity;
 			if(nClus>prevNClus){
+				unsigned int capacity = prevNClus+prevNClus/2;
+				if(capacity<nClus){
+					capacity=nClus;
+				}
+				_workClusterCapacity=capacity;
+				_workNCapacityResizes++;
 				unsigned int nCov=nCovariates();
 				unsigned int nDiscrCovs=nDiscreteCovs();
 				unsigned int nDCovs = 0;
@@ -1173,84 +1246,101 @@ class pReMiuMParams{
 				vector<unsigned int> nCats=nCategories();
 				unsigned int nCategoriesY = _theta[0].size();
 
-				_logPsi.resize(nClus);
-				_v.resize(nClus);
-				_theta.resize(nClus);
-				if (_nu.size()>1) _nu.resize(nClus);
-				for (unsigned int c=0;c<nClus;c++){
+				_logPsi.resize(capacity);
+				_v.resize(capacity);
+				_theta.resize(capacity);
+				if (_nu.size()>1) _nu.resize(capacity);
+				for (unsigned int c=0;c<capacity;c++){
 					_theta[c].resize(nCategoriesY);
 				}
-				_workNXInCluster.resize(nClus);
+				_workNXInCluster.resize(capacity);
+				_workClusterMembers.resize(capacity);
+				_workNuNEvents.resize(capacity,0.0);
+				_workNuSumEventLogT.resize(capacity,0.0);
+				_workNuLogT.resize(capacity);
+				_workNuRate.resize(capacity);
+				if(_workNSuffStatCovs>0){
+					_workSumX.resize(capacity);
+					_workSumXXt.resize(capacity);
+					_workSumXSq.resize(capacity);
+					for(unsigned int c=prevNClus;c<capacity;c++){
+						_workSumX[c].setZero(_workNSuffStatCovs);
+						if(useIndependentNormal){
+							_workSumXSq[c].setZero(_workNSuffStatCovs);
+						}else{
+							_workSumXXt[c].setZero(_workNSuffStatCovs,_workNSuffStatCovs);
+						}
+					}
+				}
 				if (covariateType.compare("Discrete")==0){
-					_logPhi.resize(nClus);
-					_workLogPhiStar.resize(nClus);
+					_logPhi.resize(capacity);
+					_workLogPhiStar.resize(capacity*_workNLogPhiStarCovs*_workLogPhiStarStride,0.0);
 				} else if (covariateType.compare("Normal")==0){
-						_mu.resize(nClus);
-						_workMuStar.resize(nClus);
-						_Sigma_blank.resize(nClus);
+						_mu.resize(capacity);
+						_workMuStar.resize(capacity);
+						_Sigma_blank.resize(capacity);
 						if (useIndependentNormal) {
-							_Tau_Indep.resize(nClus);
-							_Sigma_Indep.resize(nClus);
+							_Tau_Indep.resize(capacity);
+							_Sigma_Indep.resize(capacity);
 						}else if (useSeparationPrior) {
-							_SigmaR_blank.resize(nClus);
-							_SigmaS_blank.resize(nClus);
-							_TauR.resize(nClus);
-							_workSqrtTauR.resize(nClus);
-							_workLogDetTauR.resize(nClus);
-							_TauS.resize(nClus);
-							_workLogDetTauS.resize(nClus);
-							_Tau.resize(nClus);
-							_workSqrtTau.resize(nClus);
-							_workLogDetTau.resize(nClus);
-							_Sigma.resize(nClus);
-							_SigmaR.resize(nClus);
-							_SigmaS.resize(nClus);
+							_SigmaR_blank.resize(capacity);
+							_SigmaS_blank.resize(capacity);
+							_TauR.resize(capacity);
+							_workSqrtTauR.resize(capacity);
+							_workLogDetTauR.resize(capacity);
+							_TauS.resize(capacity);
+							_workLogDetTauS.resize(capacity);
+							_Tau.resize(capacity);
+							_workSqrtTau.resize(capacity);
+							_workLogDetTau.resize(capacity);
+							_Sigma.resize(capacity);
+							_SigmaR.resize(capacity);
+							_SigmaS.resize(capacity);
 
 						}else {
-							_Tau.resize(nClus);
-							_workSqrtTau.resize(nClus);
-							_workLogDetTau.resize(nClus);
-							_Sigma.resize(nClus);
+							_Tau.resize(capacity);
+							_workSqrtTau.resize(capacity);
+							_workLogDetTau.resize(capacity);
+							_Sigma.resize(capacity);
 						}
 						
 				} else if (covariateType.compare("Mixed")==0){
-					_logPhi.resize(nClus);
-					_workLogPhiStar.resize(nClus);
-					_mu.resize(nClus);
-					_workMuStar.resize(nClus);
-					_Sigma_blank.resize(nClus);
+					_logPhi.resize(capacity);
+					_workLogPhiStar.resize(capacity*_workNLogPhiStarCovs*_workLogPhiStarStride,0.0);
+					_mu.resize(capacity);
+					_workMuStar.resize(capacity);
+					_Sigma_blank.resize(capacity);
 					if (useIndependentNormal) {
-						_Tau_Indep.resize(nClus);
-						_Sigma_Indep.resize(nClus);
+						_Tau_Indep.resize(capacity);
+						_Sigma_Indep.resize(capacity);
 					}
 					else if (useSeparationPrior) {
-						_SigmaR_blank.resize(nClus);
-						_SigmaS_blank.resize(nClus);
-						_TauR.resize(nClus);
-						_workSqrtTauR.resize(nClus);
-						_workLogDetTauR.resize(nClus);
-						_TauS.resize(nClus);
-						_workLogDetTauS.resize(nClus);
-						_Tau.resize(nClus);
-						_workSqrtTau.resize(nClus);
-						_workLogDetTau.resize(nClus);
-						_Sigma.resize(nClus);
-						_SigmaR.resize(nClus);
-						_SigmaS.resize(nClus);
+						_SigmaR_blank.resize(capacity);
+						_SigmaS_blank.resize(capacity);
+						_TauR.resize(capacity);
+						_workSqrtTauR.resize(capacity);
+						_workLogDetTauR.resize(capacity);
+						_TauS.resize(capacity);
+						_workLogDetTauS.resize(capacity);
+						_Tau.resize(capacity);
+						_workSqrtTau.resize(capacity);
+						_workLogDetTau.resize(capacity);
+						_Sigma.resize(capacity);
+						_SigmaR.resize(capacity);
+						_SigmaS.resize(capacity);
 
 					}else {
-						_Tau.resize(nClus);
-						_workSqrtTau.resize(nClus);
-						_workLogDetTau.resize(nClus);
-						_Sigma.resize(nClus);
+						_Tau.resize(capacity);
+						_workSqrtTau.resize(capacity);
+						_workLogDetTau.resize(capacity);
+						_Sigma.resize(capacity);
 					}
 				}
-				_gamma.resize(nClus);
-				for(unsigned int c=prevNClus;c<nClus;c++){
+				_gamma.resize(capacity);
+				for(unsigned int c=prevNClus;c<capacity;c++){
 					_workNXInCluster[c]=0;
 					if (covariateType.compare("Discrete")==0){
 						_logPhi[c].resize(nCov);
-						_workLogPhiStar[c].resize(nCov);
 					} else if (covariateType.compare("Normal")==0){
 							_mu[c].setZero(nCov);
 							_workMuStar[c].setZero(nCov);
@@ -1277,7 +1367,6 @@ class pReMiuMParams{
 							}
 					} else if (covariateType.compare("Mixed")==0){
 						_logPhi[c].resize(nDiscrCovs);
-						_workLogPhiStar[c].resize(nDiscrCovs);
 						_mu[c].setZero(nContCovs);
 						_workMuStar[c].setZero(nContCovs);
 						_Sigma_blank[c] = false;
@@ -1311,14 +1400,12 @@ class pReMiuMParams{
 						}
 						for(unsigned int j=0;j<nDCovs;j++){
 							_logPhi[c][j].resize(nCats[j]);
-							_workLogPhiStar[c][j].resize(nCats[j]);
 							for(unsigned int p=0;p<nCats[j];p++){
 								// We set logPhi to 0.0 so that we can call
 								// normal member function above when we actually
 								// initialise (allowing workLogPXiGivenZi to be
 								// correctly calculated)
 								_logPhi[c][j][p]=0.0;
-								_workLogPhiStar[c][j][p]=0.0;
 							}
 							// Everything in by default
 							// This allows us to write general case with switches.
@@ -1464,7 +1551,7 @@ class pReMiuMParams{
 					_workLogPXiGivenZi[i]+=(logPhiStarNew[Xij]-logPhiStar);
 				}
 			}
-			_workLogPhiStar[c][j]=logPhiStarNew;
+			workLogPhiStar(c,j,logPhiStarNew);
 			_logPhi[c][j]=logPhiVec;
 
 		}
@@ -1507,7 +1594,7 @@ class pReMiuMParams{
 
 			}
 			for(unsigned int c=0;c<nClusters;c++){
-				_workLogPhiStar[c][j]=logPhiStarNew[c];
+				workLogPhiStar(c,j,logPhiStarNew[c]);
 			}
 			_logNullPhi[j]=logNullPhiVec;
 
@@ -1923,9 +2010,14 @@ class pReMiuMParams{
 			return _Sigma_blank;
 		}
 
-		//\brief set whether the Sigma for cluster c is blank or not
+		//\brief set whether the Sigma for cluster c is blank or not. The
+		// flags are packed in bits, so they are only written when they change,
+		// which lets the clusters be updated from different threads once the
+		// flags are set
 		void Sigma_blank(const unsigned int& c, const bool& blank) {
-			_Sigma_blank[c] = blank;
+			if (_Sigma_blank[c] != blank) {
+				_Sigma_blank[c] = blank;
+			}
 
 		}
 
@@ -2145,13 +2237,13 @@ class pReMiuMParams{
 		}
 
 		/// \brief Set the ith allocation variable to cluster c
-		void z(const unsigned int& i,const int& c,const string& covariateType, const bool useIndependentNormal){
+		void z(const unsigned int& i,const int& c,const pReMiuMCovariateType& covariateType, const bool useIndependentNormal){
 			unsigned int nCov = nCovariates();
 			unsigned int nDiscreteCov = nDiscreteCovs();
 			unsigned int nContinuousCov = nContinuousCovs();
 
 			if(i<nSubjects()){
-				if(covariateType.compare("Discrete")==0){
+				if(covariateType==covariateDiscrete){
 					for(unsigned int j=0;j<nCov;j++){
 						unsigned int zi = z(i);
 						int Xij=workDiscreteX(i,j);
@@ -2160,7 +2252,7 @@ class pReMiuMParams{
 						logPhiStarNew = workLogPhiStar(c,j,Xij);
 						_workLogPXiGivenZi[i]+=(logPhiStarNew-logPhiStar);
 					}
-				}else if(covariateType.compare("Normal")==0){
+				}else if(covariateType==covariateNormal){
 					if(Sigma_blank(0)){
 						VectorXd xi=VectorXd::Zero(nCov);
 						for(unsigned int j=0;j<nCov;j++){
@@ -2180,7 +2272,7 @@ class pReMiuMParams{
 						}
 
 					}
-				}else if(covariateType.compare("Mixed")==0){
+				}else if(covariateType==covariateMixed){
 					for(unsigned int j=0;j<nDiscreteCov;j++){
 						unsigned int zi = z(i);
 						int Xij=workDiscreteX(i,j);
@@ -2254,13 +2346,13 @@ class pReMiuMParams{
 
 				for(unsigned int i=0;i<nSbj;i++){
 					unsigned int c=z(i);
-					int Xij=_workDiscreteX[i][j];
+					int Xij=workDiscreteX(i,j);
 					double logPhiStar;
 					logPhiStar = workLogPhiStar(c,j,Xij);
 					_workLogPXiGivenZi[i]+=(logPhiStarNew[c][Xij]-logPhiStar);
 				}
 				for(unsigned int c=0;c<nClusters;c++){
-					_workLogPhiStar[c][j]=logPhiStarNew[c];
+					workLogPhiStar(c,j,logPhiStarNew[c]);
 				}
 			}else if(covariateType.compare("Normal")==0){
 				if(Sigma_blank(0)){
@@ -2304,13 +2396,13 @@ class pReMiuMParams{
 
 					for(unsigned int i=0;i<nSbj;i++){
 						unsigned int c=z(i);
-						int Xij=_workDiscreteX[i][j];
+						int Xij=workDiscreteX(i,j);
 						double logPhiStar;
 						logPhiStar = workLogPhiStar(c,j,Xij);
 						_workLogPXiGivenZi[i]+=(logPhiStarNew[c][Xij]-logPhiStar);
 					}
 					for(unsigned int c=0;c<nClusters;c++){
-						_workLogPhiStar[c][j]=logPhiStarNew[c];
+						workLogPhiStar(c,j,logPhiStarNew[c]);
 					}
 				} else {
 					if(Sigma_blank(0)){
@@ -2374,7 +2466,7 @@ class pReMiuMParams{
 						_workLogPXiGivenZi[i]+=(logPhiStarNew[Xij]-logPhiStar);
 					}
 				}
-				_workLogPhiStar[c][j] = logPhiStarNew;
+				workLogPhiStar(c,j,logPhiStarNew);
 
 			}else if(covariateType.compare("Normal")==0){
 				if(Sigma_blank(0)){
@@ -2416,7 +2508,7 @@ class pReMiuMParams{
 							_workLogPXiGivenZi[i]+=(logPhiStarNew[Xij]-logPhiStar);
 						}
 					}
-					_workLogPhiStar[c][j] = logPhiStarNew;
+					workLogPhiStar(c,j,logPhiStarNew);
 				} else {
 					if(Sigma_blank(0)){
 						VectorXd xi=VectorXd::Zero(nContCov);
@@ -2448,6 +2540,15 @@ class pReMiuMParams{
 
 		}
 
+		/// \brief Set the variable selection value for cluster c covariate j
+		/// without updating the working values
+		/// \note Internal to the variable selection update, which keeps
+		/// workLogPhiStar, workMuStar and workLogPXiGivenZi up to date itself.
+		/// Elsewhere use gamma(c,j,gammaVal,covariateType,useIndependentNormal).
+		void gammaNoWorkUpdate(const unsigned int& c, const unsigned int& j, const double& gammaVal){
+			_gamma[c][j]=gammaVal;
+		}
+
 		/// \brief Get the variable selection rho vector - in the continuous
 		/// case rho here is equivalent to zeta in the paper (and we copy
 		/// this value straight to
@@ -2523,7 +2624,7 @@ class pReMiuMParams{
 
 
 		/// \brief Return the vector _uCAR
-		vector<double> uCAR() const{
+		const vector<double>& uCAR() const{
 			return _uCAR;
 		}
 
@@ -2586,10 +2687,189 @@ class pReMiuMParams{
 			_workNXInCluster[c]=n;
 		}
 
+		/// \brief Return the fitting subjects allocated to each cluster
+		const vector<vector<unsigned int> >& workClusterMembers() const{
+			return _workClusterMembers;
+		}
+
+		/// \brief Return the fitting subjects allocated to cluster c
+		const vector<unsigned int>& workClusterMembers(const unsigned int& c) const{
+			return _workClusterMembers[c];
+		}
+
+		/// \brief Set the fitting subjects allocated to each cluster
+		void workClusterMembers(const vector<vector<unsigned int> >& clusterMembers){
+			for(unsigned int c=0;c<_workClusterMembers.size();c++){
+				if(c<clusterMembers.size()){
+					_workClusterMembers[c]=clusterMembers[c];
+				}else{
+					_workClusterMembers[c].clear();
+				}
+			}
+		}
+
+		/// \brief Compute the statistics of the Weibull likelihood of the
+		/// shape nu of cluster c (of all clusters for c=0 when the shape is
+		/// shared), from the given fitting subjects
+		/// \note For each subject the log of the survival time and the rate
+		/// exp(theta_zi+W_i beta) are kept, so the log posterior of nu and its
+		/// derivative are evaluated in one pass over the subjects for each
+		/// point of the adaptive rejection sampler. The rates depend on theta
+		/// and beta, so the statistics are only valid during the update of nu.
+		/// Different clusters can be computed in parallel.
+		void workNuStats(const unsigned int& c,const vector<unsigned int>& subjects,
+				const vector<double>& survivalTime,const vector<unsigned int>& censoring){
+			unsigned int nMembers = subjects.size();
+			vector<double>& logT = _workNuLogT[c];
+			vector<double>& rate = _workNuRate[c];
+			logT.resize(nMembers);
+			rate.resize(nMembers);
+			double nEvents=0.0,sumEventLogT=0.0;
+			for(unsigned int k=0;k<nMembers;k++){
+				unsigned int i = subjects[k];
+				logT[k]=log(survivalTime[i]);
+				rate[k]=exp(_theta[_z[i]][0]+_workLinearPredictor[0][i]);
+				if(censoring[i]){
+					nEvents+=censoring[i];
+					sumEventLogT+=censoring[i]*logT[k];
+				}
+			}
+			_workNuNEvents[c]=nEvents;
+			_workNuSumEventLogT[c]=sumEventLogT;
+		}
+
+		/// \brief Return the number of events in the statistics of nu of cluster c
+		double workNuNEvents(const unsigned int& c) const{
+			return _workNuNEvents[c];
+		}
+
+		/// \brief Return the sum of the log survival times of the events in
+		/// the statistics of nu of cluster c
+		double workNuSumEventLogT(const unsigned int& c) const{
+			return _workNuSumEventLogT[c];
+		}
+
+		/// \brief Return the log survival times in the statistics of nu of
+		/// cluster c
+		const vector<double>& workNuLogT(const unsigned int& c) const{
+			return _workNuLogT[c];
+		}
+
+		/// \brief Return the Weibull rates in the statistics of nu of cluster c
+		const vector<double>& workNuRate(const unsigned int& c) const{
+			return _workNuRate[c];
+		}
+
+		/// \brief Return the number of continuous covariates with per cluster
+		/// sufficient statistics (zero for discrete covariates)
+		unsigned int workNSuffStatCovs() const{
+			return _workNSuffStatCovs;
+		}
+
+		/// \brief Return the centre about which the sufficient statistics are taken
+		const VectorXd& workXShift() const{
+			return _workXShift;
+		}
+
+		/// \brief Return the sum of (x_i-shift) over the fitting subjects in cluster c
+		const VectorXd& workSumX(const unsigned int& c) const{
+			return _workSumX[c];
+		}
+
+		/// \brief Return the sum of (x_i-shift)(x_i-shift)' over the fitting
+		/// subjects in cluster c (full covariance model only). Only the lower
+		/// triangle is maintained
+		const MatrixXd& workSumXXt(const unsigned int& c) const{
+			return _workSumXXt[c];
+		}
+
+		/// \brief Return the elementwise sum of (x_i-shift)^2 over the fitting
+		/// subjects in cluster c (independent model only)
+		const VectorXd& workSumXSq(const unsigned int& c) const{
+			return _workSumXSq[c];
+		}
+
+		/// \brief Recompute the sufficient statistics from the working X and
+		/// the cluster members, centring them on the covariate means
+		void workSufficientStats(const bool useIndependentNormal){
+			if(_workNSuffStatCovs==0){
+				return;
+			}
+			unsigned int nSbj = nSubjects();
+			_workXShift.setZero(_workNSuffStatCovs);
+			for(unsigned int i=0;i<nSbj;i++){
+				for(unsigned int j=0;j<_workNSuffStatCovs;j++){
+					_workXShift(j)+=workContinuousX(i,j);
+				}
+			}
+			if(nSbj>0){
+				_workXShift/=(double)nSbj;
+			}
+			for(unsigned int c=0;c<_workSumX.size();c++){
+				_workSumX[c].setZero(_workNSuffStatCovs);
+				if(useIndependentNormal){
+					_workSumXSq[c].setZero(_workNSuffStatCovs);
+				}else{
+					_workSumXXt[c].setZero(_workNSuffStatCovs,_workNSuffStatCovs);
+				}
+				for(unsigned int k=0;k<_workClusterMembers[c].size();k++){
+					workAddSufficientStats(_workClusterMembers[c][k],c,useIndependentNormal);
+				}
+			}
+		}
+
+		/// \brief Add the contribution of fitting subject i to cluster c
+		void workAddSufficientStats(const unsigned int& i,const unsigned int& c,
+				const bool useIndependentNormal){
+			if(_workNSuffStatCovs==0){
+				return;
+			}
+			VectorXd yi(_workNSuffStatCovs);
+			for(unsigned int j=0;j<_workNSuffStatCovs;j++){
+				yi(j)=workContinuousX(i,j)-_workXShift(j);
+			}
+			_workSumX[c]+=yi;
+			if(useIndependentNormal){
+				_workSumXSq[c]+=yi.cwiseProduct(yi);
+			}else{
+				_workSumXXt[c].selfadjointView<Lower>().rankUpdate(yi);
+			}
+		}
+
+		/// \brief Remove the contribution of fitting subject i from cluster c
+		void workRemoveSufficientStats(const unsigned int& i,const unsigned int& c,
+				const bool useIndependentNormal){
+			if(_workNSuffStatCovs==0){
+				return;
+			}
+			VectorXd yi(_workNSuffStatCovs);
+			for(unsigned int j=0;j<_workNSuffStatCovs;j++){
+				yi(j)=workContinuousX(i,j)-_workXShift(j);
+			}
+			_workSumX[c]-=yi;
+			if(useIndependentNormal){
+				_workSumXSq[c]-=yi.cwiseProduct(yi);
+			}else{
+				_workSumXXt[c].selfadjointView<Lower>().rankUpdate(yi,-1.0);
+			}
+		}
+
 		const unsigned int& workMaxZi() const{
 			return _workMaxZi;
 		}
 
+		/// \brief Return the number of clusters the per cluster objects are
+		/// allocated for
+		unsigned int workClusterCapacity() const{
+			return _workClusterCapacity;
+		}
+
+		/// \brief Return the number of times the capacity of the per cluster
+		/// objects has grown
+		unsigned int workNCapacityResizes() const{
+			return _workNCapacityResizes;
+		}
+
 		void workMaxZi(const unsigned int& maxZ){
 			_workMaxZi=maxZ;
 		}
@@ -2602,40 +2882,88 @@ class pReMiuMParams{
 			_workMinUi=minUi;
 		}
 
-		const vector<vector<int> >& workDiscreteX() const {
+		/// \brief Set the working copy of the covariates from the data set. If
+		/// the data set has packed its covariates they are shared rather than
+		/// copied: the data set holds the imputed values as well (see
+		/// updateMissingPReMiuMData), so it has to outlive these parameters.
+		void workCovariates(const pReMiuMData& dataset){
+			unsigned int nRows=dataset.nSubjects()+dataset.nPredictSubjects();
+			if(dataset.useCompactX()){
+				_workSharedX=&dataset;
+				vector<int>().swap(_workDiscreteX);
+				vector<vector<double> >().swap(_workContinuousX);
+				return;
+			}
+			_workSharedX=NULL;
+			_workDiscreteX.assign((size_t)nRows*_workNDiscreteX,0);
+			for(unsigned int i=0;i<nRows;i++){
+				for(unsigned int j=0;j<_workNDiscreteX;j++){
+					_workDiscreteX[i*_workNDiscreteX+j]=dataset.discreteX()[i][j];
+				}
+			}
+			_workContinuousX=dataset.continuousX();
+		}
+
+		/// \brief Return the discrete covariates, stored subject major (empty
+		/// if they are shared with the data set)
+		const vector<int>& workDiscreteX() const {
 			return _workDiscreteX;
 		}
 
-		const vector<int>& workDiscreteX(const unsigned int& i) const{
-			return _workDiscreteX[i];
+		/// \brief Return the number of discrete covariates stored for each subject
+		unsigned int workNDiscreteX() const {
+			return _workNDiscreteX;
 		}
 
-		int workDiscreteX(const unsigned int& i, const unsigned int& j) const {
-			return _workDiscreteX[i][j];
+		/// \brief Return a pointer to the discrete covariates of subject i. If
+		/// they are shared with the packed data set they are first unpacked
+		/// into buffer.
+		const int* workDiscreteX(const unsigned int& i,vector<int>& buffer) const{
+			if(_workSharedX==NULL){
+				return &(_workDiscreteX[i*_workNDiscreteX]);
+			}
+			buffer.resize(_workNDiscreteX);
+			for(unsigned int j=0;j<_workNDiscreteX;j++){
+				buffer[j]=_workSharedX->discreteX(i,j);
+			}
+			return buffer.data();
 		}
 
-		void workDiscreteX(const vector<vector<int> >& X){
-			_workDiscreteX=X;
+		int workDiscreteX(const unsigned int& i, const unsigned int& j) const {
+			if(_workSharedX!=NULL){
+				return _workSharedX->discreteX(i,j);
+			}
+			return _workDiscreteX[i*_workNDiscreteX+j];
 		}
 
+		/// \brief Set the jth discrete covariate of subject i, which only needs
+		/// setting in the data set when they are shared
 		void workDiscreteX(const unsigned int& i,const unsigned int& j,const int& x){
-			_workDiscreteX[i][j]=x;
+			if(_workSharedX!=NULL){
+				return;
+			}
+			_workDiscreteX[i*_workNDiscreteX+j]=x;
 		}
 
+		/// \brief Return the continuous covariates (empty if they are shared
+		/// with the data set)
 		const vector<vector<double> >& workContinuousX() const {
 			return _workContinuousX;
 		}
 
 		double workContinuousX(const unsigned int& i, const unsigned int& j) const {
+			if(_workSharedX!=NULL){
+				return _workSharedX->continuousX(i,j);
+			}
 			return _workContinuousX[i][j];
 		}
 
-
-		void workContinuousX(const vector<vector<double> >& X){
-			_workContinuousX=X;
-		}
-
+		/// \brief Set the jth continuous covariate of subject i, which only
+		/// needs setting in the data set when they are shared
 		void workContinuousX(const unsigned int& i,const unsigned int& j,const double& x){
+			if(_workSharedX!=NULL){
+				return;
+			}
 			_workContinuousX[i][j]=x;
 		}
 
@@ -2652,16 +2980,48 @@ class pReMiuMParams{
 			_workLogPXiGivenZi[i] = newVal;
 		}
 
-		const vector<vector<vector<double> > >& workLogPhiStar() const{
+		/// \brief Return the phi star values, stored cluster major with
+		/// workLogPhiStarStride() entries for each covariate
+		const vector<double>& workLogPhiStar() const{
 			return _workLogPhiStar;
 		}
 
+		/// \brief Return the number of covariates stored for each cluster
+		unsigned int workNLogPhiStarCovs() const{
+			return _workNLogPhiStarCovs;
+		}
+
+		/// \brief Return the number of entries stored for each covariate
+		/// (the largest number of categories)
+		unsigned int workLogPhiStarStride() const{
+			return _workLogPhiStarStride;
+		}
+
+		/// \brief Return a pointer to the phi star values of cluster c, where
+		/// covariate j, category p is at offset j*workLogPhiStarStride()+p
+		const double* workLogPhiStar(const unsigned int& c) const{
+			return &(_workLogPhiStar[c*_workNLogPhiStarCovs*_workLogPhiStarStride]);
+		}
+
 		double workLogPhiStar(const unsigned int& c,const unsigned int& j, const unsigned int& p) const{
-			return _workLogPhiStar[c][j][p];
+			return _workLogPhiStar[(c*_workNLogPhiStarCovs+j)*_workLogPhiStarStride+p];
 		}
 
 		void workLogPhiStar(const unsigned int& c,const unsigned int& j, const unsigned int& p, const double& logPhiStar){
-			_workLogPhiStar[c][j][p]=logPhiStar;
+			_workLogPhiStar[(c*_workNLogPhiStarCovs+j)*_workLogPhiStarStride+p]=logPhiStar;
+		}
+
+		/// \brief Set the phi star values for cluster c, covariate j
+		void workLogPhiStar(const unsigned int& c,const unsigned int& j, const vector<double>& logPhiStarVec){
+			std::copy(logPhiStarVec.begin(),logPhiStarVec.end(),
+					_workLogPhiStar.begin()+(c*_workNLogPhiStarCovs+j)*_workLogPhiStarStride);
+		}
+
+		/// \brief Swap the phi star values of clusters c1 and c2
+		void swapWorkLogPhiStar(const unsigned int& c1,const unsigned int& c2){
+			unsigned int blockSize = _workNLogPhiStarCovs*_workLogPhiStarStride;
+			std::swap_ranges(_workLogPhiStar.begin()+c1*blockSize,_workLogPhiStar.begin()+(c1+1)*blockSize,
+					_workLogPhiStar.begin()+c2*blockSize);
 		}
 
 		const VectorXd& workMuStar(const unsigned int& c) const{
@@ -2676,6 +3036,61 @@ class pReMiuMParams{
 			_workMuStar[c]=muStar;
 		}
 
+		/// \brief Set the mu star value of cluster c, covariate j
+		void workMuStar(const unsigned int& c,const unsigned int& j,const double& muStar){
+			_workMuStar[c](j)=muStar;
+		}
+
+		/// \brief Return the fixed effects part W_i.beta_k of the linear
+		/// predictor of each fitting subject, for each category k of Y
+		const vector<vector<double> >& workLinearPredictor() const{
+			return _workLinearPredictor;
+		}
+
+		/// \brief Return the fixed effects part of the linear predictor of
+		/// the fitting subjects for category k of Y
+		const vector<double>& workLinearPredictor(const unsigned int& k) const{
+			return _workLinearPredictor[k];
+		}
+
+		/// \brief Return the fixed effects part of the linear predictor of
+		/// fitting subject i for category k of Y
+		double workLinearPredictor(const unsigned int& i,const unsigned int& k) const{
+			return _workLinearPredictor[k][i];
+		}
+
+		/// \brief Set the fixed effects part of the linear predictor of the
+		/// fitting subjects for category k of Y
+		void workLinearPredictor(const unsigned int& k,const vector<double>& linearPredictor){
+			_workLinearPredictor[k]=linearPredictor;
+		}
+
+		/// \brief Recompute the fixed effects part of the linear predictor
+		/// from beta and the fixed effects W
+		void workComputeLinearPredictor(const vector<vector<double> >& W){
+			unsigned int nSbj = _workLinearPredictor.empty()?0:_workLinearPredictor[0].size();
+			unsigned int nFixedEffects = _beta.size();
+			for(unsigned int k=0;k<_workLinearPredictor.size();k++){
+				for(unsigned int i=0;i<nSbj;i++){
+					double linearPredictor=0.0;
+					for(unsigned int j=0;j<nFixedEffects;j++){
+						linearPredictor+=_beta[j][k]*W[i][j];
+					}
+					_workLinearPredictor[k][i]=linearPredictor;
+				}
+			}
+		}
+
+		/// \brief Update the linear predictor for category k of Y when
+		/// beta_jk changes by betaDiff (a multiple of column j of W)
+		void workShiftLinearPredictor(const unsigned int& j,const unsigned int& k,
+				const double& betaDiff,const vector<vector<double> >& W){
+			vector<double>& linearPredictor = _workLinearPredictor[k];
+			for(unsigned int i=0;i<linearPredictor.size();i++){
+				linearPredictor[i]+=betaDiff*W[i][j];
+			}
+		}
+
 		double workPredictExpectedTheta(const unsigned int& j,const unsigned int& k) const{
 			return _workPredictExpectedTheta[j][k];
 		}
@@ -2688,6 +3103,45 @@ class pReMiuMParams{
 			_workPredictExpectedTheta[j][k]=expectedVal;
 		}
 
+		/// \brief Return the number of sweeps in the running moments of the
+		/// predicted responses
+		unsigned int workNPredictSamples() const{
+			return _workNPredictSamples;
+		}
+
+		/// \brief Return the running means of the predicted responses, by
+		/// prediction subject and category
+		const vector<vector<double> >& workPredictMeanY() const{
+			return _workPredictMeanY;
+		}
+
+		/// \brief Return the running sums of squared deviations from the
+		/// mean of the predicted responses, by prediction subject and category
+		const vector<vector<double> >& workPredictSumSqDevY() const{
+			return _workPredictSumSqDevY;
+		}
+
+		/// \brief Add the predicted responses of a sweep to their running
+		/// moments (with Welford's update)
+		void addWorkPredictY(const vector<vector<double> >& predictedY){
+			if(_workNPredictSamples==0){
+				_workPredictMeanY.assign(predictedY.size(),vector<double>());
+				_workPredictSumSqDevY.assign(predictedY.size(),vector<double>());
+				for(unsigned int j=0;j<predictedY.size();j++){
+					_workPredictMeanY[j].assign(predictedY[j].size(),0.0);
+					_workPredictSumSqDevY[j].assign(predictedY[j].size(),0.0);
+				}
+			}
+			_workNPredictSamples++;
+			for(unsigned int j=0;j<predictedY.size();j++){
+				for(unsigned int k=0;k<predictedY[j].size();k++){
+					double delta = predictedY[j][k]-_workPredictMeanY[j][k];
+					_workPredictMeanY[j][k]+=delta/_workNPredictSamples;
+					_workPredictSumSqDevY[j][k]+=delta*(predictedY[j][k]-_workPredictMeanY[j][k]);
+				}
+			}
+		}
+
 		double workEntropy(const unsigned int& i) const{
 			return _workEntropy[i];
 		}
@@ -2803,178 +3257,45 @@ class pReMiuMParams{
 		}
 
 
+		/// \brief Switch the labels of clusters c1 and c2
+		/// \note All the per cluster members are swapped in place (the Eigen
+		/// objects and vectors only exchange their buffers), and only the
+		/// allocations of the members of the two clusters are relabelled, so
+		/// the cost does not grow with the number of covariates or subjects
 		void switchLabels(const unsigned int& c1,const unsigned int& c2,
-							const string& covariateType,
+							const pReMiuMCovariateType& covariateType,
 							const string& varSelectType, const bool useIndependentNormal,
 			                const bool useSeparationPrior){
 
 			//Covariate parameters including working parameters
-			if(covariateType.compare("Discrete")==0){
-				_logPhi[c1].swap(_logPhi[c2]);
-				_workLogPhiStar[c1].swap(_workLogPhiStar[c2]);
-			}else if(covariateType.compare("Normal")==0){
-				VectorXd muTmp = _mu[c1];
-				_mu[c1]=_mu[c2];
-				_mu[c2]=muTmp;
-				VectorXd workMuStarTmp = _workMuStar[c1];
-				_workMuStar[c1]=_workMuStar[c2];
-				_workMuStar[c2]=workMuStarTmp;
-				bool blankTmp = _Sigma_blank[c1];
-				_Sigma_blank[c1] = _Sigma_blank[c2];
-				_Sigma_blank[c2] = blankTmp;
-
-				if (useIndependentNormal) {
-					VectorXd SigmaTmp = _Sigma_Indep[c1];
-					_Sigma_Indep[c1] = _Sigma_Indep[c2];
-					_Sigma_Indep[c2] = SigmaTmp;
-
-					VectorXd TauTmp = _Tau_Indep[c1];
-					_Tau_Indep[c1] = _Tau_Indep[c2];
-					_Tau_Indep[c2] = TauTmp;
-				}else if (useSeparationPrior) {
-					bool blankRTmp = _SigmaR_blank[c1];
-					_SigmaR_blank[c1] = _SigmaR_blank[c2];
-					_SigmaR_blank[c2] = blankRTmp;
-					bool blankSTmp = _SigmaS_blank[c1];
-					_SigmaS_blank[c1] = _SigmaS_blank[c2];
-					_SigmaS_blank[c2] = blankSTmp;
-
-					MatrixXd TauTmpR = _TauR[c1];
-					_TauR[c1] = _TauR[c2];
-					_TauR[c2] = TauTmpR;
-					MatrixXd sqrtTauTmpR = _workSqrtTauR[c1];
-					_workSqrtTauR[c1] = _workSqrtTauR[c2];
-					_workSqrtTauR[c2] = sqrtTauTmpR;
-					double logDetTauTmpR = _workLogDetTauR[c1];
-					_workLogDetTauR[c1] = _workLogDetTauR[c2];
-					_workLogDetTauR[c2] = logDetTauTmpR;
-
-					MatrixXd TauTmpS = _TauS[c1];
-					_TauS[c1] = _TauS[c2];
-					_TauS[c2] = TauTmpS;
-					double logDetTauTmpS = _workLogDetTauS[c1];
-					_workLogDetTauS[c1] = _workLogDetTauS[c2];
-					_workLogDetTauS[c2] = logDetTauTmpS;
-
-					MatrixXd SigmaTmp = _Sigma[c1];
-					_Sigma[c1] = _Sigma[c2];
-					_Sigma[c2] = SigmaTmp;
-
-					MatrixXd SigmaTmpR = _SigmaR[c1];
-					_SigmaR[c1] = _SigmaR[c2];
-					_SigmaR[c2] = SigmaTmpR;
-					MatrixXd SigmaTmpS = _SigmaS[c1];
-					_SigmaS[c1] = _SigmaS[c2];
-					_SigmaS[c2] = SigmaTmpS;
-
-					MatrixXd TauTmp = _Tau[c1];
-					_Tau[c1] = _Tau[c2];
-					_Tau[c2] = TauTmp;
-					MatrixXd sqrtTauTmp = _workSqrtTau[c1];
-					_workSqrtTau[c1] = _workSqrtTau[c2];
-					_workSqrtTau[c2] = sqrtTauTmp;
-					double logDetTauTmp = _workLogDetTau[c1];
-					_workLogDetTau[c1] = _workLogDetTau[c2];
-					_workLogDetTau[c2] = logDetTauTmp;
-
-				}else {
-					MatrixXd SigmaTmp = _Sigma[c1];
-					_Sigma[c1] = _Sigma[c2];
-					_Sigma[c2] = SigmaTmp;
-
-					MatrixXd TauTmp = _Tau[c1];
-					_Tau[c1] = _Tau[c2];
-					_Tau[c2] = TauTmp;
-					MatrixXd sqrtTauTmp = _workSqrtTau[c1];
-					_workSqrtTau[c1] = _workSqrtTau[c2];
-					_workSqrtTau[c2] = sqrtTauTmp;
-					double logDetTauTmp = _workLogDetTau[c1];
-					_workLogDetTau[c1] = _workLogDetTau[c2];
-					_workLogDetTau[c2] = logDetTauTmp;
-				}
-				
-			}else if(covariateType.compare("Mixed")==0){
+			if(covariateType==covariateDiscrete||covariateType==covariateMixed){
 				_logPhi[c1].swap(_logPhi[c2]);
-				_workLogPhiStar[c1].swap(_workLogPhiStar[c2]);
-				VectorXd muTmp = _mu[c1];
-				_mu[c1]=_mu[c2];
-				_mu[c2]=muTmp;
-				VectorXd workMuStarTmp = _workMuStar[c1];
-				_workMuStar[c1]=_workMuStar[c2];
-				_workMuStar[c2]=workMuStarTmp;
-				bool blankTmp = _Sigma_blank[c1];
-				_Sigma_blank[c1] = _Sigma_blank[c2];
-				_Sigma_blank[c2] = blankTmp;
+				swapWorkLogPhiStar(c1,c2);
+			}
+			if(covariateType==covariateNormal||covariateType==covariateMixed){
+				_mu[c1].swap(_mu[c2]);
+				_workMuStar[c1].swap(_workMuStar[c2]);
+				vector<bool>::swap(_Sigma_blank[c1],_Sigma_blank[c2]);
 
 				if (useIndependentNormal) {
-					VectorXd SigmaTmp = _Sigma_Indep[c1];
-					_Sigma_Indep[c1] = _Sigma_Indep[c2];
-					_Sigma_Indep[c2] = SigmaTmp;
-
-					VectorXd TauTmp = _Tau_Indep[c1];
-					_Tau_Indep[c1] = _Tau_Indep[c2];
-					_Tau_Indep[c2] = TauTmp;
-				}
-				else if (useSeparationPrior) {
-					bool blankRTmp = _SigmaR_blank[c1];
-					_SigmaR_blank[c1] = _SigmaR_blank[c2];
-					_SigmaR_blank[c2] = blankRTmp;
-					bool blankSTmp = _SigmaS_blank[c1];
-					_SigmaS_blank[c1] = _SigmaS_blank[c2];
-					_SigmaS_blank[c2] = blankSTmp;
-
-					MatrixXd TauTmpR = _TauR[c1];
-					_TauR[c1] = _TauR[c2];
-					_TauR[c2] = TauTmpR;
-					MatrixXd sqrtTauTmpR = _workSqrtTauR[c1];
-					_workSqrtTauR[c1] = _workSqrtTauR[c2];
-					_workSqrtTauR[c2] = sqrtTauTmpR;
-					double logDetTauTmpR = _workLogDetTauR[c1];
-					_workLogDetTauR[c1] = _workLogDetTauR[c2];
-					_workLogDetTauR[c2] = logDetTauTmpR;
-
-					MatrixXd TauTmpS = _TauS[c1];
-					_TauS[c1] = _TauS[c2];
-					_TauS[c2] = TauTmpS;
-					double logDetTauTmpS = _workLogDetTauS[c1];
-					_workLogDetTauS[c1] = _workLogDetTauS[c2];
-					_workLogDetTauS[c2] = logDetTauTmpS;
-
-					MatrixXd SigmaTmp = _Sigma[c1];
-					_Sigma[c1] = _Sigma[c2];
-					_Sigma[c2] = SigmaTmp;
-
-					MatrixXd SigmaTmpR = _SigmaR[c1];
-					_SigmaR[c1] = _SigmaR[c2];
-					_SigmaR[c2] = SigmaTmpR;
-					MatrixXd SigmaTmpS = _SigmaS[c1];
-					_SigmaS[c1] = _SigmaS[c2];
-					_SigmaS[c2] = SigmaTmpS;
-
-					MatrixXd TauTmp = _Tau[c1];
-					_Tau[c1] = _Tau[c2];
-					_Tau[c2] = TauTmp;
-					MatrixXd sqrtTauTmp = _workSqrtTau[c1];
-					_workSqrtTau[c1] = _workSqrtTau[c2];
-					_workSqrtTau[c2] = sqrtTauTmp;
-					double logDetTauTmp = _workLogDetTau[c1];
-					_workLogDetTau[c1] = _workLogDetTau[c2];
-					_workLogDetTau[c2] = logDetTauTmp;
-
-				}else {
-					MatrixXd SigmaTmp = _Sigma[c1];
-					_Sigma[c1] = _Sigma[c2];
-					_Sigma[c2] = SigmaTmp;
-
-					MatrixXd TauTmp = _Tau[c1];
-					_Tau[c1] = _Tau[c2];
-					_Tau[c2] = TauTmp;
-					MatrixXd sqrtTauTmp = _workSqrtTau[c1];
-					_workSqrtTau[c1] = _workSqrtTau[c2];
-					_workSqrtTau[c2] = sqrtTauTmp;
-					double logDetTauTmp = _workLogDetTau[c1];
-					_workLogDetTau[c1] = _workLogDetTau[c2];
-					_workLogDetTau[c2] = logDetTauTmp;
+					_Sigma_Indep[c1].swap(_Sigma_Indep[c2]);
+					_Tau_Indep[c1].swap(_Tau_Indep[c2]);
+				}else{
+					if (useSeparationPrior) {
+						vector<bool>::swap(_SigmaR_blank[c1],_SigmaR_blank[c2]);
+						vector<bool>::swap(_SigmaS_blank[c1],_SigmaS_blank[c2]);
+						_TauR[c1].swap(_TauR[c2]);
+						_workSqrtTauR[c1].swap(_workSqrtTauR[c2]);
+						std::swap(_workLogDetTauR[c1],_workLogDetTauR[c2]);
+						_TauS[c1].swap(_TauS[c2]);
+						std::swap(_workLogDetTauS[c1],_workLogDetTauS[c2]);
+						_SigmaR[c1].swap(_SigmaR[c2]);
+						_SigmaS[c1].swap(_SigmaS[c2]);
+					}
+					_Sigma[c1].swap(_Sigma[c2]);
+					_Tau[c1].swap(_Tau[c2]);
+					_workSqrtTau[c1].swap(_workSqrtTau[c2]);
+					std::swap(_workLogDetTau[c1],_workLogDetTau[c2]);
 				}
 			}
 
@@ -2983,21 +3304,30 @@ class pReMiuMParams{
 				_gamma[c1].swap(_gamma[c2]);
 			}
 			//Response parameters
-			vector<double> thetaTmp = _theta[c1];
-			_theta[c1]=_theta[c2];
-			_theta[c2]=thetaTmp;
-
-			//Allocation parameters (including counts)
-			for(unsigned int i=0;i<nSubjects()+nPredictSubjects();i++){
+			_theta[c1].swap(_theta[c2]);
+
+			//Allocation parameters (including counts), the fitting subjects
+			//are found from the cluster members
+			std::swap(_workNXInCluster[c1],_workNXInCluster[c2]);
+			_workClusterMembers[c1].swap(_workClusterMembers[c2]);
+			for(unsigned int k=0;k<_workClusterMembers[c1].size();k++){
+				_z[_workClusterMembers[c1][k]]=c1;
+			}
+			for(unsigned int k=0;k<_workClusterMembers[c2].size();k++){
+				_z[_workClusterMembers[c2][k]]=c2;
+			}
+			for(unsigned int i=nSubjects();i<nSubjects()+nPredictSubjects();i++){
 				if(_z[i]==(int)c1){
 					_z[i]=c2;
 				}else if(_z[i]==(int)c2){
 					_z[i]=c1;
 				}
 			}
-			double workNXInClusterTmp = _workNXInCluster[c1];
-			_workNXInCluster[c1]=_workNXInCluster[c2];
-			_workNXInCluster[c2]=workNXInClusterTmp;
+			if(_workNSuffStatCovs>0){
+				_workSumX[c1].swap(_workSumX[c2]);
+				_workSumXXt[c1].swap(_workSumXXt[c2]);
+				_workSumXSq[c1].swap(_workSumXSq[c2]);
+			}
 		}
 
 		/// \brief Copy operator
@@ -3039,15 +3369,35 @@ class pReMiuMParams{
 			_nu = params.nu();
 			_hyperParams = params.hyperParams();
 			_workNXInCluster=params.workNXInCluster();
+			_workClusterMembers=params.workClusterMembers();
+			_workNSuffStatCovs=params.workNSuffStatCovs();
+			_workXShift=params.workXShift();
+			_workSumX=params._workSumX;
+			_workSumXXt=params._workSumXXt;
+			_workSumXSq=params._workSumXSq;
+			_workNuNEvents=params._workNuNEvents;
+			_workNuSumEventLogT=params._workNuSumEventLogT;
+			_workNuLogT=params._workNuLogT;
+			_workNuRate=params._workNuRate;
 			_workMaxZi=params.workMaxZi();
+			_workClusterCapacity=params.workClusterCapacity();
+			_workNCapacityResizes=params.workNCapacityResizes();
 			_workMinUi=params.workMinUi();
 			_workDiscreteX=params.workDiscreteX();
+			_workNDiscreteX=params.workNDiscreteX();
 			_workContinuousX=params.workContinuousX();
+			_workSharedX=params._workSharedX;
 			_workLogPXiGivenZi = params.workLogPXiGivenZi();
 			_workLogPhiStar = params.workLogPhiStar();
+			_workNLogPhiStarCovs = params.workNLogPhiStarCovs();
+			_workLogPhiStarStride = params.workLogPhiStarStride();
 			_workMuStar = params.workMuStar();
+			_workLinearPredictor = params.workLinearPredictor();
 			_workPredictExpectedTheta = params.workPredictExpectedTheta();
 			_workEntropy = params.workEntropy();
+			_workNPredictSamples = params.workNPredictSamples();
+			_workPredictMeanY = params.workPredictMeanY();
+			_workPredictSumSqDevY = params.workPredictSumSqDevY();
 			_workNClusInit = params.workNClusInit();
 			_workLogDetTau = params.workLogDetTau();
 			_workLogDetTauR = params.workLogDetTauR();
@@ -3066,6 +3416,33 @@ class pReMiuMParams{
 			return *this;
 		}
 
+		/// \brief Member function to write or read the parameters in a
+		/// checkpoint (the hyper parameters are not included, they are set up
+		/// again from the options when the sampler is resumed)
+		template<class Archive>
+		void serialise(Archive& ar){
+			ar & _maxNClusters & _logPsi & _u & _v;
+			ar & _logPhi & _logNullPhi & _mu & _nullMu;
+			ar & _Tau & _TauR & _TauS & _Tau_Indep;
+			ar & _R1 & _mu00 & _Tau00 & _Sigma00;
+			ar & _R1_Indep & _beta_taus & _Sigma & _SigmaR;
+			ar & _SigmaS & _Sigma_Indep & _theta & _beta;
+			ar & _alpha & _kappa11 & _dPitmanYor & _lambda;
+			ar & _tauEpsilon & _z & _gamma & _rho;
+			ar & _omega & _sigmaSqY & _nu & _workNXInCluster;
+			ar & _workClusterMembers & _workNSuffStatCovs & _workXShift & _workSumX;
+			ar & _workSumXXt & _workSumXSq & _workMaxZi & _workClusterCapacity;
+			ar & _workNCapacityResizes & _workMinUi & _workDiscreteX & _workNDiscreteX;
+			ar & _workContinuousX & _workLogPXiGivenZi & _workLogPhiStar & _workNLogPhiStarCovs;
+			ar & _workLogPhiStarStride & _workMuStar & _workPredictExpectedTheta & _workEntropy;
+			ar & _workNClusInit & _workLogDetTau & _workLogDetTauR & _workLogDetTauS;
+			ar & _workLogDetTau00 & _workLogDetR1 & _workInverseR1 & _workSqrtTau;
+			ar & _workSqrtTauR & _workSqrtTau00 & _uCAR & _TauCAR;
+			ar & _Sigma_blank & _SigmaS_blank & _SigmaR_blank;
+			ar & _workNPredictSamples & _workPredictMeanY & _workPredictSumSqDevY;
+			ar & _workLinearPredictor;
+		}
+
 
 
 	private:
@@ -3182,33 +3559,80 @@ class pReMiuMParams{
 		/// in
 		unsigned int _workMaxZi;
 
+		/// \brief The number of clusters the per cluster objects are allocated for
+		unsigned int _workClusterCapacity;
+
+		/// \brief The number of times _workClusterCapacity has grown
+		unsigned int _workNCapacityResizes;
+
 		/// \brief Double determining the minimum ui
 		double _workMinUi;
 
 		/// \brief A vector containing the number of subjects in each cluster
 		vector<unsigned int> _workNXInCluster;
 
-		/// \brief A matrix containing a copy of X
-		vector<vector<int> > _workDiscreteX;
+		/// \brief The indices of the fitting subjects in each cluster
+		vector<vector<unsigned int> > _workClusterMembers;
+
+		/// \brief Sufficient statistics of the continuous covariates of the
+		/// fitting subjects in each cluster, taken about _workXShift. The
+		/// outer products are only kept for the full covariance model and the
+		/// squares only for the independent model
+		unsigned int _workNSuffStatCovs;
+		VectorXd _workXShift;
+		vector<VectorXd> _workSumX;
+		vector<MatrixXd> _workSumXXt;
+		vector<VectorXd> _workSumXSq;
+
+		/// \brief The statistics of the Weibull likelihood of the shape nu of
+		/// each cluster (see workNuStats)
+		vector<double> _workNuNEvents;
+		vector<double> _workNuSumEventLogT;
+		vector<vector<double> > _workNuLogT;
+		vector<vector<double> > _workNuRate;
+
+		/// \brief A copy of the discrete X, subject major with
+		/// _workNDiscreteX entries per subject
+		vector<int> _workDiscreteX;
+		unsigned int _workNDiscreteX;
 
 		/// \brief A matrix containing a copy of X
 		vector<vector<double> > _workContinuousX;
 
+		/// \brief The data set whose packed covariates are used instead of
+		/// the copies above (NULL if they are copied)
+		const pReMiuMData* _workSharedX;
+
 		/// \brief A matrix containing P(Xi|Zi)
 		vector<double>  _workLogPXiGivenZi;
 
-		/// \brief An array of phi star for variable selection
-		vector<vector<vector<double> > > _workLogPhiStar;
+		/// \brief An array of phi star for variable selection, cluster major
+		/// with _workNLogPhiStarCovs covariates per cluster and
+		/// _workLogPhiStarStride entries per covariate
+		vector<double> _workLogPhiStar;
+		unsigned int _workNLogPhiStarCovs;
+		unsigned int _workLogPhiStarStride;
 
 		/// \brief An array of mu star for variable selection
 		vector<VectorXd> _workMuStar;
 
+		/// \brief The fixed effects part W_i.beta_k of the linear predictor
+		/// of each fitting subject, indexed by category of Y then subject
+		vector<vector<double> > _workLinearPredictor;
+
 		/// \brief A vector of expected theta values for the prediction subjects
 		vector<vector<double> > _workPredictExpectedTheta;
 
 		/// \brief A vector of entropy values for each of the subjects
 		vector<double> _workEntropy;
 
+		/// \brief The number of sweeps, the running means and the running
+		/// sums of squared deviations of the predicted responses of the
+		/// prediction subjects (only kept with the predictSummary option)
+		unsigned int _workNPredictSamples;
+		vector<vector<double> > _workPredictMeanY;
+		vector<vector<double> > _workPredictSumSqDevY;
+
 		/// \brief The actual number of cluster the individuals are individually
 		/// allocated to. Note this is just needed for writing the log file.
 		unsigned int _workNClusInit;
@@ -3246,6 +3670,11 @@ class pReMiuMParams{
 		vector<bool> _SigmaS_blank;
 };
 
+/// \brief The type of the functions for log p(Y_i|z_i,W_i). The kernels that
+/// evaluate them for every subject take the density as a template parameter,
+/// so that it is chosen once when the proposals are added and can be inlined.
+typedef double (*pReMiuMLogPYiGivenZiWi)(const pReMiuMParams&,const pReMiuMData&,
+		const unsigned int&,const int&,const unsigned int&);
 
 double logPYiGivenZiWiBernoulli(const pReMiuMParams& params, const pReMiuMData& dataset,
 						const unsigned int& nFixedEffects,const int& zi,
@@ -3253,9 +3682,7 @@ double logPYiGivenZiWiBernoulli(const pReMiuMParams& params, const pReMiuMData&
 
 	double lambda;
 	lambda=params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		lambda+=params.beta(j,0)*dataset.W(i,j);
-	}
+	lambda+=params.workLinearPredictor(i,0);
 
 	double p=1.0/(1.0+exp(-lambda));
 	return logPdfBernoulli(dataset.discreteY(i),p);
@@ -3278,9 +3705,7 @@ double logPYiGivenZiWiBinomial(const pReMiuMParams& params, const pReMiuMData& d
 
 	double lambda;
 	lambda=params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		lambda+=params.beta(j,0)*dataset.W(i,j);
-	}
+	lambda+=params.workLinearPredictor(i,0);
 
 	double p=1.0/(1.0+exp(-lambda));
 	return logPdfBinomial(dataset.discreteY(i),dataset.nTrials(i),p);
@@ -3303,9 +3728,7 @@ double logPYiGivenZiWiPoisson(const pReMiuMParams& params, const pReMiuMData& da
 
 	double lambda;
 	lambda=params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		lambda+=params.beta(j,0)*dataset.W(i,j);
-	}
+	lambda+=params.workLinearPredictor(i,0);
 	lambda+=dataset.logOffset(i);
 
 	double mu =exp(lambda);
@@ -3329,9 +3752,7 @@ double logPYiGivenZiWiPoissonSpatial(const pReMiuMParams& params, const pReMiuMD
 
 	double lambda;
 	lambda=params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		lambda+=params.beta(j,0)*dataset.W(i,j);
-	}
+	lambda+=params.workLinearPredictor(i,0);
 	lambda+=dataset.logOffset(i);
 	lambda+=params.uCAR(i);
 
@@ -3345,9 +3766,7 @@ double logPYiGivenZiWiNormal(const pReMiuMParams& params, const pReMiuMData& dat
 
 	double mu;
 	mu=params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		mu+=params.beta(j,0)*dataset.W(i,j);
-	}
+	mu+=params.workLinearPredictor(i,0);
 
 	return logPdfNormal(dataset.continuousY(i),mu,sqrt(params.sigmaSqY()));
 }
@@ -3358,9 +3777,7 @@ double logPYiGivenZiWiNormalSpatial(const pReMiuMParams& params, const pReMiuMDa
 
 	double mu;
 	mu=params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		mu+=params.beta(j,0)*dataset.W(i,j);
-	}
+	mu+=params.workLinearPredictor(i,0);
 	mu+=params.uCAR(i);
 
 	return logPdfNormal(dataset.continuousY(i),mu,sqrt(params.sigmaSqY()));
@@ -3372,9 +3789,7 @@ double logPYiGivenZiWiQuantile(const pReMiuMParams& params, const pReMiuMData& d
 
 	double mu;
 	mu=params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		mu+=params.beta(j,0)*dataset.W(i,j);
-	}
+	mu+=params.workLinearPredictor(i,0);
 	return logPdfQuantile(dataset.continuousY(i),mu,sqrt(params.sigmaSqY()),params.hyperParams().pQuantile());
 }
 
@@ -3388,14 +3803,10 @@ double logPYiGivenZiWiCategorical(const pReMiuMParams& params, const pReMiuMData
 
 	double lambdaSum = 1.0;
 
-	double value = 0.0;
 	for (unsigned int k=0;k<dataset.nCategoriesY();k++){
-		for (unsigned int j=0;j<nFixedEffects;j++){
-			value+=params.beta(j,k)*dataset.W(i,j);
-		}
+		double value = params.workLinearPredictor(i,k);
 		lambda[k] = exp(value + params.theta(zi,k));
 		lambdaSum += exp(value + params.theta(zi,k));
-		value = 0.0;
 	}
 	vector<double> p;
 	p.resize(dataset.nCategoriesY()+1);
@@ -3414,9 +3825,7 @@ double logPYiGivenZiWiSurvival(const pReMiuMParams& params, const pReMiuMData& d
 	unsigned int weibullFixedShape=params.nu().size();
 
 	double lambda = params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		lambda+=params.beta(j,0)*dataset.W(i,j);
-	}
+	lambda+=params.workLinearPredictor(i,0);
 	double nu=0;
 	
 	if (weibullFixedShape==1) {
@@ -3447,7 +3856,7 @@ vector<double> pReMiuMLogPost(const pReMiuMParams& params,
 	unsigned int nContinuousCov=dataset.nContinuousCovs();
 	unsigned int nFixedEffects=dataset.nFixedEffects();
 	unsigned int nCategoriesY=dataset.nCategoriesY();
-	vector<unsigned int> nCategories = dataset.nCategories();
+	const vector<unsigned int>& nCategories = dataset.nCategories();
 	const pReMiuMHyperParams& hyperParams = params.hyperParams();
 	const bool includeCAR=model.options().includeCAR();
 	const bool weibullFixedShape=model.options().weibullFixedShape();
@@ -3485,9 +3894,7 @@ vector<double> pReMiuMLogPost(const pReMiuMParams& params,
 					extraVarPriorVal[i]=params.lambda(i);
 					int zi=params.z(i);
 					extraVarPriorMean[i]=params.theta(zi,0);
-					for(unsigned int j=0;j<nFixedEffects;j++){
-						extraVarPriorMean[i]+=params.beta(j,0)*dataset.W(i,j);
-					}
+					extraVarPriorMean[i]+=params.workLinearPredictor(i,0);
 				}
 			}
 		}else if(outcomeType.compare("Binomial")==0){
@@ -3499,9 +3906,7 @@ vector<double> pReMiuMLogPost(const pReMiuMParams& params,
 					extraVarPriorVal[i]=params.lambda(i);
 					int zi=params.z(i);
 					extraVarPriorMean[i]=params.theta(zi,0);
-					for(unsigned int j=0;j<nFixedEffects;j++){
-						extraVarPriorMean[i]+=params.beta(j,0)*dataset.W(i,j);
-					}
+					extraVarPriorMean[i]+=params.workLinearPredictor(i,0);
 				}
 			}
 		}else if(outcomeType.compare("Poisson")==0){
@@ -3517,9 +3922,7 @@ vector<double> pReMiuMLogPost(const pReMiuMParams& params,
 					extraVarPriorVal[i]=params.lambda(i);
 					int zi=params.z(i);
 					extraVarPriorMean[i]=params.theta(zi,0);
-					for(unsigned int j=0;j<nFixedEffects;j++){
-						extraVarPriorMean[i]+=params.beta(j,0)*dataset.W(i,j);
-					}
+					extraVarPriorMean[i]+=params.workLinearPredictor(i,0);
 					extraVarPriorMean[i]+=dataset.logOffset(i);
 				}
 			}
@@ -3835,7 +4238,7 @@ vector<double> pReMiuMLogPost(const pReMiuMParams& params,
 		// Prior for TauCAR and UCAR
 		if (includeCAR){
 			logPrior+=logPdfGamma(params.TauCAR(),hyperParams.shapeTauCAR(),hyperParams.rateTauCAR());
-			logPrior+=logPdfIntrinsicCAR(params.uCAR(), dataset.neighbours() , params.TauCAR());
+			logPrior+=logPdfIntrinsicCAR(params.uCAR(), dataset.neighbourStart(), dataset.neighbourIndex(), params.TauCAR());
 		}
 
 	}
@@ -3860,7 +4263,7 @@ double logCondPostPhicj(const pReMiuMParams& params,
 
 	const pReMiuMData& dataset = model.dataset();
 	unsigned int nSubjects=dataset.nSubjects();
-	vector<unsigned int> nCategories = dataset.nCategories();
+	const vector<unsigned int>& nCategories = dataset.nCategories();
 	const pReMiuMHyperParams& hyperParams = params.hyperParams();
 
 	double out=0.0;
@@ -3967,108 +4370,75 @@ double logCondPostRhoOmegaj(const pReMiuMParams& params,
 	return out;
 }
 
-double logCondPostThetaBeta(const pReMiuMParams& params,
+// Log conditional posterior for beta, up to the terms (the prior for theta
+// and the normalising constants of the response) which do not depend on it,
+// so only differences between two evaluations are meaningful. The density logPYiGivenZiWi is the one for the outcome type
+// (the extra variation version if there is extra variation in the response)
+template<pReMiuMLogPYiGivenZiWi logPYiGivenZiWi>
+double logCondPostBeta(const pReMiuMParams& params,
 							const mcmcModel<pReMiuMParams,
 											pReMiuMOptions,
 											pReMiuMData>& model){
 
 	const pReMiuMData& dataset = model.dataset();
-	const string outcomeType = model.dataset().outcomeType();
+	const pReMiuMOutcomeType outcomeType = model.options().outcomeTypeId();
 	const bool responseExtraVar = model.options().responseExtraVar();
+	unsigned int nThreads = model.options().nThreads();
 	unsigned int nSubjects=dataset.nSubjects();
-	unsigned int maxNClusters=params.maxNClusters();
 	unsigned int nFixedEffects=dataset.nFixedEffects();
 	unsigned int nCategoriesY=dataset.nCategoriesY();
 	const pReMiuMHyperParams& hyperParams = params.hyperParams();
-	const bool includeCAR=model.options().includeCAR();
 
 	double out=0.0;
 
 	// Add in contribution from Y
 	vector<double> extraVarPriorVal(nSubjects,0.0);
 	vector<double> extraVarPriorMean(nSubjects,0.0);
-	double (*logPYiGivenZiWi)(const pReMiuMParams&,const pReMiuMData&,
-								const unsigned int&,const int&,
-								const unsigned int&) = NULL;
-
-	if(outcomeType.compare("Bernoulli")==0){
-		if(!responseExtraVar){
-			logPYiGivenZiWi = &logPYiGivenZiWiBernoulli;
-		}else{
-			logPYiGivenZiWi = &logPYiGivenZiWiBernoulliExtraVar;
-			for(unsigned int i=0;i<nSubjects;i++){
-				extraVarPriorVal[i]=params.lambda(i);
-				int zi=params.z(i);
-				extraVarPriorMean[i]=params.theta(zi,0);
-				for(unsigned int j=0;j<nFixedEffects;j++){
-					extraVarPriorMean[i]+=params.beta(j,0)*dataset.W(i,j);
-				}
+	if(responseExtraVar&&(outcomeType==outcomeBernoulli||outcomeType==outcomeBinomial||
+			outcomeType==outcomePoisson)){
+		for(unsigned int i=0;i<nSubjects;i++){
+			extraVarPriorVal[i]=params.lambda(i);
+			int zi=params.z(i);
+			extraVarPriorMean[i]=params.theta(zi,0);
+			extraVarPriorMean[i]+=params.workLinearPredictor(i,0);
+			if(outcomeType==outcomePoisson){
+				extraVarPriorMean[i]+=dataset.logOffset(i);
 			}
 		}
-	}else if(outcomeType.compare("Binomial")==0){
-		if(!responseExtraVar){
-			logPYiGivenZiWi = &logPYiGivenZiWiBinomial;
-		}else{
-			logPYiGivenZiWi = &logPYiGivenZiWiBinomialExtraVar;
-			for(unsigned int i=0;i<nSubjects;i++){
-				extraVarPriorVal[i]=params.lambda(i);
-				int zi=params.z(i);
-				extraVarPriorMean[i]=params.theta(zi,0);
-				for(unsigned int j=0;j<nFixedEffects;j++){
-					extraVarPriorMean[i]+=params.beta(j,0)*dataset.W(i,j);
-				}
-			}
+	}
 
-		}
-	}else if(outcomeType.compare("Poisson")==0){
-		if(!responseExtraVar){
-			if (includeCAR){
-				logPYiGivenZiWi = &logPYiGivenZiWiPoissonSpatial;
-			}else{
-				logPYiGivenZiWi = &logPYiGivenZiWiPoisson;
-			}
-		}else{
-			logPYiGivenZiWi = &logPYiGivenZiWiPoissonExtraVar;
-			for(unsigned int i=0;i<nSubjects;i++){
-				extraVarPriorVal[i]=params.lambda(i);
-				int zi=params.z(i);
-				extraVarPriorMean[i]=params.theta(zi,0);
-				for(unsigned int j=0;j<nFixedEffects;j++){
-					extraVarPriorMean[i]+=params.beta(j,0)*dataset.W(i,j);
-				}
-				extraVarPriorMean[i]+=dataset.logOffset(i);
+	// The densities of the subjects are evaluated in parallel and summed in
+	// subject order, so that the value does not depend on the number of threads.
+	// For the Bernoulli and Poisson responses the terms which do not depend on
+	// the linear predictor are left out and the rest is evaluated from it directly
+	vector<double> logPYi(nSubjects);
+	if(logPYiGivenZiWi==&logPYiGivenZiWiBernoulli){
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
+		for(unsigned int i=0;i<nSubjects;i++){
+			double eta = params.theta(params.z(i),0)+params.workLinearPredictor(i,0);
+			// log(1+exp(eta)) without overflow
+			double logOnePlusExpEta = eta>0?eta+log1p(exp(-eta)):log1p(exp(eta));
+			logPYi[i]=dataset.discreteY(i)*eta-logOnePlusExpEta;
+		}
+	}else if(logPYiGivenZiWi==&logPYiGivenZiWiPoisson||logPYiGivenZiWi==&logPYiGivenZiWiPoissonSpatial){
+		const bool includeCAR = logPYiGivenZiWi==&logPYiGivenZiWiPoissonSpatial;
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
+		for(unsigned int i=0;i<nSubjects;i++){
+			double eta = params.theta(params.z(i),0)+params.workLinearPredictor(i,0)+dataset.logOffset(i);
+			if(includeCAR){
+				eta+=params.uCAR(i);
 			}
+			logPYi[i]=dataset.discreteY(i)*eta-exp(eta);
 		}
-	}else if(outcomeType.compare("Categorical")==0){
-		logPYiGivenZiWi = &logPYiGivenZiWiCategorical;
-	}else if(outcomeType.compare("Normal")==0){
-		if (includeCAR){
-			logPYiGivenZiWi = &logPYiGivenZiWiNormalSpatial;
-		}else{
-			logPYiGivenZiWi = &logPYiGivenZiWiNormal;
+	}else{
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
+		for(unsigned int i=0;i<nSubjects;i++){
+			int zi = params.z(i);
+			logPYi[i]=logPYiGivenZiWi(params,dataset,nFixedEffects,zi,i);
 		}
-	}else if(outcomeType.compare("Quantile")==0){
-		logPYiGivenZiWi = &logPYiGivenZiWiQuantile;
-	}else if(outcomeType.compare("Survival")==0){
-		logPYiGivenZiWi = &logPYiGivenZiWiSurvival;
 	}
-
-
 	for(unsigned int i=0;i<nSubjects;i++){
-		int zi = params.z(i);
-		out+=logPYiGivenZiWi(params,dataset,nFixedEffects,zi,i);
-	}
-
-	// Prior for theta
-	// We use a location/scale t distribution
-	// http://www.mathworks.com/help/toolbox/stats/brn2ivz-145.html
-	// as per Molitor et al. 2008 (from Gelman et al. 2008)
-	// This is different from Papathomas who uses a normal
-	for(unsigned int c=0;c<maxNClusters;c++){
-		for (unsigned int k=0;k<nCategoriesY;k++){
-			out+=logPdfLocationScaleT(params.theta(c,k),hyperParams.muTheta(),
-					hyperParams.sigmaTheta(),hyperParams.dofTheta());
-		}
+		out+=logPYi[i];
 	}
 
 	// Prior for beta
@@ -4092,6 +4462,57 @@ double logCondPostThetaBeta(const pReMiuMParams& params,
 	return out;
 }
 
+// Log conditional posterior for the theta of cluster c, up to the terms (from
+// the other clusters, beta and the remaining responses) which do not depend on it.
+// This only visits the members of cluster c, so the difference between two
+// evaluations equals the difference in the full log posterior when only theta_c changes.
+template<pReMiuMLogPYiGivenZiWi logPYiGivenZiWi>
+double logCondPostThetac(const pReMiuMParams& params,
+						const mcmcModel<pReMiuMParams,
+										pReMiuMOptions,
+										pReMiuMData>& model,
+						const unsigned int& c){
+
+	const pReMiuMData& dataset = model.dataset();
+	const bool includeOffset = model.options().outcomeTypeId()==outcomePoisson;
+	const bool responseExtraVar = model.options().responseExtraVar();
+	unsigned int nFixedEffects=dataset.nFixedEffects();
+	unsigned int nCategoriesY=dataset.nCategoriesY();
+	const pReMiuMHyperParams& hyperParams = params.hyperParams();
+	const vector<unsigned int>& members = params.workClusterMembers(c);
+
+	double out=0.0;
+
+	if(responseExtraVar){
+		// Y only depends on theta through the prior for lambda
+		for(unsigned int m=0;m<members.size();m++){
+			unsigned int i=members[m];
+			double meanVal=params.theta(c,0);
+			meanVal+=params.workLinearPredictor(i,0);
+			if(includeOffset){
+				meanVal+=dataset.logOffset(i);
+			}
+			out+=logPdfNormal(params.lambda(i),meanVal,1/sqrt(params.tauEpsilon()));
+		}
+	}else{
+		for(unsigned int m=0;m<members.size();m++){
+			out+=logPYiGivenZiWi(params,dataset,nFixedEffects,c,members[m]);
+		}
+	}
+
+	// Prior for theta
+	// We use a location/scale t distribution
+	// http://www.mathworks.com/help/toolbox/stats/brn2ivz-145.html
+	// as per Molitor et al. 2008 (from Gelman et al. 2008)
+	// This is different from Papathomas who uses a normal
+	for (unsigned int k=0;k<nCategoriesY;k++){
+		out+=logPdfLocationScaleT(params.theta(c,k),hyperParams.muTheta(),
+				hyperParams.sigmaTheta(),hyperParams.dofTheta());
+	}
+
+	return out;
+}
+
 double logCondPostLambdaiBernoulli(const pReMiuMParams& params,
 								const mcmcModel<pReMiuMParams,
 												pReMiuMOptions,
@@ -4103,9 +4524,7 @@ double logCondPostLambdaiBernoulli(const pReMiuMParams& params,
 
 	int zi = params.z(i);
 	double meanVal = params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		meanVal+=params.beta(j,0)*dataset.W(i,j);
-	}
+	meanVal+=params.workLinearPredictor(i,0);
 	return logPYiGivenZiWiBernoulliExtraVar(params,dataset,nFixedEffects,zi,i)
 			+ logPdfNormal(params.lambda(i),meanVal,1.0/sqrt(params.tauEpsilon()));
 
@@ -4122,9 +4541,7 @@ double logCondPostLambdaiBinomial(const pReMiuMParams& params,
 
 	int zi = params.z(i);
 	double meanVal = params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		meanVal+=params.beta(j,0)*dataset.W(i,j);
-	}
+	meanVal+=params.workLinearPredictor(i,0);
 	return logPYiGivenZiWiBinomialExtraVar(params,dataset,nFixedEffects,zi,i)
 			+ logPdfNormal(params.lambda(i),meanVal,1.0/sqrt(params.tauEpsilon()));
 
@@ -4141,9 +4558,7 @@ double logCondPostLambdaiPoisson(const pReMiuMParams& params,
 
 	int zi = params.z(i);
 	double meanVal = params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		meanVal+=params.beta(j,0)*dataset.W(i,j);
-	}
+	meanVal+=params.workLinearPredictor(i,0);
 	meanVal+=dataset.logOffset(i);
 
 	return logPYiGivenZiWiPoissonExtraVar(params,dataset,nFixedEffects,zi,i)
@@ -4160,22 +4575,19 @@ void logUiPostPoissonSpatial(const pReMiuMParams& params,
                                  double* Pt_y1, double* Pt_y2){
 
 	const pReMiuMData& dataset=model.dataset();
-	unsigned int nFixedEffects=dataset.nFixedEffects();
 
 	double y1;
 	double y2;
 	int Yi=dataset.discreteY(iSub);
 	int zi=params.z(iSub);
 	double meanVal=params.theta(zi,0);
-	for(unsigned int j=0;j<nFixedEffects;j++){
-		meanVal+=params.beta(j,0)*dataset.W(iSub,j);
-	}
+	meanVal+=params.workLinearPredictor(iSub,0);
 	int nNeighi=dataset.nNeighbours(iSub);
 	// mean of Ui is mean of Uj where j are the neighbours of i
 	double meanUi=0.0;
 	for (int j = 0; j<nNeighi; j++){
-	        unsigned int nj = dataset.neighbours(iSub,j);
-	        double ucarj = params.uCAR(nj-1);
+	        unsigned int nj = dataset.neighbour(iSub,j);
+	        double ucarj = params.uCAR(nj);
 	        meanUi+=ucarj;
 	}
 	meanUi/=nNeighi;
@@ -4188,72 +4600,34 @@ void logUiPostPoissonSpatial(const pReMiuMParams& params,
 
 
 // Evaluation log of conditional density of \nu (shape parameter of Weibull for Survival response) 
-// given \gamma for adaptive rejection sampling
+// given \gamma for adaptive rejection sampling. The statistics of the cluster
+// (of all the subjects when the shape is shared) are computed by workNuStats
+// before the sampler is run, so each evaluation is one pass over its members
 void logNuPostSurvival(const pReMiuMParams& params,
                                  const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
                                  const unsigned int& cluster,
                                  const double& x,
                                  double* Pt_y1, double* Pt_y2){
 
-	const pReMiuMData& dataset=model.dataset();
 	const pReMiuMHyperParams& hyperParams = params.hyperParams();
-	unsigned int nFixedEffects=dataset.nFixedEffects();
-	unsigned int nSubjects=dataset.nSubjects();
-	const vector<unsigned int> censoring = dataset.censoring();
-	vector<double> y = dataset.continuousY();
-	const bool weibullFixedShape=model.options().weibullFixedShape();
+	const vector<double>& logT = params.workNuLogT(cluster);
+	const vector<double>& rate = params.workNuRate(cluster);
+	unsigned int nMembers = logT.size();
 
-	double y1;
-	double y2;
- 	// compute d
-	double dCensored = 0;
-	
-	if (weibullFixedShape){
-		for (unsigned int i=0;i<nSubjects;i++){
-			dCensored += censoring[i];
-		}	
-	} else {
-		for (unsigned int i=0;i<nSubjects;i++){
-			int zi=params.z(i);
-			if (zi==(int)cluster) dCensored += censoring[i];
-		}	
-	}
+	// number of events and sum of di*log yi
+	double dCensored = params.workNuNEvents(cluster);
+	double dlogY = params.workNuSumEventLogT(cluster);
 	// sum of yi^nu
 	double yNu = 0;
 	double yNulogy = 0;
-	for (unsigned int i=0;i<nSubjects;i++){
-		int zi=params.z(i);
-		if (weibullFixedShape){
-			double lambda = params.theta(zi,0);
-			for(unsigned int j=0;j<nFixedEffects;j++){
-				lambda+=params.beta(j,0)*dataset.W(i,j);
-			}
-			yNulogy += pow(y[i],x) * log(y[i]) * exp(lambda);
-			yNu += pow(y[i],x) * exp(lambda);
-		} else {
-			if (zi==(int)cluster) {
-				double lambda = params.theta(zi,0);
-				for(unsigned int j=0;j<nFixedEffects;j++){
-					lambda+=params.beta(j,0)*dataset.W(i,j);
-				}
-				yNulogy += pow(y[i],x) * log(y[i]) * exp(lambda);
-				yNu += pow(y[i],x) * exp(lambda);
-			}
-		}
-	}	
-	// sum of di*log yi
-	double dlogY = 0;
-	for (unsigned int i=0;i<nSubjects;i++){
-		if (weibullFixedShape){
-			dlogY += log(y[i]) * censoring[i];
-		} else {
-			int zi=params.z(i);
-			if (zi==(int)cluster) dlogY += log(y[i]) * censoring[i];
-		}
+	for (unsigned int k=0;k<nMembers;k++){
+		double yNuRate = exp(x*logT[k])*rate[k];
+		yNu += yNuRate;
+		yNulogy += yNuRate*logT[k];
 	}
-	y1=dCensored * log(x) - yNu + x * dlogY + (hyperParams.shapeNu()-1) * log(x) - hyperParams.scaleNu() * x;
+	double y1=dCensored * log(x) - yNu + x * dlogY + (hyperParams.shapeNu()-1) * log(x) - hyperParams.scaleNu() * x;
 	// derivative of y1
-	y2=dCensored / x - yNulogy + dlogY + (hyperParams.shapeNu()-1) / x - hyperParams.scaleNu();
+	double y2=dCensored / x - yNulogy + dlogY + (hyperParams.shapeNu()-1) / x - hyperParams.scaleNu();
 
 	*Pt_y1=y1;
 	*Pt_y2=y2;
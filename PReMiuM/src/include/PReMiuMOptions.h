@@ -44,6 +44,16 @@ using std::ofstream;
 using std::string;
 using std::time;
 
+/// \brief The models for the outcome
+enum pReMiuMOutcomeType {outcomeBernoulli,outcomeBinomial,outcomePoisson,outcomeNormal,
+	outcomeCategorical,outcomeQuantile,outcomeSurvival};
+
+/// \brief The models for the covariates
+enum pReMiuMCovariateType {covariateDiscrete,covariateNormal,covariateMixed};
+
+/// \brief The methods used by the sampler
+enum pReMiuMSamplerType {samplerSliceDependent,samplerSliceIndependent,samplerTruncated};
+
 /// \class pReMiuMOptions PReMiuMOptions.h "PReMiuMOptions.h"
 /// \brief A class for PReMiuM options
 class pReMiuMOptions{
@@ -72,9 +82,40 @@ class pReMiuMOptions{
 			// Random number seed
 			_seed=(uint_fast32_t) time(0);
 
+			// Number of threads (only used if compiled with OpenMP)
+			_nThreads=1;
+			// Number of independent chains
+			_nChains=1;
+			// Whether the timings of the sampler are recorded
+			_recordTimings=false;
+			// Whether the input files are read through a binary cache
+			_dataCache=false;
+			// Format of the output trace files (text or binary)
+			_outputFormat="text";
+			// Whether the output files are gzip compressed
+			_compressOutput=false;
+			// Whether the allocations are written as changes between sweeps
+			_deltaZ=false;
+			// Whether the output files are written by a background thread
+			_asyncOutput=false;
+			// The engine of the random number generator
+			_rngType="mt19937";
+			// The frequency (in sweeps) of the checkpoints (0 for none)
+			_checkpointEvery=0;
+			// The checkpoint the run is resumed from (empty for a new run)
+			_resumeFileName="";
+			// The frequency (in sweeps) with which convergence is checked
+			_monitorEvery=100;
+			// The effective sample size at which sampling ends (0 for none)
+			_targetESS=0.0;
+			// The split R-hat at which burn in ends (0 for none)
+			_targetRhat=0.0;
+
 			// Profile regression variables
 			_outcomeType="Bernoulli";
+			_outcomeTypeId=outcomeBernoulli;
 			_covariateType="Discrete";
+			_covariateTypeId=covariateDiscrete;
 			_includeResponse = true;
 			_whichLabelSwitch = "123";
 			_responseExtraVar = false;
@@ -83,12 +124,20 @@ class pReMiuMOptions{
 			_fixedAlpha=-2;
 			_dPitmanYor=0;
 			_samplerType="SliceDependent";
+			_samplerTypeId=samplerSliceDependent;
 			_computeEntropy=false;
+			_predictSummary=false;
 			_includeCAR=false;
 			_includeuCARinit=false;
 			_neighbourFileName="Neighbour.txt";
 			_uCARinitFileName="uCARinit.txt";
 			_PoissonCARadaptive=false;
+			_chromaticCAR=false;
+			_parallelClusters=false;
+			_parallelProposals=false;
+			_compactCovariates=false;
+			_singlePrecisionCovariates=false;
+			_writeStatus=false;
 			_predictType ="RaoBlackwell";
 			_weibullFixedShape=false;
 			_useNormInvWishPrior=false;
@@ -174,6 +223,153 @@ class pReMiuMOptions{
 			_seed=rndSeedNew;
 		}
 
+		/// \brief Return the number of threads
+		unsigned int nThreads() const{
+			return _nThreads;
+		}
+
+		/// \brief Set the number of threads
+		void nThreads(const unsigned int& nThr){
+			_nThreads=nThr;
+		}
+
+		/// \brief Return the number of independent chains
+		unsigned int nChains() const{
+			return _nChains;
+		}
+
+		/// \brief Set the number of independent chains
+		void nChains(const unsigned int& nCh){
+			_nChains=nCh;
+		}
+
+		/// \brief Return whether the timings of the sampler are recorded
+		bool recordTimings() const{
+			return _recordTimings;
+		}
+
+		/// \brief Set whether the timings of the sampler are recorded
+		void recordTimings(const bool& recTimings){
+			_recordTimings=recTimings;
+		}
+
+		/// \brief Return whether the input files are read through a binary cache
+		bool dataCache() const{
+			return _dataCache;
+		}
+
+		/// \brief Set whether the input files are read through a binary cache
+		void dataCache(const bool& useCache){
+			_dataCache=useCache;
+		}
+
+		/// \brief Return the format of the output trace files
+		string outputFormat() const{
+			return _outputFormat;
+		}
+
+		/// \brief Set the format of the output trace files
+		void outputFormat(const string& outFormat){
+			_outputFormat=outFormat;
+		}
+
+		/// \brief Return whether the output files are gzip compressed
+		bool compressOutput() const{
+			return _compressOutput;
+		}
+
+		/// \brief Set whether the output files are gzip compressed
+		void compressOutput(const bool& compress){
+			_compressOutput=compress;
+		}
+
+		/// \brief Return whether the allocations are written as the changes
+		/// between sweeps
+		bool deltaZ() const{
+			return _deltaZ;
+		}
+
+		/// \brief Set whether the allocations are written as the changes
+		/// between sweeps
+		void deltaZ(const bool& delta){
+			_deltaZ=delta;
+		}
+
+		/// \brief Return whether the output files are written by a background thread
+		bool asyncOutput() const{
+			return _asyncOutput;
+		}
+
+		/// \brief Set whether the output files are written by a background thread
+		void asyncOutput(const bool& async){
+			_asyncOutput=async;
+		}
+
+		/// \brief Return the engine of the random number generator
+		string rngType() const{
+			return _rngType;
+		}
+
+		/// \brief Set the engine of the random number generator
+		void rngType(const string& rng){
+			_rngType=rng;
+		}
+
+		/// \brief Return the frequency (in sweeps) with which a checkpoint is written
+		unsigned int checkpointEvery() const{
+			return _checkpointEvery;
+		}
+
+		/// \brief Set the frequency (in sweeps) with which a checkpoint is written
+		void checkpointEvery(const unsigned int& nSweeps){
+			_checkpointEvery=nSweeps;
+		}
+
+		/// \brief Return the checkpoint file the run is resumed from
+		string resumeFileName() const{
+			return _resumeFileName;
+		}
+
+		/// \brief Set the checkpoint file the run is resumed from
+		void resumeFileName(const string& fileName){
+			_resumeFileName=fileName;
+		}
+
+		/// \brief Return the frequency (in sweeps) with which convergence is checked
+		unsigned int monitorEvery() const{
+			return _monitorEvery;
+		}
+
+		/// \brief Set the frequency (in sweeps) with which convergence is checked
+		void monitorEvery(const unsigned int& nSweeps){
+			_monitorEvery=nSweeps;
+		}
+
+		/// \brief Return the effective sample size at which sampling ends
+		double targetESS() const{
+			return _targetESS;
+		}
+
+		/// \brief Set the effective sample size at which sampling ends
+		void targetESS(const double& ess){
+			_targetESS=ess;
+		}
+
+		/// \brief Return the split R-hat at which burn in ends
+		double targetRhat() const{
+			return _targetRhat;
+		}
+
+		/// \brief Set the split R-hat at which burn in ends
+		void targetRhat(const double& rHat){
+			_targetRhat=rHat;
+		}
+
+		/// \brief Return whether the convergence of the sampler is monitored
+		bool monitorConvergence() const{
+			return _targetESS>0.0||_targetRhat>0.0;
+		}
+
 		/// \brief Return the input file name
 		string inFileName() const{
 			return _inFileName;
@@ -223,6 +419,27 @@ class pReMiuMOptions{
 		/// \brief Set the outcome type
 		void outcomeType(const string& outType){
 			_outcomeType=outType;
+			if(outType.compare("Binomial")==0){
+				_outcomeTypeId=outcomeBinomial;
+			}else if(outType.compare("Poisson")==0){
+				_outcomeTypeId=outcomePoisson;
+			}else if(outType.compare("Normal")==0){
+				_outcomeTypeId=outcomeNormal;
+			}else if(outType.compare("Categorical")==0){
+				_outcomeTypeId=outcomeCategorical;
+			}else if(outType.compare("Quantile")==0){
+				_outcomeTypeId=outcomeQuantile;
+			}else if(outType.compare("Survival")==0){
+				_outcomeTypeId=outcomeSurvival;
+			}else{
+				_outcomeTypeId=outcomeBernoulli;
+			}
+		}
+
+		/// \brief Return the outcome type as an enum, for use in the sampler
+		/// instead of comparing strings
+		pReMiuMOutcomeType outcomeTypeId() const{
+			return _outcomeTypeId;
 		}
 
 		/// \brief Return the covariate type
@@ -233,6 +450,18 @@ class pReMiuMOptions{
 		/// \brief Set the covariate type
 		void covariateType(const string& covType){
 			_covariateType=covType;
+			if(covType.compare("Normal")==0){
+				_covariateTypeId=covariateNormal;
+			}else if(covType.compare("Mixed")==0){
+				_covariateTypeId=covariateMixed;
+			}else{
+				_covariateTypeId=covariateDiscrete;
+			}
+		}
+
+		/// \brief Return the covariate type as an enum
+		pReMiuMCovariateType covariateTypeId() const{
+			return _covariateTypeId;
 		}
 
 
@@ -284,6 +513,18 @@ class pReMiuMOptions{
 		/// \brief Set the outcome type
 		void samplerType(const string& sampType){
 			_samplerType=sampType;
+			if(sampType.compare("SliceIndependent")==0){
+				_samplerTypeId=samplerSliceIndependent;
+			}else if(sampType.compare("Truncated")==0){
+				_samplerTypeId=samplerTruncated;
+			}else{
+				_samplerTypeId=samplerSliceDependent;
+			}
+		}
+
+		/// \brief Return the sampler method as an enum
+		pReMiuMSamplerType samplerTypeId() const{
+			return _samplerTypeId;
 		}
 
 		/// \brief Return whether we are including response
@@ -321,6 +562,18 @@ class pReMiuMOptions{
 			_computeEntropy=compEntr;
 		}
 
+		/// \brief Return whether the running moments of the predicted
+		/// responses are kept
+		bool predictSummary() const{
+			return _predictSummary;
+		}
+
+		/// \brief Set whether the running moments of the predicted responses
+		/// are kept
+		void predictSummary(const bool& predSummary){
+			_predictSummary=predSummary;
+		}
+
 		/// \brief Return whether we are including CAR random term
 		bool includeCAR() const{
 			return _includeCAR;
@@ -371,6 +624,70 @@ class pReMiuMOptions{
 			_PoissonCARadaptive=adaptive;
 		}
 
+		/// \brief Return whether the spatial random effects are updated colour by colour
+		bool chromaticCAR() const{
+			return _chromaticCAR;
+		}
+
+		/// \brief Set whether the spatial random effects are updated colour by colour
+		void chromaticCAR(const bool& chromatic){
+			_chromaticCAR=chromatic;
+		}
+
+		/// \brief Return whether the per cluster updates are run in parallel
+		bool parallelClusters() const{
+			return _parallelClusters;
+		}
+
+		/// \brief Set whether the per cluster updates are run in parallel
+		void parallelClusters(const bool& parallel){
+			_parallelClusters=parallel;
+		}
+
+		/// \brief Return whether the proposals that do not conflict are run
+		/// concurrently
+		bool parallelProposals() const{
+			return _parallelProposals;
+		}
+
+		/// \brief Set whether the proposals that do not conflict are run
+		/// concurrently
+		void parallelProposals(const bool& parallel){
+			_parallelProposals=parallel;
+		}
+
+		/// \brief Return whether the covariates are held in compact storage
+		bool compactCovariates() const{
+			return _compactCovariates;
+		}
+
+		/// \brief Set whether the covariates are held in compact storage
+		void compactCovariates(const bool& compact){
+			_compactCovariates=compact;
+		}
+
+		/// \brief Return whether the continuous covariates are held in single
+		/// precision (in compact storage)
+		bool singlePrecisionCovariates() const{
+			return _singlePrecisionCovariates;
+		}
+
+		/// \brief Set whether the continuous covariates are held in single
+		/// precision (in compact storage)
+		void singlePrecisionCovariates(const bool& singlePrecision){
+			_singlePrecisionCovariates=singlePrecision;
+		}
+
+		/// \brief Return whether the status file is written during the run
+		bool writeStatus() const{
+			return _writeStatus;
+		}
+
+		/// \brief Set whether the status file is written during the run
+		void writeStatus(const bool& status){
+			_writeStatus=status;
+		}
+
 
 		/// \brief Return the prediction type
 		string predictType() const{
@@ -446,22 +763,46 @@ class pReMiuMOptions{
 			_nProgress=options.nProgress();
 			_nClusInit=options.nClusInit();
 			_seed=options.seed();
+			_nThreads=options.nThreads();
+			_nChains=options.nChains();
+			_recordTimings=options.recordTimings();
+			_dataCache=options.dataCache();
+			_outputFormat=options.outputFormat();
+			_compressOutput=options.compressOutput();
+			_deltaZ=options.deltaZ();
+			_asyncOutput=options.asyncOutput();
+			_rngType=options.rngType();
+			_checkpointEvery=options.checkpointEvery();
+			_resumeFileName=options.resumeFileName();
+			_monitorEvery=options.monitorEvery();
+			_targetESS=options.targetESS();
+			_targetRhat=options.targetRhat();
 			_outcomeType=options.outcomeType();
+			_outcomeTypeId=options.outcomeTypeId();
 			_covariateType=options.covariateType();
+			_covariateTypeId=options.covariateTypeId();
 			_includeResponse=options.includeResponse();
 			_whichLabelSwitch=options.whichLabelSwitch();
 			_fixedAlpha=options.fixedAlpha();
 			_dPitmanYor=options.dPitmanYor();
 			_samplerType=options.samplerType();
+			_samplerTypeId=options.samplerTypeId();
 			_doPrediction=options.doPrediction();
 			_responseExtraVar=options.responseExtraVar();
 			_varSelectType=options.varSelectType();
 			_computeEntropy=options.computeEntropy();
+			_predictSummary=options.predictSummary();
 			_includeCAR=options.includeCAR();
 			_includeuCARinit=options.includeuCARinit();
 			_neighbourFileName=options.neighbourFileName();
 			_uCARinitFileName=options.uCARinitFileName();
 			_PoissonCARadaptive=options.PoissonCARadaptive();
+			_chromaticCAR=options.chromaticCAR();
+			_parallelClusters=options.parallelClusters();
+			_parallelProposals=options.parallelProposals();
+			_compactCovariates=options.compactCovariates();
+			_singlePrecisionCovariates=options.singlePrecisionCovariates();
+			_writeStatus=options.writeStatus();
 			_predictType=options.predictType();
 			_weibullFixedShape=options.weibullFixedShape();
 			_useNormInvWishPrior=options.useNormInvWishPrior();
@@ -495,10 +836,42 @@ class pReMiuMOptions{
 		unsigned int _nClusInit;
 		// The random number seed
 		uint_fast32_t _seed;
+		// The number of threads used in the parallel parts of the sampler
+		unsigned int _nThreads;
+		// The number of independent chains, run in parallel
+		unsigned int _nChains;
+		// Whether the wall time of each proposal and step of the sampler is recorded
+		bool _recordTimings;
+		// Whether the parsed input files are cached in a binary file next to them
+		bool _dataCache;
+		// The format of the output trace files ("text" or "binary")
+		string _outputFormat;
+		// Whether the output trace files are gzip compressed
+		bool _compressOutput;
+		// Whether the allocations are written as the changes since the previous sweep (_zDelta file)
+		bool _deltaZ;
+		// Whether the records of the output files are written by a background thread
+		bool _asyncOutput;
+		// The engine of the random number generator ('mt19937' or 'xoshiro256++')
+		string _rngType;
+		// The frequency (in sweeps) with which the state of the sampler is checkpointed (0 for never)
+		unsigned int _checkpointEvery;
+		// The checkpoint file the run is resumed from (empty for a new run)
+		string _resumeFileName;
+		// The frequency (in sweeps) with which the convergence of the sampler is checked
+		unsigned int _monitorEvery;
+		// The pooled effective sample size of the monitored statistics at which sampling ends (0 for never)
+		double _targetESS;
+		// The split R-hat of the monitored statistics at which burn in ends (0 for never)
+		double _targetRhat;
 		// The model for the outcome
 		string _outcomeType;
+		// The model for the outcome, as an enum
+		pReMiuMOutcomeType _outcomeTypeId;
 		// The model for the covariates
 		string _covariateType;
+		// The model for the covariates, as an enum
+		pReMiuMCovariateType _covariateTypeId;
 		// This notes whether we are including the response
 		bool _includeResponse;
 		// This notes which label switching moves are run
@@ -509,6 +882,8 @@ class pReMiuMOptions{
 		double _dPitmanYor;
 		// The method used by the sampler
 		string _samplerType;
+		// The method used by the sampler, as an enum
+		pReMiuMSamplerType _samplerTypeId;
 		// This notes whether we are also doing predictions
 		bool _doPrediction;
 		// This notes whether we have extra variation in the response
@@ -517,6 +892,8 @@ class pReMiuMOptions{
 		string _varSelectType;
 		// This notes whether we are computing entropy
 		bool _computeEntropy;
+		// This notes whether the running moments of the predicted responses are kept
+		bool _predictSummary;
 		// This notes whether we are including CAR random term
 		bool _includeCAR;
 		// This notes whether we are including initialisation values for uCAR
@@ -527,6 +904,23 @@ class pReMiuMOptions{
 		string _uCARinitFileName;
 		// For Poisson response and spatial CAR, to choose whether to use  the adaptive rejection sampler
 		bool _PoissonCARadaptive;
+		// For spatial CAR, whether the random effects of each colour of the
+		// neighbourhood graph are updated together
+		bool _chromaticCAR;
+		// Whether the updates of the parameters of each cluster are run as
+		// parallel tasks, each with its own random number substream
+		bool _parallelClusters;
+		// Whether the proposals of a sweep that do not read or write the
+		// parameters updated by each other are run concurrently
+		bool _parallelProposals;
+		// Whether the covariates are packed once they are read (missing
+		// indicators as a bitset, narrow discrete values, shared with the
+		// working copy), and whether the continuous ones are then in single
+		// precision
+		bool _compactCovariates;
+		bool _singlePrecisionCovariates;
+		// Whether the progress of the run is written to the _status.txt file
+		bool _writeStatus;
 		// The type of predictions (RaoBlackwell or random - which is only for yModel=Normal or yModel=Quantile)
 		string _predictType;
 		// For Survival response, whether the weibull shape parameter is fixed or cluster specific
@@ -35,6 +35,8 @@
 #include<string>
 #include<numeric>
 #include<limits>
+#include<algorithm>
+#include<functional>
 
 #include<boost/math/distributions/normal.hpp>
 #include<boost/math/distributions/beta.hpp>
@@ -45,6 +47,10 @@
 #include<Eigen/Cholesky>
 #include<Eigen/LU>
 
+#ifdef _OPENMP
+#include<omp.h>
+#endif
+
 // Custom includes
 #include<MCMC/chain.h>
 #include<MCMC/model.h>
@@ -65,6 +71,286 @@ using boost::math::students_t_distribution;
 using boost::math::lgamma;
 
 
+/// \class pReMiuMWorkspace PReMiuMProposals.h "PReMiuMProposals.h"
+/// \brief Class for the temporaries the proposals need in each sweep, which
+/// are kept between sweeps so that they are only allocated when they grow.
+/// The proposals size and initialise the buffers they use, the contents are
+/// meaningless between calls.
+class pReMiuMWorkspace{
+
+	public:
+		/// \brief Default constructor
+		pReMiuMWorkspace() {};
+
+		/// \brief Return the buffer for the indices of the non-empty clusters
+		/// used by the label switching moves
+		vector<unsigned int>& nonEmptyClusters(){
+			return _nonEmptyClusters;
+		}
+
+		/// \brief Return the buffer for the uniforms used for the slice variables
+		vector<double>& uRnd(){
+			return _uRnd;
+		}
+
+		/// \brief Return the buffer for the uniforms used for the allocations
+		vector<double>& zRnd(){
+			return _zRnd;
+		}
+
+		/// \brief Return the buffer for the slice variables u
+		vector<double>& zU(){
+			return _zU;
+		}
+
+		/// \brief Return the buffer for the bounds the slice variables are
+		/// tested against for each cluster
+		vector<double>& zTestBound(){
+			return _zTestBound;
+		}
+
+		/// \brief Return the buffer for the log prior weight of each cluster
+		vector<double>& zClusterWeight(){
+			return _zClusterWeight;
+		}
+
+		/// \brief Return the buffer for the clusters sorted by decreasing
+		/// test bound
+		vector<unsigned int>& zClusterOrder(){
+			return _zClusterOrder;
+		}
+
+		/// \brief Return the buffer for the test bounds in decreasing order
+		vector<double>& zSortedBound(){
+			return _zSortedBound;
+		}
+
+		/// \brief Return the buffer for the number of fitting subjects allocated
+		/// to each cluster
+		vector<unsigned int>& zNMembers(){
+			return _zNMembers;
+		}
+
+		/// \brief Return the buffer for the fitting subjects allocated to each
+		/// cluster
+		vector<vector<unsigned int> >& zClusterMembers(){
+			return _zClusterMembers;
+		}
+
+		/// \brief Return the buffer for log p(X_i|z_i=c), one row per subject
+		vector<vector<double> >& zLogPXiGivenZi(){
+			return _zLogPXiGivenZi;
+		}
+
+		/// \brief Return the buffer for the continuous covariates, one column per
+		/// fitting subject
+		MatrixXd& zContinuousX(){
+			return _zContinuousX;
+		}
+
+		/// \brief Return the buffer for the square roots of the marginal
+		/// precisions of the missing continuous covariate patterns
+		vector<MatrixXd>& zPatternSqrtTau(){
+			return _zPatternSqrtTau;
+		}
+
+		/// \brief Return the buffer for the log determinants of the marginal
+		/// precisions of the missing continuous covariate patterns
+		vector<double>& zPatternLogDetTau(){
+			return _zPatternLogDetTau;
+		}
+
+		/// \brief Return the buffer for the offset of the linear predictor
+		vector<double>& zMeanVec(){
+			return _zMeanVec;
+		}
+
+		/// \brief Return the buffer for the allocations before the update
+		vector<int>& zPrevZ(){
+			return _zPrevZ;
+		}
+
+		/// \brief Return the per thread buffers for log p(y_i,X_i,z_i=c)
+		vector<vector<double> >& zThreadLogPyXz(){
+			return _zThreadLogPyXz;
+		}
+
+		/// \brief Return the per thread buffers for p(z_i=c|y_i,X_i)
+		vector<vector<double> >& zThreadPzGivenXy(){
+			return _zThreadPzGivenXy;
+		}
+
+		/// \brief Return the per thread buffers for the cumulative p(z_i=c|y_i,X_i)
+		vector<vector<double> >& zThreadCumPzGivenXy(){
+			return _zThreadCumPzGivenXy;
+		}
+
+		/// \brief Return the per thread buffers for the expected theta of the
+		/// predictive subjects
+		vector<vector<double> >& zThreadExpectedTheta(){
+			return _zThreadExpectedTheta;
+		}
+
+		/// \brief Return the per thread buffers for the clusters a subject
+		/// can be allocated to
+		vector<vector<unsigned int> >& zThreadCandidates(){
+			return _zThreadCandidates;
+		}
+
+		/// \brief Return the buffers of each thread the discrete covariates of
+		/// a subject are unpacked into in the update of the allocations
+		vector<vector<int> >& zThreadDiscreteX(){
+			return _zThreadDiscreteX;
+		}
+
+		/// \brief Return the buffers of each thread the observed continuous
+		/// covariates of a predictive subject are gathered into
+		vector<VectorXd>& zThreadXi(){
+			return _zThreadXi;
+		}
+
+		/// \brief Return the buffers of each thread the cluster means of the
+		/// observed continuous covariates of a predictive subject are gathered
+		/// into
+		vector<VectorXd>& zThreadMuStar(){
+			return _zThreadMuStar;
+		}
+
+		/// \brief Return the buffer for the mean of the continuous covariates
+		/// in each cluster
+		vector<VectorXd>& muMeanX(){
+			return _muMeanX;
+		}
+
+		/// \brief Return the buffer for the diagonal matrices of gamma in each
+		/// cluster
+		vector<MatrixXd>& muGammaMat(){
+			return _muGammaMat;
+		}
+
+		/// \brief Return the buffer for the diagonal matrices of 1-gamma in each
+		/// cluster
+		vector<MatrixXd>& muOneMinusGammaMat(){
+			return _muOneMinusGammaMat;
+		}
+
+		/// \brief Return the buffer for the order in which the clusters are
+		/// given to the threads in the parallel per cluster updates
+		vector<unsigned int>& clusterTaskOrder(){
+			return _clusterTaskOrder;
+		}
+
+		/// \brief Return the buffer for the seeds of the random number
+		/// substream of each cluster in the parallel per cluster updates
+		vector<uint32_t>& clusterTaskSeeds(){
+			return _clusterTaskSeeds;
+		}
+
+		/// \brief Return the buffer for the linear predictor before each
+		/// proposal for beta
+		vector<double>& betaLinearPredictor(){
+			return _betaLinearPredictor;
+		}
+
+		/// \brief Return the buffer for the uniforms of the variable selection
+		/// update, one for each covariate and cluster
+		vector<double>& gammaRnd(){
+			return _gammaRnd;
+		}
+
+		/// \brief Return the buffer for the number of members of each cluster
+		/// in each category of the discrete covariates, laid out as the
+		/// working phi star values
+		vector<unsigned int>& gammaNInCategory(){
+			return _gammaNInCategory;
+		}
+
+		/// \brief Return the buffer for the change in the phi star values of
+		/// the discrete covariates whose gamma was switched, laid out as the
+		/// working phi star values
+		vector<double>& gammaLogPhiStarDiff(){
+			return _gammaLogPhiStarDiff;
+		}
+
+		/// \brief Return the buffer for the mu star values of the continuous
+		/// covariates before their gamma was switched
+		vector<double>& gammaMuStarOld(){
+			return _gammaMuStarOld;
+		}
+
+		/// \brief Return the buffer for whether gamma was switched for each
+		/// cluster and covariate
+		vector<unsigned int>& gammaSwitched(){
+			return _gammaSwitched;
+		}
+
+		/// \brief Return the buffer for the covariates whose gamma was switched,
+		/// grouped by cluster
+		vector<unsigned int>& gammaSwitchedCovs(){
+			return _gammaSwitchedCovs;
+		}
+
+		/// \brief Return the buffer for the start of each cluster in
+		/// gammaSwitchedCovs
+		vector<unsigned int>& gammaSwitchedStart(){
+			return _gammaSwitchedStart;
+		}
+
+		/// \brief Return the buffer for the subjects of the update of nu when
+		/// the Weibull shape is shared by the clusters
+		vector<unsigned int>& nuSubjects(){
+			return _nuSubjects;
+		}
+
+		/// \brief Return the workspaces of the adaptive rejection sampler
+		/// for nu, one for each thread
+		vector<arsWorkspace>& nuThreadArs(){
+			return _nuThreadArs;
+		}
+
+	private:
+		vector<unsigned int> _nonEmptyClusters;
+		vector<double> _uRnd;
+		vector<double> _zRnd;
+		vector<double> _zU;
+		vector<double> _zTestBound;
+		vector<double> _zClusterWeight;
+		vector<unsigned int> _zClusterOrder;
+		vector<double> _zSortedBound;
+		vector<unsigned int> _zNMembers;
+		vector<vector<unsigned int> > _zClusterMembers;
+		vector<vector<double> > _zLogPXiGivenZi;
+		MatrixXd _zContinuousX;
+		vector<MatrixXd> _zPatternSqrtTau;
+		vector<double> _zPatternLogDetTau;
+		vector<double> _zMeanVec;
+		vector<int> _zPrevZ;
+		vector<vector<double> > _zThreadLogPyXz;
+		vector<vector<double> > _zThreadPzGivenXy;
+		vector<vector<double> > _zThreadCumPzGivenXy;
+		vector<vector<double> > _zThreadExpectedTheta;
+		vector<vector<unsigned int> > _zThreadCandidates;
+		vector<vector<int> > _zThreadDiscreteX;
+		vector<VectorXd> _zThreadXi;
+		vector<VectorXd> _zThreadMuStar;
+		vector<VectorXd> _muMeanX;
+		vector<MatrixXd> _muGammaMat;
+		vector<MatrixXd> _muOneMinusGammaMat;
+		vector<unsigned int> _clusterTaskOrder;
+		vector<uint32_t> _clusterTaskSeeds;
+		vector<double> _gammaRnd;
+		vector<unsigned int> _gammaNInCategory;
+		vector<double> _gammaLogPhiStarDiff;
+		vector<double> _gammaMuStarOld;
+		vector<unsigned int> _gammaSwitched;
+		vector<unsigned int> _gammaSwitchedCovs;
+		vector<unsigned int> _gammaSwitchedStart;
+		vector<double> _betaLinearPredictor;
+		vector<unsigned int> _nuSubjects;
+		vector<arsWorkspace> _nuThreadArs;
+
+};
+
 class pReMiuMPropParams{
 
 	public:
@@ -952,6 +1238,12 @@ class pReMiuMPropParams{
 			_uCARAnyUpdates = newStatus;
 		}
 
+		/// \brief Return the buffers the proposals reuse between sweeps (they
+		/// are not copied with the other proposal parameters)
+		pReMiuMWorkspace& workspace(){
+			return _workspace;
+		}
+
 
 		// Need to define a copy iterator
 		pReMiuMPropParams& operator=(const pReMiuMPropParams& propParams){
@@ -1040,6 +1332,32 @@ class pReMiuMPropParams{
 
 		}
 
+		/// \brief Member function to write or read the adaptive proposal
+		/// parameters and acceptance counts in a checkpoint
+		template<class Archive>
+		void serialise(Archive& ar){
+			ar & _nTryTheta & _nAcceptTheta & _nLocalAcceptTheta & _nResetTheta;
+			ar & _thetaStdDev & _thetaStdDevLower & _thetaStdDevUpper & _thetaAcceptTarget;
+			ar & _thetaUpdateFreq & _thetaAnyUpdates & _nTryBeta & _nAcceptBeta;
+			ar & _nLocalAcceptBeta & _nResetBeta & _betaStdDev & _betaStdDevLower;
+			ar & _betaStdDevUpper & _betaAcceptTarget & _betaUpdateFreq & _betaAnyUpdates;
+			ar & _nTryTauS & _nAcceptTauS & _nLocalAcceptTauS & _nResetTauS;
+			ar & _TauSStdDev & _TauSStdDevLower & _TauSStdDevUpper & _TauSAcceptTarget;
+			ar & _TauSUpdateFreq & _TauSAnyUpdates & _nTryAlpha & _nAcceptAlpha;
+			ar & _nLocalAcceptAlpha & _nResetAlpha & _alphaStdDev & _alphaStdDevLower;
+			ar & _alphaStdDevUpper & _alphaAcceptTarget & _alphaUpdateFreq & _alphaAnyUpdates;
+			ar & _nTryKappa1 & _nAcceptKappa1 & _nLocalAcceptKappa1 & _nResetKappa1;
+			ar & _kappa1StdDev & _kappa1StdDevLower & _kappa1StdDevUpper & _kappa1AcceptTarget;
+			ar & _kappa1UpdateFreq & _kappa1AnyUpdates & _nTryRho & _nAcceptRho;
+			ar & _nLocalAcceptRho & _nResetRho & _rhoStdDev & _rhoStdDevLower;
+			ar & _rhoStdDevUpper & _rhoAcceptTarget & _rhoUpdateFreq & _rhoAnyUpdates;
+			ar & _nTryLambda & _nAcceptLambda & _nLocalAcceptLambda & _nResetLambda;
+			ar & _lambdaStdDev & _lambdaStdDevLower & _lambdaStdDevUpper & _lambdaAcceptTarget;
+			ar & _lambdaUpdateFreq & _lambdaAnyUpdates & _nTryuCAR & _nAcceptuCAR;
+			ar & _nLocalAcceptuCAR & _nResetuCAR & _uCARStdDev & _uCARStdDevLower;
+			ar & _uCARStdDevUpper & _uCARAcceptTarget & _uCARUpdateFreq & _uCARAnyUpdates;
+		}
+
 	private:
 		unsigned int _nTryTheta;
 		unsigned int _nAcceptTheta;
@@ -1123,9 +1441,49 @@ class pReMiuMPropParams{
 		unsigned int _uCARUpdateFreq;
 		bool _uCARAnyUpdates;
 
+		pReMiuMWorkspace _workspace;
+
+};
 
+/*********** Parallel per cluster updates **********************************/
+// With the parallelClusters option the updates of the parameters of each
+// cluster, which are independent given the allocations, are run as one task
+// per cluster over the threads. Each cluster draws from its own generator,
+// seeded from the main one in cluster order, so the result does not depend
+// on the number of threads or on which thread runs the cluster.
+
+// Orders the clusters by decreasing number of members, the clusters of equal
+// size in increasing order
+struct decreasingClusterSize{
+	decreasingClusterSize(const pReMiuMParams& params) : _params(params) {}
+	bool operator()(const unsigned int& c1,const unsigned int& c2) const{
+		return _params.workNXInCluster(c1)>_params.workNXInCluster(c2);
+	}
+	const pReMiuMParams& _params;
 };
 
+// Sets up the tasks for the clusters cBegin to cEnd-1: one seed for each
+// cluster, and the order in which the clusters are handed out. With a dynamic
+// schedule the threads take the next cluster of this order when they are
+// done, so when sortBySize the largest clusters are started first and the
+// small ones fill in the threads that finish early
+void clusterTasks(const pReMiuMParams& currentParams,const unsigned int& cBegin,
+		const unsigned int& cEnd,const bool& sortBySize,baseGeneratorType& rndGenerator,
+		pReMiuMWorkspace& workspace){
+	vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+	vector<unsigned int>& order = workspace.clusterTaskOrder();
+	unsigned int nTasks = cEnd>cBegin?cEnd-cBegin:0;
+	seeds.resize(nTasks);
+	order.resize(nTasks);
+	for(unsigned int k=0;k<nTasks;k++){
+		seeds[k]=rndGenerator();
+		order[k]=cBegin+k;
+	}
+	if(sortBySize){
+		std::stable_sort(order.begin(),order.end(),decreasingClusterSize(currentParams));
+	}
+}
+
 /*********** BLOCK 1 p(v^A,Theta^A,u|.) **********************************/
 // A=Active, and Theta contains: phi, mu, Tau, gamma, theta
 // We proceed by sampling from p(v^A,Theta^A|.) i.e. marginalising out the u
@@ -1181,6 +1539,82 @@ void gibbsForVActive(mcmcChain<pReMiuMParams>& chain,
 // Move for updating phi
 // Gibbs used if no variable selection, or binary switch based variable selection
 // Otherwise Metropolis Hastings is used
+
+// Updates phi_cj for each covariate j of cluster c
+void updateForPhiActiveCluster(pReMiuMParams& currentParams,
+				const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
+				const unsigned int& c,const unsigned int& nCovariates,
+				unsigned int& nTry,unsigned int& nAccept,
+				baseGeneratorType& rndGenerator){
+
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
+	const pReMiuMData& dataset = model.dataset();
+	bool continuousVarSelect = model.options().varSelectType().compare("Continuous")==0;
+	const vector<unsigned int>& members = currentParams.workClusterMembers(c);
+
+	// Define a uniform random number generator
+	randomUniform unifRand(0,1);
+
+	double currentLogPost=0.0;
+
+	// Loop over the covariates
+	for(unsigned int j=0;j<nCovariates;j++){
+		nTry++;
+
+		if(continuousVarSelect){
+			currentLogPost=logCondPostPhicj(currentParams,model,c,j);
+		}
+
+		unsigned int nCategories = currentParams.nCategories(j);
+		// We are updating phis
+		// First we must count how many individuals have Xij in each of the
+		// possible categories for covariate j.
+		vector<double> dirichParams(nCategories,hyperParams.aPhi(j));
+		double gammacj = currentParams.gamma(c,j);
+		for(unsigned int k=0;k<members.size();k++){
+			int Xij = dataset.discreteX(members[k],j);
+			// When no variable selection will always add 1.
+			// In the binary variable selection case
+			// this will add a 1 only when the
+			// variable is switched on (as required)
+			// In the continuous case this seems like a sensible proposal
+			dirichParams[Xij]=dirichParams[Xij]+gammacj;
+		}
+		vector<double> currentLogPhi(nCategories);
+		currentLogPhi=currentParams.logPhi(c,j);
+
+		vector<double> proposedLogPhi(nCategories);
+		proposedLogPhi=dirichletRand(rndGenerator,dirichParams);
+		for(unsigned int p=0;p<nCategories;p++){
+			proposedLogPhi[p]=log(proposedLogPhi[p]);
+		}
+		currentParams.logPhi(c,j,proposedLogPhi);
+		// If no variable selection or binary variable selection
+		// this is a sample from full conditional so no accept reject
+		// step need. If it is continuous variable selection we
+		// need an accept reject decision
+		if(continuousVarSelect){
+			double proposedLogPost = logCondPostPhicj(currentParams,model,c,j);
+			double logAcceptRatio=0.0;
+			logAcceptRatio=proposedLogPost-currentLogPost;
+			logAcceptRatio+=logPdfDirichlet(currentLogPhi,dirichParams,true);
+			logAcceptRatio-=logPdfDirichlet(proposedLogPhi,dirichParams,true);
+			if(unifRand(rndGenerator)<exp(logAcceptRatio)){
+				// Move accepted
+				nAccept++;
+			}else{
+				// Move rejected
+				// Reset phi
+				currentParams.logPhi(c,j,currentLogPhi);
+			}
+		}else{
+			nAccept++;
+		}
+
+	}
+
+}
+
 void updateForPhiActive(mcmcChain<pReMiuMParams>& chain,
 				unsigned int& nTry,unsigned int& nAccept,
 				const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
@@ -1189,11 +1623,7 @@ void updateForPhiActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
-
 
-	const pReMiuMData& dataset = model.dataset();
-	string varSelectType = model.options().varSelectType();
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
 	// Find the number of covariates
@@ -1203,79 +1633,85 @@ void updateForPhiActive(mcmcChain<pReMiuMParams>& chain,
 	} else {
 		nCovariates = currentParams.nCovariates();
 	}
-	// Find the number of subjects
-	unsigned int nSubjects = dataset.nSubjects();
 
-	// Define a uniform random number generator
-	randomUniform unifRand(0,1);
-
-	double currentLogPost=0.0;
+	if(model.options().parallelClusters()){
+		pReMiuMWorkspace& workspace = propParams.workspace();
+		clusterTasks(currentParams,0,maxZ+1,true,rndGenerator,workspace);
+		const vector<unsigned int>& order = workspace.clusterTaskOrder();
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		unsigned int nTryTasks=0,nAcceptTasks=0;
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1) reduction(+:nTryTasks,nAcceptTasks)
+		for(unsigned int k=0;k<=maxZ;k++){
+			unsigned int c = order[k];
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c]);
+			updateForPhiActiveCluster(currentParams,model,c,nCovariates,nTryTasks,nAcceptTasks,clusterGenerator);
+		}
+		nTry+=nTryTasks;
+		nAccept+=nAcceptTasks;
+		return;
+	}
 
 	for(unsigned int c=0;c<=maxZ;c++){
-		// Loop over the covariates
-		for(unsigned int j=0;j<nCovariates;j++){
-			nTry++;
+		updateForPhiActiveCluster(currentParams,model,c,nCovariates,nTry,nAccept,rndGenerator);
+	}
 
-			if(varSelectType.compare("Continuous")==0){
-				currentLogPost=logCondPostPhicj(currentParams,model,c,j);
-			}
+}
 
-			unsigned int nCategories = currentParams.nCategories(j);
-			// We are updating phis
-			// First we must count how many individuals have Xij in each of the
-			// possible categories for covariate j.
-			vector<double> dirichParams(nCategories,hyperParams.aPhi(j));
-			double gammacj = currentParams.gamma(c,j);
-			for(unsigned int i=0;i<nSubjects;i++){
-				int zi = currentParams.z(i);
-				if(zi==(int)c){
-					int Xij = dataset.discreteX(i,j);
-					// When no variable selection will always add 1.
-					// In the binary variable selection case
-					// this will add a 1 only when the
-					// variable is switched on (as required)
-					// In the continuous case this seems like a sensible proposal
-					dirichParams[Xij]=dirichParams[Xij]+gammacj;
-				}
-			}
-			vector<double> currentLogPhi(nCategories);
-			currentLogPhi=currentParams.logPhi(c,j);
+// Gibbs update for mu in Normal covariate case
 
-			vector<double> proposedLogPhi(nCategories);
-			proposedLogPhi=dirichletRand(rndGenerator,dirichParams);
-			for(unsigned int p=0;p<nCategories;p++){
-				proposedLogPhi[p]=log(proposedLogPhi[p]);
-			}
-			currentParams.logPhi(c,j,proposedLogPhi);
-			// If no variable selection or binary variable selection
-			// this is a sample from full conditional so no accept reject
-			// step need. If it is continuous variable selection we
-			// need an accept reject decision
-			if(varSelectType.compare("Continuous")==0){
-				double proposedLogPost = logCondPostPhicj(currentParams,model,c,j);
-				double logAcceptRatio=0.0;
-				logAcceptRatio=proposedLogPost-currentLogPost;
-				logAcceptRatio+=logPdfDirichlet(currentLogPhi,dirichParams,true);
-				logAcceptRatio-=logPdfDirichlet(proposedLogPhi,dirichParams,true);
-				if(unifRand(rndGenerator)<exp(logAcceptRatio)){
-					// Move accepted
-					nAccept++;
-				}else{
-					// Move rejected
-					// Reset phi
-					currentParams.logPhi(c,j,currentLogPhi);
-				}
-			}else{
-				nAccept++;
-			}
+// Draws mu_c from its full conditional, given the mean of the covariates in
+// cluster c and the diagonal matrices of gamma_c and 1-gamma_c
+void gibbsForMuActiveCluster(pReMiuMParams& currentParams,
+				const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
+				const unsigned int& c,VectorXd& meanX,const MatrixXd& gammaMat,
+				const MatrixXd& oneMinusGammaMat,baseGeneratorType& rndGenerator){
 
-		}
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
+	bool useIndependentNormal = model.options().useIndependentNormal();
+	bool useHyperpriorR1 = model.options().useHyperpriorR1();
+	bool useSeparationPrior = model.options().useSeparationPrior();
+	unsigned int nCovariates = meanX.size();
+
+	// Having computed this we can calcuate the posterior mean
+	// and posterior covariance for each mu_c
+	int nXInC = currentParams.workNXInCluster(c);
+	if(nXInC>0){
+		meanX=meanX/(double)nXInC;
+	}else{
+		meanX.setZero(nCovariates);
+	}
+
+	MatrixXd covMat(nCovariates,nCovariates);
+	VectorXd meanVec(nCovariates);
 
+	if (useHyperpriorR1) {
+		covMat = (currentParams.Tau00() + nXInC*gammaMat * currentParams.Tau(c)*gammaMat).inverse();	
+		meanVec = currentParams.Tau00()*currentParams.mu00() +
+			nXInC*gammaMat * currentParams.Tau(c)*(meanX - oneMinusGammaMat * currentParams.nullMu());
+		meanVec = covMat*meanVec;
+	}
+	else if (useSeparationPrior) {
+		covMat = (hyperParams.Tau00() + nXInC*gammaMat * currentParams.Tau(c)*gammaMat).inverse();
+		meanVec = hyperParams.Tau00()*currentParams.mu00() +
+			nXInC*gammaMat * currentParams.Tau(c)*(meanX - oneMinusGammaMat * currentParams.nullMu());
+		meanVec = covMat*meanVec;
+	} 
+	else {
+		covMat = (hyperParams.Tau0() + nXInC*gammaMat * currentParams.Tau(c)*gammaMat).inverse();
+		meanVec = hyperParams.Tau0()*hyperParams.mu0() +
+			nXInC*gammaMat * currentParams.Tau(c)*(meanX - oneMinusGammaMat * currentParams.nullMu());
+		meanVec = covMat*meanVec;
 	}
 
+	VectorXd mu(nCovariates);
+	// We sample from this posterior
+	mu = multivarNormalRand(rndGenerator, meanVec, covMat);
+
+	// We store our sample
+	currentParams.mu(c,mu, useIndependentNormal);
 }
 
-// Gibbs update for mu in Normal covariate case
 void gibbsForMuActive(mcmcChain<pReMiuMParams>& chain,
 				unsigned int& nTry,unsigned int& nAccept,
 				const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
@@ -1284,12 +1720,6 @@ void gibbsForMuActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
-
-	const pReMiuMData& dataset = model.dataset();
-	bool useIndependentNormal = model.options().useIndependentNormal();
-	bool useHyperpriorR1 = model.options().useHyperpriorR1();
-	bool useSeparationPrior = model.options().useSeparationPrior();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -1300,37 +1730,24 @@ void gibbsForMuActive(mcmcChain<pReMiuMParams>& chain,
 	} else {
 		nCovariates = currentParams.nCovariates();
 	}
-	// Find the number of subjects
-	unsigned int nSubjects = dataset.nSubjects();
 
 
 	nTry++;
 	nAccept++;
 
-	// In the following it is useful to have the rows of X as
-	// Eigen dynamic vectors
-	vector<VectorXd> xi(nSubjects);
-	for(unsigned int i=0;i<nSubjects;i++){
-		xi[i].setZero(nCovariates);
-		for(unsigned int j=0;j<nCovariates;j++){
-			xi[i](j)=dataset.continuousX(i,j);
-		}
-	}
-
-
-
-	// We begin by computing the mean X for individuals in each cluster
-	vector<VectorXd> meanX(maxZ+1);
+	// We begin by computing the sum of X for individuals in each cluster
+	// from the sufficient statistics, which are about workXShift
+	const VectorXd& xShift = currentParams.workXShift();
+	vector<VectorXd>& meanX = propParams.workspace().muMeanX();
+	meanX.resize(maxZ+1);
 	for(unsigned int c=0;c<=maxZ;c++){
-		meanX[c].setZero(nCovariates);
-	}
-
-	for(unsigned int i=0;i<nSubjects;i++){
-		meanX[currentParams.z(i)]=meanX[currentParams.z(i)]+xi[i];
+		meanX[c]=currentParams.workSumX(c)+currentParams.workNXInCluster(c)*xShift;
 	}
 
-	vector<MatrixXd> gammaMat(maxZ+1);
-	vector<MatrixXd> oneMinusGammaMat(maxZ+1);
+	vector<MatrixXd>& gammaMat = propParams.workspace().muGammaMat();
+	vector<MatrixXd>& oneMinusGammaMat = propParams.workspace().muOneMinusGammaMat();
+	gammaMat.resize(maxZ+1);
+	oneMinusGammaMat.resize(maxZ+1);
 	for(unsigned int c=0;c<=maxZ;c++){
 		gammaMat[c].setZero(nCovariates,nCovariates);
 		oneMinusGammaMat[c].setZero(nCovariates,nCovariates);
@@ -1341,44 +1758,23 @@ void gibbsForMuActive(mcmcChain<pReMiuMParams>& chain,
 	}
 
 
-	for(unsigned int c=0;c<=maxZ;c++){
-		// Having computed this we can calcuate the posterior mean
-		// and posterior covariance for each mu_c
-		int nXInC = currentParams.workNXInCluster(c);
-		if(nXInC>0){
-			meanX[c]=meanX[c]/(double)nXInC;
-		}else{
-			meanX[c].setZero(nCovariates);
-		}
-
-		MatrixXd covMat(nCovariates,nCovariates);
-		VectorXd meanVec(nCovariates);
-
-		if (useHyperpriorR1) {
-			covMat = (currentParams.Tau00() + nXInC*gammaMat[c] * currentParams.Tau(c)*gammaMat[c]).inverse();	
-			meanVec = currentParams.Tau00()*currentParams.mu00() +
-				nXInC*gammaMat[c] * currentParams.Tau(c)*(meanX[c] - oneMinusGammaMat[c] * currentParams.nullMu());
-			meanVec = covMat*meanVec;
-		}
-		else if (useSeparationPrior) {
-			covMat = (hyperParams.Tau00() + nXInC*gammaMat[c] * currentParams.Tau(c)*gammaMat[c]).inverse();
-			meanVec = hyperParams.Tau00()*currentParams.mu00() +
-				nXInC*gammaMat[c] * currentParams.Tau(c)*(meanX[c] - oneMinusGammaMat[c] * currentParams.nullMu());
-			meanVec = covMat*meanVec;
-		} 
-		else {
-			covMat = (hyperParams.Tau0() + nXInC*gammaMat[c] * currentParams.Tau(c)*gammaMat[c]).inverse();
-			meanVec = hyperParams.Tau0()*hyperParams.mu0() +
-				nXInC*gammaMat[c] * currentParams.Tau(c)*(meanX[c] - oneMinusGammaMat[c] * currentParams.nullMu());
-			meanVec = covMat*meanVec;
+	if(model.options().parallelClusters()){
+		pReMiuMWorkspace& workspace = propParams.workspace();
+		clusterTasks(currentParams,0,maxZ+1,true,rndGenerator,workspace);
+		const vector<unsigned int>& order = workspace.clusterTaskOrder();
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for(unsigned int k=0;k<=maxZ;k++){
+			unsigned int c = order[k];
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c]);
+			gibbsForMuActiveCluster(currentParams,model,c,meanX[c],gammaMat[c],oneMinusGammaMat[c],clusterGenerator);
 		}
+		return;
+	}
 
-		VectorXd mu(nCovariates);
-		// We sample from this posterior
-		mu = multivarNormalRand(rndGenerator, meanVec, covMat);
-
-		// We store our sample
-		currentParams.mu(c,mu, useIndependentNormal);
+	for(unsigned int c=0;c<=maxZ;c++){
+		gibbsForMuActiveCluster(currentParams,model,c,meanX[c],gammaMat[c],oneMinusGammaMat[c],rndGenerator);
 	}
 }
 
@@ -1391,9 +1787,8 @@ void gibbsForMuActiveNIWP(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
-	const pReMiuMData& dataset = model.dataset();
 	bool useIndependentNormal = model.options().useIndependentNormal();
 
 	// Find the number of clusters
@@ -1405,34 +1800,23 @@ void gibbsForMuActiveNIWP(mcmcChain<pReMiuMParams>& chain,
 	} else {
 		nCovariates = currentParams.nCovariates();
 	}
-	// Find the number of subjects
-	unsigned int nSubjects = dataset.nSubjects();
 
 	nTry++;
 	nAccept++;
 
-	// In the following it is useful to have the rows of X as
-	// Eigen dynamic vectors
-	vector<VectorXd> xi(nSubjects);
-	for(unsigned int i=0;i<nSubjects;i++){
-		xi[i].setZero(nCovariates);
-		for(unsigned int j=0;j<nCovariates;j++){
-			xi[i](j)=dataset.continuousX(i,j);
-		}
-	}
-
-	// We begin by computing the mean X for individuals in each cluster
-	vector<VectorXd> meanX(maxZ+1);
+	// We begin by computing the sum of X for individuals in each cluster
+	// from the sufficient statistics, which are about workXShift
+	const VectorXd& xShift = currentParams.workXShift();
+	vector<VectorXd>& meanX = propParams.workspace().muMeanX();
+	meanX.resize(maxZ+1);
 	for(unsigned int c=0;c<=maxZ;c++){
-		meanX[c].setZero(nCovariates);
+		meanX[c]=currentParams.workSumX(c)+currentParams.workNXInCluster(c)*xShift;
 	}
 
-	for(unsigned int i=0;i<nSubjects;i++){
-		meanX[currentParams.z(i)]=meanX[currentParams.z(i)]+xi[i];
-	}
-
-	vector<MatrixXd> gammaMat(maxZ+1);
-	vector<MatrixXd> oneMinusGammaMat(maxZ+1);
+	vector<MatrixXd>& gammaMat = propParams.workspace().muGammaMat();
+	vector<MatrixXd>& oneMinusGammaMat = propParams.workspace().muOneMinusGammaMat();
+	gammaMat.resize(maxZ+1);
+	oneMinusGammaMat.resize(maxZ+1);
 	for(unsigned int c=0;c<=maxZ;c++){
 		gammaMat[c].setZero(nCovariates,nCovariates);
 		oneMinusGammaMat[c].setZero(nCovariates,nCovariates);
@@ -1484,9 +1868,8 @@ void gibbsForMuActiveIndep(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
-	const pReMiuMData& dataset = model.dataset();
 	bool useIndependentNormal = model.options().useIndependentNormal(); 
 
 	// Find the number of clusters
@@ -1499,31 +1882,18 @@ void gibbsForMuActiveIndep(mcmcChain<pReMiuMParams>& chain,
 	else {
 		nCovariates = currentParams.nCovariates();
 	}
-	// Find the number of subjects
-	unsigned int nSubjects = dataset.nSubjects();
 
 
 	nTry++;
 	nAccept++;
 
-	// In the following it is useful to have the rows of X as
-	// Eigen dynamic vectors
-	vector<VectorXd> xi(nSubjects);
-	for (unsigned int i = 0; i<nSubjects; i++) {
-		xi[i].setZero(nCovariates);
-		for (unsigned int j = 0; j<nCovariates; j++) {
-			xi[i](j) = dataset.continuousX(i, j);
-		}
-	}
-
-	// We begin by computing the mean X for individuals in each cluster
-	vector<VectorXd> meanX(maxZ + 1);
+	// We begin by computing the sum of X for individuals in each cluster
+	// from the sufficient statistics, which are about workXShift
+	const VectorXd& xShift = currentParams.workXShift();
+	vector<VectorXd>& meanX = propParams.workspace().muMeanX();
+	meanX.resize(maxZ + 1);
 	for (unsigned int c = 0; c <= maxZ; c++) {
-		meanX[c].setZero(nCovariates);
-	}
-
-	for (unsigned int i = 0; i<nSubjects; i++) {
-		meanX[currentParams.z(i)] = meanX[currentParams.z(i)] + xi[i];
+		meanX[c] = currentParams.workSumX(c) + currentParams.workNXInCluster(c)*xShift;
 	}
 	for (unsigned int c = 0; c <= maxZ; c++) {
 		int nXInC = currentParams.workNXInCluster(c);
@@ -1541,9 +1911,9 @@ void gibbsForMuActiveIndep(mcmcChain<pReMiuMParams>& chain,
 	//initialize gamma_cj and 1-gamma_cj used for variable selection 
 	double gamma_cj = 0.0;
 	double oneMinusGamma_cj = 0.0;
-	VectorXd mu0 = hyperParams.mu0();
-	VectorXd Tau0 = hyperParams.Tau0_Indep();
-	VectorXd nullMu = currentParams.nullMu();
+	const VectorXd& mu0 = hyperParams.mu0();
+	const VectorXd& Tau0 = hyperParams.Tau0_Indep();
+	const VectorXd& nullMu = currentParams.nullMu();
 	
 	for (unsigned int c = 0; c <= maxZ; c++) {
 
@@ -1577,6 +1947,25 @@ void gibbsForMuActiveIndep(mcmcChain<pReMiuMParams>& chain,
 
 
 // Gibbs update for Tau in the Normal covariate case
+
+// Draws Tau_c from its full conditional, given the scatter matrix Rc of the
+// covariates in cluster c about mu_c
+void gibbsForTauActiveCluster(pReMiuMParams& currentParams,
+				const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
+				const unsigned int& c,const MatrixXd& Rc,baseGeneratorType& rndGenerator){
+
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
+	MatrixXd Tau;
+	if (model.options().useHyperpriorR1()){
+		MatrixXd R=(currentParams.R1().inverse()+Rc).inverse();
+		Tau = wishartRand(rndGenerator,R,currentParams.workNXInCluster(c)+currentParams.kappa11());
+	} else {
+		MatrixXd R=(hyperParams.R0().inverse()+Rc).inverse();
+		Tau = wishartRand(rndGenerator,R,currentParams.workNXInCluster(c)+hyperParams.kappa0());
+	}
+	currentParams.Tau(c,Tau);
+}
+
 void gibbsForTauActive(mcmcChain<pReMiuMParams>& chain,
 				unsigned int& nTry,unsigned int& nAccept,
 				const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
@@ -1585,62 +1974,49 @@ void gibbsForTauActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
-	bool useHyperpriorR1 = model.options().useHyperpriorR1();
 
-	const pReMiuMData& dataset = model.dataset();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
-	// Find the number of covariates
-	unsigned int nCovariates = 0;
-	if(model.options().covariateType().compare("Mixed")==0){
-		nCovariates = currentParams.nContinuousCovs();
-	} else {
-		nCovariates = currentParams.nCovariates();
-	}
-	// Find the number of subjects
-	unsigned int nSubjects = dataset.nSubjects();
 
 	nTry++;
 	nAccept++;
 
-	// In the following it is useful to have the rows of X as
-	// Eigen dynamic vectors
-	vector<VectorXd> xi(nSubjects);
-	for(unsigned int i=0;i<nSubjects;i++){
-		xi[i].setZero(nCovariates);
-		for(unsigned int j=0;j<nCovariates;j++){
-			xi[i](j)=dataset.continuousX(i,j);
-		}
-	}
-
+	// Rc = sum_i (x_i-mu_c)(x_i-mu_c)' expanded in terms of the sufficient
+	// statistics, all taken about workXShift
+	const VectorXd& xShift = currentParams.workXShift();
 	vector<MatrixXd> Rc(maxZ+1);
 	for(unsigned int c=0;c<=maxZ;c++){
-		Rc[c].setZero(nCovariates,nCovariates);
-	}
-
-	for(unsigned int i=0;i<nSubjects;i++){
-		unsigned int zi = currentParams.z(i);
-		Rc[zi]=Rc[zi]+(xi[i]-currentParams.workMuStar(zi))*((xi[i]-currentParams.workMuStar(zi)).transpose());
-	}
-
-	if (useHyperpriorR1){
+		VectorXd muC = currentParams.workMuStar(c)-xShift;
+		const VectorXd& sumX = currentParams.workSumX(c);
+		Rc[c]=currentParams.workSumXXt(c).selfadjointView<Lower>();
+		Rc[c]-=muC*sumX.transpose()+sumX*muC.transpose();
+		Rc[c]+=currentParams.workNXInCluster(c)*muC*muC.transpose();
+	}
+
+	if(model.options().parallelClusters()){
+		pReMiuMWorkspace& workspace = propParams.workspace();
+		clusterTasks(currentParams,0,maxZ+1,true,rndGenerator,workspace);
+		const vector<unsigned int>& order = workspace.clusterTaskOrder();
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		// The flags are packed in bits, so they are set here rather than
+		// from the threads
 		for(unsigned int c=0;c<=maxZ;c++){
-			Rc[c]=(currentParams.R1().inverse()+Rc[c]).inverse();
-			MatrixXd Tau = wishartRand(rndGenerator,Rc[c],currentParams.workNXInCluster(c)+currentParams.kappa11());
-	
-			currentParams.Tau(c,Tau);
+			currentParams.Sigma_blank(c,true);
 		}
-	} else {
-		for(unsigned int c=0;c<=maxZ;c++){
-			Rc[c]=(hyperParams.R0().inverse()+Rc[c]).inverse();
-			MatrixXd Tau = wishartRand(rndGenerator,Rc[c],currentParams.workNXInCluster(c)+hyperParams.kappa0());
-	
-			currentParams.Tau(c,Tau);
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for(unsigned int k=0;k<=maxZ;k++){
+			unsigned int c = order[k];
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c]);
+			gibbsForTauActiveCluster(currentParams,model,c,Rc[c],clusterGenerator);
 		}
+		return;
 	}
 
+	for(unsigned int c=0;c<=maxZ;c++){
+		gibbsForTauActiveCluster(currentParams,model,c,Rc[c],rndGenerator);
+	}
 
 }
 
@@ -1653,44 +2029,25 @@ void gibbsForTauRActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
-	const pReMiuMData& dataset = model.dataset();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
-	// Find the number of covariates
-	unsigned int nCovariates = 0;
-	if (model.options().covariateType().compare("Mixed") == 0) {
-		nCovariates = currentParams.nContinuousCovs();
-	}
-	else {
-		nCovariates = currentParams.nCovariates();
-	}
-	// Find the number of subjects
-	unsigned int nSubjects = dataset.nSubjects();
 
 	nTry++;
 	nAccept++;
 
-	// In the following it is useful to have the rows of X as
-	// Eigen dynamic vectors
-	vector<VectorXd> xi(nSubjects);
-	for (unsigned int i = 0; i<nSubjects; i++) {
-		xi[i].setZero(nCovariates);
-		for (unsigned int j = 0; j<nCovariates; j++) {
-			xi[i](j) = dataset.continuousX(i, j);
-		}
-	}
-
+	// Rc = sum_i (x_i-mu_c)(x_i-mu_c)' expanded in terms of the sufficient
+	// statistics, all taken about workXShift
+	const VectorXd& xShift = currentParams.workXShift();
 	vector<MatrixXd> Rc(maxZ + 1);
 	for (unsigned int c = 0; c <= maxZ; c++) {
-		Rc[c].setZero(nCovariates, nCovariates);
-	}
-
-	for (unsigned int i = 0; i<nSubjects; i++) {
-		unsigned int zi = currentParams.z(i);
-		Rc[zi] = Rc[zi] + (xi[i] - currentParams.workMuStar(zi))*((xi[i] - currentParams.workMuStar(zi)).transpose());
+		VectorXd muC = currentParams.workMuStar(c) - xShift;
+		const VectorXd& sumX = currentParams.workSumX(c);
+		Rc[c] = currentParams.workSumXXt(c).selfadjointView<Lower>();
+		Rc[c] -= muC*sumX.transpose() + sumX*muC.transpose();
+		Rc[c] += currentParams.workNXInCluster(c)*muC*muC.transpose();
 	}
 
 	for (unsigned int c = 0; c <= maxZ; c++) {
@@ -1711,7 +2068,6 @@ void metropolisHastingsForTauS(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -1782,6 +2138,28 @@ void metropolisHastingsForTauS(mcmcChain<pReMiuMParams>& chain,
 
 
 // Gibbs update for Tau in the independent Normal case
+
+// Draws the precisions of cluster c from their full conditionals, given the
+// sums of squares of the covariates in cluster c about mu_c
+void gibbsForTauActiveIndepCluster(pReMiuMParams& currentParams,
+	const mcmcModel<pReMiuMParams, pReMiuMOptions, pReMiuMData>& model,
+	const unsigned int& c, const VectorXd& sumXiMinusMuStarSq,
+	baseGeneratorType& rndGenerator) {
+
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
+	unsigned int nCovariates = sumXiMinusMuStarSq.size();
+	VectorXd tau(nCovariates);
+	int nXInC = currentParams.workNXInCluster(c);
+	for (unsigned int j = 0; j < nCovariates; j++) {
+		double kappaNew = (double) nXInC / 2 + hyperParams.kappa1();
+		double rNew = (sumXiMinusMuStarSq(j) + 2 * currentParams.R1_Indep(j))/2;
+
+		randomGamma gammaRand(kappaNew, 1.0 / rNew);
+		tau(j) = gammaRand(rndGenerator);
+	}
+	currentParams.Tau_Indep(c, tau);
+}
+
 void gibbsForTauActiveIndep(mcmcChain<pReMiuMParams>& chain,
 	unsigned int& nTry, unsigned int& nAccept,
 	const mcmcModel<pReMiuMParams, pReMiuMOptions, pReMiuMData>& model,
@@ -1790,72 +2168,62 @@ void gibbsForTauActiveIndep(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
-
-	const pReMiuMData& dataset = model.dataset();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
-	// Find the number of covariates
-	unsigned int nCovariates = 0;
-	if (model.options().covariateType().compare("Mixed") == 0) {
-		nCovariates = currentParams.nContinuousCovs();
-	}
-	else {
-		nCovariates = currentParams.nCovariates();
-	}
-	// Find the number of subjects
-	unsigned int nSubjects = dataset.nSubjects();
 
 	nTry++;
 	nAccept++;
 
-	// In the following it is useful to have the rows of X as
-	// Eigen dynamic vectors
-	vector<VectorXd> xi(nSubjects);
-	for (unsigned int i = 0; i<nSubjects; i++) {
-		xi[i].setZero(nCovariates);
-		for (unsigned int j = 0; j<nCovariates; j++) {
-			xi[i](j) = dataset.continuousX(i, j);
-		}
-	}
-
-	vector<VectorXd> XiMinusMuStarSq(nSubjects);
-	for (unsigned int i = 0; i < nSubjects; i++) {
-		XiMinusMuStarSq[i].setZero(nCovariates);
-		VectorXd muStar = currentParams.workMuStar(currentParams.z(i));
-		for (unsigned int j = 0; j < nCovariates; j++) {
-			XiMinusMuStarSq[i](j) = (xi[i](j) - muStar(j))*(xi[i](j) - muStar(j));
-		}
-	}
-
-	// We begin by computing the sum of X minus mu_star in each cluster
+	// We begin by computing the sum of (X minus mu_star)^2 in each cluster
+	// from the sufficient statistics, which are about workXShift. The
+	// expansion can round to just below zero for tight clusters.
+	const VectorXd& xShift = currentParams.workXShift();
 	vector<VectorXd> sumXiMinusMuStarSq(maxZ + 1);
 	for (unsigned int c = 0; c <= maxZ; c++) {
-		sumXiMinusMuStarSq[c].setZero(nCovariates);
+		VectorXd muC = currentParams.workMuStar(c) - xShift;
+		double nXInC = (double)currentParams.workNXInCluster(c);
+		sumXiMinusMuStarSq[c] = currentParams.workSumXSq(c)
+			- 2.0*muC.cwiseProduct(currentParams.workSumX(c))
+			+ nXInC*muC.cwiseProduct(muC);
+		sumXiMinusMuStarSq[c] = sumXiMinusMuStarSq[c].cwiseMax(0.0);
 	}
 
-	for (unsigned int i = 0; i<nSubjects; i++) {
-		sumXiMinusMuStarSq[currentParams.z(i)] = sumXiMinusMuStarSq[currentParams.z(i)] + XiMinusMuStarSq[i];
-	}
 
+	if (model.options().parallelClusters()) {
+		pReMiuMWorkspace& workspace = propParams.workspace();
+		clusterTasks(currentParams, 0, maxZ + 1, true, rndGenerator, workspace);
+		const vector<unsigned int>& order = workspace.clusterTaskOrder();
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		for (unsigned int c = 0; c <= maxZ; c++) {
+			currentParams.Sigma_blank(c, true);
+		}
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for (unsigned int k = 0; k <= maxZ; k++) {
+			unsigned int c = order[k];
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c]);
+			gibbsForTauActiveIndepCluster(currentParams, model, c, sumXiMinusMuStarSq[c], clusterGenerator);
+		}
+		return;
+	}
 
 	for (unsigned int c = 0; c <= maxZ; c++) {
-		VectorXd tau(nCovariates);
-		int nXInC = currentParams.workNXInCluster(c);
-		for (unsigned int j = 0; j < nCovariates; j++) {
-			double kappaNew = (double) nXInC / 2 + hyperParams.kappa1();
-			double rNew = (sumXiMinusMuStarSq[c](j) + 2 * currentParams.R1_Indep(j))/2;
-
-			randomGamma gammaRand(kappaNew, 1.0 / rNew);
-			tau(j) = gammaRand(rndGenerator);
-		}
-		currentParams.Tau_Indep(c, tau);
+		gibbsForTauActiveIndepCluster(currentParams, model, c, sumXiMinusMuStarSq[c], rndGenerator);
 	}
 
 }
 
-// Gibbs update for update of gamma (only used in the binary variable selection case)
+// Gibbs update for update of gamma (only used in the binary variable selection case).
+// For discrete covariates and independent Normal covariates the log likelihood
+// of the members of a cluster is a sum of one term per covariate, so the change
+// from switching gamma_cj only depends on covariate j: it is computed from the
+// number of members in each category, or from the sum of the members' values,
+// and the covariates are updated in parallel. The working log likelihoods of
+// the members are then corrected once for all the switched covariates. The
+// uniforms are drawn beforehand in the order of the serial loop so that the
+// chain does not depend on the number of threads. Normal covariates with a full
+// covariance matrix are still updated one at a time.
 void gibbsForGammaActive(mcmcChain<pReMiuMParams>& chain,
 					unsigned int& nTry,unsigned int& nAccept,
 					const mcmcModel<pReMiuMParams,
@@ -1867,16 +2235,25 @@ void gibbsForGammaActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
-	
 
 	// Find the number of subjects
 	unsigned int nCovariates = currentParams.nCovariates();
-	unsigned int nSubjects = currentParams.nSubjects();
 	unsigned int maxZ = currentParams.workMaxZi();
+	unsigned int nClusters = maxZ+1;
 	string covariateType = model.options().covariateType();
-	string varSelectType = model.options().varSelectType();
 	bool useIndependentNormal = model.options().useIndependentNormal();
+	unsigned int nThreads = model.options().nThreads();
+	pReMiuMWorkspace& workspace = propParams.workspace();
+
+	// The discrete covariates come first for the Mixed model
+	unsigned int nDiscreteCovs = 0;
+	if(covariateType.compare("Discrete")==0){
+		nDiscreteCovs = nCovariates;
+	}else if(covariateType.compare("Mixed")==0){
+		nDiscreteCovs = currentParams.nDiscreteCovs();
+	}
+	unsigned int nSeparableCovs = useIndependentNormal?nCovariates:nDiscreteCovs;
+	bool muStarUpdated = currentParams.Sigma_blank(0);
 
 	// Define a uniform random number generator
 	randomUniform unifRand(0,1);
@@ -1884,53 +2261,189 @@ void gibbsForGammaActive(mcmcChain<pReMiuMParams>& chain,
 	nTry++;
 	nAccept++;
 
+	vector<double>& rnd = workspace.gammaRnd();
+	rnd.assign(nCovariates*nClusters,0.0);
 	for(unsigned int j=0;j<nCovariates;j++){
+		if(currentParams.omega(j)==0){
+			// Nothing to do - not allowed to change
+			continue;
+		}
+		for(unsigned int c=0;c<nClusters;c++){
+			rnd[j*nClusters+c]=unifRand(rndGenerator);
+		}
+	}
+
+	// Count the members of each cluster in each category
+	unsigned int stride = currentParams.workLogPhiStarStride();
+	unsigned int clusterStride = nDiscreteCovs*stride;
+	vector<unsigned int>& nInCategory = workspace.gammaNInCategory();
+	vector<double>& logPhiStarDiff = workspace.gammaLogPhiStarDiff();
+	nInCategory.assign(nClusters*clusterStride,0);
+	logPhiStarDiff.resize(nClusters*clusterStride);
+	if(nDiscreteCovs>0){
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for(unsigned int c=0;c<nClusters;c++){
+			const vector<unsigned int>& members = currentParams.workClusterMembers(c);
+			unsigned int* nInCategoryC = &(nInCategory[c*clusterStride]);
+			for(unsigned int k=0;k<members.size();k++){
+				unsigned int i = members[k];
+				for(unsigned int j=0;j<nDiscreteCovs;j++){
+					nInCategoryC[j*stride+currentParams.workDiscreteX(i,j)]++;
+				}
+			}
+		}
+	}
 
-		for(unsigned int c=0;c<=maxZ;c++){
+	vector<double>& muStarOld = workspace.gammaMuStarOld();
+	vector<unsigned int>& switched = workspace.gammaSwitched();
+	muStarOld.resize(nClusters*nCovariates);
+	switched.assign(nClusters*nCovariates,0);
 
-			vector<double> currentGamma=currentParams.gamma(c);
+	#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+	for(unsigned int j=0;j<nSeparableCovs;j++){
+		if(currentParams.omega(j)==0){
+			continue;
+		}
+		double logRho = log(currentParams.rho(j));
+		double logOneMinusRho = log(1-currentParams.rho(j));
+		for(unsigned int c=0;c<nClusters;c++){
 			// work in terms of prob of sticking with current value and switching value
-			// Compute probability of sticking
-			double logProbStick=0;
-			double logProbSwitch=0;
-			double probStick=0;
-			if(currentParams.omega(j)==0){
-				// Nothing to do - not allowed to change
-				continue;
+			double currentGamma = currentParams.gamma(c,j);
+			double newGamma = 1-currentGamma;
+			double logProbStick=currentGamma*logRho+(1-currentGamma)*logOneMinusRho;
+			double logProbSwitch=newGamma*logRho+(1-newGamma)*logOneMinusRho;
+			if(j<nDiscreteCovs){
+				unsigned int nCat = currentParams.nCategories(j);
+				const unsigned int* nInCategoryCj = &(nInCategory[c*clusterStride+j*stride]);
+				double* logPhiStarDiffCj = &(logPhiStarDiff[c*clusterStride+j*stride]);
+				for(unsigned int p=0;p<nCat;p++){
+					double logPhiStarNew = log(newGamma*exp(currentParams.logPhi(c,j,p))+
+							(1.0-newGamma)*exp(currentParams.logNullPhi(j,p)));
+					logPhiStarDiffCj[p]=logPhiStarNew-currentParams.workLogPhiStar(c,j,p);
+					logProbSwitch+=nInCategoryCj[p]*logPhiStarDiffCj[p];
+				}
+			}else if(muStarUpdated){
+				// Sum of the changes in the members' Normal log densities
+				unsigned int jj = j-nDiscreteCovs;
+				const vector<unsigned int>& members = currentParams.workClusterMembers(c);
+				double sumX=0.0;
+				for(unsigned int k=0;k<members.size();k++){
+					sumX+=currentParams.workContinuousX(members[k],jj);
+				}
+				muStarOld[c*nCovariates+j]=currentParams.workMuStar(c)(jj);
+				double muStarNew = newGamma*currentParams.mu(c,jj)+(1-newGamma)*currentParams.nullMu(jj);
+				double muStarDiff = muStarOld[c*nCovariates+j]-muStarNew;
+				logProbSwitch-=0.5*currentParams.Tau_Indep(c,jj)*muStarDiff*
+						(2.0*sumX-(double)members.size()*(muStarOld[c*nCovariates+j]+muStarNew));
+			}
+
+			double maxLogProb;
+			if(logProbSwitch<logProbStick){
+				maxLogProb=logProbStick;
 			}else{
-				for(unsigned int i=0;i<nSubjects;i++){
-					unsigned int zi = currentParams.z(i);
-					if(zi==c){
-						logProbStick+=currentParams.workLogPXiGivenZi(i);
-					}
+				maxLogProb=logProbSwitch;
+			}
+			double probStick=exp(logProbStick-maxLogProb)/(exp(logProbStick-maxLogProb)+exp(logProbSwitch-maxLogProb));
+			if(rnd[j*nClusters+c]<probStick){
+				continue;
+			}
+
+			// Switching: the parameters of cluster c, covariate j are only
+			// touched by this task, the members are corrected below
+			switched[c*nCovariates+j]=1;
+			currentParams.gammaNoWorkUpdate(c,j,newGamma);
+			if(j<nDiscreteCovs){
+				unsigned int nCat = currentParams.nCategories(j);
+				for(unsigned int p=0;p<nCat;p++){
+					currentParams.workLogPhiStar(c,j,p,log(newGamma*exp(currentParams.logPhi(c,j,p))+
+							(1.0-newGamma)*exp(currentParams.logNullPhi(j,p))));
 				}
-				logProbStick+=(currentGamma[j]*log(currentParams.rho(j))+
-							(1-currentGamma[j])*log(1-currentParams.rho(j)));
+			}else if(muStarUpdated){
+				unsigned int jj = j-nDiscreteCovs;
+				currentParams.workMuStar(c,jj,newGamma*currentParams.mu(c,jj)+(1-newGamma)*currentParams.nullMu(jj));
+			}
+		}
+	}
 
-				// Now compute probability of switching
-				currentGamma[j]=1-currentGamma[j];
-				currentParams.gamma(c,j,currentGamma[j],covariateType,useIndependentNormal);
+	// Group the switched covariates by cluster
+	vector<unsigned int>& switchedCovs = workspace.gammaSwitchedCovs();
+	vector<unsigned int>& switchedStart = workspace.gammaSwitchedStart();
+	switchedCovs.clear();
+	switchedStart.resize(nClusters+1);
+	for(unsigned int c=0;c<nClusters;c++){
+		switchedStart[c]=switchedCovs.size();
+		for(unsigned int j=0;j<nSeparableCovs;j++){
+			if(switched[c*nCovariates+j]){
+				switchedCovs.push_back(j);
+			}
+		}
+	}
+	switchedStart[nClusters]=switchedCovs.size();
 
-				for(unsigned int i=0;i<nSubjects;i++){
-					unsigned int zi = currentParams.z(i);
-					if(zi==c){
-						logProbSwitch+=currentParams.workLogPXiGivenZi(i);
-					}
+	// Correct the working log likelihood of the members of each cluster
+	#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+	for(unsigned int c=0;c<nClusters;c++){
+		if(switchedStart[c]==switchedStart[c+1]){
+			continue;
+		}
+		const vector<unsigned int>& members = currentParams.workClusterMembers(c);
+		for(unsigned int k=0;k<members.size();k++){
+			unsigned int i = members[k];
+			double logPXiGivenZi = currentParams.workLogPXiGivenZi(i);
+			for(unsigned int s=switchedStart[c];s<switchedStart[c+1];s++){
+				unsigned int j = switchedCovs[s];
+				if(j<nDiscreteCovs){
+					logPXiGivenZi+=logPhiStarDiff[c*clusterStride+j*stride+currentParams.workDiscreteX(i,j)];
+				}else if(muStarUpdated){
+					unsigned int jj = j-nDiscreteCovs;
+					double xij = currentParams.workContinuousX(i,jj);
+					double sigma = sqrt(1.0/currentParams.Tau_Indep(c,jj));
+					logPXiGivenZi+=logPdfNormal(xij,currentParams.workMuStar(c)(jj),sigma)-
+							logPdfNormal(xij,muStarOld[c*nCovariates+j],sigma);
 				}
-				logProbSwitch+=(currentGamma[j]*log(currentParams.rho(j))+
+			}
+			currentParams.workLogPXiGivenZi(i,logPXiGivenZi);
+		}
+	}
+
+	// Normal covariates with a full covariance matrix
+	for(unsigned int j=nSeparableCovs;j<nCovariates;j++){
+		if(currentParams.omega(j)==0){
+			continue;
+		}
+		for(unsigned int c=0;c<nClusters;c++){
+			const vector<unsigned int>& members = currentParams.workClusterMembers(c);
+			vector<double> currentGamma=currentParams.gamma(c);
+			// work in terms of prob of sticking with current value and switching value
+			// Compute probability of sticking
+			double logProbStick=0;
+			double logProbSwitch=0;
+			double probStick=0;
+			for(unsigned int k=0;k<members.size();k++){
+				logProbStick+=currentParams.workLogPXiGivenZi(members[k]);
+			}
+			logProbStick+=(currentGamma[j]*log(currentParams.rho(j))+
 						(1-currentGamma[j])*log(1-currentParams.rho(j)));
 
-				double maxLogProb;
-				if(logProbSwitch<logProbStick){
-					maxLogProb=logProbStick;
-				}else{
-					maxLogProb=logProbSwitch;
-				}
+			// Now compute probability of switching
+			currentGamma[j]=1-currentGamma[j];
+			currentParams.gamma(c,j,currentGamma[j],covariateType,useIndependentNormal);
 
+			for(unsigned int k=0;k<members.size();k++){
+				logProbSwitch+=currentParams.workLogPXiGivenZi(members[k]);
+			}
+			logProbSwitch+=(currentGamma[j]*log(currentParams.rho(j))+
+					(1-currentGamma[j])*log(1-currentParams.rho(j)));
 
-				probStick=exp(logProbStick-maxLogProb)/(exp(logProbStick-maxLogProb)+exp(logProbSwitch-maxLogProb));
+			double maxLogProb;
+			if(logProbSwitch<logProbStick){
+				maxLogProb=logProbStick;
+			}else{
+				maxLogProb=logProbSwitch;
 			}
-			if(unifRand(rndGenerator)<probStick){
+
+			probStick=exp(logProbStick-maxLogProb)/(exp(logProbStick-maxLogProb)+exp(logProbSwitch-maxLogProb));
+			if(rnd[j*nClusters+c]<probStick){
 				// Sticking (we actually need to revert back to what we were
 				// before doing the calculations)
 				currentGamma[j]=1-currentGamma[j];
@@ -1938,7 +2451,6 @@ void gibbsForGammaActive(mcmcChain<pReMiuMParams>& chain,
 			}
 			// Otherwise switching but nothing to do here as we had already done the
 			// switch in the calculations
-
 		}
 	}
 
@@ -1946,6 +2458,7 @@ void gibbsForGammaActive(mcmcChain<pReMiuMParams>& chain,
 
 
 // Adaptive Metropolis-Hastings for theta
+template<pReMiuMLogPYiGivenZiWi logPYiGivenZiWi>
 void metropolisHastingsForThetaActive(mcmcChain<pReMiuMParams>& chain,
 								unsigned int& nTry,unsigned int& nAccept,
 								const mcmcModel<pReMiuMParams,
@@ -1956,7 +2469,6 @@ void metropolisHastingsForThetaActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	const string outcomeType = model.dataset().outcomeType();
 	unsigned int nCategoriesY = currentParams.nCategoriesY();
 
 
@@ -1971,9 +2483,9 @@ void metropolisHastingsForThetaActive(mcmcChain<pReMiuMParams>& chain,
 	double thetaTargetRate = propParams.thetaAcceptTarget();
 	unsigned int thetaUpdateFreq = propParams.thetaUpdateFreq();
 
-	double currentCondLogPost = logCondPostThetaBeta(currentParams,model);
-
 	for(unsigned int c=0;c<=maxZ;c++){
+		// Only the members of cluster c are affected by a change in theta_c
+		double currentCondLogPost = logCondPostThetac<logPYiGivenZiWi>(currentParams,model,c);
 		for (unsigned int k=0;k<nCategoriesY;k++){
 			nTry++;
 			propParams.thetaAddTry();
@@ -1981,7 +2493,7 @@ void metropolisHastingsForThetaActive(mcmcChain<pReMiuMParams>& chain,
 			double thetaOrig = currentParams.theta(c,k);
 			double thetaProp = thetaOrig +stdDev*normRand(rndGenerator);
 			currentParams.theta(c,k,thetaProp);
-			double propCondLogPost = logCondPostThetaBeta(currentParams,model);
+			double propCondLogPost = logCondPostThetac<logPYiGivenZiWi>(currentParams,model,c);
 			double logAcceptRatio = propCondLogPost - currentCondLogPost;
 			if(unifRand(rndGenerator)<exp(logAcceptRatio)){
 				nAccept++;
@@ -2033,7 +2545,7 @@ void metropolisHastingsForLabels123(mcmcChain<pReMiuMParams>& chain,
 		return;
 	}
 	string varSelectType = model.options().varSelectType();
-	string covariateType = model.options().covariateType();
+	const pReMiuMCovariateType covariateType = model.options().covariateTypeId();
 	bool useIndependentNormal = model.options().useIndependentNormal();
 	bool useSeparationPrior = model.options().useSeparationPrior();
 
@@ -2043,21 +2555,28 @@ void metropolisHastingsForLabels123(mcmcChain<pReMiuMParams>& chain,
 	//          leaving psi_c^prop = psi_c for all c
 
 	// Compute how many non-empty clusters
-	unsigned int nNotEmpty=0;
-	vector<unsigned int> nonEmptyIndices;
+	vector<unsigned int>& nonEmptyIndices = propParams.workspace().nonEmptyClusters();
+	nonEmptyIndices.clear();
 	for(unsigned int c=0;c<=maxZ;c++){
 		if(currentParams.workNXInCluster(c)>0){
-			nNotEmpty++;
 			nonEmptyIndices.push_back(c);
 		}
 	}
+	unsigned int nNotEmpty=nonEmptyIndices.size();
+	if(nNotEmpty<2){
+		// The only non-empty cluster can have a label above 0
+		return;
+	}
 
-	// Select two non-empty clusters at random
+	// Select two non-empty clusters at random, the second among the
+	// non-empty clusters other than the first
 	nTry++;
 	unsigned int i1=(unsigned int)nNotEmpty*unifRand(rndGenerator);
 	unsigned int c1=nonEmptyIndices[i1];
-	nonEmptyIndices.erase(nonEmptyIndices.begin()+i1);
 	unsigned int i2=(unsigned int)(nNotEmpty-1)*unifRand(rndGenerator);
+	if(i2>=i1){
+		i2++;
+	}
 	unsigned int c2=nonEmptyIndices[i2];
 
 	// Check whether we accept the move
@@ -2178,7 +2697,7 @@ void metropolisHastingsForLabels12(mcmcChain<pReMiuMParams>& chain,
 		return;
 	}
 	string varSelectType = model.options().varSelectType();
-	string covariateType = model.options().covariateType();
+	const pReMiuMCovariateType covariateType = model.options().covariateTypeId();
 	bool useIndependentNormal = model.options().useIndependentNormal();
 	bool useSeparationPrior = model.options().useSeparationPrior();
 
@@ -2188,21 +2707,28 @@ void metropolisHastingsForLabels12(mcmcChain<pReMiuMParams>& chain,
 	//          leaving psi_c^prop = psi_c for all c
 
 	// Compute how many non-empty clusters
-	unsigned int nNotEmpty=0;
-	vector<unsigned int> nonEmptyIndices;
+	vector<unsigned int>& nonEmptyIndices = propParams.workspace().nonEmptyClusters();
+	nonEmptyIndices.clear();
 	for(unsigned int c=0;c<=maxZ;c++){
 		if(currentParams.workNXInCluster(c)>0){
-			nNotEmpty++;
 			nonEmptyIndices.push_back(c);
 		}
 	}
+	unsigned int nNotEmpty=nonEmptyIndices.size();
+	if(nNotEmpty<2){
+		// The only non-empty cluster can have a label above 0
+		return;
+	}
 
-	// Select two non-empty clusters at random
+	// Select two non-empty clusters at random, the second among the
+	// non-empty clusters other than the first
 	nTry++;
 	unsigned int i1=(unsigned int)nNotEmpty*unifRand(rndGenerator);
 	unsigned int c1=nonEmptyIndices[i1];
-	nonEmptyIndices.erase(nonEmptyIndices.begin()+i1);
 	unsigned int i2=(unsigned int)(nNotEmpty-1)*unifRand(rndGenerator);
+	if(i2>=i1){
+		i2++;
+	}
 	unsigned int c2=nonEmptyIndices[i2];
 
 	// Check whether we accept the move
@@ -2266,7 +2792,7 @@ void metropolisHastingsForLabels3(mcmcChain<pReMiuMParams>& chain,
 		return;
 	}
 	string varSelectType = model.options().varSelectType();
-	string covariateType = model.options().covariateType();
+	const pReMiuMCovariateType covariateType = model.options().covariateTypeId();
 	bool useIndependentNormal = model.options().useIndependentNormal();
 	bool useSeparationPrior= model.options().useSeparationPrior();
 
@@ -2274,26 +2800,15 @@ void metropolisHastingsForLabels3(mcmcChain<pReMiuMParams>& chain,
 
 	// Move 3
 
-	// Compute how many non-empty clusters
-	unsigned int nNotEmpty=0;
-	vector<unsigned int> nonEmptyIndices;
-	for(unsigned int c=0;c<=maxZ;c++){
-		if(currentParams.workNXInCluster(c)>0){
-			nNotEmpty++;
-			nonEmptyIndices.push_back(c);
-		}
-	}
-
-	// Select two non-empty clusters at random
+	// A non-empty cluster used to be selected here, it is not used by the
+	// move but the draw is kept so that the random number stream is unchanged
 	nTry++;
-	unsigned int i1=(unsigned int)nNotEmpty*unifRand(rndGenerator);
-	unsigned int c1=nonEmptyIndices[i1];
-	nonEmptyIndices.erase(nonEmptyIndices.begin()+i1);
+	unifRand(rndGenerator);
 
 	// Check whether we accept the move
 	double logAcceptRatio=0;
 
-	c1=(unsigned int)maxZ*unifRand(rndGenerator);
+	unsigned int c1=(unsigned int)maxZ*unifRand(rndGenerator);
 	// Compute the acceptance ratio
 	unsigned int sumNAfterC1Plus1=0;
 	for(unsigned int c=c1+2;c<=maxZ;c++){
@@ -2361,8 +2876,8 @@ void gibbsForU(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
-	string samplerType = model.options().samplerType();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
+	const pReMiuMSamplerType samplerType = model.options().samplerTypeId();
 
 	nTry++;
 	nAccept++;
@@ -2370,16 +2885,18 @@ void gibbsForU(mcmcChain<pReMiuMParams>& chain,
 	unsigned int nSubjects = currentParams.nSubjects();
 	unsigned int nPredictSubjects = currentParams.nPredictSubjects();
 
-	// Define a uniform random number generator
-	randomUniform unifRand(0,1);
+	// The uniforms are drawn in one call
+	vector<double>& uRnd = propParams.workspace().uRnd();
+	uRnd.resize(nSubjects+nPredictSubjects);
+	fillUniformRand(rndGenerator,uRnd);
 
 	double minUi = 1.0;
 	for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
 		int zi = currentParams.z(i);
-		double ui=unifRand(rndGenerator);
-		if(samplerType.compare("SliceDependent")==0){
+		double ui=uRnd[i];
+		if(samplerType==samplerSliceDependent){
 			ui*=exp(currentParams.logPsi((unsigned int)zi));
-		}else if(samplerType.compare("SliceIndependent")==0){
+		}else if(samplerType==samplerSliceIndependent){
 			ui*=hyperParams.workXiSlice((unsigned int)zi);
 		}
 
@@ -2417,7 +2934,7 @@ void metropolisHastingsForAlpha(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 
@@ -2491,7 +3008,7 @@ void gibbsForVInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 	string samplerType = model.options().samplerType();
 	string covariateType = model.options().covariateType();
 	bool useIndependentNormal = model.options().useIndependentNormal();
@@ -2587,7 +3104,7 @@ void metropolisHastingsForKappa1(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -2674,7 +3191,7 @@ void metropolisHastingsForKappa1SP(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -2761,7 +3278,7 @@ void gibbsForR1(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -2801,7 +3318,7 @@ void gibbsForMu00(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 	bool useSeparationPrior = model.options().useSeparationPrior();
 
 	// Find the number of clusters
@@ -2855,7 +3372,7 @@ void gibbsForTau00(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -2900,7 +3417,7 @@ void gibbsForBetaTauS(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -2949,7 +3466,7 @@ void gibbsForR1Indep(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -2988,6 +3505,25 @@ void gibbsForR1Indep(mcmcChain<pReMiuMParams>& chain,
 }
 
 // Gibbs move for updating phi
+// Draws phi_cj for each covariate j of the empty cluster c from its prior
+void gibbsForPhiInActiveCluster(pReMiuMParams& currentParams,const unsigned int& c,
+				const unsigned int& nCovariates,baseGeneratorType& rndGenerator){
+
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
+	// Loop over the covariates
+	for(unsigned int j=0;j<nCovariates;j++){
+		unsigned int nCategories = currentParams.nCategories(j);
+		vector<double> dirichParams(nCategories,hyperParams.aPhi(j));
+		vector<double> proposedLogPhi(nCategories);
+		proposedLogPhi=dirichletRand(rndGenerator,dirichParams);
+
+		for(unsigned int p=0;p<nCategories;p++){
+			proposedLogPhi[p]=log(proposedLogPhi[p]);
+		}
+		currentParams.logPhi(c,j,proposedLogPhi);
+	}
+}
+
 void gibbsForPhiInActive(mcmcChain<pReMiuMParams>& chain,
 				unsigned int& nTry,unsigned int& nAccept,
 				const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model,
@@ -2996,9 +3532,7 @@ void gibbsForPhiInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
 
-	string varSelectType = model.options().varSelectType();
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
 	unsigned int maxNClusters = currentParams.maxNClusters();
@@ -3014,19 +3548,21 @@ void gibbsForPhiInActive(mcmcChain<pReMiuMParams>& chain,
 	nTry++;
 	nAccept++;
 
-	for(unsigned int c=maxZ+1;c<maxNClusters;c++){
-		// Loop over the covariates
-		for(unsigned int j=0;j<nCovariates;j++){
-			unsigned int nCategories = currentParams.nCategories(j);
-			vector<double> dirichParams(nCategories,hyperParams.aPhi(j));
-			vector<double> proposedLogPhi(nCategories);
-			proposedLogPhi=dirichletRand(rndGenerator,dirichParams);
-
-			for(unsigned int p=0;p<nCategories;p++){
-				proposedLogPhi[p]=log(proposedLogPhi[p]);
-			}
-			currentParams.logPhi(c,j,proposedLogPhi);
+	if(model.options().parallelClusters()){
+		pReMiuMWorkspace& workspace = propParams.workspace();
+		clusterTasks(currentParams,maxZ+1,maxNClusters,false,rndGenerator,workspace);
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for(unsigned int c=maxZ+1;c<maxNClusters;c++){
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c-maxZ-1]);
+			gibbsForPhiInActiveCluster(currentParams,c,nCovariates,clusterGenerator);
 		}
+		return;
+	}
+
+	for(unsigned int c=maxZ+1;c<maxNClusters;c++){
+		gibbsForPhiInActiveCluster(currentParams,c,nCovariates,rndGenerator);
 	}
 }
 
@@ -3040,7 +3576,7 @@ void gibbsForMuInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	bool useIndependentNormal = model.options().useIndependentNormal();
 	bool useHyperpriorR1 = model.options().useHyperpriorR1();
@@ -3077,6 +3613,20 @@ void gibbsForMuInActive(mcmcChain<pReMiuMParams>& chain,
 		meanVec = hyperParams.mu0();
 	}
 
+	if(model.options().parallelClusters()){
+		pReMiuMWorkspace& workspace = propParams.workspace();
+		clusterTasks(currentParams,maxZ+1,maxNClusters,false,rndGenerator,workspace);
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for(unsigned int c=maxZ+1;c<maxNClusters;c++){
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c-maxZ-1]);
+			VectorXd mu = multivarNormalRand(clusterGenerator, meanVec, covMat);
+			currentParams.mu(c, mu, useIndependentNormal);
+		}
+		return;
+	}
+
 	for(unsigned int c=maxZ+1;c<maxNClusters;c++){
 		VectorXd mu(nCovariates);
 
@@ -3100,7 +3650,7 @@ void gibbsForMuInActiveIndep(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	bool useIndependentNormal = model.options().useIndependentNormal();
 
@@ -3146,7 +3696,7 @@ void gibbsForMuInActiveNIWP(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	bool useIndependentNormal = model.options().useIndependentNormal();
 
@@ -3190,7 +3740,7 @@ void gibbsForTauInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 	bool useHyperpriorR1 = model.options().useHyperpriorR1();
 
 	// Find the number of clusters
@@ -3200,6 +3750,27 @@ void gibbsForTauInActive(mcmcChain<pReMiuMParams>& chain,
 	nTry++;
 	nAccept++;
 
+	if(model.options().parallelClusters()){
+		pReMiuMWorkspace& workspace = propParams.workspace();
+		clusterTasks(currentParams,maxZ+1,maxNClusters,false,rndGenerator,workspace);
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		const MatrixXd& R = useHyperpriorR1?currentParams.R1():hyperParams.R0();
+		double kappa = useHyperpriorR1?currentParams.kappa11():hyperParams.kappa0();
+		// The flags are packed in bits, so they are set here rather than
+		// from the threads
+		for(unsigned int c=maxZ+1;c<maxNClusters;c++){
+			currentParams.Sigma_blank(c,true);
+		}
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for(unsigned int c=maxZ+1;c<maxNClusters;c++){
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c-maxZ-1]);
+			MatrixXd Tau = wishartRand(clusterGenerator,R,kappa);
+			currentParams.Tau(c,Tau);
+		}
+		return;
+	}
+
 	if (useHyperpriorR1){
 		for(unsigned int c=maxZ+1;c<maxNClusters;c++){
 			MatrixXd Tau = wishartRand(rndGenerator,currentParams.R1(), currentParams.kappa11());
@@ -3225,7 +3796,7 @@ void gibbsForTauRInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -3251,7 +3822,7 @@ void gibbsForTauSInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -3290,7 +3861,7 @@ void gibbsForTauInActiveIndep(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
@@ -3332,7 +3903,6 @@ void gibbsForGammaInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
 
 	// Find the number of subjects
 	unsigned int nCovariates = currentParams.nCovariates();
@@ -3405,7 +3975,7 @@ void gibbsForThetaInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 	const pReMiuMData& dataset = model.dataset();
 	unsigned int nCategoriesY=dataset.nCategoriesY();
 	const string outcomeType = model.dataset().outcomeType();
@@ -3420,6 +3990,23 @@ void gibbsForThetaInActive(mcmcChain<pReMiuMParams>& chain,
 	double location = hyperParams.muTheta();
 	double scale = hyperParams.sigmaTheta();
 	unsigned int dof = hyperParams.dofTheta();
+	if(model.options().parallelClusters()){
+		pReMiuMWorkspace& workspace = propParams.workspace();
+		clusterTasks(currentParams,maxZ+1,maxNClusters,false,rndGenerator,workspace);
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for(unsigned int c=maxZ+1;c<maxNClusters;c++){
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c-maxZ-1]);
+			randomStudentsT studentsTRand(dof);
+			for (unsigned int k=0;k<nCategoriesY;k++){
+				double theta=location+scale*studentsTRand(clusterGenerator);
+				currentParams.theta(c,k,theta);
+			}
+		}
+		return;
+	}
+
 	randomStudentsT studentsTRand(dof);
 	for (unsigned int k=0;k<nCategoriesY;k++){
 		for(unsigned int c=maxZ+1;c<maxNClusters;c++){
@@ -3441,7 +4028,7 @@ void gibbsForNuInActive(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 	const string outcomeType = model.dataset().outcomeType();
 
 	// Find the number of clusters
@@ -3462,6 +4049,7 @@ void gibbsForNuInActive(mcmcChain<pReMiuMParams>& chain,
 // N=Non-cluster, and Theta contains: beta, rho, omega, lambda, tau_epsilon, uCAR and TauCAR
 
 // Adaptive Metropolis-Hastings for beta
+template<pReMiuMLogPYiGivenZiWi logPYiGivenZiWi>
 void metropolisHastingsForBeta(mcmcChain<pReMiuMParams>& chain,
 								unsigned int& nTry,unsigned int& nAccept,
 								const mcmcModel<pReMiuMParams,
@@ -3488,7 +4076,14 @@ void metropolisHastingsForBeta(mcmcChain<pReMiuMParams>& chain,
 	double betaTargetRate = propParams.betaAcceptTarget();
 	unsigned int betaUpdateFreq = propParams.betaUpdateFreq();
 
-	double currentCondLogPost = logCondPostThetaBeta(currentParams,model);
+	// The likelihood is evaluated from the fixed effects part of the linear
+	// predictor, which is recomputed once per sweep and shifted by a column
+	// of W for each proposal (and restored if it is rejected)
+	const vector<vector<double> >& W = model.dataset().W();
+	vector<double>& linearPredictorOrig = propParams.workspace().betaLinearPredictor();
+	currentParams.workComputeLinearPredictor(W);
+
+	double currentCondLogPost = logCondPostBeta<logPYiGivenZiWi>(currentParams,model);
 
 	for(unsigned int j=0;j<nFixedEffects;j++){
 		for (unsigned int k=0;k<nCategoriesY;k++){
@@ -3498,7 +4093,9 @@ void metropolisHastingsForBeta(mcmcChain<pReMiuMParams>& chain,
 			double betaOrig = currentParams.beta(j,k);
 			double betaProp = betaOrig+stdDev*normRand(rndGenerator);
 			currentParams.beta(j,k,betaProp);
-			double propCondLogPost = logCondPostThetaBeta(currentParams,model);
+			linearPredictorOrig = currentParams.workLinearPredictor(k);
+			currentParams.workShiftLinearPredictor(j,k,betaProp-betaOrig,W);
+			double propCondLogPost = logCondPostBeta<logPYiGivenZiWi>(currentParams,model);
 			double logAcceptRatio = propCondLogPost - currentCondLogPost;
 			if(unifRand(rndGenerator)<exp(logAcceptRatio)){
 				nAccept++;
@@ -3516,6 +4113,7 @@ void metropolisHastingsForBeta(mcmcChain<pReMiuMParams>& chain,
 				}
 			}else{
 				currentParams.beta(j,k,betaOrig);
+				currentParams.workLinearPredictor(k,linearPredictorOrig);
 				// Update the std dev of the proposal
 				if(propParams.nTryBeta(j)%betaUpdateFreq==0){
 					stdDev += 10*(propParams.betaLocalAcceptRate(j)-betaTargetRate)/
@@ -3628,12 +4226,11 @@ void gibbsForTauEpsilon(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 	const pReMiuMData& dataset = model.dataset();
 	const string& outcomeType = model.dataset().outcomeType();
 
 	unsigned int nSubjects=dataset.nSubjects();
-	unsigned int nFixedEffects=dataset.nFixedEffects();
 
 	nTry++;
 	nAccept++;
@@ -3648,9 +4245,7 @@ void gibbsForTauEpsilon(mcmcChain<pReMiuMParams>& chain,
 	for(unsigned int i=0;i<nSubjects;i++){
 		int zi=currentParams.z(i);
 		double meanVal=meanVec[i]+currentParams.theta(zi,0);
-		for(unsigned int j=0;j<nFixedEffects;j++){
-			meanVal+=currentParams.beta(j,0)*dataset.W(i,j);
-		}
+		meanVal+=currentParams.workLinearPredictor(i,0);
 		double eps = currentParams.lambda(i)-meanVal;
 		sumEpsilon+=pow(eps,2.0);
 	}
@@ -3675,7 +4270,7 @@ void metropolisHastingsForRhoOmega(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	// Find the number of subjects
 	unsigned int nCovariates = currentParams.nCovariates();
@@ -3818,12 +4413,11 @@ void gibbsForSigmaSqY(mcmcChain<pReMiuMParams>& chain,
 						baseGeneratorType& rndGenerator){
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	const pReMiuMData& dataset = model.dataset();
 
 	unsigned int nSubjects = currentParams.nSubjects();
-	unsigned int nFixedEffects = dataset.nFixedEffects();
 
 	nTry++;
 	nAccept++;
@@ -3833,9 +4427,7 @@ void gibbsForSigmaSqY(mcmcChain<pReMiuMParams>& chain,
 		int Zi = currentParams.z(i);
 
 		double mu = currentParams.theta(Zi,0);
-		for(unsigned int j=0;j<nFixedEffects;j++){
-			mu+=currentParams.beta(j,0)*dataset.W(i,j);
-		}
+		mu+=currentParams.workLinearPredictor(i,0);
 
 		sumVal+=pow(dataset.continuousY(i)-mu,2.0);
 	}
@@ -3856,12 +4448,11 @@ void gibbsForSigmaSqYQuantile(mcmcChain<pReMiuMParams>& chain,
 				const mcmcModel<pReMiuMParams, pReMiuMOptions, pReMiuMData>& model, pReMiuMPropParams& propParams, baseGeneratorType& rndGenerator){
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 
 	const pReMiuMData& dataset = model.dataset();
 
 	unsigned int nSubjects = currentParams.nSubjects();
-	unsigned int nFixedEffects = dataset.nFixedEffects();
 	double pQuantile = hyperParams.pQuantile();
 
 	nTry++;
@@ -3871,9 +4462,7 @@ void gibbsForSigmaSqYQuantile(mcmcChain<pReMiuMParams>& chain,
 	for(unsigned int i=0;i<nSubjects;i++){
 		int Zi = currentParams.z(i);
 		double mu = currentParams.theta(Zi,0);
-		for(unsigned int j=0;j<nFixedEffects;j++){
-			mu+=currentParams.beta(j,0)*dataset.W(i,j);
-		}
+		mu+=currentParams.workLinearPredictor(i,0);
 		// here used different parametrisation of ALD than in paper (see distribution.h for further details on this parametrisation)
 		sumVal+=(abs(dataset.continuousY(i)-mu)+(2*pQuantile-1)*(dataset.continuousY(i)-mu))/2;
 	}
@@ -3899,21 +4488,63 @@ void gibbsForNu(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMData& dataset = model.dataset();
+	const vector<double>& survivalTime = dataset.continuousY();
+	const vector<unsigned int>& censoring = dataset.censoring();
 	const bool weibullFixedShape=model.options().weibullFixedShape();
 	// Find the number of clusters
 	unsigned int maxZ = currentParams.workMaxZi();
 
 	nTry++;
 	nAccept++;
+	// The statistics of the likelihood of nu are computed once for each
+	// cluster, from its members, before the adaptive rejection sampler is
+	// run, and the workspaces of the sampler are kept between the sweeps
+	pReMiuMWorkspace& workspace = propParams.workspace();
+	vector<arsWorkspace>& threadArs = workspace.nuThreadArs();
 	if (weibullFixedShape){
-		double nu = ARSsampleNu(currentParams, model, 0,logNuPostSurvival,rndGenerator);
+		// The shape is shared, so the statistics are taken over all the
+		// subjects, each with the rate of its own cluster
+		unsigned int nSubjects = dataset.nSubjects();
+		vector<unsigned int>& subjects = workspace.nuSubjects();
+		subjects.resize(nSubjects);
+		for (unsigned int i=0;i<nSubjects;i++){
+			subjects[i]=i;
+		}
+		currentParams.workNuStats(0,subjects,survivalTime,censoring);
+		threadArs.resize(1);
+		double nu = ARSsampleNu(currentParams, model, 0,logNuPostSurvival,rndGenerator,threadArs[0]);
 		currentParams.nu(0,nu);
-	} else {
-		for (unsigned int c=0;c<=maxZ;c++){
-			double nu = ARSsampleNu(currentParams, model, c,logNuPostSurvival,rndGenerator);
+		return;
+	}
+
+	if(model.options().parallelClusters()){
+		clusterTasks(currentParams,0,maxZ+1,true,rndGenerator,workspace);
+		const vector<unsigned int>& order = workspace.clusterTaskOrder();
+		const vector<uint32_t>& seeds = workspace.clusterTaskSeeds();
+		unsigned int nThreads = model.options().nThreads();
+		threadArs.resize(nThreads);
+		#pragma omp parallel for num_threads(nThreads) schedule(dynamic,1)
+		for(unsigned int k=0;k<=maxZ;k++){
+			unsigned int c = order[k];
+#ifdef _OPENMP
+			unsigned int thread = omp_get_thread_num();
+#else
+			unsigned int thread = 0;
+#endif
+			baseGeneratorType clusterGenerator = rndGenerator.substream(seeds[c]);
+			currentParams.workNuStats(c,currentParams.workClusterMembers(c),survivalTime,censoring);
+			double nu = ARSsampleNu(currentParams, model, c,logNuPostSurvival,clusterGenerator,threadArs[thread]);
 			currentParams.nu(c,nu);
 		}
+		return;
+	}
+
+	threadArs.resize(1);
+	for (unsigned int c=0;c<=maxZ;c++){
+		currentParams.workNuStats(c,currentParams.workClusterMembers(c),survivalTime,censoring);
+		double nu = ARSsampleNu(currentParams, model, c,logNuPostSurvival,rndGenerator,threadArs[0]);
+		currentParams.nu(c,nu);
 	}
 }
 
@@ -3928,7 +4559,7 @@ void gibbsForTauCAR(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 	const pReMiuMData& dataset = model.dataset();
 
 	//Rprintf("TauCAR before update is %f \n.", currentParams.TauCAR());
@@ -3947,8 +4578,8 @@ void gibbsForTauCAR(mcmcChain<pReMiuMParams>& chain,
 		int nNeighi = dataset.nNeighbours(i);
 		sumCAR1+= uCARi*uCARi*nNeighi;
 		for (int j = 0; j<nNeighi; j++){
-			unsigned int nj = dataset.neighbours(i,j);
-			double ucarj = currentParams.uCAR(nj-1);
+			unsigned int nj = dataset.neighbour(i,j);
+			double ucarj = currentParams.uCAR(nj);
 			sumCAR2+=uCARi*ucarj;
 	        }
 	}
@@ -3965,6 +4596,18 @@ void gibbsForTauCAR(mcmcChain<pReMiuMParams>& chain,
 	//Rprintf("TauCAR after update is %f \n .", currentParams.TauCAR());
 }
 
+// Subtract the mean of the spatial random effects so that they sum up to 0
+void centreUCAR(pReMiuMParams& currentParams){
+
+	vector<double> tempU = currentParams.uCAR();
+	unsigned int nSubjects = tempU.size();
+	double meanU=0.0;
+	for (unsigned int i=0; i<nSubjects; i++){meanU+=tempU[i];}
+	meanU/=nSubjects;
+	for (unsigned int i=0; i<nSubjects; i++){tempU[i]-=meanU;}
+	currentParams.uCAR(tempU);
+}
+
 // Gibbs update for spatial random term using adaptive rejection sampling for Poisson outcome
 void adaptiveRejectionSamplerForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
 						unsigned int& nTry,unsigned int& nAccept,
@@ -3983,10 +4626,44 @@ void adaptiveRejectionSamplerForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
 	nTry++;
 	nAccept++;
 
+	if(model.options().chromaticCAR()){
+		// The subjects of one colour are not neighbours, so their full
+		// conditionals do not depend on each other. Each chunk of subjects
+		// has its own generator, seeded from the main one, so that the result
+		// does not depend on the number of threads
+		const vector<vector<unsigned int> >& neighbourColours = dataset.neighbourColours();
+		unsigned int nThreads = model.options().nThreads();
+		const unsigned int chunkSize = 64;
+		for(unsigned int col=0;col<neighbourColours.size();col++){
+			const vector<unsigned int>& subjects = neighbourColours[col];
+			unsigned int nColour = subjects.size();
+			unsigned int nChunks = (nColour+chunkSize-1)/chunkSize;
+			vector<uint32_t> chunkSeeds(nChunks);
+			for(unsigned int b=0;b<nChunks;b++){
+				chunkSeeds[b]=rndGenerator();
+			}
+			#pragma omp parallel for num_threads(nThreads) schedule(dynamic)
+			for(unsigned int b=0;b<nChunks;b++){
+				baseGeneratorType chunkGenerator = rndGenerator.substream(chunkSeeds[b]);
+				arsWorkspace chunkWorkspace;
+				unsigned int kEnd = std::min((b+1)*chunkSize,nColour);
+				for(unsigned int k=b*chunkSize;k<kEnd;k++){
+					unsigned int iSub = subjects[k];
+					double ui=ARSsampleCAR(currentParams, model, iSub,logUiPostPoissonSpatial,chunkGenerator,chunkWorkspace);
+					currentParams.uCAR(iSub,ui);
+				}
+			}
+		}
+		centreUCAR(currentParams);
+		return;
+	}
+
 	vector<double> tempU;
 	tempU.resize(nSubjects);
+	// The current uCAR are only read while the new values are sampled
+	arsWorkspace workspace;
 	for (unsigned int iSub=0; iSub<nSubjects; iSub++){
-		double ui=ARSsampleCAR(currentParams, model, iSub,logUiPostPoissonSpatial,rndGenerator);
+		double ui=ARSsampleCAR(currentParams, model, iSub,logUiPostPoissonSpatial,rndGenerator,workspace);
 		tempU[iSub]=ui;
 	}
 	double meanU=0.0;
@@ -3998,7 +4675,36 @@ void adaptiveRejectionSamplerForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
 }
 
 // Random Walk Metropolis for Poisson outcome with spatial random effect
-void metropolisForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
+// Adaptive update of the std dev of the random walk proposal for uCAR, after
+// a proposal has been accepted or rejected
+void updateUCARStdDev(pReMiuMPropParams& propParams,const bool& accepted){
+
+	double uCARTargetRate = propParams.uCARAcceptTarget();
+	unsigned int uCARUpdateFreq = propParams.uCARUpdateFreq();
+	double& stdDev = propParams.uCARStdDev();
+
+	if(propParams.nTryuCAR()%uCARUpdateFreq==0){
+		stdDev += 10*(propParams.uCARLocalAcceptRate()-uCARTargetRate)/
+			pow((double)(propParams.nTryuCAR()/uCARUpdateFreq)+2.0,0.75);
+		propParams.uCARAnyUpdates(true);
+		if(stdDev>propParams.uCARStdDevUpper()||stdDev<propParams.uCARStdDevLower()){
+			propParams.uCARStdDevReset();
+		}
+		if(accepted){
+			propParams.thetaLocalReset();
+		}else{
+			propParams.uCARLocalReset();
+		}
+	}
+}
+
+// Random walk Metropolis update of the spatial random effects of all the subjects
+// of each colour of the neighbourhood graph at the same time. The neighbours of
+// a subject have other colours, so the proposals for one colour are independent
+// and can be evaluated in parallel. The random numbers are drawn up front and
+// the adaptation of the proposal is done afterwards in subject order, so that
+// the result does not depend on the number of threads.
+void chromaticMetropolisForUCARPoisson(pReMiuMParams& currentParams,
 						unsigned int& nTry,unsigned int& nAccept,
 						const mcmcModel<pReMiuMParams,
 										pReMiuMOptions,
@@ -4006,28 +4712,103 @@ void metropolisForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
 						pReMiuMPropParams& propParams,
 						baseGeneratorType& rndGenerator){
 
-	mcmcState<pReMiuMParams>& currentState = chain.currentState();
-	pReMiuMParams& currentParams = currentState.parameters();
 	const pReMiuMData& dataset = model.dataset();
-	unsigned int nSubjects=dataset.nSubjects();
 	unsigned int nFixedEffects=dataset.nFixedEffects();
+	unsigned int nThreads = model.options().nThreads();
+	const vector<vector<unsigned int> >& neighbourColours = dataset.neighbourColours();
 
-	// Define a uniform random number generator
 	randomUniform unifRand(0,1);
-	// Define a normal random number generator
 	randomNormal normRand(0,1);
 
-	double uCARTargetRate = propParams.uCARAcceptTarget();
-	unsigned int uCARUpdateFreq = propParams.uCARUpdateFreq();
+	vector<double> normDraws,unifDraws;
+	vector<unsigned int> accepted;
+	for(unsigned int col=0;col<neighbourColours.size();col++){
+		const vector<unsigned int>& subjects = neighbourColours[col];
+		unsigned int nColour = subjects.size();
+		double stdDev = propParams.uCARStdDev();
+		normDraws.resize(nColour);
+		unifDraws.resize(nColour);
+		for(unsigned int k=0;k<nColour;k++){
+			normDraws[k]=normRand(rndGenerator);
+			unifDraws[k]=unifRand(rndGenerator);
+		}
+		accepted.assign(nColour,0);
+
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
+		for(unsigned int k=0;k<nColour;k++){
+			unsigned int iSub=subjects[k];
+			double uCAROrig = currentParams.uCAR(iSub);
+			double uCARProp = uCAROrig +stdDev*normDraws[k];
+			int zi = currentParams.z(iSub);
+			double currentCondLogPost = logPYiGivenZiWiPoissonSpatial(currentParams,dataset,nFixedEffects,zi,iSub);
+			currentParams.uCAR(iSub,uCARProp);
+			double propCondLogPost = logPYiGivenZiWiPoissonSpatial(currentParams,dataset,nFixedEffects,zi,iSub);
+
+			int nNeighi = dataset.nNeighbours(iSub);
+			double priorVar = currentParams.TauCAR()/nNeighi;
+			double priorMean=0.0;
+			for (int j = 0; j<nNeighi; j++){
+				unsigned int nj = dataset.neighbour(iSub,j);
+				priorMean+=currentParams.uCAR(nj);
+			}
+			priorMean/=nNeighi;
 
-	vector<double> tempU;
-	tempU.resize(nSubjects);
-	for (unsigned int iSub=0; iSub<nSubjects; iSub++){
-		nTry++;
-		propParams.uCARAddTry();
-		double& stdDev = propParams.uCARStdDev();
-			
-		// likelihood	
+			double propPrior = 0.5*pow((uCARProp-priorMean),2)/sqrt(priorVar);
+			double currentPrior = 0.5*pow((uCAROrig-priorMean),2)/sqrt(priorVar);
+
+			double logAcceptRatio = propCondLogPost - currentCondLogPost - propPrior + currentPrior;
+			if(unifDraws[k]<exp(logAcceptRatio)){
+				accepted[k]=1;
+			}else{
+				currentParams.uCAR(iSub,uCAROrig);
+			}
+		}
+
+		for(unsigned int k=0;k<nColour;k++){
+			nTry++;
+			propParams.uCARAddTry();
+			if(accepted[k]==1){
+				nAccept++;
+				propParams.uCARAddAccept();
+			}
+			updateUCARStdDev(propParams,accepted[k]==1);
+		}
+	}
+	centreUCAR(currentParams);
+}
+
+void metropolisForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
+						unsigned int& nTry,unsigned int& nAccept,
+						const mcmcModel<pReMiuMParams,
+										pReMiuMOptions,
+										pReMiuMData>& model,
+						pReMiuMPropParams& propParams,
+						baseGeneratorType& rndGenerator){
+
+	mcmcState<pReMiuMParams>& currentState = chain.currentState();
+	pReMiuMParams& currentParams = currentState.parameters();
+	const pReMiuMData& dataset = model.dataset();
+	unsigned int nSubjects=dataset.nSubjects();
+	unsigned int nFixedEffects=dataset.nFixedEffects();
+
+	// Define a uniform random number generator
+	randomUniform unifRand(0,1);
+	// Define a normal random number generator
+	randomNormal normRand(0,1);
+
+	if(model.options().chromaticCAR()){
+		chromaticMetropolisForUCARPoisson(currentParams,nTry,nAccept,model,propParams,rndGenerator);
+		return;
+	}
+
+	vector<double> tempU;
+	tempU.resize(nSubjects);
+	for (unsigned int iSub=0; iSub<nSubjects; iSub++){
+		nTry++;
+		propParams.uCARAddTry();
+		double& stdDev = propParams.uCARStdDev();
+			
+		// likelihood	
 		double uCAROrig = currentParams.uCAR(iSub);
 		double uCARProp = uCAROrig +stdDev*normRand(rndGenerator);
 		int zi = currentParams.z(iSub);
@@ -4042,8 +4823,8 @@ void metropolisForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
 		// prior mean
 		double priorMean=0.0;
 		for (unsigned int j = 0; j<nNeighi; j++){
-        		unsigned int nj = dataset.neighbours(iSub,j);
-        		double ucarj = currentParams.uCAR(nj-1);
+        		unsigned int nj = dataset.neighbour(iSub,j);
+        		double ucarj = currentParams.uCAR(nj);
         		priorMean+=ucarj;
 		}
 		priorMean/=nNeighi;
@@ -4059,15 +4840,7 @@ void metropolisForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
 			propParams.uCARAddAccept();
 			currentCondLogPost = propCondLogPost;
 			// Update the std dev of the proposal
-			if(propParams.nTryuCAR()%uCARUpdateFreq==0){
-				stdDev += 10*(propParams.uCARLocalAcceptRate()-uCARTargetRate)/
-					pow((double)(propParams.nTryuCAR()/uCARUpdateFreq)+2.0,0.75);
-				propParams.uCARAnyUpdates(true);
-				if(stdDev>propParams.uCARStdDevUpper()||stdDev<propParams.uCARStdDevLower()){
-					propParams.uCARStdDevReset();
-				}
-				propParams.thetaLocalReset();
-			}
+			updateUCARStdDev(propParams,true);
 			// make sure that the spatial random effects sum up to 0
 			double meanU=0.0;
 			for (unsigned int kk=0; kk<nSubjects; kk++){meanU+=tempU[kk];}
@@ -4078,15 +4851,7 @@ void metropolisForUCARPoisson(mcmcChain<pReMiuMParams>& chain,
 			tempU[iSub]=uCAROrig;
 			currentParams.uCAR(iSub,uCAROrig);
 			// Update the std dev of the proposal
-			if(propParams.nTryuCAR()%uCARUpdateFreq==0){
-				stdDev += 10*(propParams.uCARLocalAcceptRate()-uCARTargetRate)/
-					pow((double)(propParams.nTryuCAR()/uCARUpdateFreq)+2.0,0.75);
-				propParams.uCARAnyUpdates(true);
-				if(stdDev<propParams.uCARStdDevLower()||stdDev>propParams.uCARStdDevUpper()){
-					propParams.uCARStdDevReset();
-				}
-				propParams.uCARLocalReset();
-			}
+			updateUCARStdDev(propParams,false);
 		}
 	}
 	double meanU=0.0;
@@ -4110,25 +4875,60 @@ void gibbsForUCARNormal(mcmcChain<pReMiuMParams>& chain,
 	pReMiuMParams& currentParams = currentState.parameters();
 	const pReMiuMData& dataset = model.dataset();
 	unsigned int nSubjects=dataset.nSubjects();
-	unsigned int nFixedEffects=dataset.nFixedEffects();
 
 	vector<double> tempU;
 	tempU.resize(nSubjects);
 
 	nTry++;
 	nAccept++;
+	if(model.options().chromaticCAR()){
+		// The subjects of one colour are not neighbours, so they are drawn
+		// together from their full conditionals (with the normal deviates
+		// drawn up front)
+		const vector<vector<unsigned int> >& neighbourColours = dataset.neighbourColours();
+		unsigned int nThreads = model.options().nThreads();
+		randomNormal normRand(0,1);
+		vector<double> normDraws;
+		for(unsigned int col=0;col<neighbourColours.size();col++){
+			const vector<unsigned int>& subjects = neighbourColours[col];
+			unsigned int nColour = subjects.size();
+			normDraws.resize(nColour);
+			for(unsigned int k=0;k<nColour;k++){
+				normDraws[k]=normRand(rndGenerator);
+			}
+			#pragma omp parallel for num_threads(nThreads) schedule(static)
+			for(unsigned int k=0;k<nColour;k++){
+				unsigned int iSub = subjects[k];
+				int nNeighi = dataset.nNeighbours(iSub);
+				double sigmaSqUCAR = 1/(1/currentParams.sigmaSqY()+currentParams.TauCAR()*nNeighi);
+				int Zi = currentParams.z(iSub);
+				double betaW = 0.0;
+				betaW+=currentParams.workLinearPredictor(iSub,0);
+				double meanUi=0.0;
+				for (int j = 0; j<nNeighi; j++){
+					unsigned int nj = dataset.neighbour(iSub,j);
+					meanUi+=currentParams.uCAR(nj);
+				}
+				meanUi/=nNeighi;
+				double mUCAR = 1/currentParams.sigmaSqY()*(dataset.continuousY(iSub)-currentParams.theta(Zi,0)-betaW)+currentParams.TauCAR()*nNeighi*meanUi;
+				mUCAR = mUCAR * sigmaSqUCAR;
+				double ui = sqrt(sigmaSqUCAR)*normDraws[k]+mUCAR;
+				currentParams.uCAR(iSub,ui);
+			}
+		}
+		centreUCAR(currentParams);
+		return;
+	}
 	for (unsigned int iSub=0; iSub<nSubjects; iSub++){
 		int nNeighi = dataset.nNeighbours(iSub);
 		double sigmaSqUCAR = 1/(1/currentParams.sigmaSqY()+currentParams.TauCAR()*nNeighi);
 		int Zi = currentParams.z(iSub);
 		double betaW = 0.0;
-		for(unsigned int j=0;j<nFixedEffects;j++){
-			betaW+=currentParams.beta(j,0)*dataset.W(iSub,j);
-		}
+		betaW+=currentParams.workLinearPredictor(iSub,0);
 			double meanUi=0.0;
 		for (int j = 0; j<nNeighi; j++){
-        		unsigned int nj = dataset.neighbours(iSub,j);
-        		double ucarj = currentParams.uCAR(nj-1);
+        		unsigned int nj = dataset.neighbour(iSub,j);
+        		double ucarj = currentParams.uCAR(nj);
 	        		meanUi+=ucarj;
 		}
 		meanUi/=nNeighi;	
@@ -4148,7 +4948,236 @@ void gibbsForUCARNormal(mcmcChain<pReMiuMParams>& chain,
 
 /*********** BLOCK 5 p(Z|.) **********************************/
 
+// Adds the continuous covariate term of log p(X_i|z_i=c) for the fitting
+// subjects i that are not currently in cluster c and have u_i below the bound
+// of c. The continuous X of subject i is column i of X. The subjects of each
+// cluster are evaluated in blocks, so that the centred covariates are
+// multiplied by the square root of the precision as one matrix product.
+void addContinuousLogPXiGivenZi(const pReMiuMParams& currentParams,const MatrixXd& X,
+		const vector<double>& u,const vector<double>& testBound,const bool& useIndependentNormal,
+		const unsigned int& nThreads,vector<vector<double> >& logPXiGivenZi){
+
+	const unsigned int blockSize=256;
+	unsigned int nSubjects=X.cols();
+	unsigned int nContCovs=X.rows();
+	unsigned int maxNClusters=currentParams.maxNClusters();
+
+	#pragma omp parallel for num_threads(nThreads) schedule(dynamic)
+	for(unsigned int c=0;c<maxNClusters;c++){
+		vector<unsigned int> subjects;
+		for(unsigned int i=0;i<nSubjects;i++){
+			if(u[i]<testBound[c]&&currentParams.z(i)!=(int)c){
+				subjects.push_back(i);
+			}
+		}
+		if(subjects.empty()){
+			continue;
+		}
+		VectorXd sigma_c;
+		if(useIndependentNormal){
+			sigma_c.resize(nContCovs);
+			for(unsigned int j=0;j<nContCovs;j++){
+				sigma_c(j)=sqrt(1.0/currentParams.Tau_Indep(c,j));
+			}
+		}
+		MatrixXd XBlock;
+		VectorXd logPdf;
+		for(unsigned int b=0;b<subjects.size();b+=blockSize){
+			unsigned int nBlock=std::min(blockSize,(unsigned int)subjects.size()-b);
+			XBlock.resize(nContCovs,nBlock);
+			for(unsigned int k=0;k<nBlock;k++){
+				XBlock.col(k)=X.col(subjects[b+k]);
+			}
+			if(useIndependentNormal){
+				logPdfIndepNormalBlock(XBlock,currentParams.workMuStar(c),sigma_c,logPdf);
+			}else{
+				logPdfMultivarNormalBlock(XBlock,currentParams.workMuStar(c),currentParams.workSqrtTau(c),
+						currentParams.workLogDetTau(c),logPdf);
+			}
+			for(unsigned int k=0;k<nBlock;k++){
+				logPXiGivenZi[subjects[b+k]][c]+=logPdf(k);
+			}
+		}
+	}
+}
+
+// Computes, for each pattern of missing continuous covariates among the
+// partially observed predictive subjects and each cluster that one of those
+// subjects can join, the square root and log determinant of the precision
+// of the observed covariates. Entry p*maxNClusters+c is for pattern p and
+// cluster c, and is only filled where it is needed (the other entries keep
+// whatever they held before, so the buffers can be reused between sweeps).
+void marginalPrecisionsForMissingPatterns(const pReMiuMParams& currentParams,
+		const pReMiuMData& dataset,const unsigned int& nContCovs,
+		const vector<double>& u,const vector<double>& testBound,
+		const unsigned int& nThreads,vector<MatrixXd>& sqrtTau,
+		vector<double>& logDetTau){
+
+	unsigned int nSubjects=dataset.nSubjects();
+	unsigned int nPredictSubjects=dataset.nPredictSubjects();
+	unsigned int nPatterns=dataset.nMissingPatterns();
+	unsigned int maxNClusters=currentParams.maxNClusters();
+
+	// A pattern is needed in cluster c if its smallest u is below the bound
+	vector<bool> patternUsed(nPatterns,false);
+	vector<double> minU(nPatterns,1.0);
+	for(unsigned int i=nSubjects;i<nSubjects+nPredictSubjects;i++){
+		if(dataset.nContinuousCovariatesNotMissing(i)<nContCovs){
+			unsigned int p=dataset.missingPattern(i);
+			if(!patternUsed[p]||u[i]<minU[p]){
+				minU[p]=u[i];
+			}
+			patternUsed[p]=true;
+		}
+	}
+
+	sqrtTau.resize(nPatterns*maxNClusters);
+	logDetTau.resize(nPatterns*maxNClusters);
+	#pragma omp parallel for num_threads(nThreads) schedule(dynamic)
+	for(unsigned int k=0;k<nPatterns*maxNClusters;k++){
+		unsigned int p=k/maxNClusters;
+		unsigned int c=k%maxNClusters;
+		if(!patternUsed[p]||!(minU[p]<testBound[c])){
+			continue;
+		}
+		const vector<unsigned int>& observed=dataset.missingPatternObserved(p);
+		unsigned int nObserved=observed.size();
+		const MatrixXd& workSigma=currentParams.Sigma(c);
+		MatrixXd Sigma(nObserved,nObserved);
+		for(unsigned int j=0;j<nObserved;j++){
+			for(unsigned int r=0;r<nObserved;r++){
+				Sigma(j,r)=workSigma(observed[j],observed[r]);
+			}
+		}
+		MatrixXd Tau=Sigma.inverse();
+		LLT<MatrixXd> llt;
+		sqrtTau[k]=(llt.compute(Tau)).matrixU();
+		logDetTau[k]=log(Tau.determinant());
+	}
+}
+
+// Orders the clusters by decreasing test bound, the clusters of equal bounds
+// in increasing order, as for the independent slice sampler (whose bounds
+// decrease) and the truncated sampler (whose bounds are all 1)
+struct decreasingTestBound{
+	decreasingTestBound(const vector<double>& testBound) : _testBound(testBound) {}
+	bool operator()(const unsigned int& c1,const unsigned int& c2) const{
+		return _testBound[c1]>_testBound[c2];
+	}
+	const vector<double>& _testBound;
+};
+
+// Sorts the clusters by decreasing test bound, so that the clusters that a
+// subject with slice variable u_i can be allocated to (those with u_i below
+// their bound) are the first nSliceCandidates of clusterOrder. Returns
+// whether clusterOrder is the order of the cluster indices.
+bool sortClustersByTestBound(const vector<double>& testBound,vector<unsigned int>& clusterOrder,
+		vector<double>& sortedBound){
+	unsigned int maxNClusters = testBound.size();
+	clusterOrder.resize(maxNClusters);
+	for(unsigned int c=0;c<maxNClusters;c++){
+		clusterOrder[c]=c;
+	}
+	std::stable_sort(clusterOrder.begin(),clusterOrder.end(),decreasingTestBound(testBound));
+	sortedBound.resize(maxNClusters);
+	bool inIndexOrder = true;
+	for(unsigned int k=0;k<maxNClusters;k++){
+		sortedBound[k]=testBound[clusterOrder[k]];
+		inIndexOrder = inIndexOrder&&clusterOrder[k]==k;
+	}
+	return inIndexOrder;
+}
+
+// The number of clusters whose test bound is above u_i, by binary search in
+// the bounds sorted by sortClustersByTestBound
+inline unsigned int nSliceCandidates(const double& ui,const vector<double>& sortedBound){
+	return std::lower_bound(sortedBound.begin(),sortedBound.end(),ui,std::greater<double>())-sortedBound.begin();
+}
+
+// Adds the continuous covariate term of log p(X_i|z_i=c) for the predictive
+// subjects, counting only their observed covariates. The observed covariates
+// of a subject are gathered once into the buffer of its thread, and the
+// cluster parameters are used in place when no covariate is missing.
+void addContinuousPredictLogPXiGivenZi(const pReMiuMParams& currentParams,const pReMiuMData& dataset,
+		const unsigned int& nContinuousCovs,const vector<double>& u,const vector<double>& sortedBound,
+		const vector<unsigned int>& clusterOrder,const vector<MatrixXd>& patternSqrtTau,
+		const vector<double>& patternLogDetTau,const bool& useIndependentNormal,
+		const unsigned int& nThreads,pReMiuMWorkspace& workspace,vector<vector<double> >& logPXiGivenZi){
+
+	unsigned int nSubjects=dataset.nSubjects();
+	unsigned int nPredictSubjects=dataset.nPredictSubjects();
+	unsigned int maxNClusters=currentParams.maxNClusters();
+
+	vector<VectorXd>& threadXi = workspace.zThreadXi();
+	vector<VectorXd>& threadMuStar = workspace.zThreadMuStar();
+	threadXi.resize(nThreads);
+	threadMuStar.resize(nThreads);
+
+	#pragma omp parallel for num_threads(nThreads) schedule(static)
+	for(unsigned int i=nSubjects;i<nSubjects+nPredictSubjects;i++){
+#ifdef _OPENMP
+		unsigned int thread = omp_get_thread_num();
+#else
+		unsigned int thread = 0;
+#endif
+		unsigned int nNotMissing=dataset.nContinuousCovariatesNotMissing(i);
+		bool complete = nNotMissing==nContinuousCovs;
+		unsigned int p = complete ? 0 : dataset.missingPattern(i);
+
+		VectorXd& xi = threadXi[thread];
+		VectorXd& muStar = threadMuStar[thread];
+		xi.resize(nNotMissing);
+		muStar.resize(nNotMissing);
+		if(complete){
+			for(unsigned int j=0;j<nContinuousCovs;j++){
+				xi(j)=currentParams.workContinuousX(i,j);
+			}
+		}else{
+			const vector<unsigned int>& observed = dataset.missingPatternObserved(p);
+			for(unsigned int j=0;j<nNotMissing;j++){
+				xi(j)=currentParams.workContinuousX(i,observed[j]);
+			}
+		}
+
+		unsigned int nCandidates = nSliceCandidates(u[i],sortedBound);
+		for(unsigned int k=0;k<nCandidates;k++){
+			unsigned int c = clusterOrder[k];
+			const VectorXd& workMuStar=currentParams.workMuStar(c);
+			if(useIndependentNormal){
+				if(complete){
+					for(unsigned int j=0;j<nContinuousCovs;j++){
+						logPXiGivenZi[i][c]+=logPdfNormal(xi(j),workMuStar(j),sqrt(1.0/currentParams.Tau_Indep(c,j)));
+					}
+				}else{
+					const VectorXd& workSigma = currentParams.Sigma_Indep(c);
+					const vector<unsigned int>& observed = dataset.missingPatternObserved(p);
+					for(unsigned int j=0;j<nNotMissing;j++){
+						logPXiGivenZi[i][c]+=logPdfNormal(xi(j),workMuStar(observed[j]),sqrt(workSigma(observed[j])));
+					}
+				}
+			}else{
+				if(complete){
+					logPXiGivenZi[i][c]+=logPdfMultivarNormal(nNotMissing,xi,workMuStar,
+						currentParams.workSqrtTau(c),currentParams.workLogDetTau(c));
+				}else{
+					const vector<unsigned int>& observed = dataset.missingPatternObserved(p);
+					for(unsigned int j=0;j<nNotMissing;j++){
+						muStar(j)=workMuStar(observed[j]);
+					}
+					logPXiGivenZi[i][c]+=logPdfMultivarNormal(nNotMissing,xi,muStar,
+						patternSqrtTau[p*maxNClusters+c],patternLogDetTau[p*maxNClusters+c]);
+				}
+			}
+		}
+	}
+}
+
+// The number of sweeps between the rebuilds of the per cluster sufficient
+// statistics of the continuous covariates from the cluster members
+const unsigned int sufficientStatsRebuildEvery = 500;
+
 // Gibbs update for the allocation variables
+template<pReMiuMLogPYiGivenZiWi logPYiGivenZiWi>
 void gibbsForZ(mcmcChain<pReMiuMParams>& chain,
 				unsigned int& nTry,unsigned int& nAccept,
 				const mcmcModel<pReMiuMParams,
@@ -4159,11 +5188,11 @@ void gibbsForZ(mcmcChain<pReMiuMParams>& chain,
 
 	mcmcState<pReMiuMParams>& currentState = chain.currentState();
 	pReMiuMParams& currentParams = currentState.parameters();
-	pReMiuMHyperParams hyperParams = currentParams.hyperParams();
+	const pReMiuMHyperParams& hyperParams = currentParams.hyperParams();
 	const pReMiuMData& dataset = model.dataset();
-	const string& outcomeType = model.dataset().outcomeType();
-	const string& covariateType = model.dataset().covariateType();
-	const string& samplerType = model.options().samplerType();
+	const pReMiuMOutcomeType outcomeType = model.options().outcomeTypeId();
+	const pReMiuMCovariateType covariateType = model.options().covariateTypeId();
+	const pReMiuMSamplerType samplerType = model.options().samplerTypeId();
 	bool computeEntropy = model.options().computeEntropy();
 	unsigned int nSubjects=dataset.nSubjects();
 	unsigned int nPredictSubjects=dataset.nPredictSubjects();
@@ -4173,13 +5202,12 @@ void gibbsForZ(mcmcChain<pReMiuMParams>& chain,
 	unsigned int nCovariates=dataset.nCovariates();
 	unsigned int nDiscreteCovs=dataset.nDiscreteCovs();
 	unsigned int nContinuousCovs=dataset.nContinuousCovs();
-	vector<unsigned int>nCategories=dataset.nCategories();
-	const vector<vector<bool> >& missingX=dataset.missingX();
 	bool includeResponse = model.options().includeResponse();
 	bool responseExtraVar = model.options().responseExtraVar();
-	const bool includeCAR=model.options().includeCAR();
-	const string& predictType = model.options().predictType();
+	const bool raoBlackwellPredict = model.options().predictType().compare("RaoBlackwell")==0;
+	const bool randomPredict = model.options().predictType().compare("random")==0;
 	bool useIndependentNormal = model.options().useIndependentNormal();
+	unsigned int nThreads = model.options().nThreads();
 
 
 	nTry++;
@@ -4188,504 +5216,448 @@ void gibbsForZ(mcmcChain<pReMiuMParams>& chain,
 	// Define a uniform random number generator
 	randomUniform unifRand(0,1);
 
-	vector<unsigned int> nMembers(maxNClusters,0);
+	// The temporaries are kept in the workspace between sweeps
+	pReMiuMWorkspace& workspace = propParams.workspace();
 
-	vector<double> rnd(nSubjects+nPredictSubjects,0.0);
-	vector<double> u(nSubjects+nPredictSubjects,0.0);
+	vector<unsigned int>& nMembers = workspace.zNMembers();
+	nMembers.assign(maxNClusters,0);
+	vector<vector<unsigned int> >& clusterMembers = workspace.zClusterMembers();
+	if(clusterMembers.size()<maxNClusters){
+		clusterMembers.resize(maxNClusters);
+	}
+	for(unsigned int c=0;c<clusterMembers.size();c++){
+		clusterMembers[c].clear();
+	}
+
+	// The uniforms used for the allocations are drawn up front so that the
+	// allocations do not depend on how the subjects are split between threads
+	vector<double>& rnd = workspace.zRnd();
+	vector<double>& u = workspace.zU();
+	rnd.resize(nSubjects+nPredictSubjects);
+	u.resize(nSubjects+nPredictSubjects);
+	fillUniformRand(rndGenerator,rnd);
 	for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
-		rnd[i] = unifRand(rndGenerator);
 		u[i] = currentParams.u(i);
 	}
 
-	vector<double> testBound(maxNClusters,0.0);
-	vector<double> clusterWeight(maxNClusters,0.0);
+	vector<double>& testBound = workspace.zTestBound();
+	vector<double>& clusterWeight = workspace.zClusterWeight();
+	testBound.resize(maxNClusters);
+	clusterWeight.resize(maxNClusters);
 	for(unsigned int c=0;c<maxNClusters;c++){
-		if(samplerType.compare("SliceDependent")==0){
+		if(samplerType==samplerSliceDependent){
 			testBound[c] = exp(currentParams.logPsi(c));
 			clusterWeight[c] = 0.0;
-		}else if(samplerType.compare("SliceIndependent")==0){
+		}else if(samplerType==samplerSliceIndependent){
 			testBound[c] = hyperParams.workXiSlice(c);
 			clusterWeight[c] = currentParams.logPsi(c)-(double)c*log(hyperParams.rSlice())-log(1-hyperParams.rSlice());
-		}else if(samplerType.compare("Truncated")==0){
+		}else if(samplerType==samplerTruncated){
 			testBound[c] = 1.0;
 			clusterWeight[c] = currentParams.logPsi(c);
 		}
 	}
 
+	// Each subject can only be allocated to the clusters whose bound is above
+	// its slice variable, which are the first ones of the clusters sorted by
+	// decreasing bound
+	vector<unsigned int>& clusterOrder = workspace.zClusterOrder();
+	vector<double>& sortedBound = workspace.zSortedBound();
+	bool boundsInIndexOrder = sortClustersByTestBound(testBound,clusterOrder,sortedBound);
+
 	// Compute the allocation probabilities in terms of the unique vectors
-	vector<vector<double> > logPXiGivenZi;
+	// Each subject only writes to its own row, so the subjects are split
+	// between threads
+	vector<vector<double> >& logPXiGivenZi = workspace.zLogPXiGivenZi();
 	logPXiGivenZi.resize(nSubjects+nPredictSubjects);
-	if(covariateType.compare("Discrete")==0){
+	// The buffers the discrete covariates of a subject are unpacked into
+	// when they are shared with the packed data set
+	vector<vector<int> >& threadDiscreteX = workspace.zThreadDiscreteX();
+	threadDiscreteX.resize(nThreads);
+	unsigned int phiStride = currentParams.workLogPhiStarStride();
+	if(covariateType==covariateDiscrete){
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
 		for(unsigned int i=0;i<nSubjects;i++){
-			logPXiGivenZi[i].resize(maxNClusters,0);
-			for(unsigned int c=0;c<maxNClusters;c++){
-				if(u[i]<testBound[c]){
-					if(currentParams.z(i)==(int)c){
-						logPXiGivenZi[i][c]=currentParams.workLogPXiGivenZi(i);
-					}else{
-						logPXiGivenZi[i][c]=0;
-						for(unsigned int j=0;j<nCovariates;j++){
-							int Xij = currentParams.workDiscreteX(i,j);
-							logPXiGivenZi[i][c]+=currentParams.workLogPhiStar(c,j,(unsigned int)Xij);
-						}
+			logPXiGivenZi[i].assign(maxNClusters,0.0);
+#ifdef _OPENMP
+			unsigned int thread = omp_get_thread_num();
+#else
+			unsigned int thread = 0;
+#endif
+			const int* discreteXi = currentParams.workDiscreteX(i,threadDiscreteX[thread]);
+			unsigned int nCandidates = nSliceCandidates(u[i],sortedBound);
+			for(unsigned int k=0;k<nCandidates;k++){
+				unsigned int c = clusterOrder[k];
+				if(currentParams.z(i)==(int)c){
+					logPXiGivenZi[i][c]=currentParams.workLogPXiGivenZi(i);
+				}else{
+					// Contiguous gather over the covariates
+					const double* logPhiStarC = currentParams.workLogPhiStar(c);
+					double logPXi=0;
+					for(unsigned int j=0;j<nCovariates;j++){
+						logPXi+=logPhiStarC[j*phiStride+discreteXi[j]];
 					}
+					logPXiGivenZi[i][c]=logPXi;
 				}
 			}
 		}
 		// For the predictive subjects we do not count missing data
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
 		for(unsigned int i=nSubjects;i<nSubjects+nPredictSubjects;i++){
-			logPXiGivenZi[i].resize(maxNClusters,0);
-			for(unsigned int c=0;c<maxNClusters;c++){
-				if(u[i]<testBound[c]){
-					for(unsigned int j=0;j<nCovariates;j++){
-						if(!missingX[i][j]){
-							int Xij = currentParams.workDiscreteX(i,j);
-							logPXiGivenZi[i][c]+=currentParams.workLogPhiStar(c,j,(unsigned int)Xij);
-						}
+			logPXiGivenZi[i].assign(maxNClusters,0.0);
+#ifdef _OPENMP
+			unsigned int thread = omp_get_thread_num();
+#else
+			unsigned int thread = 0;
+#endif
+			const int* discreteXi = currentParams.workDiscreteX(i,threadDiscreteX[thread]);
+			unsigned int nCandidates = nSliceCandidates(u[i],sortedBound);
+			for(unsigned int k=0;k<nCandidates;k++){
+				unsigned int c = clusterOrder[k];
+				const double* logPhiStarC = currentParams.workLogPhiStar(c);
+				for(unsigned int j=0;j<nCovariates;j++){
+					if(!dataset.missingX(i,j)){
+						logPXiGivenZi[i][c]+=logPhiStarC[j*phiStride+discreteXi[j]];
 					}
 				}
 			}
 		}
 
-	}else if(covariateType.compare("Normal")==0){
+	}else if(covariateType==covariateNormal){
+		MatrixXd& X = workspace.zContinuousX();
+		X.resize(nCovariates,nSubjects);
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
 		for(unsigned int i=0;i<nSubjects;i++){
-			logPXiGivenZi[i].resize(maxNClusters,0.0);
-			VectorXd xi=VectorXd::Zero(nCovariates);
-			for(unsigned int c=0;c<maxNClusters;c++){
-				if(u[i]<testBound[c]){
-					if(currentParams.z(i)==(int)c){
-						logPXiGivenZi[i][c]=currentParams.workLogPXiGivenZi(i);
-					}else{
-						for(unsigned int j=0;j<nCovariates;j++){
-							xi(j)=currentParams.workContinuousX(i,j);
-						}
-						if (useIndependentNormal) {
-							VectorXd muStar = currentParams.workMuStar(c);
-							VectorXd sigma_cj(nCovariates);
-							for (unsigned int j = 0; j < nCovariates; j++) {
-								sigma_cj(j)= sqrt(1.0 / currentParams.Tau_Indep(c, j));
-							}
-							for (unsigned int j = 0; j<nCovariates; j++) {
-								logPXiGivenZi[i][c] += logPdfNormal(xi(j), muStar(j), sigma_cj(j));
-							}
-						}
-						else {
-							logPXiGivenZi[i][c] = logPdfMultivarNormal(nCovariates, xi, currentParams.workMuStar(c), currentParams.workSqrtTau(c), currentParams.workLogDetTau(c));
-						}
-						
-					}
-				}
-
+			logPXiGivenZi[i].assign(maxNClusters,0.0);
+			for(unsigned int j=0;j<nCovariates;j++){
+				X(j,i)=currentParams.workContinuousX(i,j);
 			}
+			int zi=currentParams.z(i);
+			if(u[i]<testBound[zi]){
+				logPXiGivenZi[i][zi]=currentParams.workLogPXiGivenZi(i);
+			}
+		}
+		addContinuousLogPXiGivenZi(currentParams,X,u,testBound,useIndependentNormal,nThreads,logPXiGivenZi);
+		vector<MatrixXd>& patternSqrtTau = workspace.zPatternSqrtTau();
+		vector<double>& patternLogDetTau = workspace.zPatternLogDetTau();
+		if(!useIndependentNormal&&nPredictSubjects>0){
+			marginalPrecisionsForMissingPatterns(currentParams,dataset,nCovariates,u,testBound,
+				nThreads,patternSqrtTau,patternLogDetTau);
 		}
 		// For the predictive subjects we do not count missing data
-		LLT<MatrixXd> llt;
 		for(unsigned int i=nSubjects;i<nSubjects+nPredictSubjects;i++){
-			logPXiGivenZi[i].resize(maxNClusters,0.0);
-
-			unsigned int nNotMissing=dataset.nContinuousCovariatesNotMissing(i);
-
-			for(unsigned int c=0;c<maxNClusters;c++){
-				if(u[i]<testBound[c]){
-					VectorXd workMuStar=currentParams.workMuStar(c);
-
-					VectorXd xi=VectorXd::Zero(nNotMissing);
-					VectorXd muStar=VectorXd::Zero(nNotMissing);
-					VectorXd sigma_cj = VectorXd::Zero(nNotMissing);
-					MatrixXd sqrtTau = MatrixXd::Zero(nNotMissing, nNotMissing);
-					double logDetTau = 0.0;
-					
-					if(nNotMissing==nCovariates){
-						muStar=workMuStar;
-						if (useIndependentNormal) {
-							for (unsigned int j = 0; j < nCovariates; j++) {
-								sigma_cj(j) = sqrt(1.0 / currentParams.Tau_Indep(c,j));
-							}
-						}
-						else {
-							sqrtTau = currentParams.workSqrtTau(c);
-							logDetTau = currentParams.workLogDetTau(c);
-						}
-						for(unsigned int j=0;j<nCovariates;j++){
-							xi(j)=currentParams.workContinuousX(i,j);
-						}
-					}else{
-
-						if (useIndependentNormal) {
-							VectorXd workSigma = currentParams.Sigma_Indep(c);
-							unsigned int j = 0;
-							for (unsigned int j0 = 0; j0<nCovariates; j0++) {
-								if (!missingX[i][nDiscreteCovs + j0]) {
-									xi(j) = currentParams.workContinuousX(i, j0);
-									muStar(j) = workMuStar(j0);
-									sigma_cj(j) = sqrt(workSigma(j0));
-									j++;
-								}
-							}
-						}
-						else {
-							MatrixXd workSigma = currentParams.Sigma(c);
-							MatrixXd Sigma = MatrixXd::Zero(nNotMissing, nNotMissing);
-							MatrixXd Tau = MatrixXd::Zero(nNotMissing, nNotMissing);
-							unsigned int j = 0;
-							for (unsigned int j0 = 0; j0<nCovariates; j0++) {
-								if (!missingX[i][nDiscreteCovs + j0]) {
-									xi(j) = currentParams.workContinuousX(i, j0);
-									muStar(j) = workMuStar(j0);
-									unsigned int r = 0;
-									for (unsigned int j1 = 0; j1<nCovariates; j1++) {
-										if (!missingX[i][nDiscreteCovs + j1]) {
-											Sigma(j, r) = workSigma(j0, j1);
-											r++;
-										}
-									}
-									j++;
-								}
-							}
-							Tau = Sigma.inverse();
-							sqrtTau = (llt.compute(Tau)).matrixU();
-							logDetTau = log(Tau.determinant());
-						}
-
-					}
-						
-					if (useIndependentNormal) {
-						for (unsigned int j = 0; j<nNotMissing; j++) {
-							logPXiGivenZi[i][c] += logPdfNormal(xi(j), muStar(j), sigma_cj(j));
-						}
-					}
-					else {
-						logPXiGivenZi[i][c] = logPdfMultivarNormal(nNotMissing, xi, muStar, sqrtTau, logDetTau);
-					}
-
-				}
-			}
+			logPXiGivenZi[i].assign(maxNClusters,0.0);
 		}
+		addContinuousPredictLogPXiGivenZi(currentParams,dataset,nCovariates,u,sortedBound,clusterOrder,
+			patternSqrtTau,patternLogDetTau,useIndependentNormal,nThreads,workspace,logPXiGivenZi);
 
-	}else if(covariateType.compare("Mixed")==0){
+	}else if(covariateType==covariateMixed){
+		MatrixXd& X = workspace.zContinuousX();
+		X.resize(nContinuousCovs,nSubjects);
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
 		for(unsigned int i=0;i<nSubjects;i++){
-			VectorXd xi=VectorXd::Zero(nContinuousCovs);
-			logPXiGivenZi[i].resize(maxNClusters,0);
-			for(unsigned int c=0;c<maxNClusters;c++){
-				if(u[i]<testBound[c]){
-					if(currentParams.z(i)==(int)c){
-						logPXiGivenZi[i][c]=currentParams.workLogPXiGivenZi(i);
-					}else{
-						logPXiGivenZi[i][c]=0;
-						for(unsigned int j=0;j<nDiscreteCovs;j++){
-							int Xij = currentParams.workDiscreteX(i,j);
-							logPXiGivenZi[i][c]+=currentParams.workLogPhiStar(c,j,(unsigned int)Xij);
-						}
-						for(unsigned int j=0;j<nContinuousCovs;j++){
-							xi(j)=currentParams.workContinuousX(i,j);
-						}
-
-						if (useIndependentNormal) {
-							VectorXd muStar = currentParams.workMuStar(c);
-							VectorXd sigma_cj(nContinuousCovs);
-							for (unsigned int j = 0; j < nContinuousCovs; j++) {
-								sigma_cj(j)= sqrt(1.0 / currentParams.Tau_Indep(c,j));
-							}
-							for (unsigned int j = 0; j<nContinuousCovs; j++) {
-								logPXiGivenZi[i][c] += logPdfNormal(xi(j), muStar(j), sigma_cj(j));
-							}
-						}
-						else {
-							logPXiGivenZi[i][c] += logPdfMultivarNormal(nContinuousCovs, xi, currentParams.workMuStar(c), currentParams.workSqrtTau(c), currentParams.workLogDetTau(c));						
-						}
-						
-					}
-				}
+			logPXiGivenZi[i].assign(maxNClusters,0.0);
+#ifdef _OPENMP
+			unsigned int thread = omp_get_thread_num();
+#else
+			unsigned int thread = 0;
+#endif
+			const int* discreteXi = currentParams.workDiscreteX(i,threadDiscreteX[thread]);
+			for(unsigned int j=0;j<nContinuousCovs;j++){
+				X(j,i)=currentParams.workContinuousX(i,j);
 			}
-		}
-
-		// For the predictive subjects we do not count missing data
-		for(unsigned int i=nSubjects;i<nSubjects+nPredictSubjects;i++){
-			logPXiGivenZi[i].resize(maxNClusters,0);
-			for(unsigned int c=0;c<maxNClusters;c++){
-				if(u[i]<testBound[c]){
+			unsigned int nCandidates = nSliceCandidates(u[i],sortedBound);
+			for(unsigned int k=0;k<nCandidates;k++){
+				unsigned int c = clusterOrder[k];
+				if(currentParams.z(i)==(int)c){
+					logPXiGivenZi[i][c]=currentParams.workLogPXiGivenZi(i);
+				}else{
+					const double* logPhiStarC = currentParams.workLogPhiStar(c);
+					double logPXi=0;
 					for(unsigned int j=0;j<nDiscreteCovs;j++){
-						if(!missingX[i][j]){
-							int Xij = currentParams.workDiscreteX(i,j);
-							logPXiGivenZi[i][c]+=currentParams.workLogPhiStar(c,j,(unsigned int)Xij);
-						}
+						logPXi+=logPhiStarC[j*phiStride+discreteXi[j]];
 					}
+					logPXiGivenZi[i][c]=logPXi;
 				}
 			}
 		}
+		// The continuous part is added cluster by cluster
+		addContinuousLogPXiGivenZi(currentParams,X,u,testBound,useIndependentNormal,nThreads,logPXiGivenZi);
 
 		// For the predictive subjects we do not count missing data
-		LLT<MatrixXd> llt;
+		#pragma omp parallel for num_threads(nThreads) schedule(static)
 		for(unsigned int i=nSubjects;i<nSubjects+nPredictSubjects;i++){
-
-			unsigned int nNotMissing=dataset.nContinuousCovariatesNotMissing(i);
-
-			for(unsigned int c=0;c<maxNClusters;c++){
-				if(u[i]<testBound[c]){
-					VectorXd workMuStar=currentParams.workMuStar(c);
-					VectorXd xi=VectorXd::Zero(nNotMissing);
-					VectorXd muStar=VectorXd::Zero(nNotMissing);
-					VectorXd sigma_cj = VectorXd::Zero(nNotMissing);
-					MatrixXd sqrtTau = MatrixXd::Zero(nNotMissing, nNotMissing);
-					double logDetTau = 0.0;
-		
-					if(nNotMissing==nContinuousCovs){
-						muStar=workMuStar;
-						if (useIndependentNormal) {
-							for (unsigned int j = 0; j < nContinuousCovs; j++) {
-								sigma_cj(j) = sqrt(1.0 / currentParams.Tau_Indep(c, j));
-							}
-						}
-						else {
-							sqrtTau = currentParams.workSqrtTau(c);
-							logDetTau = currentParams.workLogDetTau(c);
-						}
-						for(unsigned int j=0;j<nContinuousCovs;j++){
-							xi(j)=currentParams.workContinuousX(i,j);
-						}
-					}else{
-
-						if (useIndependentNormal) {
-							VectorXd workSigma = currentParams.Sigma_Indep(c);
-							unsigned int j = 0;
-							for (unsigned int j0 = 0; j0<nContinuousCovs; j0++) {
-								if (!missingX[i][nDiscreteCovs + j0]) {
-									xi(j) = currentParams.workContinuousX(i, j0);
-									muStar(j) = workMuStar(j0);
-									sigma_cj(j) = sqrt(workSigma(j0));
-									j++;
-								}
-							}
-						}
-						else {
-							MatrixXd workSigma = currentParams.Sigma(c);
-							MatrixXd Sigma = MatrixXd::Zero(nNotMissing, nNotMissing);
-							MatrixXd Tau = MatrixXd::Zero(nNotMissing, nNotMissing);
-							unsigned int j = 0;
-							for (unsigned int j0 = 0; j0<nContinuousCovs; j0++) {
-								if (!missingX[i][nDiscreteCovs + j0]) {
-									xi(j) = currentParams.workContinuousX(i, j0);
-									muStar(j) = workMuStar(j0);
-									unsigned int r = 0;
-									for (unsigned int j1 = 0; j1<nContinuousCovs; j1++) {
-										if (!missingX[i][nDiscreteCovs + j1]) {
-											Sigma(j, r) = workSigma(j0, j1);
-											r++;
-										}
-									}
-									j++;
-								}
-							}
-							Tau = Sigma.inverse();
-							sqrtTau = (llt.compute(Tau)).matrixU();
-							logDetTau = log(Tau.determinant());
-						}
-
-					}
-
-					if (useIndependentNormal) {
-						for (unsigned int j = 0; j<nNotMissing; j++) {
-							logPXiGivenZi[i][c] += logPdfNormal(xi(j), muStar(j), sigma_cj(j));
-						}
+			logPXiGivenZi[i].assign(maxNClusters,0.0);
+#ifdef _OPENMP
+			unsigned int thread = omp_get_thread_num();
+#else
+			unsigned int thread = 0;
+#endif
+			const int* discreteXi = currentParams.workDiscreteX(i,threadDiscreteX[thread]);
+			unsigned int nCandidates = nSliceCandidates(u[i],sortedBound);
+			for(unsigned int k=0;k<nCandidates;k++){
+				unsigned int c = clusterOrder[k];
+				const double* logPhiStarC = currentParams.workLogPhiStar(c);
+				for(unsigned int j=0;j<nDiscreteCovs;j++){
+					if(!dataset.missingX(i,j)){
+						logPXiGivenZi[i][c]+=logPhiStarC[j*phiStride+discreteXi[j]];
 					}
-					else {
-						logPXiGivenZi[i][c] += logPdfMultivarNormal(nNotMissing, xi, muStar, sqrtTau, logDetTau);
-					}
-
-					
 				}
 			}
 		}
 
-	}
-	double (*logPYiGivenZiWi)(const pReMiuMParams&, const pReMiuMData&,
-											const unsigned int&,const int&,
-											const unsigned int&)=NULL;
-	if(includeResponse){
-		if(!responseExtraVar){
-			if(outcomeType.compare("Bernoulli")==0){
-				logPYiGivenZiWi = &logPYiGivenZiWiBernoulli;
-			}else if(outcomeType.compare("Binomial")==0){
-				logPYiGivenZiWi = &logPYiGivenZiWiBinomial;
-			}else if(outcomeType.compare("Poisson")==0){
-				if (includeCAR){
-					logPYiGivenZiWi = &logPYiGivenZiWiPoissonSpatial;
-				}else{
-					logPYiGivenZiWi = &logPYiGivenZiWiPoisson;
-				}
-			}else if(outcomeType.compare("Normal")==0){
-				logPYiGivenZiWi = &logPYiGivenZiWiNormal;
-			}else if(outcomeType.compare("Quantile")==0){
-				logPYiGivenZiWi = &logPYiGivenZiWiQuantile;
-			}else if(outcomeType.compare("Categorical")==0){
-				logPYiGivenZiWi = &logPYiGivenZiWiCategorical;
-			}else if(outcomeType.compare("Survival")==0){
-				logPYiGivenZiWi = &logPYiGivenZiWiSurvival;
-			}
+		vector<MatrixXd>& patternSqrtTau = workspace.zPatternSqrtTau();
+		vector<double>& patternLogDetTau = workspace.zPatternLogDetTau();
+		if(!useIndependentNormal&&nPredictSubjects>0){
+			marginalPrecisionsForMissingPatterns(currentParams,dataset,nContinuousCovs,u,testBound,
+				nThreads,patternSqrtTau,patternLogDetTau);
 		}
-	}
+		// For the predictive subjects we do not count missing data
+		addContinuousPredictLogPXiGivenZi(currentParams,dataset,nContinuousCovs,u,sortedBound,clusterOrder,
+			patternSqrtTau,patternLogDetTau,useIndependentNormal,nThreads,workspace,logPXiGivenZi);
 
-	vector<double> meanVec(nSubjects,0.0);
-	if(includeResponse){
-		if(outcomeType.compare("Poisson")==0){
-			meanVec = dataset.logOffset();
-		}
 	}
+	vector<double>& meanVec = workspace.zMeanVec();
+	if(includeResponse&&outcomeType==outcomePoisson){
+		meanVec = dataset.logOffset();
+	}else{
+		meanVec.assign(nSubjects,0.0);
+	}
+
+	// Keep the previous allocations so the sufficient statistics only need
+	// updating for the subjects that move
+	vector<int>& prevZ = workspace.zPrevZ();
+	prevZ.assign(currentParams.z().begin(),currentParams.z().begin()+nSubjects);
+
+	// Each thread has its own buffers for the allocation probabilities
+	vector<vector<double> >& threadLogPyXz = workspace.zThreadLogPyXz();
+	vector<vector<double> >& threadPzGivenXy = workspace.zThreadPzGivenXy();
+	vector<vector<double> >& threadCumPzGivenXy = workspace.zThreadCumPzGivenXy();
+	vector<vector<double> >& threadExpectedTheta = workspace.zThreadExpectedTheta();
+	threadLogPyXz.resize(nThreads);
+	threadPzGivenXy.resize(nThreads);
+	threadCumPzGivenXy.resize(nThreads);
+	threadExpectedTheta.resize(nThreads);
+	vector<vector<unsigned int> >& threadCandidates = workspace.zThreadCandidates();
+	threadCandidates.resize(nThreads);
 
 	unsigned int maxZ=0;
-	for(unsigned int i=0;i<nSubjects+nPredictSubjects;i++){
-
-		vector<double> logPyXz(maxNClusters,0.0);
-		// We calculate p(Z=c|y,X) \propto p(y,X,Z=c)
-		// p(y,X,z=c) = p(y|Z=c)p(X|z=c)p(z=c)
-		double maxLogPyXz = -(numeric_limits<double>::max());
+	for(unsigned int pass=0;pass<2;pass++){
+		// The fitting subjects are conditionally independent given the parameters
+		// so are allocated in parallel in the first pass. The prediction subjects
+		// can only join clusters with fitting members, and may use the random
+		// number generator, so they are allocated in serial in the second pass.
+		unsigned int iStart = (pass==0) ? 0 : nSubjects;
+		unsigned int iEnd = (pass==0) ? nSubjects : nSubjects+nPredictSubjects;
+		#pragma omp parallel for num_threads(nThreads) schedule(static) if(pass==0)
+		for(unsigned int i=iStart;i<iEnd;i++){
+
+#ifdef _OPENMP
+			unsigned int thread = omp_get_thread_num();
+#else
+			unsigned int thread = 0;
+#endif
+			// The clusters subject i can be allocated to, in increasing order
+			// so that the probabilities are summed in the same order as over
+			// all the clusters. If u_i (which is kept away from 0) is above all
+			// the bounds, every cluster is equally likely.
+			vector<unsigned int>& candidates = threadCandidates[thread];
+			unsigned int nCandidates = nSliceCandidates(u[i],sortedBound);
+			bool anyCandidate = nCandidates>0;
+			if(!anyCandidate){
+				nCandidates = maxNClusters;
+			}
+			candidates.resize(nCandidates);
+			for(unsigned int k=0;k<nCandidates;k++){
+				candidates[k] = anyCandidate?clusterOrder[k]:k;
+			}
+			if(!boundsInIndexOrder){
+				std::sort(candidates.begin(),candidates.end());
+			}
 
-		if(includeResponse&&i<nSubjects){
-			// Response only included in allocation probs for fitting subjects, not predicting subjects
-			if(responseExtraVar){
-				// In this case the Y only go into this conditional
-				// through lambda
-				for(unsigned int c=0;c<maxNClusters;c++){
-					if(u[i]<testBound[c]){
+			// The probabilities are only kept for the candidate clusters, at
+			// the position of the cluster in candidates
+			vector<double>& logPyXz = threadLogPyXz[thread];
+			logPyXz.assign(nCandidates,0.0);
+			// We calculate p(Z=c|y,X) \propto p(y,X,z=c)
+			// p(y,X,z=c) = p(y|Z=c)p(X|z=c)p(z=c)
+			double maxLogPyXz = -(numeric_limits<double>::max());
+
+			if(includeResponse&&i<nSubjects&&anyCandidate){
+				// Response only included in allocation probs for fitting subjects, not predicting subjects
+				if(responseExtraVar){
+					// In this case the Y only go into this conditional
+					// through lambda
+					for(unsigned int k=0;k<nCandidates;k++){
+						unsigned int c = candidates[k];
 						double meanVal=meanVec[i]+currentParams.theta(c,0);
-						for(unsigned int j=0;j<nFixedEffects;j++){
-							meanVal+=currentParams.beta(j,0)*dataset.W(i,j);
-						}
+						meanVal+=currentParams.workLinearPredictor(i,0);
 
-						logPyXz[c]+=logPdfNormal(currentParams.lambda(i),meanVal,
+						logPyXz[k]+=logPdfNormal(currentParams.lambda(i),meanVal,
 													1/sqrt(currentParams.tauEpsilon()));
 					}
-				}
-			}else{
-				// In this case the Y go in directly
-				for(unsigned int c=0;c<maxNClusters;c++){
-					if(u[i]<testBound[c]){
-						logPyXz[c]+=logPYiGivenZiWi(currentParams,dataset,nFixedEffects,c,i);
+				}else{
+					// In this case the Y go in directly
+					for(unsigned int k=0;k<nCandidates;k++){
+						logPyXz[k]+=logPYiGivenZiWi(currentParams,dataset,nFixedEffects,candidates[k],i);
 					}
 				}
 			}
-		}
 
-		for(unsigned int c=0;c<maxNClusters;c++){
-			if(u[i]<testBound[c]){
-				// Make sure prediction subjects can only be allocated to one
-				// of the non-empty clusters
-				if(i<nSubjects||nMembers[c]>0){
-					logPyXz[c]+=clusterWeight[c];
-					logPyXz[c]+=logPXiGivenZi[i][c];
+			for(unsigned int k=0;k<nCandidates;k++){
+				unsigned int c = candidates[k];
+				if(anyCandidate){
+					// Make sure prediction subjects can only be allocated to one
+					// of the non-empty clusters
+					if(i<nSubjects||nMembers[c]>0){
+						logPyXz[k]+=clusterWeight[c];
+						logPyXz[k]+=logPXiGivenZi[i][c];
+					}else{
+						logPyXz[k]=-(numeric_limits<double>::max());
+					}
 				}else{
-					logPyXz[c]=-(numeric_limits<double>::max());
+					logPyXz[k]=-(numeric_limits<double>::max());
+				}
+				if(logPyXz[k]>maxLogPyXz){
+					maxLogPyXz=logPyXz[k];
 				}
-			}else{
-				logPyXz[c]=-(numeric_limits<double>::max());
-			}
-			if(logPyXz[c]>maxLogPyXz){
-				maxLogPyXz=logPyXz[c];
 			}
-		}
-		vector<double> pzGivenXy(maxNClusters);
-		double sumVal=0;
-		for(unsigned int c=0;c<maxNClusters;c++){
-			double exponent = logPyXz[c] - maxLogPyXz;
-			// Check for negative infinity (can only be negative)
-			if(std::isinf(exponent)||std::isnan(exponent)){
-				exponent=-(numeric_limits<double>::max());
+			vector<double>& pzGivenXy = threadPzGivenXy[thread];
+			pzGivenXy.resize(nCandidates);
+			double sumVal=0;
+			for(unsigned int k=0;k<nCandidates;k++){
+				double exponent = logPyXz[k] - maxLogPyXz;
+				// Check for negative infinity (can only be negative)
+				if(std::isinf(exponent)||std::isnan(exponent)){
+					exponent=-(numeric_limits<double>::max());
+				}
+				pzGivenXy[k]=exp(exponent);
+				sumVal+=pzGivenXy[k];
 			}
-			pzGivenXy[c]=exp(exponent);
-			sumVal+=pzGivenXy[c];
-		}
 
-		vector<double> expectedTheta(nCategoriesY);
-		double entropyVal=0.0;
-		vector<double> cumPzGivenXy(maxNClusters);
-		for(unsigned int c=0;c<maxNClusters;c++){
-			pzGivenXy[c]/=sumVal;
-			if(computeEntropy){
-				if(pzGivenXy[c]>0){
-					entropyVal-=pzGivenXy[c]*log(pzGivenXy[c]);
+			vector<double>& expectedTheta = threadExpectedTheta[thread];
+			expectedTheta.assign(nCategoriesY,0.0);
+			double entropyVal=0.0;
+			vector<double>& cumPzGivenXy = threadCumPzGivenXy[thread];
+			cumPzGivenXy.resize(nCandidates);
+			for(unsigned int k=0;k<nCandidates;k++){
+				unsigned int c = candidates[k];
+				pzGivenXy[k]/=sumVal;
+				if(computeEntropy){
+					if(pzGivenXy[k]>0){
+						entropyVal-=pzGivenXy[k]*log(pzGivenXy[k]);
+					}
 				}
-			}
 
-			if(c==0){
-				cumPzGivenXy[c]=pzGivenXy[c];
-			}else{
-				cumPzGivenXy[c]=cumPzGivenXy[c-1]+pzGivenXy[c];
-			}
-			if (predictType.compare("RaoBlackwell")==0){
-				if(includeResponse&&i>=nSubjects){
-					if(outcomeType.compare("Categorical")==0){
-						for (unsigned int k=0;k<nCategoriesY;k++){
-							expectedTheta[k]+=currentParams.theta(c,k)*pzGivenXy[c];
+				if(k==0){
+					cumPzGivenXy[k]=pzGivenXy[k];
+				}else{
+					cumPzGivenXy[k]=cumPzGivenXy[k-1]+pzGivenXy[k];
+				}
+				if(raoBlackwellPredict){
+					if(includeResponse&&i>=nSubjects){
+						if(outcomeType==outcomeCategorical){
+							for (unsigned int m=0;m<nCategoriesY;m++){
+								expectedTheta[m]+=currentParams.theta(c,m)*pzGivenXy[k];
+							}
+						} else {
+							expectedTheta[0]+=currentParams.theta(c,0)*pzGivenXy[k];
 						}
-					} else {
-						expectedTheta[0]+=currentParams.theta(c,0)*pzGivenXy[c];
 					}
 				}
 			}
-		}
-		if(includeResponse&&i>=nSubjects){
-			if (predictType.compare("random")==0){
-				// choose which component of the mixture we are sampling from
-				double u=unifRand(rndGenerator);
-				unsigned int c=0;
-				while(cumPzGivenXy[c]<=u){
-					c++;	
+			if(includeResponse&&i>=nSubjects){
+				if(randomPredict){
+					// choose which component of the mixture we are sampling from
+					double uComponent=unifRand(rndGenerator);
+					unsigned int k=0;
+					while(k+1<nCandidates&&cumPzGivenXy[k]<=uComponent){
+						k++;	
+					}
+					unsigned int c=candidates[k];
+					if(outcomeType==outcomeQuantile){
+						// draw from the ALD distribution (Yu et al, 2005)
+						// X1, X2 distributed Exp(1) then X1/p-X2/(1-p) has ALD(0,1;p)
+						// if X distr ALD(0,1;p) then mu+sigma X has distribution ALD(mu,sigma;p)  
+						double u1=unifRand(rndGenerator);
+						double u2=unifRand(rndGenerator);
+						double EXP1 = -log(u1);
+						double EXP2 = -log(u2);
+						double r= EXP1/hyperParams.pQuantile()-EXP2/(1-hyperParams.pQuantile());
+						expectedTheta[0]=currentParams.sigmaSqY()*r+currentParams.theta(c,0);
+						// line below should be a mistake because sigmaSqY is not a square for the ALD					
+						//expectedTheta[0]=sqrt(currentParams.sigmaSqY())*r+currentParams.theta(c,0);
+					}else{ 
+						// draw from the normal distribution of that sample (only for yModel=Normal)
+						// Create a normal random generator
+						randomNormal normRand(0,1);
+						expectedTheta[0]=sqrt(currentParams.sigmaSqY())*normRand(rndGenerator)+currentParams.theta(c,0);
+					}
 				}
-				if(outcomeType.compare("Quantile")==0){
-					// draw from the ALD distribution (Yu et al, 2005)
-					// X1, X2 distributed Exp(1) then X1/p-X2/(1-p) has ALD(0,1;p)
-					// if X distr ALD(0,1;p) then mu+sigma X has distribution ALD(mu,sigma;p)  
-					double u1=unifRand(rndGenerator);
-					double u2=unifRand(rndGenerator);
-					double EXP1 = -log(u1);
-					double EXP2 = -log(u2);
-					double r= EXP1/hyperParams.pQuantile()-EXP2/(1-hyperParams.pQuantile());
-					expectedTheta[0]=currentParams.sigmaSqY()*r+currentParams.theta(c,0);
-					// line below should be a mistake because sigmaSqY is not a square for the ALD					
-					//expectedTheta[0]=sqrt(currentParams.sigmaSqY())*r+currentParams.theta(c,0);
-				}else{ 
-					// draw from the normal distribution of that sample (only for yModel=Normal)
-					// Create a normal random generator
-					randomNormal normRand(0,1);
-					expectedTheta[0]=sqrt(currentParams.sigmaSqY())*normRand(rndGenerator)+currentParams.theta(c,0);
+			}		
+			unsigned int zi;
+
+			if(maxNClusters==1){
+				zi=0;
+			}else{
+				zi = 0;
+				for(unsigned int k=0;k<nCandidates;k++){
+					if(rnd[i]<cumPzGivenXy[k]){
+						zi=candidates[k];
+						break;
+					}
 				}
 			}
-		}		
-		unsigned int zi;
+			if(i>=nSubjects&&zi>maxZ){
+				maxZ=zi;
+			}
 
-		if(maxNClusters==1){
-			zi=0;
-		}else{
-			zi = 0;
-			for(unsigned int c=0;c<maxNClusters;c++){
-				if(rnd[i]<cumPzGivenXy[c]){
-					zi=c;
-					break;
+
+			currentParams.z(i, zi, covariateType, useIndependentNormal);
+			if(computeEntropy){
+				currentParams.workEntropy(i,entropyVal);
+			}
+			if(i>=nSubjects){
+				if(includeResponse){
+					for (unsigned int k=0;k<nCategoriesY;k++){
+						currentParams.workPredictExpectedTheta(i-nSubjects,k,expectedTheta[k]);
+					}
 				}
 			}
 		}
-		if(zi>maxZ){
-			maxZ=zi;
-		}
 
-
-		currentParams.z(i, zi, covariateType, useIndependentNormal);
-		if(computeEntropy){
-			currentParams.workEntropy(i,entropyVal);
-		}
-		if(i<nSubjects){
-			nMembers[zi]++;
-		}else{
-			if(includeResponse){
-				for (unsigned int k=0;k<nCategoriesY;k++){
-					currentParams.workPredictExpectedTheta(i-nSubjects,k,expectedTheta[k]);
+		if(pass==0){
+			for(unsigned int i=0;i<nSubjects;i++){
+				unsigned int zi = currentParams.z(i);
+				nMembers[zi]++;
+				clusterMembers[zi].push_back(i);
+				if(zi>maxZ){
+					maxZ=zi;
 				}
 			}
 		}
 	}
 
+	// The sufficient statistics are only updated for the subjects that move,
+	// so they are rebuilt from the cluster members every
+	// sufficientStatsRebuildEvery sweeps to stop the rounding errors from
+	// building up
+	bool rebuildSufficientStats = nTry%sufficientStatsRebuildEvery==0;
+	if(currentParams.workNSuffStatCovs()>0&&!rebuildSufficientStats){
+		for(unsigned int i=0;i<nSubjects;i++){
+			int zi=currentParams.z(i);
+			if(zi!=prevZ[i]){
+				currentParams.workRemoveSufficientStats(i,prevZ[i],useIndependentNormal);
+				currentParams.workAddSufficientStats(i,zi,useIndependentNormal);
+			}
+		}
+	}
+
 	currentParams.workNXInCluster(nMembers);
+	currentParams.workClusterMembers(clusterMembers);
 	currentParams.workMaxZi(maxZ);
+	if(rebuildSufficientStats){
+		currentParams.workSufficientStats(useIndependentNormal);
+	}
 }
 
 
@@ -4698,8 +5670,9 @@ void updateMissingPReMiuMData(baseGeneratorType& rndGenerator,
 	unsigned int nCovariates = dataset.nCovariates();
 	unsigned int nDiscreteCovs = dataset.nDiscreteCovs();
 	unsigned int nContinuousCovs = dataset.nContinuousCovs();
-	vector<unsigned int> nCategories = params.nCategories();
+	const vector<unsigned int>& nCategories = dataset.nCategories();
 	string covariateType = options.covariateType();
+	bool useIndependentNormal = options.useIndependentNormal();
 
 	// Define a uniform random number generator
 	randomUniform unifRand(0,1);
@@ -4746,6 +5719,7 @@ void updateMissingPReMiuMData(baseGeneratorType& rndGenerator,
 			// Check if there is anything to do
 			if(dataset.nContinuousCovariatesNotMissing(i)<nCovariates){
 				int zi = params.z(i);
+				params.workRemoveSufficientStats(i,zi,useIndependentNormal);
 				VectorXd newXi=multivarNormalRand(rndGenerator,params.workMuStar(zi),params.Sigma(zi));
 				for(unsigned int j=0;j<nCovariates;j++){
 					if(dataset.missingX(i,j)){
@@ -4755,6 +5729,7 @@ void updateMissingPReMiuMData(baseGeneratorType& rndGenerator,
 						newXi(j)=dataset.continuousX(i,j);
 					}
 				}
+				params.workAddSufficientStats(i,zi,useIndependentNormal);
 				double logVal = logPdfMultivarNormal(nCovariates,newXi,params.workMuStar(zi),params.workSqrtTau(zi),params.workLogDetTau(zi));
 				params.workLogPXiGivenZi(i,logVal);
 			}
@@ -4801,6 +5776,7 @@ void updateMissingPReMiuMData(baseGeneratorType& rndGenerator,
 			// Check if there is anything to do
 			if(dataset.nContinuousCovariatesNotMissing(i)<nContinuousCovs){
 				int zi = params.z(i);
+				params.workRemoveSufficientStats(i,zi,useIndependentNormal);
 				VectorXd newXi=multivarNormalRand(rndGenerator,params.workMuStar(zi),params.Sigma(zi));
 				for(unsigned int j=0;j<nContinuousCovs;j++){
 					if(dataset.missingX(i,nDiscreteCovs+j)){
@@ -4810,6 +5786,7 @@ void updateMissingPReMiuMData(baseGeneratorType& rndGenerator,
 						newXi(j)=dataset.continuousX(i,j);
 					}
 				}
+				params.workAddSufficientStats(i,zi,useIndependentNormal);
 				double logVal = logPdfMultivarNormal(nContinuousCovs,newXi,params.workMuStar(zi),params.workSqrtTau(zi),params.workLogDetTau(zi));
 				params.workLogPXiGivenZi(i,logVal);
 			}
@@ -4822,4 +5799,105 @@ void updateMissingPReMiuMData(baseGeneratorType& rndGenerator,
 }
 
 
+/// \brief The type of the proposal functions added to the sampler
+typedef void (*pReMiuMProposalFn)(mcmcChain<pReMiuMParams>&,unsigned int&,unsigned int&,
+		const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>&,
+		pReMiuMPropParams&,baseGeneratorType&);
+
+/// \brief The proposals that evaluate the response density for each subject,
+/// instantiated for one density
+class pReMiuMResponseProposals{
+
+	public:
+		/// \brief Default constructor
+		pReMiuMResponseProposals() : _zProposal(NULL), _thetaProposal(NULL),
+			_betaProposal(NULL) {};
+
+		/// \brief Member function to set the proposals to the instantiations for
+		/// the density logPYiGivenZiWi, the update of the allocations using
+		/// logPYiGivenZiWiForZ
+		template<pReMiuMLogPYiGivenZiWi logPYiGivenZiWi,
+				pReMiuMLogPYiGivenZiWi logPYiGivenZiWiForZ=logPYiGivenZiWi>
+		void instantiate(){
+			_zProposal = &gibbsForZ<logPYiGivenZiWiForZ>;
+			_thetaProposal = &metropolisHastingsForThetaActive<logPYiGivenZiWi>;
+			_betaProposal = &metropolisHastingsForBeta<logPYiGivenZiWi>;
+		}
+
+		/// \brief Return the update for the allocations
+		pReMiuMProposalFn zProposal() const{
+			return _zProposal;
+		}
+
+		/// \brief Return the update for the active theta
+		pReMiuMProposalFn thetaProposal() const{
+			return _thetaProposal;
+		}
+
+		/// \brief Return the update for beta
+		pReMiuMProposalFn betaProposal() const{
+			return _betaProposal;
+		}
+
+	private:
+		pReMiuMProposalFn _zProposal;
+		pReMiuMProposalFn _thetaProposal;
+		pReMiuMProposalFn _betaProposal;
+
+};
+
+// Chooses the response density from the options, once when the proposals are
+// added. With extra variation in the response the density is the one of the
+// response given lambda (gibbsForZ and the theta update then do not use it).
+pReMiuMResponseProposals responseProposals(const pReMiuMOptions& options){
+
+	pReMiuMResponseProposals proposals;
+	bool responseExtraVar=options.responseExtraVar();
+	bool includeCAR=options.includeCAR();
+	switch(options.outcomeTypeId()){
+		case outcomeBernoulli:
+			if(responseExtraVar){
+				proposals.instantiate<&logPYiGivenZiWiBernoulliExtraVar>();
+			}else{
+				proposals.instantiate<&logPYiGivenZiWiBernoulli>();
+			}
+			break;
+		case outcomeBinomial:
+			if(responseExtraVar){
+				proposals.instantiate<&logPYiGivenZiWiBinomialExtraVar>();
+			}else{
+				proposals.instantiate<&logPYiGivenZiWiBinomial>();
+			}
+			break;
+		case outcomePoisson:
+			if(responseExtraVar){
+				proposals.instantiate<&logPYiGivenZiWiPoissonExtraVar>();
+			}else if(includeCAR){
+				proposals.instantiate<&logPYiGivenZiWiPoissonSpatial>();
+			}else{
+				proposals.instantiate<&logPYiGivenZiWiPoisson>();
+			}
+			break;
+		case outcomeNormal:
+			// The allocations use the Normal density without the spatial
+			// effects, as they always have
+			if(includeCAR){
+				proposals.instantiate<&logPYiGivenZiWiNormalSpatial,&logPYiGivenZiWiNormal>();
+			}else{
+				proposals.instantiate<&logPYiGivenZiWiNormal>();
+			}
+			break;
+		case outcomeCategorical:
+			proposals.instantiate<&logPYiGivenZiWiCategorical>();
+			break;
+		case outcomeQuantile:
+			proposals.instantiate<&logPYiGivenZiWiQuantile>();
+			break;
+		case outcomeSurvival:
+			proposals.instantiate<&logPYiGivenZiWiSurvival>();
+			break;
+	}
+	return proposals;
+}
+
 #endif /* DIPBACPROPOSALS_H_ */
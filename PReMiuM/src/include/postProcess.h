@@ -10,16 +10,16 @@ double Gamma(double);
 //RcppExport SEXP profRegr(SEXP input, SEXP output, SEXP hyper, SEXP predict, SEXP nSweeps, SEXP nBurn, SEXP nProgress, SEXP nFilter, SEXP nClusInit, 	SEXP seed, SEXP yModel, SEXP xModel, SEXP sampler, SEXP alpha, SEXP excludeY, SEXP extraYVar, SEXP varSelect, SEXP entropy);
 RcppExport SEXP profRegr(SEXP inputString);
 
-RcppExport SEXP calcDisSimMat(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects, SEXP onlyLS);
+RcppExport SEXP calcDisSimMat(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects, SEXP onlyLS, SEXP nThreads, SEXP compact);
+RcppExport SEXP calcApproxLSSweep(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects, SEXP pairI, SEXP pairJ, SEXP nThreads);
 
-RcppExport SEXP pYGivenZW(SEXP betaIn,SEXP thetaIn,SEXP zAlloc,SEXP sigmaBeta,
-		SEXP sigmaTheta, SEXP dofTheta, SEXP dofBeta, SEXP nSubjects,
-		SEXP yMat,SEXP betaW,SEXP nFixedEffects,SEXP nNames,SEXP constants,
-		SEXP maxnNames);
+RcppExport SEXP calcAvgRiskProfile(SEXP traces, SEXP settings, SEXP nThreads);
 
-RcppExport SEXP GradpYGivenZW(SEXP betaIn,SEXP thetaIn,SEXP zAlloc, SEXP nSubjects,
-		SEXP betaW,SEXP yMat, SEXP nFixedEffects,SEXP nNames,SEXP maxnNames);
+RcppExport SEXP scoreSubjects(SEXP traces, SEXP settings, SEXP newDataFile, SEXP outFile, SEXP blockSize, SEXP nThreads);
 
-RcppExport SEXP pZpX(SEXP nClusters, SEXP nCategories,SEXP aPhi, SEXP n,SEXP nCovariates,SEXP zAlloc, SEXP xMat, SEXP nNames,SEXP alpha);
+RcppExport SEXP calcPAMClustering(SEXP disSimMat, SEXP nSubjects, SEXP maxNClusters, SEXP nThreads);
+RcppExport SEXP compactDisSimCounts(SEXP disSimMat);
+
+RcppExport SEXP margModPosterior(SEXP zTrace, SEXP allocations, SEXP settings, SEXP nThreads);
 
 #endif
@@ -8,10 +8,14 @@
 
 static const R_CallMethodDef R_CallDef[] = {
    CALLDEF(profRegr, 1),
-   CALLDEF(calcDisSimMat, 7),
-   CALLDEF(pZpX, 10),
-   CALLDEF(pYGivenZW, 14),
-   CALLDEF(GradpYGivenZW, 9),
+   CALLDEF(profRegrData, 2),
+   CALLDEF(calcDisSimMat, 9),
+   CALLDEF(calcApproxLSSweep, 9),
+   CALLDEF(calcAvgRiskProfile, 3),
+   CALLDEF(scoreSubjects, 6),
+   CALLDEF(calcPAMClustering, 4),
+   CALLDEF(compactDisSimCounts, 1),
+   CALLDEF(margModPosterior, 4),
    {NULL, NULL, 0}
 };
 
@@ -6,17 +6,268 @@
 #include <sstream>
 #include <cmath>
 #include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
 
 #include "include/postProcess.h"
+#include "include/MCMC/compressedStream.h"
 #include <Rcpp.h>
 
 using std::string;
-using std::ifstream;
+using std::istream;
 using std::vector;
 
-SEXP calcDisSimMat(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects,SEXP onlyLS){
+// Read the allocations of one sweep from either a text or a binary z file,
+// which may be gzip compressed. In a delta encoded file (_zDelta) each sweep
+// only lists the subjects whose allocation changed, as a count followed by
+// the index and new allocation of each of them (see MCMC/output.h for the
+// layout of the binary records)
+static void readZSweep(istream& zFile,const bool& binaryFile,const bool& deltaFile,vector<int>& clusterData){
+	vector<int> values;
+	if(binaryFile){
+		unsigned char lenBytes[4];
+		zFile.read((char*)lenBytes,4);
+		unsigned int nVals=lenBytes[0]|(lenBytes[1]<<8)|(lenBytes[2]<<16)|((unsigned int)lenBytes[3]<<24);
+		if(!zFile||(!deltaFile&&nVals!=clusterData.size())){
+			throw std::runtime_error("Unexpected record in binary allocation file");
+		}
+		vector<unsigned char> bytes(4*nVals);
+		if(nVals>0){
+			zFile.read((char*)&(bytes[0]),bytes.size());
+		}
+		values.resize(nVals);
+		for(unsigned int i=0;i<nVals;i++){
+			unsigned int uintVal=bytes[4*i]|(bytes[4*i+1]<<8)|(bytes[4*i+2]<<16)|((unsigned int)bytes[4*i+3]<<24);
+			values[i]=(int)uintVal;
+		}
+		if(!deltaFile){
+			clusterData.swap(values);
+			return;
+		}
+	}else if(!deltaFile){
+		for(unsigned long int i=0;i<clusterData.size();i++){
+			zFile >> clusterData[i];
+		}
+		return;
+	}else{
+		int nChanged=0;
+		zFile >> nChanged;
+		values.resize(1+2*(nChanged>0?nChanged:0));
+		values[0]=nChanged;
+		for(unsigned long int j=1;j<values.size();j++){
+			zFile >> values[j];
+		}
+	}
+	if(values.size()==0||values.size()!=(unsigned long int)(1+2*values[0])){
+		throw std::runtime_error("Unexpected record in delta encoded allocation file");
+	}
+	for(unsigned long int j=1;j<values.size();j+=2){
+		if(values[j]<0||(unsigned long int)values[j]>=clusterData.size()){
+			throw std::runtime_error("Unexpected subject in delta encoded allocation file");
+		}
+		clusterData[values[j]]=values[j+1];
+	}
+}
+
+// Open an allocation trace file, returning whether it is a binary file (its
+// header is then checked and skipped, integerValues is set to whether the
+// file holds int32 values). Binary files are recognised by their header,
+// compressed files are decompressed as they are read.
+static bool openZFile(const string& fName,gzipInputBuffer& zBuffer,istream& zFile,
+		bool* integerValues=NULL){
+	if(!zBuffer.open(fName)){
+		throw std::runtime_error("Unable to open the trace file "+fName);
+	}
+	char magic[8]={0};
+	zFile.read(magic,8);
+	bool binaryFile = zFile&&string(magic,8).compare("PReMiuMB")==0;
+	zFile.clear();
+	if(binaryFile){
+		unsigned char header[24]={0};
+		zFile.read((char*)header,24);
+		// The format version and the value type, see MCMC/output.h
+		unsigned int version=header[0]|(header[1]<<8)|(header[2]<<16)|((unsigned int)header[3]<<24);
+		unsigned int valueType=header[4]|(header[5]<<8)|(header[6]<<16)|((unsigned int)header[7]<<24);
+		if(!zFile||version!=1){
+			throw std::runtime_error(fName+" is not a binary PReMiuM trace file");
+		}
+		if(integerValues){
+			*integerValues = valueType==0;
+		}
+	}else{
+		zBuffer.open(fName);
+	}
+	return binaryFile;
+}
+
+// Count the number of sweeps in which each pair is in the same cluster, in
+// the rows of the dissimilarity matrix (see calcDisSimMat). The dense
+// sweeps compare the labels of all the pairs, the grouped sweeps only visit
+// the pairs within each cluster.
+template<class Count>
+static void countCoClustering(const vector<int>& allocations,const unsigned long int& nAlloc,
+		const unsigned long int& nSj,const vector<unsigned long int>& denseSweeps,
+		const vector<unsigned long int>& groupedSweeps,const vector<unsigned long int>& tileStart,
+		const int& nThr,vector<Count>& coClustered){
+    long int nTiles = tileStart.size()-1;
+    vector<unsigned long int> labelCount;
+    unsigned long int nDense = denseSweeps.size();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThr) schedule(dynamic)
+#endif
+    for(long int tile=0;tile<nTiles;tile++){
+    	for(unsigned long int k=0;k<nDense;k++){
+    		const int* z = &(allocations[denseSweeps[k]*nAlloc]);
+    		for(unsigned long int t=tileStart[tile];t<tileStart[tile+1];t++){
+    			if(t<nSj-1){
+    				unsigned long int r = t*(nSj-1)-(t*(t-1))/2;
+    				Count* counts = &(coClustered[r]);
+    				int zi = z[t];
+    				for(unsigned long int ii=t+1;ii<nSj;ii++){
+    					counts[ii-t-1]+=(z[ii]==zi);
+    				}
+    			}else{
+    				unsigned long int i = t-(nSj-1);
+    				Count* counts = &(coClustered[(nSj*(nSj-1))/2+i*nSj]);
+    				int zi = z[nSj+i];
+    				for(unsigned long int ii=0;ii<nSj;ii++){
+    					counts[ii]+=(z[ii]==zi);
+    				}
+    			}
+    		}
+    	}
+    }
+
+    // For the grouped sweeps the fitting subjects are sorted by label (and
+    // by index within each label), so the partners of each row are the
+    // subjects that follow it in its cluster
+    vector<unsigned long int> clusterStart,order(nSj),position(nSj);
+    for(unsigned long int k=0;k<groupedSweeps.size();k++){
+    	const int* z = &(allocations[groupedSweeps[k]*nAlloc]);
+    	unsigned long int nLabels=0;
+    	for(unsigned long int i=0;i<nAlloc;i++){
+    		if((unsigned long int)z[i]+1>nLabels){
+    			nLabels=z[i]+1;
+    		}
+    	}
+    	clusterStart.assign(nLabels+1,0);
+    	for(unsigned long int i=0;i<nSj;i++){
+    		clusterStart[z[i]+1]++;
+    	}
+    	for(unsigned long int c=0;c<nLabels;c++){
+    		clusterStart[c+1]+=clusterStart[c];
+    	}
+    	labelCount.assign(clusterStart.begin(),clusterStart.end()-1);
+    	for(unsigned long int i=0;i<nSj;i++){
+    		position[i]=labelCount[z[i]]++;
+    		order[position[i]]=i;
+    	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThr) schedule(dynamic)
+#endif
+    	for(long int tile=0;tile<nTiles;tile++){
+    		for(unsigned long int t=tileStart[tile];t<tileStart[tile+1];t++){
+    			if(t<nSj-1){
+    				unsigned long int r = t*(nSj-1)-(t*(t-1))/2;
+    				Count* counts = &(coClustered[r]);
+    				unsigned long int qEnd = clusterStart[z[t]+1];
+    				for(unsigned long int q=position[t]+1;q<qEnd;q++){
+    					counts[order[q]-t-1]++;
+    				}
+    			}else{
+    				unsigned long int i = t-(nSj-1);
+    				Count* counts = &(coClustered[(nSj*(nSj-1))/2+i*nSj]);
+    				int zi = z[nSj+i];
+    				for(unsigned long int q=clusterStart[zi];q<clusterStart[zi+1];q++){
+    					counts[order[q]]++;
+    				}
+    			}
+    		}
+    	}
+    }
+}
+
+// The index (from 1) of the sweep whose partition is closest in least
+// squares to the dissimilarity matrix, disSim[r] being the dissimilarity
+// of pair r of the fitting subjects
+template<class Values>
+static int lsOptimalSweep(const vector<int>& allocations,const unsigned long int& nAlloc,
+		const unsigned long int& nSj,const unsigned long int& nSamples,const unsigned long int& kMin,
+		const int& nThr,const Values& disSim){
+    // The sweeps are processed in blocks of 1000, with the sweeps of each
+    // block in parallel
+    vector<double> sumSq(nSamples,0.0);
+    for(unsigned long int block=0;block<nSamples;block+=1000){
+    	Rprintf("Stage 2:%i samples out of %i\n",(int)(block+1),(int)nSamples);
+    	long int blockEnd = block+1000<nSamples?block+1000:nSamples;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThr) schedule(static)
+#endif
+    	for(long int s=block;s<blockEnd;s++){
+    		const int* z = &(allocations[s*nAlloc]);
+    		double tmpSum=0.0;
+    		unsigned long int r=0;
+    		for(unsigned long int i=0;i+1<nSj;i++){
+    			int zi = z[i];
+    			for(unsigned long int ii=i+1;ii<nSj;ii++){
+    				double d = z[ii]==zi?disSim[r]:1.0-disSim[r];
+    				tmpSum+=d*d;
+    				r++;
+    			}
+    		}
+    		sumSq[s]=tmpSum;
+    	}
+    }
+    int minIndex=0;
+    double currMinSum=nSj*(nSj-1)/2.0;
+    for(unsigned long int s=0;s<nSamples;s++){
+    	if(sumSq[s]<currMinSum){
+    		minIndex=s+kMin;
+    		currMinSum=sumSq[s];
+    	}
+    }
+    return minIndex;
+}
+
+// Accessor of the dissimilarities of a compact dissimilarity matrix
+struct coClusteringValues{
+	const uint16_t* coClustered;
+	double denom;
+	/// \brief Return the dissimilarity of pair r
+	double operator[](const unsigned long int& r) const{
+		return (denom-(double)coClustered[r])/denom;
+	}
+};
 
-    string fName = Rcpp::as<string>(fileName);
+// The compact dissimilarity matrix of the fitting subjects, holding the
+// number of sweeps in which each pair is in the same cluster in 16 bit
+// counters (in the order of the dissimilarities returned by calcDisSimMat).
+// It is kept by R as an external pointer, a quarter of the size of the
+// dissimilarities as doubles.
+struct compactDisSimMat{
+	compactDisSimMat(const unsigned long int& n,const double& d) : nSubjects(n), denom(d) {}
+	unsigned long int nSubjects;
+	double denom;
+	vector<uint16_t> coClustered;
+	/// \brief Return the accessor of the dissimilarities
+	coClusteringValues values() const{
+		coClusteringValues v = {coClustered.empty()?NULL:&(coClustered[0]),denom};
+		return v;
+	}
+};
+
+SEXP calcDisSimMat(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects,SEXP onlyLS,SEXP nThreads,SEXP compact){
+
+    // The allocations are read from the trace file, or passed as an integer
+    // vector for traces kept in memory by profRegr
+    bool fromMemory = !Rf_isString(fileName);
+    string fName = fromMemory?string():Rcpp::as<string>(fileName);
 
     unsigned int nS = Rcpp::as<int>(nSweeps);
     unsigned int nB = Rcpp::as<int>(nBurn);
@@ -25,6 +276,11 @@ SEXP calcDisSimMat(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nS
     unsigned int nPSj = Rcpp::as<int>(nPredictSubjects);
 
     bool oLS = Rcpp::as<bool>(onlyLS);
+    bool cmp = Rcpp::as<bool>(compact);
+    int nThr = Rcpp::as<int>(nThreads);
+    if(nThr<1){
+        nThr=1;
+    }
 
     // Calculate how many samples we will have
     unsigned int nLines =  (nS+nB)/nF;
@@ -36,261 +292,2480 @@ SEXP calcDisSimMat(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nS
 
 	// Number of entries in diagonal dissimilarity matrix matrix
 	unsigned long int lengthMat = (nSj*(nSj-1))/2+nPSj*nSj;
-	
-    vector<double> disSimMat(lengthMat,denom);
 
-    // Open the file with sample in
-    ifstream zFile;
-    zFile.open(fName.c_str());
+    // Open the file with sample in, delta encoded files are recognised by
+    // their name
+    gzipInputBuffer zBuffer;
+    istream zFile(&zBuffer);
+    bool binaryFile = false;
+    bool deltaFile = false;
+    unsigned long int nAlloc = nSj+nPSj;
+    Rcpp::IntegerVector zValues;
+    if(fromMemory){
+    	zValues = Rcpp::IntegerVector(fileName);
+    	if((unsigned long int)zValues.size()!=(unsigned long int)nLines*nAlloc){
+    		Rcpp::stop("The allocations kept in memory do not match the number of sweeps and subjects");
+    	}
+    }else{
+    	deltaFile = fName.find("_zDelta.")!=string::npos;
+    	binaryFile = openZFile(fName,zBuffer,zFile);
+    }
 
-    // A temporary vector for storing the cluster from each sweep
-    vector<int> clusterData(nSj+nPSj);
+    // The file is read only once, the allocations of the sweeps after the
+    // burn in are stored (one row per sweep) and used by both stages below
+    unsigned long int kMin = firstLine>1?firstLine:1;
+    unsigned long int nSamples = nLines>=kMin?nLines-kMin+1:0;
+    vector<int> clusterData(nAlloc);
+    vector<int> allocations(nSamples*nAlloc);
     for(unsigned long int k=1;k<=nLines;k++){
-    	if(k<firstLine){
-        	// Ignore the burn in
-    		for(unsigned long int i=0;i<nSj+nPSj;i++){
-    			int tmp=0;
-    			zFile >> tmp;
-    		}
-     	}else{
+    	// Fill up the cluster data for this sweep
+    	if(fromMemory){
+    		std::copy(zValues.begin()+(k-1)*nAlloc,zValues.begin()+k*nAlloc,clusterData.begin());
+    	}else{
+    		readZSweep(zFile,binaryFile,deltaFile,clusterData);
+    	}
+    	if(k>=kMin){
     		if((1+k-firstLine)==1||(1+k-firstLine)%1000==0){
 				Rprintf("Stage 1:%i samples out of %i\n",1+k-firstLine,1+nLines-firstLine);
 			}
-			for(unsigned long int i=0;i<nSj+nPSj;i++){
-    			// Fill up the cluster data for this sweep
-    			zFile >> clusterData[i];
-    		}
-    		// Now we need to populate the dissimilarity matrix
-    		unsigned long int r=0;
-		for(unsigned long int i=0;i<nSj-1;i++){
-    			for(unsigned long int ii=i+1;ii<nSj;ii++){
-    				if(clusterData[i]==clusterData[ii]){
-        				disSimMat[r]-=1.0;
-        			}
-    				r++;
-    			}
-    		}
-		for(unsigned long int i=0;i<nPSj;i++){
-			for(unsigned long int ii=0;ii<nSj;ii++){
-				if(clusterData[nSj+i]==clusterData[ii]){
-					disSimMat[r]-=1.0;
-				}
-				r++;
-			}
-		}
+    		std::copy(clusterData.begin(),clusterData.end(),allocations.begin()+(k-kMin)*nAlloc);
     	}
     }
-	for (unsigned long int i=0;i<lengthMat;i++) disSimMat[i] /= denom;
-	
+    zBuffer.close();
 
-    // Computing the optimal partition for least squares method 
-    // Could make these steps optional as only relevant for R option useLS=T
-    // Cheaper (for large datasets) to re-read everything in again, instead
-    // of storing things
-    zFile.seekg(0,std::ios::beg);
-    int minIndex=0;
-    double currMinSum=nSj*(nSj-1)/2.0;
-    for(unsigned long int k=1;k<=nLines;k++){
-    	if(k<firstLine){
-    		// Ignore the burn in
-    		for(unsigned long int i=0;i<nSj+nPSj;i++){
-    			int tmp=0;
-    			zFile >> tmp;
-        	}
-        }else{
-        	if((1+k-firstLine)==1||(1+k-firstLine)%1000==0){
-			Rprintf("Stage 2:%i samples out of %i\n",1+k-firstLine,1+nLines-firstLine);
-    		}
-        	for(unsigned long int i=0;i<nSj+nPSj;i++){
-        		// Fill up the cluster data for this sweep
-        		zFile >> clusterData[i];
-        	}
-        	double tmpSum=0.0;
-    		unsigned long int r=0;
-			for(unsigned long int i=0;i<nSj-1;i++){
-    			for(unsigned long int ii=i+1;ii<nSj;ii++){
-    				if(clusterData[i]==clusterData[ii]){
-        				tmpSum+=pow(disSimMat[r],2.0);
-        			}else{
-        				tmpSum+=pow(1.0-disSimMat[r],2.0);
-        			}
-    				r++;
-    			}
+    // Rows of the dissimilarity matrix: row i<nSj-1 holds the pairs (i,ii)
+    // with ii>i, row nSj-1+i holds the pairs of prediction subject i with
+    // every fitting subject. The rows are grouped into tiles of roughly
+    // tileSize pairs, which are counted independently of each other.
+    unsigned long int nRows = (nSj>0?nSj-1:0)+nPSj;
+    const unsigned long int tileSize = 32768;
+    vector<unsigned long int> tileStart(1,0);
+    unsigned long int tilePairs=0;
+    for(unsigned long int t=0;t<nRows;t++){
+    	tilePairs+=t<nSj-1?nSj-1-t:nSj;
+    	if(tilePairs>=tileSize||t==nRows-1){
+    		tileStart.push_back(t+1);
+    		tilePairs=0;
+    	}
+    }
+
+    // The sweeps are counted either densely, comparing the labels of all the
+    // pairs, or by grouping the subjects by label and visiting only the pairs
+    // within each cluster. The grouped path costs roughly the sum of the
+    // squared cluster sizes, but its memory access is scattered, so it is
+    // only used when that sum is well below the number of pairs
+    const double groupedCostRatio = 8.0;
+    vector<unsigned long int> denseSweeps,groupedSweeps;
+    vector<unsigned long int> labelCount;
+    for(unsigned long int s=0;s<nSamples;s++){
+    	const int* z = &(allocations[s*nAlloc]);
+    	labelCount.assign(1,0);
+    	for(unsigned long int i=0;i<nAlloc;i++){
+    		unsigned long int c = (unsigned long int)z[i];
+    		if(c>=labelCount.size()){
+    			labelCount.resize(c+1,0);
     		}
-			if(tmpSum<currMinSum){
-				minIndex=k;
-				currMinSum=tmpSum;
-			}
-        }
+    		labelCount[c]++;
+    	}
+    	double sumSqSizes=0.0;
+    	for(unsigned long int c=0;c<labelCount.size();c++){
+    		sumSqSizes+=(double)labelCount[c]*(double)labelCount[c];
+    	}
+    	if(groupedCostRatio*sumSqSizes<(double)nAlloc*(double)nAlloc){
+    		groupedSweeps.push_back(s);
+    	}else{
+    		denseSweeps.push_back(s);
+    	}
+    }
+
+    // Count the number of sweeps in which each pair is in the same cluster,
+    // in 16 bit counters for the compact matrix which is then kept as it is
+    vector<double> disSimMat;
+    std::unique_ptr<compactDisSimMat> compactMat;
+    vector<double> disSimMatPred;
+    if(cmp){
+    	if(nSamples>std::numeric_limits<uint16_t>::max()){
+    		return Rcpp::List::create(Rcpp::Named("error")=string("The compact dissimilarity matrix can count at most 65535 sweeps, increase nFilter or set compact=FALSE"));
+    	}
+    	compactMat.reset(new compactDisSimMat(nSj,denom));
+    	vector<uint16_t>& coClustered = compactMat->coClustered;
+    	coClustered.assign(lengthMat,0);
+    	countCoClustering(allocations,nAlloc,nSj,denseSweeps,groupedSweeps,tileStart,nThr,coClustered);
+    	// The prediction subjects are returned as dissimilarities
+    	unsigned long int lengthFit = (nSj*(nSj-1))/2;
+    	disSimMatPred.resize(lengthMat-lengthFit);
+    	for(unsigned long int r=lengthFit;r<lengthMat;r++){
+    		disSimMatPred[r-lengthFit] = (denom-(double)coClustered[r])/denom;
+    	}
+    	coClustered.resize(lengthFit);
+    	coClustered.shrink_to_fit();
+    }else{
+    	vector<unsigned int> coClustered(lengthMat,0);
+    	countCoClustering(allocations,nAlloc,nSj,denseSweeps,groupedSweeps,tileStart,nThr,coClustered);
+    	// Normalise the counts
+    	disSimMat.resize(lengthMat);
+    	for (unsigned long int r=0;r<lengthMat;r++){
+    		disSimMat[r] = (denom-(double)coClustered[r])/denom;
+    	}
     }
 
-    zFile.close();
+    // Computing the optimal partition for least squares method
+    // Could make these steps optional as only relevant for R option useLS=T
+    int minIndex = cmp?lsOptimalSweep(allocations,nAlloc,nSj,nSamples,kMin,nThr,compactMat->values()):
+    		lsOptimalSweep(allocations,nAlloc,nSj,nSamples,kMin,nThr,disSimMat);
+
 	if (oLS){
 		return Rcpp::List::create(Rcpp::Named("lsOptSweep")=minIndex);
+	} else if (cmp){
+		Rcpp::XPtr<compactDisSimMat> compactPtr(compactMat.release(),true);
+		return Rcpp::List::create(Rcpp::Named("lsOptSweep")=minIndex,
+			Rcpp::Named("disSimMat")=compactPtr,
+			Rcpp::Named("disSimMatPred")=Rcpp::wrap<vector<double> >(disSimMatPred));
 	} else {
 		return Rcpp::List::create(Rcpp::Named("lsOptSweep")=minIndex,
 			Rcpp::Named("disSimMat")=Rcpp::wrap<vector<double> >(disSimMat));	
 	}
 }
 
-SEXP pYGivenZW(SEXP betaIn,SEXP thetaIn,SEXP zAlloc,SEXP sigmaBeta,
-		SEXP sigmaTheta, SEXP dofTheta, SEXP dofBeta, SEXP nSubjects,
-		SEXP yMat,SEXP betaW,SEXP nFixedEffects,SEXP nTableNames,SEXP constants,
-		SEXP maxNTableNames){
+// A candidate for the least squares partition in calcApproxLSSweep: a
+// sweep, its criterion on the sampled pairs and the allocations of its
+// fitting subjects
+struct lsCandidate{
+	double sampledSumSq;
+	unsigned long int sweep;
+	vector<int> z;
+};
 
-	unsigned int nFE = Rcpp::as<int>(nFixedEffects);
-	Rcpp::NumericVector beta(betaIn);
-	Rcpp::NumericVector bW(betaW);
-	double sigmaB = Rcpp::as<double>(sigmaBeta);
-	double dofB = Rcpp::as<double>(dofBeta);
-	Rcpp::NumericVector theta(thetaIn);
-	Rcpp::IntegerVector z(zAlloc);
-	unsigned long int nSj = Rcpp::as<int>(nSubjects);
-	Rcpp::NumericVector yM(yMat);
-	double con = Rcpp::as<double>(constants);
-	Rcpp::IntegerVector nN(nTableNames);
-	unsigned int maxnN = Rcpp::as<int>(maxNTableNames);
-	double sigmaT = Rcpp::as<double>(sigmaTheta);
-	double dofT = Rcpp::as<double>(dofTheta);
-
-    vector<double> thetaTmp(maxnN+1);
-    unsigned int k=0;
-	for (int i=0; i<nN.size();i++) {
-		thetaTmp.at(nN[i]) = theta[k];
-		k++;
-	}
-	vector<double> pred(nSj);
-	for (unsigned int i=0; i<nSj;i++) {
-		pred[i] = thetaTmp.at(z(i));
-	}
-	vector<double> predictorAll(nSj);
-	if (nFE>0){
-		for (unsigned int i=0; i<nSj;i++) {
-			predictorAll[i] = pred[i] + bW[i];
+// Order the candidates by their criterion on the sampled pairs
+static bool lessSampledSumSq(const lsCandidate& a,const lsCandidate& b){
+	return a.sampledSumSq<b.sampledSumSq;
+}
+
+SEXP calcApproxLSSweep(SEXP fileName, SEXP nSweeps, SEXP nBurn, SEXP nFilter,SEXP nSubjects,SEXP nPredictSubjects,SEXP pairI,SEXP pairJ,SEXP nThreads){
+
+    // As in calcDisSimMat, but the least squares criterion is first only
+    // evaluated on the given pairs of fitting subjects (indexed from 0), so
+    // neither the dissimilarity matrix nor the allocations of all the sweeps
+    // are kept. The trace is read once to count the co-clustering of the
+    // pairs and once to compare each sweep with it, keeping the nCandidates
+    // best sweeps. Up to a term that does not depend on the partition, the
+    // exact criterion of a partition is the sum over its pairs in the same
+    // cluster of 1-2p, where p is the proportion of the sweeps in which the
+    // pair is in the same cluster. The trace is read a third time to count
+    // these pairs for each candidate, from the number of subjects that each
+    // of its clusters shares with each cluster of the sweep, and the best
+    // candidate on the exact criterion is returned.
+    const unsigned long int nCandidates = 10;
+    bool fromMemory = !Rf_isString(fileName);
+    string fName = fromMemory?string():Rcpp::as<string>(fileName);
+
+    unsigned int nS = Rcpp::as<int>(nSweeps);
+    unsigned int nB = Rcpp::as<int>(nBurn);
+    unsigned int nF = Rcpp::as<int>(nFilter);
+    unsigned long int nSj = Rcpp::as<int>(nSubjects);
+    unsigned int nPSj = Rcpp::as<int>(nPredictSubjects);
+    Rcpp::IntegerVector pI(pairI);
+    Rcpp::IntegerVector pJ(pairJ);
+    int nThr = Rcpp::as<int>(nThreads);
+    if(nThr<1){
+        nThr=1;
+    }
+
+    long int nPairs = pI.size();
+    if(nPairs==0||pJ.size()!=nPairs){
+    	return Rcpp::List::create(Rcpp::Named("error")=string("The pairs of subjects are empty or of different lengths"));
+    }
+    vector<unsigned long int> first(nPairs),second(nPairs);
+    for(long int p=0;p<nPairs;p++){
+    	if(pI[p]<0||pJ[p]<0||(unsigned long int)pI[p]>=nSj||(unsigned long int)pJ[p]>=nSj||pI[p]==pJ[p]){
+    		return Rcpp::List::create(Rcpp::Named("error")=string("The pairs must be of two different fitting subjects"));
+    	}
+    	first[p]=pI[p];
+    	second[p]=pJ[p];
+    }
+
+    unsigned int nLines =  (nS+nB)/nF;
+    unsigned int firstLine = nB/nF;
+    double denom = (double)nLines-(double)firstLine;
+    unsigned long int nAlloc = nSj+nPSj;
+    unsigned long int kMin = firstLine>1?firstLine:1;
+
+    Rcpp::IntegerVector zValues;
+    if(fromMemory){
+    	zValues = Rcpp::IntegerVector(fileName);
+    	if((unsigned long int)zValues.size()!=(unsigned long int)nLines*nAlloc){
+    		Rcpp::stop("The allocations kept in memory do not match the number of sweeps and subjects");
+    	}
+    }
+    bool deltaFile = !fromMemory&&fName.find("_zDelta.")!=string::npos;
+    vector<int> clusterData(nAlloc);
+    vector<unsigned int> coClustered(nPairs,0);
+    vector<lsCandidate> candidates;
+    // The clusters of each candidate (its fitting subjects grouped by cluster
+    // and the end of each cluster) and the sum over the sweeps of the number
+    // of its pairs in the same cluster in both the candidate and the sweep
+    vector<vector<unsigned long int> > members,clusterEnd,labelCount;
+    vector<double> coClusteredWithin;
+    for(unsigned int stage=1;stage<=3;stage++){
+    	if(stage==3){
+    		if(candidates.size()<2){
+    			break;
+    		}
+    		unsigned long int nCand = candidates.size();
+    		members.resize(nCand);
+    		clusterEnd.resize(nCand);
+    		labelCount.resize(nCand);
+    		coClusteredWithin.assign(nCand,0.0);
+    		for(unsigned long int c=0;c<nCand;c++){
+    			const vector<int>& zC = candidates[c].z;
+    			vector<unsigned long int> nMembers;
+    			for(unsigned long int i=0;i<nSj;i++){
+    				unsigned long int zi = (unsigned long int)zC[i];
+    				if(zi>=nMembers.size()){
+    					nMembers.resize(zi+1,0);
+    				}
+    				nMembers[zi]++;
+    			}
+    			// The position of the next member of each cluster
+    			vector<unsigned long int> next(nMembers.size(),0);
+    			for(unsigned long int a=0;a<nMembers.size();a++){
+    				if(nMembers[a]>0){
+    					next[a]=clusterEnd[c].empty()?0:clusterEnd[c].back();
+    					clusterEnd[c].push_back(next[a]+nMembers[a]);
+    				}
+    			}
+    			members[c].resize(nSj);
+    			for(unsigned long int i=0;i<nSj;i++){
+    				members[c][next[(unsigned long int)zC[i]]++]=i;
+    			}
+    		}
+    	}
+    	gzipInputBuffer zBuffer;
+    	istream zFile(&zBuffer);
+    	bool binaryFile = fromMemory?false:openZFile(fName,zBuffer,zFile);
+    	for(unsigned long int k=1;k<=nLines;k++){
+    		if(fromMemory){
+    			std::copy(zValues.begin()+(k-1)*nAlloc,zValues.begin()+k*nAlloc,clusterData.begin());
+    		}else{
+    			readZSweep(zFile,binaryFile,deltaFile,clusterData);
+    		}
+    		if(k<kMin){
+    			continue;
+    		}
+    		if((1+k-firstLine)==1||(1+k-firstLine)%1000==0){
+    			Rprintf("Stage %i:%i samples out of %i\n",stage,1+k-firstLine,1+nLines-firstLine);
+    		}
+    		const int* z = &(clusterData[0]);
+    		if(stage==1){
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThr) schedule(static)
+#endif
+    			for(long int p=0;p<nPairs;p++){
+    				coClustered[p]+=(z[first[p]]==z[second[p]]);
+    			}
+    		}else if(stage==2){
+    			double tmpSum=0.0;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThr) schedule(static) reduction(+:tmpSum)
+#endif
+    			for(long int p=0;p<nPairs;p++){
+    				double disSim = (denom-(double)coClustered[p])/denom;
+    				double d = z[first[p]]==z[second[p]]?disSim:1.0-disSim;
+    				tmpSum+=d*d;
+    			}
+    			// Keep the allocations of the best sweeps so far, a sweep
+    			// is placed after the earlier sweeps of the same criterion
+    			if(candidates.size()<nCandidates||tmpSum<candidates.back().sampledSumSq){
+    				if(candidates.size()==nCandidates){
+    					candidates.pop_back();
+    				}
+    				lsCandidate cand = {tmpSum,k,vector<int>(z,z+nSj)};
+    				candidates.insert(std::upper_bound(candidates.begin(),candidates.end(),
+    						cand,lessSampledSumSq),cand);
+    			}
+    		}else{
+    			long int nCand = candidates.size();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThr) schedule(dynamic)
+#endif
+    			for(long int c=0;c<nCand;c++){
+    				// The pairs of each cluster of the candidate that are in
+    				// the same cluster in the sweep, counted as the subjects
+    				// are added to the clusters of the sweep
+    				const vector<unsigned long int>& ord = members[c];
+    				vector<unsigned long int>& count = labelCount[c];
+    				double nShared=0.0;
+    				unsigned long int start=0;
+    				for(unsigned long int a=0;a<clusterEnd[c].size();a++){
+    					unsigned long int end = clusterEnd[c][a];
+    					for(unsigned long int m=start;m<end;m++){
+    						unsigned long int zi = (unsigned long int)z[ord[m]];
+    						if(zi>=count.size()){
+    							count.resize(zi+1,0);
+    						}
+    						nShared+=(double)count[zi];
+    						count[zi]++;
+    					}
+    					for(unsigned long int m=start;m<end;m++){
+    						count[(unsigned long int)z[ord[m]]]=0;
+    					}
+    					start=end;
+    				}
+    				coClusteredWithin[c]+=nShared;
+    			}
+    		}
+    	}
+    	zBuffer.close();
+    }
+
+    int minIndex=0;
+    if(candidates.size()==1){
+    	minIndex=candidates[0].sweep;
+    }else if(candidates.size()>1){
+    	double currMinSum=0.0;
+    	for(unsigned long int c=0;c<candidates.size();c++){
+    		double nWithin=0.0;
+    		unsigned long int start=0;
+    		for(unsigned long int a=0;a<clusterEnd[c].size();a++){
+    			double size = (double)(clusterEnd[c][a]-start);
+    			nWithin+=size*(size-1.0)/2.0;
+    			start=clusterEnd[c][a];
+    		}
+    		double exactSum = nWithin-2.0*coClusteredWithin[c]/denom;
+    		if(c==0||exactSum<currMinSum||(exactSum==currMinSum&&candidates[c].sweep<(unsigned long int)minIndex)){
+    			minIndex=candidates[c].sweep;
+    			currMinSum=exactSum;
+    		}
+    	}
+    }
+    return Rcpp::List::create(Rcpp::Named("lsOptSweep")=minIndex);
+}
+
+// Sequential reader of the records (one per recorded sweep) of a trace: a
+// text or binary trace file, possibly gzip compressed, or a trace kept in
+// memory by profRegr (the values of all the records and the end of each
+// record). For a delta encoded allocation file the full allocations of each
+// sweep are returned.
+class traceReader{
+
+	public:
+		traceReader() : _file(&_buffer), _isOpen(false), _binary(false),
+				_integer(false), _delta(false), _memory(false), _record(0) {}
+
+		/// \brief Open a trace file, nValues is the number of allocations of
+		/// a delta encoded allocation file
+		void open(const string& fileName,const unsigned long int& nValues=0){
+			_binary = openZFile(fileName,_buffer,_file,&_integer);
+			_isOpen=true;
+			_delta = fileName.find("_zDelta.")!=string::npos;
+			_z.assign(nValues,0);
 		}
-	} else {
-		for (unsigned int i=0; i<nSj;i++) {
-			predictorAll[i] = pred[i];
+
+		/// \brief Use a trace kept in memory
+		void open(const vector<double>& values,const vector<unsigned long int>& recordEnd){
+			_memory=true;
+			_values=values;
+			_recordEnd=recordEnd;
+			_record=0;
+		}
+
+		/// \brief Return whether a trace has been opened
+		bool isOpen() const{
+			return _isOpen||_memory;
+		}
+
+		/// \brief Read the next record, returns false after the last record
+		bool next(vector<double>& values){
+			if(_memory){
+				if(_record>=_recordEnd.size()){
+					return false;
+				}
+				unsigned long int start = _record>0?_recordEnd[_record-1]:0;
+				values.assign(_values.begin()+start,_values.begin()+_recordEnd[_record]);
+				_record++;
+				return true;
+			}
+			if(!_delta){
+				return readRecord(values);
+			}
+			// readZSweep expects a record, so check for the end of the file
+			if(!_binary){
+				_file >> std::ws;
+			}
+			if(_file.peek()==std::char_traits<char>::eof()){
+				return false;
+			}
+			readZSweep(_file,_binary,true,_z);
+			values.assign(_z.begin(),_z.end());
+			return true;
+		}
+
+		/// \brief Close the file
+		void close(){
+			if(_isOpen){
+				_buffer.close();
+				_isOpen=false;
+			}
+		}
+
+	private:
+		gzipInputBuffer _buffer;
+		istream _file;
+		bool _isOpen,_binary,_integer,_delta,_memory;
+		// The current allocations of a delta encoded file
+		vector<int> _z;
+		// The trace kept in memory and the next record of it
+		vector<double> _values;
+		vector<unsigned long int> _recordEnd;
+		unsigned long int _record;
+
+		unsigned int readUInt32(){
+			unsigned char bytes[4]={0};
+			_file.read((char*)bytes,4);
+			return bytes[0]|(bytes[1]<<8)|(bytes[2]<<16)|((unsigned int)bytes[3]<<24);
+		}
+
+		// Read the values of the next record of the file, the binary values
+		// are little endian
+		bool readRecord(vector<double>& values){
+			if(_binary){
+				unsigned int nVals=readUInt32();
+				if(!_file){
+					return false;
+				}
+				unsigned int size = _integer?4:8;
+				vector<unsigned char> bytes(size*(unsigned long int)nVals);
+				if(nVals>0){
+					_file.read((char*)&(bytes[0]),bytes.size());
+				}
+				if(!_file){
+					return false;
+				}
+				values.resize(nVals);
+				for(unsigned long int i=0;i<nVals;i++){
+					const unsigned char* b=&(bytes[size*i]);
+					if(_integer){
+						unsigned int uintVal=b[0]|(b[1]<<8)|(b[2]<<16)|((unsigned int)b[3]<<24);
+						values[i]=(double)(int)uintVal;
+					}else{
+						uint64_t bits=0;
+						for(int j=7;j>=0;j--){
+							bits=(bits<<8)|b[j];
+						}
+						double val;
+						memcpy(&val,&bits,8);
+						values[i]=val;
+					}
+				}
+				return true;
+			}
+			string line;
+			if(!std::getline(_file,line)){
+				return false;
+			}
+			values.clear();
+			const char* pos=line.c_str();
+			char* end;
+			while(true){
+				double val=strtod(pos,&end);
+				if(end==pos){
+					break;
+				}
+				values.push_back(val);
+				pos=end;
+			}
+			return true;
+		}
+
+};
+
+// The traces used by calcAvgRiskProfile, in the order of riskProfileTraceNames
+enum riskProfileTrace {traceNClusters,traceZ,traceTheta,traceBeta,traceNu,
+	tracePhi,traceGamma,traceMu,traceSigma,nRiskProfileTraces};
+static const char* riskProfileTraceNames[nRiskProfileTraces] =
+		{"nClusters","z","theta","beta","nu","phi","gamma","mu","Sigma"};
+
+// The settings of calcAvgRiskProfile, as set by calcAvgRiskAndProfile
+struct riskProfileSettings{
+	string yModel,xModel,varSelectType;
+	unsigned long int nSubjects,nPredictSubjects,firstLine,lastLine;
+	unsigned int nCategoriesY,nCovariates,nDiscreteCovs,nContinuousCovs,maxNCategories,nFixedEffects;
+	bool includeResponse,includeFixedEffects,weibullFixedShape,proportionalHazards,useIndependentNormal;
+	// The fixed effects (by column) and the response category of each subject
+	vector<double> wMat;
+	vector<int> yCategory;
+	// The profiles of the covariates that are not selected
+	vector<double> nullPhi,nullMu;
+	// The optimal clusters (1 based) of the subjects
+	vector<int> clustering;
+};
+
+// The averages over the subjects of each optimal cluster, for each sweep,
+// laid out as the R arrays returned by calcAvgRiskAndProfile (the sweep
+// varies fastest)
+struct riskProfileArrays{
+	vector<double> risk,nu,phi,phiStar,mu,muStar,sigma;
+};
+
+// The value i of the record of a trace, checking the record is long enough
+static double traceValue(const vector<double>& record,const unsigned long int& i){
+	if(i>=record.size()){
+		throw std::runtime_error("A record of a trace file is shorter than expected");
+	}
+	return record[i];
+}
+
+// Compute the averages of one sweep from the records of its traces
+static void riskProfileSweep(const riskProfileSettings& set,const vector<vector<unsigned long int> >& optAlloc,
+		const vector<vector<double> >& rec,const unsigned long int& s,const unsigned long int& nSamples,
+		riskProfileArrays& out){
+
+	unsigned long int nClusters = optAlloc.size();
+	unsigned long int currMax = (unsigned long int)rec[traceNClusters].at(0);
+	const vector<double>& z = rec[traceZ];
+	if(z.size()<set.nSubjects){
+		throw std::runtime_error("Unexpected record in allocation file");
+	}
+	bool categorical = set.yModel.compare("Categorical")==0;
+	bool varSelect = set.varSelectType.compare("None")!=0;
+	bool binaryCluster = set.varSelectType.compare("BinaryCluster")==0;
+	unsigned int nCatY = set.nCategoriesY;
+	// Categorical theta and beta have no values for the reference category
+	unsigned int nCatTheta = categorical?nCatY-1:nCatY;
+	unsigned int nD = set.xModel.compare("Normal")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nDiscreteCovs:set.nCovariates);
+	unsigned int nC = set.xModel.compare("Discrete")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nContinuousCovs:set.nCovariates);
+	unsigned int gammaOffset = set.xModel.compare("Mixed")==0?set.nDiscreteCovs:0;
+	unsigned int maxNCat = set.maxNCategories;
+
+	const vector<double>& thetaRecord = rec[traceTheta];
+	const vector<double>& betaRecord = rec[traceBeta];
+	const vector<double>& nuRecord = rec[traceNu];
+	const vector<double>& phiRecord = rec[tracePhi];
+	const vector<double>& gammaRecord = rec[traceGamma];
+	const vector<double>& muRecord = rec[traceMu];
+	const vector<double>& sigmaRecord = rec[traceSigma];
+
+	vector<double> lambda(nCatY),risk(nCatY),riskSum(nCatY);
+	for(unsigned long int c=0;c<nClusters;c++){
+		const vector<unsigned long int>& members = optAlloc[c];
+		double nMembers = (double)members.size();
+
+		if(set.includeResponse){
+			riskSum.assign(nCatY,0.0);
+			double nuSum=0.0;
+			for(unsigned long int m=0;m<members.size();m++){
+				unsigned long int i = members[m];
+				unsigned long int zi = (unsigned long int)z[i];
+				for(unsigned int k=0;k<nCatY;k++){
+					lambda[k] = categorical?(k==0?0.0:traceValue(thetaRecord,zi*nCatTheta+k-1)):traceValue(thetaRecord,zi*nCatTheta+k);
+				}
+				if(set.includeFixedEffects&&set.nFixedEffects>0){
+					for(unsigned int k=0;k<nCatY;k++){
+						// For categorical responses the coefficients of the
+						// category of the subject are used
+						unsigned int kBeta = categorical?set.yCategory[i]:k;
+						double fixedEffect=0.0;
+						for(unsigned int j=0;j<set.nFixedEffects;j++){
+							double betaJK = categorical?(kBeta==0?0.0:traceValue(betaRecord,j*nCatTheta+kBeta-1)):traceValue(betaRecord,j*nCatTheta+kBeta);
+							fixedEffect+=set.wMat[i+set.nSubjects*j]*betaJK;
+						}
+						lambda[k]+=fixedEffect;
+					}
+				}
+				if(set.yModel.compare("Poisson")==0){
+					risk[0]=exp(lambda[0]);
+				}else if(set.yModel.compare("Bernoulli")==0||set.yModel.compare("Binomial")==0){
+					risk[0]=1.0/(1.0+exp(-lambda[0]));
+				}else if(set.yModel.compare("Normal")==0||set.yModel.compare("Quantile")==0){
+					risk[0]=lambda[0];
+				}else if(categorical){
+					double total=0.0;
+					for(unsigned int k=0;k<nCatY;k++){
+						risk[k]=exp(lambda[k]);
+						total+=risk[k];
+					}
+					for(unsigned int k=0;k<nCatY;k++){
+						risk[k]/=total;
+					}
+				}else if(set.yModel.compare("Survival")==0){
+					double nuI = set.weibullFixedShape?traceValue(nuRecord,0):traceValue(nuRecord,zi);
+					nuSum+=nuI;
+					if(set.proportionalHazards){
+						risk[0]=exp(lambda[0]);
+					}else{
+						risk[0]=1.0/pow(exp(lambda[0]),1.0/nuI)*tgamma(1.0+1.0/nuI);
+					}
+				}
+				for(unsigned int k=0;k<nCatY;k++){
+					riskSum[k]+=risk[k];
+				}
+			}
+			for(unsigned int k=0;k<nCatY;k++){
+				out.risk[s+nSamples*(c+nClusters*k)]=riskSum[k]/nMembers;
+			}
+			if(set.yModel.compare("Survival")==0&&!set.weibullFixedShape){
+				out.nu[s+nSamples*c]=nuSum/nMembers;
+			}
+		}
+
+		// The discrete covariates
+		for(unsigned int j=0;j<nD;j++){
+			for(unsigned int p=0;p<maxNCat;p++){
+				double phiSum=0.0,phiStarSum=0.0;
+				for(unsigned long int m=0;m<members.size();m++){
+					unsigned long int zi = (unsigned long int)z[members[m]];
+					double phiVal = traceValue(phiRecord,zi+currMax*(p+maxNCat*j));
+					phiSum+=phiVal;
+					if(varSelect){
+						double g = binaryCluster?traceValue(gammaRecord,zi+currMax*j):traceValue(gammaRecord,j);
+						phiStarSum+=g*phiVal+(1.0-g)*set.nullPhi.at(p+maxNCat*j);
+					}
+				}
+				unsigned long int idx = s+nSamples*(c+nClusters*(j+nD*p));
+				out.phi[idx]=phiSum/nMembers;
+				if(varSelect){
+					out.phiStar[idx]=phiStarSum/nMembers;
+				}
+			}
+		}
+
+		// The continuous covariates
+		for(unsigned int j=0;j<nC;j++){
+			double muSum=0.0,muStarSum=0.0;
+			for(unsigned long int m=0;m<members.size();m++){
+				unsigned long int zi = (unsigned long int)z[members[m]];
+				double muVal = traceValue(muRecord,zi+currMax*j);
+				muSum+=muVal;
+				if(varSelect){
+					double g = binaryCluster?traceValue(gammaRecord,zi+currMax*(gammaOffset+j)):traceValue(gammaRecord,gammaOffset+j);
+					muStarSum+=g*muVal+(1.0-g)*set.nullMu.at(j);
+				}
+			}
+			unsigned long int idx = s+nSamples*(c+nClusters*j);
+			out.mu[idx]=muSum/nMembers;
+			if(varSelect){
+				out.muStar[idx]=muStarSum/nMembers;
+			}
+			unsigned int nL = set.useIndependentNormal?1:nC;
+			for(unsigned int l=0;l<nL;l++){
+				double sigmaSum=0.0;
+				for(unsigned long int m=0;m<members.size();m++){
+					unsigned long int zi = (unsigned long int)z[members[m]];
+					sigmaSum+=traceValue(sigmaRecord,zi+currMax*(j+nC*l));
+				}
+				out.sigma[s+nSamples*(c+nClusters*(j+nC*l))]=sigmaSum/nMembers;
+			}
+		}
+	}
+
+}
+
+// Stream the traces once, from line firstLine to lastLine, and compute the
+// averages over the subjects of each optimal cluster for each sweep. The
+// traces are read in chunks of sweeps, the sweeps of each chunk are
+// averaged in parallel.
+static void riskProfile(const riskProfileSettings& set,vector<traceReader>& traces,
+		const int& nThreads,riskProfileArrays& out){
+
+	unsigned long int nSamples = set.lastLine>=set.firstLine?set.lastLine-set.firstLine+1:0;
+	unsigned long int nClusters=0;
+	for(unsigned long int i=0;i<set.clustering.size();i++){
+		if((unsigned long int)set.clustering[i]>nClusters){
+			nClusters=set.clustering[i];
+		}
+	}
+	if(set.clustering.size()!=set.nSubjects){
+		throw std::runtime_error("The optimal clustering must have one cluster for each subject");
+	}
+	vector<vector<unsigned long int> > optAlloc(nClusters);
+	for(unsigned long int i=0;i<set.clustering.size();i++){
+		if(set.clustering[i]<1){
+			throw std::runtime_error("The optimal clusters must be numbered from 1");
 		}
+		optAlloc[set.clustering[i]-1].push_back(i);
+	}
+	if(set.includeResponse&&set.includeFixedEffects&&set.wMat.size()<set.nSubjects*set.nFixedEffects){
+		throw std::runtime_error("The fixed effects do not have a value for each subject");
+	}
+	if(set.includeResponse&&set.yModel.compare("Categorical")==0&&set.yCategory.size()<set.nSubjects){
+		throw std::runtime_error("The categorical response does not have a value for each subject");
 	}
-	double output = 0.0;
-	for (unsigned int i=0;i<nSj;i++){
-		output = output + yM[i] * predictorAll.at(i)-log(1+exp(predictorAll.at(i)));
+
+	unsigned int nD = set.xModel.compare("Normal")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nDiscreteCovs:set.nCovariates);
+	unsigned int nC = set.xModel.compare("Discrete")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nContinuousCovs:set.nCovariates);
+	bool varSelect = set.varSelectType.compare("None")!=0;
+	if(set.includeResponse){
+		out.risk.assign(nSamples*nClusters*set.nCategoriesY,0.0);
+		if(set.yModel.compare("Survival")==0&&!set.weibullFixedShape){
+			out.nu.assign(nSamples*nClusters,0.0);
+		}
 	}
-	// contribution from theta
-	double paramsThetaTmp = 1/pow(sigmaT,2);
-	double outputTheta = 0.0;
-	for (int i=0;i<theta.size();i++){
-		outputTheta = outputTheta+ log(dofT+pow(theta[i],2)*paramsThetaTmp);
+	out.phi.assign(nSamples*nClusters*nD*set.maxNCategories,0.0);
+	out.phiStar.assign(varSelect?out.phi.size():0,0.0);
+	out.mu.assign(nSamples*nClusters*nC,0.0);
+	out.muStar.assign(varSelect?out.mu.size():0,0.0);
+	out.sigma.assign(nSamples*nClusters*nC*(set.useIndependentNormal?1:nC),0.0);
+
+	// Skip the sweeps of the burn in
+	vector<double> values;
+	for(unsigned int t=0;t<nRiskProfileTraces;t++){
+		for(unsigned long int k=1;k<set.firstLine&&traces[t].isOpen();k++){
+			traces[t].next(values);
+		}
 	}
-	outputTheta = outputTheta*0.5*(dofT+1);
 
-	double out = -(output-outputTheta+con)/nSj;
-	if (nFE>0) {	
-		// contribution from beta
-		double paramsBetaTmp = 1/pow(sigmaB,2);
-		double outputBeta = 0.0;
-		for (int i=0;i<beta.size();i++){
-			outputBeta = outputBeta+ log(dofB+pow(beta[i],2)*paramsBetaTmp);
+	const unsigned long int chunkSize = 1000;
+	vector<vector<vector<double> > > records(chunkSize,vector<vector<double> >(nRiskProfileTraces));
+	for(unsigned long int chunk=0;chunk<nSamples;chunk+=chunkSize){
+		Rprintf("Processing sweep %lu of %lu\n",chunk+1,nSamples);
+		long int chunkEnd = chunk+chunkSize<nSamples?chunk+chunkSize:nSamples;
+		for(long int s=chunk;s<chunkEnd;s++){
+			for(unsigned int t=0;t<nRiskProfileTraces;t++){
+				if(traces[t].isOpen()&&!traces[t].next(records[s-chunk][t])){
+					throw std::runtime_error(string("The ")+riskProfileTraceNames[t]+" trace has fewer sweeps than expected");
+				}
+			}
+		}
+		// The first error of a thread is thrown again after the loop
+		string errorMessage;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+#endif
+		for(long int s=chunk;s<chunkEnd;s++){
+			try{
+				riskProfileSweep(set,optAlloc,records[s-chunk],s,nSamples,out);
+			}catch(const std::exception& e){
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+				errorMessage=e.what();
+			}
 		}
-		outputBeta = outputBeta*0.5*(dofB+1);
-		out = out - (-outputBeta)/nSj;
+		if(errorMessage.size()>0){
+			throw std::runtime_error(errorMessage);
+		}
+	}
+
+}
+
+// Convert a vector to an R array with the given dimensions
+static SEXP riskProfileArray(const vector<double>& values,const vector<int>& dims){
+	if(values.size()==0){
+		return R_NilValue;
 	}
-    return Rcpp::List::create(Rcpp::Named("pYGivenZW")=out);
+	Rcpp::NumericVector array(values.begin(),values.end());
+	array.attr("dim") = Rcpp::IntegerVector(dims.begin(),dims.end());
+	return array;
 }
 
+SEXP calcAvgRiskProfile(SEXP traces, SEXP settings, SEXP nThreads){
 
-SEXP GradpYGivenZW(SEXP betaIn,SEXP thetaIn,SEXP zAlloc, SEXP nSubjects,
-		SEXP betaW,SEXP yMat, SEXP nFixedEffects,SEXP nTableNames,SEXP maxNTableNames){
-	Rcpp::NumericVector beta(betaIn);
-	Rcpp::NumericVector bW(betaW);
-    Rcpp::NumericVector theta(thetaIn);
-    Rcpp::IntegerVector z(zAlloc);
-    unsigned long int nSj = Rcpp::as<int>(nSubjects);
-    unsigned int nFE = Rcpp::as<int>(nFixedEffects);
-    Rcpp::IntegerVector nN(nTableNames);
-    unsigned int maxnN = Rcpp::as<int>(maxNTableNames);
-    Rcpp::NumericVector yM(yMat);
-
-    vector<double> thetaTmp(maxnN+1);
-    unsigned int k=0;
-	for (int i=0; i<nN.size();i++) {
-		thetaTmp.at(nN[i]) = theta[k];
-		k++;
-	}
-	vector<double> pred(nSj);
-	for (unsigned int i=0; i<nSj;i++) {
-		pred[i] = thetaTmp.at(z(i));
-	}
-	Rcpp::NumericVector yPred(nSj);
-	if (nFE>0) {
-		for (unsigned int i=0;i<nSj;i++){
-			yPred[i] = yM[i]-1/(1+1/exp(pred[i]+bW[i]));
+	Rcpp::List traceList(traces);
+	Rcpp::List settingList(settings);
+	riskProfileSettings set;
+	set.yModel = Rcpp::as<string>(settingList["yModel"]);
+	set.xModel = Rcpp::as<string>(settingList["xModel"]);
+	set.varSelectType = Rcpp::as<string>(settingList["varSelectType"]);
+	set.nSubjects = Rcpp::as<int>(settingList["nSubjects"]);
+	set.nPredictSubjects = Rcpp::as<int>(settingList["nPredictSubjects"]);
+	set.firstLine = Rcpp::as<int>(settingList["firstLine"]);
+	set.lastLine = Rcpp::as<int>(settingList["lastLine"]);
+	set.nCategoriesY = Rcpp::as<int>(settingList["nCategoriesY"]);
+	set.nCovariates = Rcpp::as<int>(settingList["nCovariates"]);
+	set.nDiscreteCovs = Rcpp::as<int>(settingList["nDiscreteCovs"]);
+	set.nContinuousCovs = Rcpp::as<int>(settingList["nContinuousCovs"]);
+	set.maxNCategories = Rcpp::as<int>(settingList["maxNCategories"]);
+	set.nFixedEffects = Rcpp::as<int>(settingList["nFixedEffects"]);
+	set.includeResponse = Rcpp::as<bool>(settingList["includeResponse"]);
+	set.includeFixedEffects = Rcpp::as<bool>(settingList["includeFixedEffects"]);
+	set.weibullFixedShape = Rcpp::as<bool>(settingList["weibullFixedShape"]);
+	set.proportionalHazards = Rcpp::as<bool>(settingList["proportionalHazards"]);
+	set.useIndependentNormal = Rcpp::as<bool>(settingList["useIndependentNormal"]);
+	set.wMat = Rcpp::as<vector<double> >(settingList["wMat"]);
+	set.yCategory = Rcpp::as<vector<int> >(settingList["yCategory"]);
+	set.nullPhi = Rcpp::as<vector<double> >(settingList["nullPhi"]);
+	set.nullMu = Rcpp::as<vector<double> >(settingList["nullMu"]);
+	set.clustering = Rcpp::as<vector<int> >(settingList["clustering"]);
+	int nThr = Rcpp::as<int>(nThreads);
+	if(nThr<1){
+		nThr=1;
+	}
+
+	// Errors are returned to R, which stops with the message
+	riskProfileArrays out;
+	string errorMessage;
+	try{
+		vector<traceReader> readers(nRiskProfileTraces);
+		for(unsigned int t=0;t<nRiskProfileTraces;t++){
+			SEXP trace = traceList[riskProfileTraceNames[t]];
+			if(Rf_isNull(trace)){
+				continue;
+			}else if(Rf_isString(trace)){
+				readers[t].open(Rcpp::as<string>(trace),set.nSubjects+set.nPredictSubjects);
+			}else{
+				Rcpp::List memoryTrace(trace);
+				vector<double> ends = Rcpp::as<vector<double> >(memoryTrace["recordEnd"]);
+				vector<unsigned long int> recordEnd(ends.begin(),ends.end());
+				readers[t].open(Rcpp::as<vector<double> >(memoryTrace["values"]),
+						recordEnd);
+			}
 		}
-	} else {
-		for (unsigned int i=0;i<nSj;i++){
-			yPred[i] = yM[i]-1/(1+1/exp(pred[i]));
+		riskProfile(set,readers,nThr,out);
+		for(unsigned int t=0;t<nRiskProfileTraces;t++){
+			readers[t].close();
 		}
+	}catch(const std::exception& e){
+		errorMessage=e.what();
+	}
+	if(errorMessage.size()>0){
+		return Rcpp::List::create(Rcpp::Named("error")=errorMessage);
+	}
+
+	int nS = set.lastLine>=set.firstLine?set.lastLine-set.firstLine+1:0;
+	int nCl = 0;
+	for(unsigned long int i=0;i<set.clustering.size();i++){
+		nCl = set.clustering[i]>nCl?set.clustering[i]:nCl;
+	}
+	int nD = set.xModel.compare("Mixed")==0?set.nDiscreteCovs:set.nCovariates;
+	int nC = set.xModel.compare("Mixed")==0?set.nContinuousCovs:set.nCovariates;
+	vector<int> riskDims = {nS,nCl,(int)set.nCategoriesY};
+	vector<int> phiDims = {nS,nCl,nD,(int)set.maxNCategories};
+	vector<int> muDims = {nS,nCl,nC};
+	vector<int> sigmaDims = {nS,nCl,nC,nC};
+	if(set.useIndependentNormal){
+		sigmaDims.pop_back();
 	}
+	return Rcpp::List::create(Rcpp::Named("risk")=riskProfileArray(out.risk,riskDims),
+			Rcpp::Named("nu")=riskProfileArray(out.nu,vector<int>{nS,nCl}),
+			Rcpp::Named("phi")=riskProfileArray(out.phi,phiDims),
+			Rcpp::Named("phiStar")=riskProfileArray(out.phiStar,phiDims),
+			Rcpp::Named("mu")=riskProfileArray(out.mu,muDims),
+			Rcpp::Named("muStar")=riskProfileArray(out.muStar,muDims),
+			Rcpp::Named("sigma")=riskProfileArray(out.sigma,sigmaDims));
 
-    return Rcpp::wrap(yPred);
 }
 
-SEXP pZpX(SEXP nClusters, SEXP nCategories,SEXP aPhi, SEXP n,SEXP nCovariates,SEXP zAlloc, SEXP xMat, SEXP nNames,SEXP alpha){
+// The traces used by scoreSubjects, in the order of scoringTraceNames
+enum scoringTrace {scoreNClusters,scorePsi,scoreNMembers,scorePhi,scoreMu,scoreSigma,
+	scoreGamma,scoreTheta,scoreNu,scoreBeta,scoreZ,nScoringTraces};
+static const char* scoringTraceNames[nScoringTraces] =
+		{"nClusters","psi","nMembers","phi","mu","Sigma","gamma","theta","nu","beta","z"};
 
-	unsigned int nC = Rcpp::as<int>(nClusters);
-	Rcpp::NumericVector nCat(nCategories);
-	Rcpp::NumericVector nn(n);
-	Rcpp::NumericVector aP(aPhi);
-	unsigned int nCov = Rcpp::as<int>(nCovariates);
-	Rcpp::NumericVector xM(xMat);
-	Rcpp::NumericVector z(zAlloc);
-	Rcpp::NumericVector names(nNames);
-	double a = Rcpp::as<double>(alpha);
-	unsigned int nSj = z.size();
+// The settings of scoreSubjects, as set by scoreNewSubjects
+struct scoringSettings{
+	string yModel,xModel,varSelectType;
+	unsigned long int nSubjects,nPredictSubjects,firstLine,lastLine;
+	unsigned int nCategoriesY,nCovariates,nDiscreteCovs,nContinuousCovs,maxNCategories,nFixedEffects;
+	bool includeResponse,weibullFixedShape,useIndependentNormal;
+	// The number of categories of each discrete covariate
+	vector<int> nCategories;
+	// The profiles of the covariates that are not selected
+	vector<double> nullPhi,nullMu;
+	// The largest observed survival time, which caps the predicted times
+	double restrictedMeanSurvival;
+	// The optimal clusters (1 based) of the fitting subjects, empty if the
+	// allocation probabilities are not reported
+	vector<int> clustering;
+};
 
-	double out = 0.0;
-	for (unsigned int k=0;k<nCov;k++){
-		out = out+nC*(LogGamma(nCat[k]*aP[k])-nCat[k]*LogGamma(aP[k]));
-	}
-
-	double sumNCat = std::accumulate(nCat.begin(),nCat.end(),0);
-	vector<double> nCatK(sumNCat*nC,0);
-	for (unsigned int c=0;c<nC;c++){
-		unsigned int index = 0;
-		for (unsigned int k=0;k<nCov;k++){
-			out = out-LogGamma(nCat[k]*aP[k]+nn[c]);
-		} 
-		for (unsigned int j=0;j<nCov;j++){
-			for (unsigned int kj=0;kj<nCat[j];kj++){
-				for (unsigned int zi=0;zi<nSj;zi++){
-					if (z[zi] == names[c]){
-						if (xM[j*nSj+zi]==kj){
-							nCatK[c*sumNCat+index]++;
-						}
-					}			
-				}
-				nCatK[c*sumNCat+index] = nCatK[c*sumNCat+index] + aP[j];
-				index = index+1;
+// The parameters of one sweep needed to score new subjects, for the clusters
+// with fitting members only (the new subjects are allocated to these
+// clusters, as the prediction subjects are in the sampler). The discrete and
+// continuous profiles already include the variable selection.
+struct scoringDraw{
+	unsigned int nClusters;
+	// log psi of each cluster
+	vector<double> logPsi;
+	// log phiStar, at c+nClusters*(p+maxNCategories*j)
+	vector<double> logPhi;
+	// muStar, at j+nContinuousCovs*c
+	vector<double> mu;
+	// The covariance matrix of each cluster (j2+nC*j1+nC*nC*c) and its lower
+	// Cholesky factor, or the standard deviations (j+nC*c) with independent
+	// Normal covariates, and the log determinant of each covariance
+	vector<double> sigma,cholSigma,logDetSigma;
+	// theta (k+nCatTheta*c), nu (one per cluster or a single value) and beta
+	// (k+nCatTheta*j)
+	vector<double> theta,nu,beta;
+	// The fraction of the fitting members of each cluster in each optimal
+	// cluster, at k+nOptimalClusters*c
+	vector<double> optWeight;
+};
+
+// Factorise the symmetric matrix in a (n by n) as L L', leaving L in the lower
+// triangle of a and setting logDet to the log determinant of the matrix.
+// Returns false if the matrix is not positive definite.
+static bool choleskyLowerIfPositive(vector<double>& a,const unsigned int& n,double& logDet){
+	logDet=0.0;
+	for(unsigned int j=0;j<n;j++){
+		double d=a[j*n+j];
+		for(unsigned int k=0;k<j;k++){
+			d-=a[j*n+k]*a[j*n+k];
+		}
+		if(!(d>0.0)){
+			return false;
+		}
+		d=sqrt(d);
+		a[j*n+j]=d;
+		logDet+=2.0*log(d);
+		for(unsigned int i=j+1;i<n;i++){
+			double v=a[i*n+j];
+			for(unsigned int k=0;k<j;k++){
+				v-=a[i*n+k]*a[j*n+k];
 			}
-			
-		}		
+			a[i*n+j]=v/d;
+		}
+		for(unsigned int k=j+1;k<n;k++){
+			a[j*n+k]=0.0;
+		}
+	}
+	return true;
+}
+
+// The lower Cholesky factor of the n x n matrix a (row major) in place,
+// returns the log determinant of a
+static double choleskyLower(vector<double>& a,const unsigned int& n){
+	double logDet;
+	if(!choleskyLowerIfPositive(a,n,logDet)){
+		throw std::runtime_error("A covariance matrix of the traces is not positive definite");
+	}
+	return logDet;
+}
+
+// Convert the records of the traces of one sweep to the parameters used for
+// scoring
+static void scoringSweep(const scoringSettings& set,const vector<vector<double> >& rec,
+		const unsigned long int& nOptimalClusters,scoringDraw& draw){
+
+	unsigned long int currMax = (unsigned long int)traceValue(rec[scoreNClusters],0);
+	bool categorical = set.yModel.compare("Categorical")==0;
+	bool varSelect = set.varSelectType.compare("None")!=0;
+	bool binaryCluster = set.varSelectType.compare("BinaryCluster")==0;
+	unsigned int nCatTheta = categorical?set.nCategoriesY-1:set.nCategoriesY;
+	unsigned int nD = set.xModel.compare("Normal")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nDiscreteCovs:set.nCovariates);
+	unsigned int nC = set.xModel.compare("Discrete")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nContinuousCovs:set.nCovariates);
+	unsigned int gammaOffset = set.xModel.compare("Mixed")==0?set.nDiscreteCovs:0;
+	unsigned int maxNCat = set.maxNCategories;
+
+	vector<unsigned long int> clusters;
+	for(unsigned long int c=0;c<currMax;c++){
+		if(traceValue(rec[scoreNMembers],c)>0){
+			clusters.push_back(c);
+		}
 	}
-	for (unsigned int i=0; i< nCatK.size();i++){
-		out = out + LogGamma(nCatK[i]); 
+	unsigned int nQ = clusters.size();
+	draw.nClusters = nQ;
+	draw.logPsi.resize(nQ);
+	for(unsigned int q=0;q<nQ;q++){
+		draw.logPsi[q]=log(traceValue(rec[scorePsi],clusters[q]));
 	}
-	out = out + nC * log(a) + LogGamma(nSj+1) + LogGamma(a)-LogGamma(a+nSj);
 
-	vector<double> counts(nSj,0);
-	for (unsigned int i=0;i<nC;i++){
-		counts[nn[i]-1] = counts[nn[i]-1]+1;
+	draw.logPhi.assign((unsigned long int)nQ*maxNCat*nD,-std::numeric_limits<double>::infinity());
+	for(unsigned int j=0;j<nD;j++){
+		for(unsigned int p=0;p<(unsigned int)set.nCategories[j];p++){
+			for(unsigned int q=0;q<nQ;q++){
+				unsigned long int c = clusters[q];
+				double phiVal = traceValue(rec[scorePhi],c+currMax*(p+maxNCat*j));
+				if(varSelect){
+					double g = binaryCluster?traceValue(rec[scoreGamma],c+currMax*j):traceValue(rec[scoreGamma],j);
+					phiVal = g*phiVal+(1.0-g)*set.nullPhi.at(p+maxNCat*j);
+				}
+				draw.logPhi[q+nQ*(p+maxNCat*j)]=log(phiVal);
+			}
+		}
 	}
 
-	for (unsigned int i=0;i<nSj;i++){
-		out = out -counts[i] * log(i+1.0)-LogGamma(counts[i]+1);
+	draw.mu.resize((unsigned long int)nQ*nC);
+	draw.logDetSigma.assign(nQ,0.0);
+	if(set.useIndependentNormal){
+		draw.cholSigma.resize((unsigned long int)nQ*nC);
+	}else{
+		draw.sigma.resize((unsigned long int)nQ*nC*nC);
+	}
+	for(unsigned int q=0;q<nQ;q++){
+		unsigned long int c = clusters[q];
+		for(unsigned int j=0;j<nC;j++){
+			double muVal = traceValue(rec[scoreMu],c+currMax*j);
+			if(varSelect){
+				double g = binaryCluster?traceValue(rec[scoreGamma],c+currMax*(gammaOffset+j)):traceValue(rec[scoreGamma],gammaOffset+j);
+				muVal = g*muVal+(1.0-g)*set.nullMu.at(j);
+			}
+			draw.mu[j+nC*q]=muVal;
+			if(set.useIndependentNormal){
+				double var = traceValue(rec[scoreSigma],c+currMax*j);
+				draw.cholSigma[j+nC*q]=sqrt(var);
+				draw.logDetSigma[q]+=log(var);
+			}else{
+				for(unsigned int l=0;l<nC;l++){
+					draw.sigma[l+nC*(j+nC*q)]=traceValue(rec[scoreSigma],c+currMax*(l+nC*j));
+				}
+			}
+		}
+		if(!set.useIndependentNormal&&nC>0){
+			vector<double> chol(draw.sigma.begin()+nC*nC*q,draw.sigma.begin()+nC*nC*(q+1));
+			draw.logDetSigma[q]=choleskyLower(chol,nC);
+			draw.cholSigma.insert(draw.cholSigma.end(),chol.begin(),chol.end());
+		}
+	}
+
+	if(set.includeResponse){
+		draw.theta.resize((unsigned long int)nQ*nCatTheta);
+		for(unsigned int q=0;q<nQ;q++){
+			for(unsigned int k=0;k<nCatTheta;k++){
+				draw.theta[k+nCatTheta*q]=traceValue(rec[scoreTheta],clusters[q]*nCatTheta+k);
+			}
+		}
+		draw.beta.resize((unsigned long int)set.nFixedEffects*nCatTheta);
+		for(unsigned long int j=0;j<draw.beta.size();j++){
+			draw.beta[j]=traceValue(rec[scoreBeta],j);
+		}
+		draw.nu.clear();
+		if(set.yModel.compare("Survival")==0){
+			if(set.weibullFixedShape){
+				draw.nu.push_back(traceValue(rec[scoreNu],0));
+			}else{
+				for(unsigned int q=0;q<nQ;q++){
+					draw.nu.push_back(traceValue(rec[scoreNu],clusters[q]));
+				}
+			}
+		}
+	}
+
+	if(nOptimalClusters>0){
+		const vector<double>& z = rec[scoreZ];
+		if(z.size()<set.nSubjects){
+			throw std::runtime_error("Unexpected record in allocation file");
+		}
+		vector<long int> compactIndex(currMax,-1);
+		for(unsigned int q=0;q<nQ;q++){
+			compactIndex[clusters[q]]=q;
+		}
+		draw.optWeight.assign((unsigned long int)nQ*nOptimalClusters,0.0);
+		vector<double> nMembers(nQ,0.0);
+		for(unsigned long int i=0;i<set.nSubjects;i++){
+			unsigned long int zi = (unsigned long int)z[i];
+			if(zi>=currMax||compactIndex[zi]<0){
+				throw std::runtime_error("The allocation file does not match the number of members of the clusters");
+			}
+			draw.optWeight[set.clustering[i]-1+nOptimalClusters*compactIndex[zi]]+=1.0;
+			nMembers[compactIndex[zi]]+=1.0;
+		}
+		for(unsigned int q=0;q<nQ;q++){
+			for(unsigned long int k=0;k<nOptimalClusters;k++){
+				draw.optWeight[k+nOptimalClusters*q]/=nMembers[q];
+			}
+		}
+	}
+
+}
+
+// The covariates, fixed effects and offset or number of trials of a block of
+// new subjects, one row per subject
+struct scoringBlock{
+	unsigned long int nRows,nColumns;
+	vector<double> values;
+	// The missing pattern of the continuous covariates of each subject (0 if
+	// all are observed) and the observed covariates of each pattern
+	vector<unsigned int> pattern;
+	vector<vector<unsigned int> > observed;
+};
+
+// Read the next block of at most blockSize subjects from the new data,
+// returns false if there are none left. Empty lines are skipped.
+static bool readScoringBlock(istream& in,const unsigned long int& blockSize,unsigned long int& lineNumber,
+		scoringBlock& block){
+	block.nRows=0;
+	string line;
+	while(block.nRows<blockSize&&std::getline(in,line)){
+		lineNumber++;
+		double* row = &(block.values[block.nRows*block.nColumns]);
+		const char* pos=line.c_str();
+		char* end;
+		unsigned long int nValues=0;
+		while(true){
+			double val=strtod(pos,&end);
+			if(end==pos){
+				break;
+			}
+			if(nValues<block.nColumns){
+				row[nValues]=val;
+			}
+			nValues++;
+			pos=end;
+		}
+		if(nValues==0){
+			continue;
+		}
+		if(nValues!=block.nColumns){
+			std::ostringstream message;
+			message << "Line " << lineNumber << " of the new data has " << nValues
+					<< " values instead of " << block.nColumns;
+			throw std::runtime_error(message.str());
+		}
+		block.nRows++;
+	}
+	return block.nRows>0;
+}
+
+// The per subject sums over the sweeps of a block of new subjects: the
+// running mean and sum of squared deviations of the predicted response
+// (Welford's algorithm, in the order of the sweeps) and the sum of the
+// allocation probabilities to the optimal clusters
+struct scoringSums{
+	vector<double> yMean,yM2,optProb;
+};
+
+// The scratch space of a thread scoring subjects
+struct scoringWork{
+	vector<double> prob,residual,fixedEffect,lambda,predicted;
+};
+
+// Score one subject of a block for one sweep: the allocation probabilities
+// of the subject given its observed covariates, the expected linear
+// predictor under them, and the predicted response, which are added to the
+// sums of the subject
+static void scoreSubject(const scoringSettings& set,const scoringDraw& draw,const unsigned long int& s,
+		const scoringBlock& block,const unsigned long int& i,const vector<vector<double> >& patternChol,
+		const vector<vector<double> >& patternLogDet,const unsigned long int& nOptimalClusters,
+		scoringWork& work,scoringSums& sums){
+
+	bool categorical = set.yModel.compare("Categorical")==0;
+	unsigned int nCatY = set.nCategoriesY;
+	unsigned int nCatTheta = categorical?nCatY-1:nCatY;
+	unsigned int nD = set.xModel.compare("Normal")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nDiscreteCovs:set.nCovariates);
+	unsigned int nC = set.xModel.compare("Discrete")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nContinuousCovs:set.nCovariates);
+	unsigned int maxNCat = set.maxNCategories;
+	unsigned int nQ = draw.nClusters;
+	const double* x = &(block.values[i*block.nColumns]);
+	const double log2Pi = log(2.0*3.14159265358979323846);
+
+	// The log of the unnormalised allocation probabilities, missing
+	// covariates are left out
+	vector<double>& prob = work.prob;
+	prob.assign(draw.logPsi.begin(),draw.logPsi.end());
+	for(unsigned int j=0;j<nD;j++){
+		if(x[j]==-999){
+			continue;
+		}
+		const double* logPhi = &(draw.logPhi[nQ*((unsigned long int)x[j]+maxNCat*j)]);
+		for(unsigned int q=0;q<nQ;q++){
+			prob[q]+=logPhi[q];
+		}
+	}
+	if(nC>0){
+		const double* xC = x+nD;
+		if(set.useIndependentNormal){
+			for(unsigned int q=0;q<nQ;q++){
+				for(unsigned int j=0;j<nC;j++){
+					if(xC[j]!=-999){
+						double sd = draw.cholSigma[j+nC*q];
+						double u = (xC[j]-draw.mu[j+nC*q])/sd;
+						prob[q]-=0.5*(log2Pi+u*u)+log(sd);
+					}
+				}
+			}
+		}else{
+			// The density of the observed covariates, from the Cholesky
+			// factor of their covariance matrix
+			unsigned int pattern = block.pattern[i];
+			const vector<unsigned int>& observed = block.observed[pattern];
+			unsigned int nObs = observed.size();
+			const double* chol = pattern==0?&(draw.cholSigma[0]):&(patternChol[pattern][0]);
+			const double* logDet = pattern==0?&(draw.logDetSigma[0]):&(patternLogDet[pattern][0]);
+			work.residual.resize(nObs);
+			for(unsigned int q=0;q<nQ;q++){
+				const double* L = chol+(unsigned long int)nObs*nObs*q;
+				double quadForm=0.0;
+				for(unsigned int j=0;j<nObs;j++){
+					double v = xC[observed[j]]-draw.mu[observed[j]+nC*q];
+					for(unsigned int k=0;k<j;k++){
+						v-=L[j*nObs+k]*work.residual[k];
+					}
+					work.residual[j]=v/L[j*nObs+j];
+					quadForm+=work.residual[j]*work.residual[j];
+				}
+				prob[q]-=0.5*(nObs*log2Pi+logDet[q]+quadForm);
+			}
+		}
+	}
+	double maxLogP=-std::numeric_limits<double>::infinity();
+	for(unsigned int q=0;q<nQ;q++){
+		maxLogP = prob[q]>maxLogP?prob[q]:maxLogP;
+	}
+	double total=0.0;
+	for(unsigned int q=0;q<nQ;q++){
+		prob[q]=exp(prob[q]-maxLogP);
+		total+=prob[q];
+	}
+	for(unsigned int q=0;q<nQ;q++){
+		prob[q]/=total;
+	}
+
+	for(unsigned long int k=0;k<nOptimalClusters;k++){
+		double p=0.0;
+		for(unsigned int q=0;q<nQ;q++){
+			p+=prob[q]*draw.optWeight[k+nOptimalClusters*q];
+		}
+		sums.optProb[k+nOptimalClusters*i]+=p;
+	}
+
+	if(!set.includeResponse){
+		return;
+	}
+
+	// The fixed effects (missing values contribute nothing) and the offset or
+	// number of trials (1 if missing) follow the covariates. The reference
+	// category of a categorical response has no theta or beta.
+	const double* w = x+set.nCovariates;
+	double extra = 1.0;
+	if(set.yModel.compare("Poisson")==0||set.yModel.compare("Binomial")==0){
+		extra = w[set.nFixedEffects]!=-999?w[set.nFixedEffects]:1.0;
+	}
+	work.fixedEffect.assign(nCatY,0.0);
+	work.lambda.assign(nCatY,0.0);
+	work.predicted.assign(nCatY,0.0);
+	for(unsigned int k=0;k<nCatTheta;k++){
+		unsigned int kY = categorical?k+1:k;
+		for(unsigned int j=0;j<set.nFixedEffects;j++){
+			if(w[j]!=-999){
+				work.fixedEffect[kY]+=w[j]*draw.beta[k+nCatTheta*j];
+			}
+		}
+		double expectedTheta=0.0;
+		for(unsigned int q=0;q<nQ;q++){
+			expectedTheta+=prob[q]*draw.theta[k+nCatTheta*q];
+		}
+		work.lambda[kY]=expectedTheta+work.fixedEffect[kY];
+	}
+
+	vector<double>& predicted = work.predicted;
+	const vector<double>& lambda = work.lambda;
+	if(set.yModel.compare("Bernoulli")==0){
+		predicted[0]=1.0/(1.0+exp(-lambda[0]));
+	}else if(set.yModel.compare("Binomial")==0){
+		predicted[0]=extra/(1.0+exp(-lambda[0]));
+	}else if(set.yModel.compare("Poisson")==0){
+		predicted[0]=exp(lambda[0]+log(extra));
+	}else if(set.yModel.compare("Normal")==0||set.yModel.compare("Quantile")==0){
+		predicted[0]=lambda[0];
+	}else if(set.yModel.compare("Survival")==0){
+		if(set.weibullFixedShape){
+			double nu = draw.nu[0];
+			predicted[0]=exp(-lambda[0]/nu)*tgamma(1.0+1.0/nu);
+		}else{
+			// With a shape for each cluster the expected survival time is
+			// averaged over the clusters instead
+			for(unsigned int q=0;q<nQ;q++){
+				double nu = draw.nu[q];
+				predicted[0]+=prob[q]*exp(-(draw.theta[q]+work.fixedEffect[0])/nu)*tgamma(1.0+1.0/nu);
+			}
+		}
+		if(predicted[0]>set.restrictedMeanSurvival){
+			predicted[0]=set.restrictedMeanSurvival;
+		}
+	}else if(categorical){
+		double totalY=0.0;
+		for(unsigned int k=0;k<nCatY;k++){
+			predicted[k]=exp(lambda[k]);
+			totalY+=predicted[k];
+		}
+		for(unsigned int k=0;k<nCatY;k++){
+			predicted[k]/=totalY;
+		}
+	}
+
+	double n = (double)(s+1);
+	for(unsigned int k=0;k<nCatY;k++){
+		double& mean = sums.yMean[k+nCatY*i];
+		double delta = predicted[k]-mean;
+		mean+=delta/n;
+		sums.yM2[k+nCatY*i]+=delta*(predicted[k]-mean);
+	}
+
+}
+
+// Stream the traces once, from line firstLine to lastLine, and keep the
+// parameters of the clusters with members of each sweep. The records are
+// converted in parallel, in chunks of sweeps.
+static void scoringDraws(const scoringSettings& set,vector<traceReader>& traces,
+		const unsigned long int& nOptimalClusters,const int& nThreads,vector<scoringDraw>& draws){
+
+	unsigned long int nSamples = set.lastLine>=set.firstLine?set.lastLine-set.firstLine+1:0;
+	draws.resize(nSamples);
+
+	vector<double> values;
+	for(unsigned int t=0;t<nScoringTraces;t++){
+		for(unsigned long int k=1;k<set.firstLine&&traces[t].isOpen();k++){
+			traces[t].next(values);
+		}
+	}
+
+	const unsigned long int chunkSize = 1000;
+	vector<vector<vector<double> > > records(chunkSize,vector<vector<double> >(nScoringTraces));
+	for(unsigned long int chunk=0;chunk<nSamples;chunk+=chunkSize){
+		long int chunkEnd = chunk+chunkSize<nSamples?chunk+chunkSize:nSamples;
+		for(long int s=chunk;s<chunkEnd;s++){
+			for(unsigned int t=0;t<nScoringTraces;t++){
+				if(traces[t].isOpen()&&!traces[t].next(records[s-chunk][t])){
+					throw std::runtime_error(string("The ")+scoringTraceNames[t]+" trace has fewer sweeps than expected");
+				}
+			}
+		}
+		string errorMessage;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+#endif
+		for(long int s=chunk;s<chunkEnd;s++){
+			try{
+				scoringSweep(set,records[s-chunk],nOptimalClusters,draws[s]);
+			}catch(const std::exception& e){
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+				errorMessage=e.what();
+			}
+		}
+		if(errorMessage.size()>0){
+			throw std::runtime_error(errorMessage);
+		}
+	}
+
+}
+
+// Score the new subjects read from newData against the sweeps kept in draws,
+// writing one line per subject to out. The subjects are read in blocks of
+// blockSize. For each block the sweeps are visited in turn and the subjects
+// of the block are scored in parallel, so the results do not depend on the
+// number of threads. The marginal covariances of the observed continuous
+// covariates are factorised once per sweep for each missing pattern of the
+// block.
+static unsigned long int scoreBlocks(const scoringSettings& set,const vector<scoringDraw>& draws,
+		istream& newData,std::ostream& out,const unsigned long int& nOptimalClusters,
+		const unsigned long int& blockSize,const int& nThreads){
+
+	bool extraColumn = set.yModel.compare("Poisson")==0||set.yModel.compare("Binomial")==0;
+	unsigned int nD = set.xModel.compare("Normal")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nDiscreteCovs:set.nCovariates);
+	unsigned int nC = set.xModel.compare("Discrete")==0?0:
+			(set.xModel.compare("Mixed")==0?set.nContinuousCovs:set.nCovariates);
+	unsigned int nCatY = set.includeResponse?set.nCategoriesY:0;
+	unsigned long int nSamples = draws.size();
+
+	scoringBlock block;
+	block.nColumns = set.nCovariates+(set.includeResponse?set.nFixedEffects+(extraColumn?1:0):0);
+	block.values.resize(blockSize*block.nColumns);
+	block.pattern.resize(blockSize);
+
+	// The header
+	vector<string> columns;
+	for(unsigned int k=0;k<nCatY;k++){
+		std::ostringstream name;
+		name << "predictedY";
+		if(set.nCategoriesY>1){
+			name << k+1;
+		}
+		columns.push_back(name.str());
+	}
+	for(unsigned int k=0;k<nCatY;k++){
+		columns.push_back(columns[k]+"Var");
+	}
+	for(unsigned long int k=0;k<nOptimalClusters;k++){
+		std::ostringstream name;
+		name << "pCluster" << k+1;
+		columns.push_back(name.str());
+	}
+	for(unsigned long int k=0;k<columns.size();k++){
+		out << columns[k] << (k+1<columns.size()?" ":"\n");
+	}
+	out.precision(std::numeric_limits<double>::digits10);
+
+	unsigned long int nScored=0,lineNumber=0;
+	scoringSums sums;
+	vector<vector<double> > patternChol,patternLogDet;
+	while(readScoringBlock(newData,blockSize,lineNumber,block)){
+		Rprintf("Scoring subjects %lu to %lu\n",nScored+1,nScored+block.nRows);
+		long int nRows = block.nRows;
+
+		// Check the discrete covariates and find the missing patterns of the
+		// continuous covariates
+		block.observed.assign(1,vector<unsigned int>());
+		for(unsigned int j=0;j<nC;j++){
+			block.observed[0].push_back(j);
+		}
+		std::map<vector<unsigned int>,unsigned int> patterns;
+		for(long int i=0;i<nRows;i++){
+			const double* x = &(block.values[i*block.nColumns]);
+			for(unsigned int j=0;j<nD;j++){
+				if(x[j]!=-999&&(x[j]<0||x[j]>=set.nCategories[j]||x[j]!=floor(x[j]))){
+					std::ostringstream message;
+					message << "The discrete covariate " << j+1 << " of new subject " << nScored+i+1
+							<< " is not one of its categories 0 to " << set.nCategories[j]-1;
+					throw std::runtime_error(message.str());
+				}
+			}
+			block.pattern[i]=0;
+			if(set.useIndependentNormal){
+				continue;
+			}
+			vector<unsigned int> observed;
+			for(unsigned int j=0;j<nC;j++){
+				if(x[nD+j]!=-999){
+					observed.push_back(j);
+				}
+			}
+			if(observed.size()<nC){
+				std::map<vector<unsigned int>,unsigned int>::iterator it = patterns.find(observed);
+				if(it==patterns.end()){
+					it = patterns.insert(std::make_pair(observed,(unsigned int)block.observed.size())).first;
+					block.observed.push_back(observed);
+				}
+				block.pattern[i]=it->second;
+			}
+		}
+		unsigned int nPatterns = block.observed.size();
+		patternChol.resize(nPatterns);
+		patternLogDet.resize(nPatterns);
+
+		sums.yMean.assign(nRows*nCatY,0.0);
+		sums.yM2.assign(nRows*nCatY,0.0);
+		sums.optProb.assign(nRows*nOptimalClusters,0.0);
+		for(unsigned long int s=0;s<nSamples;s++){
+			const scoringDraw& draw = draws[s];
+			unsigned int nQ = draw.nClusters;
+			for(unsigned int pattern=1;pattern<nPatterns;pattern++){
+				unsigned long int nObs = block.observed[pattern].size();
+				patternChol[pattern].resize(nObs*nObs*nQ);
+				patternLogDet[pattern].resize(nQ);
+			}
+			string errorMessage;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+#endif
+			for(long int pq=nQ;pq<(long int)nPatterns*nQ;pq++){
+				unsigned int pattern = pq/nQ;
+				unsigned int q = pq%nQ;
+				const vector<unsigned int>& observed = block.observed[pattern];
+				unsigned int nObs = observed.size();
+				vector<double> chol(nObs*nObs);
+				for(unsigned int j=0;j<nObs;j++){
+					for(unsigned int l=0;l<nObs;l++){
+						chol[l+nObs*j]=draw.sigma[observed[l]+nC*(observed[j]+nC*q)];
+					}
+				}
+				try{
+					patternLogDet[pattern][q]=choleskyLower(chol,nObs);
+					std::copy(chol.begin(),chol.end(),patternChol[pattern].begin()+(unsigned long int)nObs*nObs*q);
+				}catch(const std::exception& e){
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+					errorMessage=e.what();
+				}
+			}
+			if(errorMessage.size()>0){
+				throw std::runtime_error(errorMessage);
+			}
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nThreads)
+#endif
+			{
+				scoringWork work;
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+				for(long int i=0;i<nRows;i++){
+					scoreSubject(set,draw,s,block,i,patternChol,patternLogDet,nOptimalClusters,work,sums);
+				}
+			}
+		}
+
+		// The posterior means and variances of the predicted responses and
+		// the mean allocation probabilities
+		for(long int i=0;i<nRows;i++){
+			const char* sep="";
+			for(unsigned int k=0;k<nCatY;k++){
+				out << sep << sums.yMean[k+nCatY*i];
+				sep=" ";
+			}
+			for(unsigned int k=0;k<nCatY;k++){
+				out << sep << (nSamples>1?sums.yM2[k+nCatY*i]/(nSamples-1):0.0);
+			}
+			for(unsigned long int k=0;k<nOptimalClusters;k++){
+				out << sep << sums.optProb[k+nOptimalClusters*i]/nSamples;
+				sep=" ";
+			}
+			out << "\n";
+		}
+		if(!out){
+			throw std::runtime_error("Unable to write the scores of the new subjects");
+		}
+		nScored+=block.nRows;
+	}
+	return nScored;
+
+}
+
+SEXP scoreSubjects(SEXP traces, SEXP settings, SEXP newDataFile, SEXP outFile, SEXP blockSize, SEXP nThreads){
+
+	Rcpp::List traceList(traces);
+	Rcpp::List settingList(settings);
+	scoringSettings set;
+	set.yModel = Rcpp::as<string>(settingList["yModel"]);
+	set.xModel = Rcpp::as<string>(settingList["xModel"]);
+	set.varSelectType = Rcpp::as<string>(settingList["varSelectType"]);
+	set.nSubjects = Rcpp::as<int>(settingList["nSubjects"]);
+	set.nPredictSubjects = Rcpp::as<int>(settingList["nPredictSubjects"]);
+	set.firstLine = Rcpp::as<int>(settingList["firstLine"]);
+	set.lastLine = Rcpp::as<int>(settingList["lastLine"]);
+	set.nCategoriesY = Rcpp::as<int>(settingList["nCategoriesY"]);
+	set.nCovariates = Rcpp::as<int>(settingList["nCovariates"]);
+	set.nDiscreteCovs = Rcpp::as<int>(settingList["nDiscreteCovs"]);
+	set.nContinuousCovs = Rcpp::as<int>(settingList["nContinuousCovs"]);
+	set.maxNCategories = Rcpp::as<int>(settingList["maxNCategories"]);
+	set.nFixedEffects = Rcpp::as<int>(settingList["nFixedEffects"]);
+	set.includeResponse = Rcpp::as<bool>(settingList["includeResponse"]);
+	set.weibullFixedShape = Rcpp::as<bool>(settingList["weibullFixedShape"]);
+	set.useIndependentNormal = Rcpp::as<bool>(settingList["useIndependentNormal"]);
+	set.nCategories = Rcpp::as<vector<int> >(settingList["nCategories"]);
+	set.nullPhi = Rcpp::as<vector<double> >(settingList["nullPhi"]);
+	set.nullMu = Rcpp::as<vector<double> >(settingList["nullMu"]);
+	set.restrictedMeanSurvival = Rcpp::as<double>(settingList["restrictedMeanSurvival"]);
+	set.clustering = Rcpp::as<vector<int> >(settingList["clustering"]);
+	string newDataName = Rcpp::as<string>(newDataFile);
+	string outName = Rcpp::as<string>(outFile);
+	long int bSize = Rcpp::as<int>(blockSize);
+	if(bSize<1){
+		bSize=1;
+	}
+	int nThr = Rcpp::as<int>(nThreads);
+	if(nThr<1){
+		nThr=1;
+	}
+
+	// Errors are returned to R, which stops with the message
+	unsigned long int nScored=0;
+	string errorMessage;
+	try{
+		unsigned long int nOptimalClusters=0;
+		for(unsigned long int i=0;i<set.clustering.size();i++){
+			if(set.clustering[i]<1){
+				throw std::runtime_error("The optimal clusters must be numbered from 1");
+			}
+			if((unsigned long int)set.clustering[i]>nOptimalClusters){
+				nOptimalClusters=set.clustering[i];
+			}
+		}
+		if(nOptimalClusters>0&&set.clustering.size()!=set.nSubjects){
+			throw std::runtime_error("The optimal clustering must have one cluster for each subject");
+		}
+		unsigned int nD = set.xModel.compare("Normal")==0?0:
+				(set.xModel.compare("Mixed")==0?set.nDiscreteCovs:set.nCovariates);
+		if(set.nCategories.size()<nD){
+			throw std::runtime_error("The number of categories of each discrete covariate is needed");
+		}
+
+		vector<traceReader> readers(nScoringTraces);
+		for(unsigned int t=0;t<nScoringTraces;t++){
+			SEXP trace = traceList[scoringTraceNames[t]];
+			if(Rf_isNull(trace)){
+				continue;
+			}else if(Rf_isString(trace)){
+				readers[t].open(Rcpp::as<string>(trace),set.nSubjects+set.nPredictSubjects);
+			}else{
+				Rcpp::List memoryTrace(trace);
+				vector<double> ends = Rcpp::as<vector<double> >(memoryTrace["recordEnd"]);
+				vector<unsigned long int> recordEnd(ends.begin(),ends.end());
+				readers[t].open(Rcpp::as<vector<double> >(memoryTrace["values"]),
+						recordEnd);
+			}
+		}
+		vector<scoringDraw> draws;
+		scoringDraws(set,readers,nOptimalClusters,nThr,draws);
+		for(unsigned int t=0;t<nScoringTraces;t++){
+			readers[t].close();
+		}
+		if(draws.size()==0){
+			throw std::runtime_error("There are no sweeps after the burn in to score the new subjects with");
+		}
+
+		// The new data are streamed from the file (which may be gzip
+		// compressed) and the scores written as each block is done
+		gzipInputBuffer newDataBuffer;
+		if(!newDataBuffer.open(newDataName)){
+			throw std::runtime_error("Unable to open the new data file "+newDataName);
+		}
+		istream newData(&newDataBuffer);
+		std::ofstream out(outName.c_str());
+		if(!out.is_open()){
+			throw std::runtime_error("Unable to open the output file "+outName);
+		}
+		nScored = scoreBlocks(set,draws,newData,out,nOptimalClusters,bSize,nThr);
+		newDataBuffer.close();
+		out.close();
+	}catch(const std::exception& e){
+		errorMessage=e.what();
+	}
+	if(errorMessage.size()>0){
+		return Rcpp::List::create(Rcpp::Named("error")=errorMessage);
+	}
+	return Rcpp::List::create(Rcpp::Named("nScored")=(double)nScored,
+			Rcpp::Named("nSamples")=(int)(set.lastLine>=set.firstLine?set.lastLine-set.firstLine+1:0));
+
+}
+
+// The dissimilarities between the fitting subjects, kept as calcDisSimMat
+// returns them (the lower triangle by column, as a dist object in R)
+// without expanding them to a full matrix. The values are either the
+// doubles themselves or the counts of a compact dissimilarity matrix. The
+// offset of the column of each subject is cached, so each dissimilarity is
+// a single lookup.
+template<class Values>
+class packedDissimilarity{
+
+	public:
+		packedDissimilarity(const Values& values,const unsigned long int& n) :
+				_values(values), _colOffset(n){
+			for(unsigned long int i=0;i<n;i++){
+				_colOffset[i]=(long int)(n*i)-(long int)((i*(i+1))/2)-(long int)i-1;
+			}
+		}
+
+		/// \brief Return the number of subjects
+		unsigned long int size() const{
+			return _colOffset.size();
+		}
+
+		/// \brief Return the dissimilarity between subjects i and j
+		double operator()(const unsigned long int& i,const unsigned long int& j) const{
+			if(i==j){
+				return 0.0;
+			}
+			return i<j?_values[_colOffset[i]+(long int)j]:_values[_colOffset[j]+(long int)i];
+		}
+
+	private:
+		Values _values;
+		vector<long int> _colOffset;
+
+};
+
+// The partition around medoids for one number of clusters, with the
+// clusters numbered in the order of their first subject
+struct pamClustering{
+	vector<unsigned long int> medoids,sizes;
+	vector<int> clustering;
+	double avgSilhouetteWidth;
+};
+
+// The BUILD phase of partitioning around medoids (Kaufman and Rousseeuw,
+// 1990), as in pam from the cluster package. Each medoid is chosen given
+// the previous ones, so the medoids for k clusters are the first k of the
+// sequence built once for the largest number of clusters.
+template<class Dissimilarity>
+static vector<unsigned long int> pamBuild(const Dissimilarity& d,const unsigned int& maxK,
+		const double& sentinel,const int& nThreads){
+	long int n = d.size();
+	vector<char> isMedoid(n,0);
+	vector<double> dNearest(n,sentinel),gain(n,0.0);
+	vector<unsigned long int> medoids;
+	for(unsigned int k=0;k<maxK;k++){
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThreads) schedule(static)
+#endif
+		for(long int i=0;i<n;i++){
+			if(isMedoid[i]){
+				continue;
+			}
+			double g=0.0;
+			for(long int j=0;j<n;j++){
+				double cmd = dNearest[j]-d(i,j);
+				if(cmd>0.0){
+					g+=cmd;
+				}
+			}
+			gain[i]=g;
+		}
+		long int best=-1;
+		double maxGain=0.0;
+		for(long int i=0;i<n;i++){
+			if(!isMedoid[i]&&maxGain<=gain[i]){
+				maxGain=gain[i];
+				best=i;
+			}
+		}
+		isMedoid[best]=1;
+		medoids.push_back(best);
+		for(long int j=0;j<n;j++){
+			double dBest = d(best,j);
+			if(dNearest[j]>dBest){
+				dNearest[j]=dBest;
+			}
+		}
+	}
+	return medoids;
+}
+
+// The SWAP phase of partitioning around medoids, the best swap of a medoid
+// and another subject is made until none decreases the total dissimilarity
+// to the nearest medoids. The sums run in the same order as in pam so that
+// ties are broken in the same way.
+template<class Dissimilarity>
+static void pamSwap(const Dissimilarity& d,vector<unsigned long int>& medoids,const double& sentinel){
+	unsigned long int n = d.size();
+	unsigned int k = medoids.size();
+	vector<char> isMedoid(n,0);
+	for(unsigned int m=0;m<k;m++){
+		isMedoid[medoids[m]]=1;
+	}
+	vector<double> dNearest(n),dSecond(n),dz(k);
+	// Whether medoid m is (one of) the nearest of subject j, at j*k+m
+	vector<char> isNearest(n*k);
+	double sky=0.0;
+	bool first=true;
+	while(true){
+		std::sort(medoids.begin(),medoids.end());
+		for(unsigned long int j=0;j<n;j++){
+			double dA=sentinel,dB=sentinel;
+			for(unsigned int m=0;m<k;m++){
+				double dij = d(medoids[m],j);
+				if(dA>dij){
+					dB=dA;
+					dA=dij;
+				}else if(dB>dij){
+					dB=dij;
+				}
+			}
+			dNearest[j]=dA;
+			dSecond[j]=dB;
+			for(unsigned int m=0;m<k;m++){
+				isNearest[j*k+m] = d(medoids[m],j)==dA;
+			}
+		}
+		if(first){
+			for(unsigned long int j=0;j<n;j++){
+				sky+=dNearest[j];
+			}
+			first=false;
+		}
+		double dzBest=1.0;
+		unsigned long int hBest=0;
+		unsigned int mBest=0;
+		for(unsigned long int h=0;h<n;h++){
+			if(isMedoid[h]){
+				continue;
+			}
+			dz.assign(k,0.0);
+			for(unsigned long int j=0;j<n;j++){
+				double dhj = d(h,j);
+				double nearTerm = -dNearest[j]+(dSecond[j]>dhj?dhj:dSecond[j]);
+				bool closer = dhj<dNearest[j];
+				const char* near = &(isNearest[j*k]);
+				for(unsigned int m=0;m<k;m++){
+					if(near[m]){
+						dz[m]+=nearTerm;
+					}else if(closer){
+						dz[m]+=(-dNearest[j]+dhj);
+					}
+				}
+			}
+			for(unsigned int m=0;m<k;m++){
+				if(dzBest>dz[m]){
+					dzBest=dz[m];
+					hBest=h;
+					mBest=m;
+				}
+			}
+		}
+		// A small tolerance stops swapping subjects at the same distance
+		if(!(dzBest< -16*std::numeric_limits<double>::epsilon()*fabs(sky))){
+			break;
+		}
+		isMedoid[medoids[mBest]]=0;
+		isMedoid[hBest]=1;
+		medoids[mBest]=hBest;
+		sky+=dzBest;
+	}
+}
+
+// Assign the subjects to their nearest medoids and compute the average
+// silhouette width of the clustering
+template<class Dissimilarity>
+static pamClustering pamSilhouette(const Dissimilarity& d,const vector<unsigned long int>& sortedMedoids,
+		const double& sentinel){
+	unsigned long int n = d.size();
+	unsigned int k = sortedMedoids.size();
+	pamClustering out;
+
+	// The nearest medoid of each subject (the first one of equally near
+	// medoids), the clusters are numbered in the order of their first subject
+	vector<int> medoidCluster(n,0);
+	for(unsigned int m=0;m<k;m++){
+		medoidCluster[sortedMedoids[m]]=-1;
+	}
+	out.clustering.resize(n);
+	out.medoids.clear();
+	int nNumbered=0;
+	for(unsigned long int j=0;j<n;j++){
+		unsigned long int nearest=j;
+		if(medoidCluster[j]==0){
+			double dMin=sentinel;
+			for(unsigned int m=0;m<k;m++){
+				double dmj = d(sortedMedoids[m],j);
+				if(dMin>dmj){
+					dMin=dmj;
+					nearest=sortedMedoids[m];
+				}
+			}
+		}
+		if(medoidCluster[nearest]<0){
+			medoidCluster[nearest]=++nNumbered;
+			out.medoids.push_back(nearest);
+		}
+		out.clustering[j]=medoidCluster[nearest];
+	}
+	out.sizes.assign(k,0);
+	for(unsigned long int j=0;j<n;j++){
+		out.sizes[out.clustering[j]-1]++;
+	}
+
+	// The silhouette of each subject compares its mean dissimilarity to its
+	// own cluster with the smallest mean dissimilarity to another cluster,
+	// each sum is over the subjects in order
+	vector<double> sil(n),clusterSum(k);
+	for(unsigned long int j=0;j<n;j++){
+		clusterSum.assign(k,0.0);
+		for(unsigned long int l=0;l<n;l++){
+			if(l!=j){
+				clusterSum[out.clustering[l]-1]+=d(j,l);
+			}
+		}
+		unsigned int own = out.clustering[j]-1;
+		double dysb = sentinel;
+		for(unsigned int c=0;c<k;c++){
+			if(c!=own){
+				double db = clusterSum[c]/(double)out.sizes[c];
+				if(dysb>db){
+					dysb=db;
+				}
+			}
+		}
+		if(out.sizes[own]==1){
+			sil[j]=0.0;
+			continue;
+		}
+		double dysa = clusterSum[own]/(double)(out.sizes[own]-1);
+		if(dysa>0.0){
+			if(dysb>0.0){
+				if(dysb>dysa){
+					sil[j]=1.0-dysa/dysb;
+				}else if(dysb<dysa){
+					sil[j]=dysb/dysa-1.0;
+				}else{
+					sil[j]=0.0;
+				}
+				sil[j]=sil[j]<-1.0?-1.0:(sil[j]>1.0?1.0:sil[j]);
+			}else{
+				sil[j]=-1.0;
+			}
+		}else{
+			sil[j]=dysb>0.0?1.0:0.0;
+		}
+	}
+
+	// The silhouettes of each cluster are summed in decreasing order
+	double total=0.0;
+	vector<double> clusterSil;
+	for(unsigned int c=0;c<k;c++){
+		clusterSil.clear();
+		for(unsigned long int j=0;j<n;j++){
+			if(out.clustering[j]==(int)c+1){
+				clusterSil.push_back(sil[j]);
+			}
+		}
+		std::sort(clusterSil.begin(),clusterSil.end(),std::greater<double>());
+		double clusterTotal=0.0;
+		for(unsigned long int j=0;j<clusterSil.size();j++){
+			clusterTotal+=clusterSil[j];
+		}
+		total+=clusterTotal;
+	}
+	out.avgSilhouetteWidth = total/(double)n;
+	return out;
+}
+
+// Partition the subjects around medoids for 2 to maxK clusters and choose
+// the number of clusters with the largest average silhouette width
+template<class Values>
+static SEXP pamOptimalClustering(const Values& values,const unsigned long int& nSj,
+		const unsigned int& maxK,const int& nThr){
+
+	packedDissimilarity<Values> d(values,nSj);
+	double dMax=0.0;
+	for(unsigned long int r=0;r<(nSj*(nSj-1))/2;r++){
+		if(dMax<values[r]){
+			dMax=values[r];
+		}
+	}
+	double sentinel = dMax*1.1+1.0;
+
+	vector<unsigned long int> built = pamBuild(d,maxK,sentinel,nThr);
+
+	// The numbers of clusters are tried in parallel, the largest first as
+	// they take longest
+	vector<pamClustering> results(maxK+1);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nThr) schedule(dynamic)
+#endif
+	for(long int kk=maxK;kk>=2;kk--){
+		vector<unsigned long int> medoids(built.begin(),built.begin()+kk);
+		pamSwap(d,medoids,sentinel);
+		std::sort(medoids.begin(),medoids.end());
+		results[kk]=pamSilhouette(d,medoids,sentinel);
+	}
+
+	// The first number of clusters with the largest average silhouette
+	// width is chosen
+	vector<double> avgSilhouetteWidth;
+	unsigned int chosenK=2;
+	for(unsigned int kk=2;kk<=maxK;kk++){
+		avgSilhouetteWidth.push_back(results[kk].avgSilhouetteWidth);
+		if(results[chosenK].avgSilhouetteWidth<results[kk].avgSilhouetteWidth){
+			chosenK=kk;
+		}
+	}
+	const pamClustering& chosen = results[chosenK];
+	vector<int> medoids(chosen.medoids.begin(),chosen.medoids.end());
+	for(unsigned int c=0;c<medoids.size();c++){
+		medoids[c]++;
+	}
+	vector<int> sizes(chosen.sizes.begin(),chosen.sizes.end());
+	return Rcpp::List::create(Rcpp::Named("nClusters")=(int)chosenK,
+			Rcpp::Named("clustering")=Rcpp::wrap<vector<int> >(chosen.clustering),
+			Rcpp::Named("clusterSizes")=Rcpp::wrap<vector<int> >(sizes),
+			Rcpp::Named("medoids")=Rcpp::wrap<vector<int> >(medoids),
+			Rcpp::Named("avgSilhouetteWidth")=Rcpp::wrap<vector<double> >(avgSilhouetteWidth));
+
+}
+
+// Return the compact dissimilarity matrix held by an external pointer, or
+// NULL (with the error message) if it is not one
+static const compactDisSimMat* compactDisSimMatPtr(SEXP disSimMat,string& error){
+	if(TYPEOF(disSimMat)!=EXTPTRSXP){
+		error = "The dissimilarity matrix is not a compact dissimilarity matrix";
+		return NULL;
+	}
+	Rcpp::XPtr<compactDisSimMat> ptr(disSimMat);
+	const compactDisSimMat* mat = ptr.get();
+	if(mat==NULL){
+		error = "The compact dissimilarity matrix is no longer available (it is not kept when the R session is saved), run calcDissimilarityMatrix again";
+	}
+	return mat;
+}
+
+SEXP calcPAMClustering(SEXP disSimMat, SEXP nSubjects, SEXP maxNClusters, SEXP nThreads){
+
+	unsigned long int nSj = Rcpp::as<int>(nSubjects);
+	unsigned int maxK = Rcpp::as<int>(maxNClusters);
+	int nThr = Rcpp::as<int>(nThreads);
+	if(nThr<1){
+		nThr=1;
+	}
+	if(maxK<2||maxK>=nSj){
+		return Rcpp::List::create(Rcpp::Named("error")=string("The maximum number of clusters must be at least 2 and less than the number of subjects"));
+	}
+
+	// A compact dissimilarity matrix is used as it is, without converting
+	// its counts to doubles
+	if(TYPEOF(disSimMat)==EXTPTRSXP){
+		string error;
+		const compactDisSimMat* mat = compactDisSimMatPtr(disSimMat,error);
+		if(mat==NULL){
+			return Rcpp::List::create(Rcpp::Named("error")=error);
+		}
+		if(mat->nSubjects!=nSj){
+			return Rcpp::List::create(Rcpp::Named("error")=string("The dissimilarity matrix does not match the number of subjects"));
+		}
+		return pamOptimalClustering(mat->values(),nSj,maxK,nThr);
+	}
+
+	Rcpp::NumericVector disSim(disSimMat);
+	if((unsigned long int)disSim.size()!=(nSj*(nSj-1))/2){
+		return Rcpp::List::create(Rcpp::Named("error")=string("The dissimilarity matrix does not match the number of subjects"));
+	}
+	const double* values = disSim.begin();
+	return pamOptimalClustering(values,nSj,maxK,nThr);
+
+}
+
+SEXP compactDisSimCounts(SEXP disSimMat){
+
+	string error;
+	const compactDisSimMat* mat = compactDisSimMatPtr(disSimMat,error);
+	if(mat==NULL){
+		return Rcpp::List::create(Rcpp::Named("error")=error);
+	}
+	unsigned long int nSj = mat->nSubjects;
+	Rcpp::IntegerMatrix counts(nSj,nSj);
+	unsigned long int r=0;
+	for(unsigned long int i=0;i<nSj;i++){
+		counts(i,i)=(int)mat->denom;
+		for(unsigned long int j=i+1;j<nSj;j++){
+			counts(i,j)=mat->coClustered[r];
+			counts(j,i)=mat->coClustered[r];
+			r++;
+		}
+	}
+	return Rcpp::List::create(Rcpp::Named("counts")=counts);
+
+}
+
+// The settings of the marginal model posterior, as margModelPosterior in R
+// reads them from the run. The covariates, response and fixed effects of the
+// fitting subjects are held by column.
+struct margModelSettings{
+	unsigned long int nSubjects,nPredictSubjects,firstLine,lastLine;
+	unsigned int nCovariates,nFixedEffects;
+	bool includeResponse;
+	vector<int> nCategories,xMat;
+	vector<double> aPhi,yMat,wMat;
+	double alpha,sigmaTheta,dofTheta,sigmaBeta,dofBeta;
+	// The constants of the Student t priors of each theta and beta
+	double constantTheta,constantBeta;
+};
+
+// The workspace for the marginal model posterior of one partition, which is
+// kept by each thread and reused for its partitions
+struct margModelWork{
+	vector<int> labels;
+	vector<unsigned int> cluster;
+	vector<unsigned long int> sizes,counts;
+	vector<double> par,step,grad,hessian,chol;
+	vector<double> trialPar,trialGrad,trialHessian;
+	vector<double> eta,residual,weight;
+};
+
+// The number of Newton iterations for the Laplace approximation of p(Y|Z,W)
+const unsigned int margModelMaxIterations = 100;
+const double margModelLogTwoPi = 1.83787706640934548356;
+
+// Number the clusters of the partition z from 0 in the increasing order of
+// their labels (the order of table(z) in R), setting the cluster of each
+// subject and the cluster sizes. Returns the number of clusters.
+static unsigned int margModelClusters(const margModelSettings& set,const vector<int>& z,
+		margModelWork& work){
+
+	unsigned long int nSj = set.nSubjects;
+	work.labels.assign(z.begin(),z.begin()+nSj);
+	std::sort(work.labels.begin(),work.labels.end());
+	work.labels.erase(std::unique(work.labels.begin(),work.labels.end()),work.labels.end());
+	unsigned int nC = work.labels.size();
+	work.cluster.resize(nSj);
+	work.sizes.assign(nC,0);
+	for(unsigned long int i=0;i<nSj;i++){
+		work.cluster[i]=std::lower_bound(work.labels.begin(),work.labels.end(),z[i])-work.labels.begin();
+		work.sizes[work.cluster[i]]++;
+	}
+	return nC;
+
+}
+
+// log p(Z|alpha)+log p(X|Z) for the discrete covariates, with phi integrated
+// out. The category counts of every cluster and covariate are made in one
+// pass over the covariates.
+static double margModelPZPX(const margModelSettings& set,const unsigned int& nC,
+		margModelWork& work){
+
+	unsigned long int nSj = set.nSubjects;
+	unsigned int nCov = set.nCovariates;
+	vector<unsigned long int> catOffset(nCov+1,0);
+	for(unsigned int j=0;j<nCov;j++){
+		catOffset[j+1]=catOffset[j]+set.nCategories[j];
+	}
+	unsigned long int sumNCat = catOffset[nCov];
+	work.counts.assign(nC*sumNCat,0);
+	for(unsigned int j=0;j<nCov;j++){
+		const int* x = &(set.xMat[j*nSj]);
+		for(unsigned long int i=0;i<nSj;i++){
+			work.counts[work.cluster[i]*sumNCat+catOffset[j]+x[i]]++;
+		}
+	}
+
+	double out = 0.0;
+	for(unsigned int j=0;j<nCov;j++){
+		double nCat = set.nCategories[j];
+		out+=nC*(LogGamma(nCat*set.aPhi[j])-nCat*LogGamma(set.aPhi[j]));
+	}
+	for(unsigned int c=0;c<nC;c++){
+		for(unsigned int j=0;j<nCov;j++){
+			out-=LogGamma(set.nCategories[j]*set.aPhi[j]+work.sizes[c]);
+			for(unsigned long int k=catOffset[j];k<catOffset[j+1];k++){
+				out+=LogGamma(work.counts[c*sumNCat+k]+set.aPhi[j]);
+			}
+		}
+	}
+	double a = set.alpha;
+	out+=nC*log(a)+LogGamma(nSj+1.0)+LogGamma(a)-LogGamma(a+nSj);
+
+	// The number of clusters of each size
+	vector<unsigned long int> sizes(work.sizes);
+	std::sort(sizes.begin(),sizes.end());
+	for(unsigned int c=0;c<nC;){
+		unsigned int d=c;
+		while(d<nC&&sizes[d]==sizes[c]){
+			d++;
+		}
+		out-=(d-c)*log((double)sizes[c])+LogGamma(d-c+1.0);
+		c=d;
+	}
+	return out;
+
+}
+
+// The negative log posterior of theta and beta for the Bernoulli response
+// given the partition, divided by the number of subjects, and its gradient,
+// which are computed together from one pass over the subjects. The Hessian
+// is computed in the same pass if hessian is not NULL. The parameters are
+// the theta of the nC clusters followed by the beta of the fixed effects.
+static double margModelBernoulli(const margModelSettings& set,const unsigned int& nC,
+		const vector<double>& par,margModelWork& work,vector<double>& grad,
+		vector<double>* hessian){
+
+	unsigned long int nSj = set.nSubjects;
+	unsigned int nFE = set.nFixedEffects;
+	unsigned int nPar = nC+nFE;
+
+	work.eta.resize(nSj);
+	work.residual.resize(nSj);
+	work.weight.resize(nSj);
+	for(unsigned long int i=0;i<nSj;i++){
+		work.eta[i]=par[work.cluster[i]];
+	}
+	for(unsigned int k=0;k<nFE;k++){
+		const double* w = &(set.wMat[k*nSj]);
+		double beta = par[nC+k];
+		for(unsigned long int i=0;i<nSj;i++){
+			work.eta[i]+=w[i]*beta;
+		}
+	}
+
+	double logLik=0.0;
+	grad.assign(nPar,0.0);
+	if(hessian){
+		hessian->assign(nPar*nPar,0.0);
+	}
+	for(unsigned long int i=0;i<nSj;i++){
+		double eta = work.eta[i];
+		double y = set.yMat[i];
+		// log(1+exp(eta)) and the fitted probability, without overflow
+		double p,log1pExp;
+		if(eta>0){
+			double e = exp(-eta);
+			p = 1.0/(1.0+e);
+			log1pExp = eta+log1p(e);
+		}else{
+			double e = exp(eta);
+			p = e/(1.0+e);
+			log1pExp = log1p(e);
+		}
+		logLik+=y*eta-log1pExp;
+		work.residual[i]=y-p;
+		work.weight[i]=p*(1.0-p);
+		grad[work.cluster[i]]-=work.residual[i];
+		if(hessian){
+			(*hessian)[work.cluster[i]*(nPar+1)]+=work.weight[i];
+		}
+	}
+	for(unsigned int k=0;k<nFE;k++){
+		const double* w = &(set.wMat[k*nSj]);
+		double g=0.0;
+		for(unsigned long int i=0;i<nSj;i++){
+			g+=w[i]*work.residual[i];
+		}
+		grad[nC+k]=-g;
+		if(hessian){
+			vector<double>& h = *hessian;
+			for(unsigned long int i=0;i<nSj;i++){
+				double ww = w[i]*work.weight[i];
+				h[work.cluster[i]*nPar+nC+k]+=ww;
+				for(unsigned int l=0;l<=k;l++){
+					h[(nC+l)*nPar+nC+k]+=set.wMat[l*nSj+i]*ww;
+				}
+			}
+		}
+	}
+
+	// The Student t priors of theta and beta
+	double logPrior=0.0;
+	double scaleTheta = set.dofTheta*set.sigmaTheta*set.sigmaTheta;
+	for(unsigned int c=0;c<nC;c++){
+		double theta = par[c];
+		double sq = theta*theta;
+		logPrior-=0.5*(set.dofTheta+1)*log(set.dofTheta+sq/(set.sigmaTheta*set.sigmaTheta));
+		grad[c]+=(set.dofTheta+1)*theta/(scaleTheta+sq);
+		if(hessian){
+			(*hessian)[c*(nPar+1)]+=(set.dofTheta+1)*(scaleTheta-sq)/((scaleTheta+sq)*(scaleTheta+sq));
+		}
+	}
+	double scaleBeta = set.dofBeta*set.sigmaBeta*set.sigmaBeta;
+	for(unsigned int k=0;k<nFE;k++){
+		double beta = par[nC+k];
+		double sq = beta*beta;
+		logPrior-=0.5*(set.dofBeta+1)*log(set.dofBeta+sq/(set.sigmaBeta*set.sigmaBeta));
+		grad[nC+k]+=(set.dofBeta+1)*beta/(scaleBeta+sq);
+		if(hessian){
+			(*hessian)[(nC+k)*(nPar+1)]+=(set.dofBeta+1)*(scaleBeta-sq)/((scaleBeta+sq)*(scaleBeta+sq));
+		}
+	}
+	double constants = nC*set.constantTheta+nFE*set.constantBeta;
+
+	for(unsigned int k=0;k<nPar;k++){
+		grad[k]/=nSj;
+	}
+	if(hessian){
+		// Only the upper triangle has been filled
+		vector<double>& h = *hessian;
+		for(unsigned int k=0;k<nPar;k++){
+			for(unsigned int l=k;l<nPar;l++){
+				h[k*nPar+l]/=nSj;
+				h[l*nPar+k]=h[k*nPar+l];
+			}
+		}
+	}
+	return -(logLik+logPrior+constants)/nSj;
+
+}
+
+// log p(Y|Z,W) by the Laplace approximation, at the mode of the posterior of
+// theta and beta found by Newton's method with a backtracking line search.
+// The Hessian is shifted towards the identity where it is not positive
+// definite.
+static double margModelPY(const margModelSettings& set,const unsigned int& nC,
+		margModelWork& work){
+
+	unsigned long int nSj = set.nSubjects;
+	unsigned int nPar = nC+set.nFixedEffects;
+	work.par.assign(nPar,0.0);
+	work.step.resize(nPar);
+	double value = margModelBernoulli(set,nC,work.par,work,work.grad,&work.hessian);
+	double logDet=0.0;
+	for(unsigned int iter=0;iter<margModelMaxIterations;iter++){
+		double shift=0.0;
+		while(true){
+			work.chol=work.hessian;
+			for(unsigned int k=0;k<nPar;k++){
+				work.chol[k*(nPar+1)]+=shift;
+			}
+			if(choleskyLowerIfPositive(work.chol,nPar,logDet)){
+				break;
+			}
+			shift = shift>0?10*shift:1e-8;
+			if(!(shift<1e8)){
+				throw std::runtime_error("The Laplace approximation of p(Y|Z,W) failed, its Hessian is not finite");
+			}
+		}
+		// The Newton step solves (L L') step = -grad
+		for(unsigned int k=0;k<nPar;k++){
+			double v=-work.grad[k];
+			for(unsigned int l=0;l<k;l++){
+				v-=work.chol[k*nPar+l]*work.step[l];
+			}
+			work.step[k]=v/work.chol[k*(nPar+1)];
+		}
+		for(unsigned int k=nPar;k-->0;){
+			double v=work.step[k];
+			for(unsigned int l=k+1;l<nPar;l++){
+				v-=work.chol[l*nPar+k]*work.step[l];
+			}
+			work.step[k]=v/work.chol[k*(nPar+1)];
+		}
+		double slope=0.0;
+		for(unsigned int k=0;k<nPar;k++){
+			slope+=work.grad[k]*work.step[k];
+		}
+		// Stop once the predicted decrease of the log posterior is negligible,
+		// after this last step (which the Hessian at the mode is sensitive to)
+		if(-slope*nSj<1e-12){
+			for(unsigned int k=0;k<nPar;k++){
+				work.par[k]+=work.step[k];
+			}
+			value = margModelBernoulli(set,nC,work.par,work,work.grad,&work.hessian);
+			break;
+		}
+		double t=1.0,trialValue=value;
+		work.trialPar.resize(nPar);
+		while(t>1e-10){
+			for(unsigned int k=0;k<nPar;k++){
+				work.trialPar[k]=work.par[k]+t*work.step[k];
+			}
+			trialValue = margModelBernoulli(set,nC,work.trialPar,work,work.trialGrad,&work.trialHessian);
+			if(trialValue<=value+1e-4*t*slope){
+				break;
+			}
+			t*=0.5;
+		}
+		if(!(t>1e-10)){
+			break;
+		}
+		work.par.swap(work.trialPar);
+		work.grad.swap(work.trialGrad);
+		work.hessian.swap(work.trialHessian);
+		value=trialValue;
+	}
+
+	work.chol=work.hessian;
+	if(!choleskyLowerIfPositive(work.chol,nPar,logDet)){
+		// As log(det()) in R, of a Hessian that is not positive definite
+		logDet=std::numeric_limits<double>::quiet_NaN();
+	}
+	return -(double)nSj*value+0.5*logDet-nPar*0.5*log((double)nSj)+nPar*0.5*margModelLogTwoPi;
+
+}
+
+// The log marginal model posterior of the partition z of the fitting
+// subjects
+static double margModelPartition(const margModelSettings& set,const vector<int>& z,
+		margModelWork& work){
+
+	unsigned int nC = margModelClusters(set,z,work);
+	double out = margModelPZPX(set,nC,work);
+	if(set.includeResponse){
+		out+=margModelPY(set,nC,work);
+	}
+	return out;
+
+}
+
+SEXP margModPosterior(SEXP zTrace, SEXP allocations, SEXP settings, SEXP nThreads){
+
+	Rcpp::List settingList(settings);
+	margModelSettings set;
+	set.nSubjects = Rcpp::as<int>(settingList["nSubjects"]);
+	set.nPredictSubjects = Rcpp::as<int>(settingList["nPredictSubjects"]);
+	set.firstLine = Rcpp::as<int>(settingList["firstLine"]);
+	set.lastLine = Rcpp::as<int>(settingList["lastLine"]);
+	set.nCovariates = Rcpp::as<int>(settingList["nCovariates"]);
+	set.nFixedEffects = Rcpp::as<int>(settingList["nFixedEffects"]);
+	set.includeResponse = Rcpp::as<bool>(settingList["includeResponse"]);
+	set.nCategories = Rcpp::as<vector<int> >(settingList["nCategories"]);
+	set.xMat = Rcpp::as<vector<int> >(settingList["xMat"]);
+	set.aPhi = Rcpp::as<vector<double> >(settingList["aPhi"]);
+	set.yMat = Rcpp::as<vector<double> >(settingList["yMat"]);
+	set.wMat = Rcpp::as<vector<double> >(settingList["wMat"]);
+	set.alpha = Rcpp::as<double>(settingList["alpha"]);
+	set.sigmaTheta = Rcpp::as<double>(settingList["sigmaTheta"]);
+	set.dofTheta = Rcpp::as<double>(settingList["dofTheta"]);
+	set.sigmaBeta = Rcpp::as<double>(settingList["sigmaBeta"]);
+	set.dofBeta = Rcpp::as<double>(settingList["dofBeta"]);
+	set.constantTheta = Rcpp::as<double>(settingList["constantTheta"]);
+	set.constantBeta = Rcpp::as<double>(settingList["constantBeta"]);
+	int nThr = Rcpp::as<int>(nThreads);
+	if(nThr<1){
+		nThr=1;
+	}
+
+	// Errors are returned to R, which stops with the message
+	vector<double> margModPost;
+	string errorMessage;
+	try{
+		unsigned long int nSj = set.nSubjects;
+		if(set.nCategories.size()<set.nCovariates||set.aPhi.size()<set.nCovariates||
+				set.xMat.size()!=nSj*set.nCovariates){
+			throw std::runtime_error("The covariates do not match the number of subjects and covariates");
+		}
+		for(unsigned int j=0;j<set.nCovariates;j++){
+			for(unsigned long int i=0;i<nSj;i++){
+				int x = set.xMat[j*nSj+i];
+				if(x<0||x>=set.nCategories[j]){
+					throw std::runtime_error("The discrete covariates must be coded from 0 to the number of categories minus 1");
+				}
+			}
+		}
+		if(set.includeResponse&&(set.yMat.size()!=nSj||set.wMat.size()!=nSj*set.nFixedEffects)){
+			throw std::runtime_error("The response and fixed effects do not match the number of subjects");
+		}
+
+		// The partitions are either the allocations of the sweeps, read from
+		// the trace, or the rows of allocations
+		traceReader reader;
+		vector<int> given;
+		unsigned long int nPartitions;
+		if(!Rf_isNull(zTrace)){
+			if(Rf_isString(zTrace)){
+				reader.open(Rcpp::as<string>(zTrace),nSj+set.nPredictSubjects);
+			}else{
+				Rcpp::List memoryTrace(zTrace);
+				vector<double> ends = Rcpp::as<vector<double> >(memoryTrace["recordEnd"]);
+				vector<unsigned long int> recordEnd(ends.begin(),ends.end());
+				reader.open(Rcpp::as<vector<double> >(memoryTrace["values"]),recordEnd);
+			}
+			vector<double> values;
+			for(unsigned long int k=1;k<set.firstLine;k++){
+				reader.next(values);
+			}
+			nPartitions = set.lastLine>=set.firstLine?set.lastLine-set.firstLine+1:0;
+		}else{
+			given = Rcpp::as<vector<int> >(allocations);
+			nPartitions = nSj>0?given.size()/nSj:0;
+		}
+		margModPost.resize(nPartitions);
+
+		// The partitions are evaluated in parallel in chunks, each thread
+		// reusing its workspace
+		const unsigned long int chunkSize = 1000;
+		vector<vector<int> > z(chunkSize);
+		vector<double> values;
+		for(unsigned long int chunk=0;chunk<nPartitions;chunk+=chunkSize){
+			long int chunkEnd = chunk+chunkSize<nPartitions?chunk+chunkSize:nPartitions;
+			for(long int s=chunk;s<chunkEnd;s++){
+				if(reader.isOpen()){
+					if(!reader.next(values)||values.size()<nSj){
+						throw std::runtime_error("The allocation trace has fewer sweeps than expected");
+					}
+					z[s-chunk].assign(values.begin(),values.begin()+nSj);
+				}else{
+					z[s-chunk].assign(given.begin()+s*nSj,given.begin()+(s+1)*nSj);
+				}
+			}
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nThr)
+#endif
+			{
+				margModelWork work;
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+				for(long int s=chunk;s<chunkEnd;s++){
+					try{
+						margModPost[s]=margModelPartition(set,z[s-chunk],work);
+					}catch(const std::exception& e){
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+						errorMessage=e.what();
+					}
+				}
+			}
+			if(errorMessage.size()>0){
+				throw std::runtime_error(errorMessage);
+			}
+		}
+		reader.close();
+	}catch(const std::exception& e){
+		errorMessage=e.what();
+	}
+	if(errorMessage.size()>0){
+		return Rcpp::List::create(Rcpp::Named("error")=errorMessage);
 	}
+	return Rcpp::List::create(Rcpp::Named("margModPost")=margModPost);
 
-	return Rcpp::wrap(out);
 }
 
 
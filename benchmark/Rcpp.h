@@ -0,0 +1,255 @@
+/// \file Rcpp.h
+/// \brief Stand-in for the parts of R and Rcpp used by the PReMiuM sources,
+/// so that the sampler and the post-processing can be compiled without R for
+/// the benchmarks.
+
+/// \note Only the scalar arguments of the R entry points can be read, from
+/// the values made by benchmarkArg. The vectors and lists exchanged with R
+/// are empty stand-ins, so the entry points can only be called with options
+/// that read their input from files, and their results are discarded. The
+/// messages are written to standard error, so that standard output only holds
+/// the results of the benchmarks.
+
+#ifndef BENCHMARK_RCPP_H_
+#define BENCHMARK_RCPP_H_
+
+#include<string>
+#include<vector>
+#include<cstdio>
+#include<cstdarg>
+#include<type_traits>
+
+/// \brief A scalar argument of an R entry point
+struct SEXPREC{
+	bool isString;
+	std::string stringValue;
+	double value;
+};
+typedef SEXPREC* SEXP;
+
+/// \brief Makes a numeric or logical argument for an R entry point, which
+/// lives as long as the program
+inline SEXP benchmarkArg(const double& value){
+	SEXP x = new SEXPREC();
+	x->isString = false;
+	x->value = value;
+	return x;
+}
+
+/// \brief Makes a character argument for an R entry point, which lives as
+/// long as the program
+inline SEXP benchmarkArg(const std::string& value){
+	SEXP x = new SEXPREC();
+	x->isString = true;
+	x->stringValue = value;
+	x->value = 0.0;
+	return x;
+}
+
+#define RcppExport extern "C"
+#define R_NilValue ((SEXP)0)
+#define EXTPTRSXP 22
+
+inline int TYPEOF(SEXP){
+	return 0;
+}
+
+inline bool Rf_isString(SEXP x){
+	return x&&x->isString;
+}
+
+inline bool Rf_isNull(SEXP x){
+	return !x;
+}
+
+inline void Rprintf(const char* format,...){
+	va_list args;
+	va_start(args,format);
+	vfprintf(stderr,format,args);
+	va_end(args);
+}
+
+inline void REprintf(const char* format,...){
+	va_list args;
+	va_start(args,format);
+	vfprintf(stderr,format,args);
+	va_end(args);
+}
+
+inline void R_CheckUserInterrupt(){
+}
+
+typedef enum{FALSE=0,TRUE} Rboolean;
+
+/// \brief Runs the function, which can not be interrupted without R
+inline Rboolean R_ToplevelExec(void (*f)(void*),void* data){
+	f(data);
+	return TRUE;
+}
+
+namespace Rcpp{
+
+	/// \brief An element of the stand-in vectors and lists, which reads as 0
+	/// and ignores what is assigned to it
+	class Element{
+		public:
+			template<class T> Element& operator=(const T&){
+				return *this;
+			}
+			operator double() const{
+				return 0.0;
+			}
+			operator SEXP() const{
+				return R_NilValue;
+			}
+			bool operator==(const Element&) const{
+				return true;
+			}
+			template<class Index> typename std::enable_if<std::is_integral<Index>::value,Element>::type
+					operator[](const Index&) const{
+				return Element();
+			}
+			Element operator[](const std::string&) const{
+				return Element();
+			}
+	};
+
+	/// \brief The stand-in for the vectors, matrices and lists of Rcpp,
+	/// which are always empty
+	template<int RTYPE> class Vector{
+		public:
+			Vector(){}
+			Vector(SEXP){}
+			Vector(const int&){}
+			Vector(const int&,const double&){}
+			template<class Iterator> Vector(Iterator,Iterator,
+					typename std::enable_if<!std::is_arithmetic<Iterator>::value>::type* =0){}
+			int size() const{
+				return 0;
+			}
+			int length() const{
+				return 0;
+			}
+			int nrow() const{
+				return 0;
+			}
+			int ncol() const{
+				return 0;
+			}
+			template<class Index> typename std::enable_if<std::is_integral<Index>::value,Element>::type
+					operator[](const Index&) const{
+				return Element();
+			}
+			Element operator[](const std::string&) const{
+				return Element();
+			}
+			Element operator()(const int&) const{
+				return Element();
+			}
+			Element operator()(const int&,const int&) const{
+				return Element();
+			}
+			double* begin(){
+				return 0;
+			}
+			double* end(){
+				return 0;
+			}
+			template<class T> void push_back(const T&){}
+			template<class T> void push_back(const T&,const std::string&){}
+			Element attr(const std::string&){
+				return Element();
+			}
+			Element names(){
+				return Element();
+			}
+			bool containsElementNamed(const char*) const{
+				return false;
+			}
+			operator SEXP() const{
+				return R_NilValue;
+			}
+			template<class... Args> static Vector create(const Args&...){
+				return Vector();
+			}
+	};
+
+	typedef Vector<0> List;
+	typedef Vector<1> NumericVector;
+	typedef Vector<2> IntegerVector;
+	typedef Vector<3> NumericMatrix;
+	typedef Vector<4> IntegerMatrix;
+	typedef Vector<5> CharacterVector;
+	typedef Vector<6> LogicalVector;
+
+	/// \brief The stand-in for a named element of a list
+	class NamedElement{
+		public:
+			template<class T> NamedElement& operator=(const T&){
+				return *this;
+			}
+	};
+
+	inline NamedElement Named(const char*){
+		return NamedElement();
+	}
+
+	/// \brief The stand-in for an external pointer, which does not own the
+	/// object
+	template<class T> class XPtr{
+		public:
+			XPtr(SEXP) : _ptr(0) {}
+			XPtr(T* ptr,const bool& =true) : _ptr(ptr) {}
+			T* get() const{
+				return _ptr;
+			}
+			T* operator->() const{
+				return _ptr;
+			}
+			T& operator*() const{
+				return *_ptr;
+			}
+			operator SEXP() const{
+				return R_NilValue;
+			}
+		private:
+			T* _ptr;
+	};
+
+	namespace traits{
+		template<class T,class Enable=void> struct benchmarkAs{
+			static T get(SEXP){
+				return T();
+			}
+		};
+		template<class T> struct benchmarkAs<T,typename std::enable_if<std::is_arithmetic<T>::value>::type>{
+			static T get(SEXP x){
+				return x?static_cast<T>(x->value):T();
+			}
+		};
+		template<> struct benchmarkAs<std::string>{
+			static std::string get(SEXP x){
+				return x?x->stringValue:std::string();
+			}
+		};
+	}
+
+	template<class T> T as(SEXP x){
+		return traits::benchmarkAs<T>::get(x);
+	}
+
+	template<class T> T as(const Element&){
+		return T();
+	}
+
+	template<class T> SEXP wrap(const T&){
+		return R_NilValue;
+	}
+
+	inline void stop(const std::string& message){
+		REprintf("%s\n",message.c_str());
+	}
+
+}
+
+#endif /* BENCHMARK_RCPP_H_ */
@@ -0,0 +1,419 @@
+/// \file benchmark.cpp
+/// \brief Benchmarks of the PReMiuM sampler and post-processing, which are
+/// built without R (see the Makefile in this directory).
+
+/// \note (C) Copyright David Hastie and Silvia Liverani, 2012.
+
+/// PReMiuM++ is free software; you can redistribute it and/or modify it under the
+/// terms of the GNU Lesser General Public License as published by the Free Software
+/// Foundation; either version 3 of the License, or (at your option) any later
+/// version.
+
+/// PReMiuM++ is distributed in the hope that it will be useful, but WITHOUT ANY
+/// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+/// PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+
+/// You should have received a copy of the GNU Lesser General Public License
+/// along with PReMiuM++ in the documentation directory. If not, see
+/// <http://www.gnu.org/licenses/>.
+
+/// For each scenario and each combination of the number of subjects N, of
+/// covariates p and of clusters K, the benchmark writes a data set following
+/// the clusSummary scenario of the same name used by generateSampleDataFile
+/// (K clusters of equal size, whose covariate profiles and theta are spread
+/// as in the R scenarios), and times
+///  - importPReMiuMData, reading the data file,
+///  - sweep, full sweeps of the sampler (after nWarmup sweeps), including
+///    the writing of the output,
+///  - gibbsForZ, logCondPostBeta, pReMiuMLogPost and writePReMiuMOutput on
+///    the state at the end of the sweeps,
+///  - calcDisSimMat, on the allocations written by the sweeps.
+/// Each line of the standard output gives the time of one kernel, with the
+/// number of calls per second (sweeps per second for the full sweeps) and
+/// the number of subjects times clusters per second, where the clusters are
+/// the (mean) number of clusters of the sampler. The messages of the sampler
+/// go to the standard error.
+///
+/// Usage: premiumBenchmark [--scenarios=BernoulliDiscrete,NormalNormal,BernoulliMixed]
+///		[--N=1000,10000] [--p=5,20] [--K=5,20] [--nSweeps=100] [--nWarmup=20]
+///		[--nThreads=1] [--seed=1] [--dir=.]
+
+#include<string>
+#include<vector>
+#include<sstream>
+#include<fstream>
+#include<iostream>
+#include<chrono>
+#include<cstdlib>
+#include<cmath>
+
+#include "PReMiuM.cpp"
+#include "postProcess.cpp"
+
+using std::string;
+using std::vector;
+using std::ostringstream;
+using std::istringstream;
+
+typedef mcmcSampler<pReMiuMParams,pReMiuMOptions,pReMiuMPropParams,pReMiuMData> benchmarkSampler;
+
+/// \brief The options of the benchmark
+struct benchmarkOptions{
+	benchmarkOptions() : nSweeps(100), nWarmup(20), nThreads(1), seed(1), dir(".") {
+		scenarios.push_back("BernoulliDiscrete");
+		scenarios.push_back("NormalNormal");
+		scenarios.push_back("BernoulliMixed");
+		N.push_back(1000);
+		N.push_back(10000);
+		p.push_back(5);
+		p.push_back(20);
+		K.push_back(5);
+		K.push_back(20);
+	}
+	vector<string> scenarios;
+	vector<unsigned int> N,p,K;
+	unsigned int nSweeps,nWarmup,nThreads,seed;
+	string dir;
+};
+
+/// \brief The values of a comma separated list
+vector<string> splitList(const string& list){
+	vector<string> values;
+	istringstream iss(list);
+	string value;
+	while(std::getline(iss,value,',')){
+		if(!value.empty()){
+			values.push_back(value);
+		}
+	}
+	return values;
+}
+
+/// \brief The values of a comma separated list of numbers
+vector<unsigned int> splitNumbers(const string& list){
+	vector<string> values = splitList(list);
+	vector<unsigned int> numbers(values.size());
+	for(unsigned int k=0;k<values.size();k++){
+		numbers[k]=(unsigned int)atoi(values[k].c_str());
+	}
+	return numbers;
+}
+
+/// \brief Reads the options of the benchmark, returns false if one is not
+/// recognised
+bool readBenchmarkOptions(int argc,char** argv,benchmarkOptions& options){
+	for(int k=1;k<argc;k++){
+		string arg(argv[k]);
+		size_t pos = arg.find('=');
+		string name = arg.substr(0,pos);
+		string value = pos==string::npos?string():arg.substr(pos+1);
+		if(name.compare("--scenarios")==0){
+			options.scenarios = splitList(value);
+		}else if(name.compare("--N")==0){
+			options.N = splitNumbers(value);
+		}else if(name.compare("--p")==0){
+			options.p = splitNumbers(value);
+		}else if(name.compare("--K")==0){
+			options.K = splitNumbers(value);
+		}else if(name.compare("--nSweeps")==0){
+			options.nSweeps = (unsigned int)atoi(value.c_str());
+		}else if(name.compare("--nWarmup")==0){
+			options.nWarmup = (unsigned int)atoi(value.c_str());
+		}else if(name.compare("--nThreads")==0){
+			options.nThreads = (unsigned int)atoi(value.c_str());
+		}else if(name.compare("--seed")==0){
+			options.seed = (unsigned int)atoi(value.c_str());
+		}else if(name.compare("--dir")==0){
+			options.dir = value;
+		}else{
+			Rprintf("Unknown option %s\n",arg.c_str());
+			return false;
+		}
+	}
+	for(unsigned int k=0;k<options.scenarios.size();k++){
+		const string& scenario = options.scenarios[k];
+		if(scenario.compare("BernoulliDiscrete")!=0&&scenario.compare("NormalNormal")!=0&&
+				scenario.compare("BernoulliMixed")!=0){
+			Rprintf("Unknown scenario %s\n",scenario.c_str());
+			return false;
+		}
+	}
+	return options.nSweeps>0;
+}
+
+/// \brief Writes a data file for the scenario, in the format of the input
+/// files of profRegr. The outcome and covariate models of the scenarios are
+/// those of clusSummaryBernoulliDiscrete, clusSummaryNormalNormal and
+/// clusSummaryBernoulliMixed, with N subjects in K clusters of equal size, p
+/// covariates (half of them discrete for the mixed scenario) and two fixed
+/// effects. The discrete covariates have 3 categories, cluster k having
+/// probability 0.8 for the category given by digit j of k in base 3 for
+/// covariate j (0.1 for the others), and the continuous covariates have
+/// unit variance around means 4 times these digits. Theta decreases
+/// linearly over the clusters, from log(9) to log(1/9) for the Bernoulli
+/// outcome and from 5 to -5 for the Normal outcome.
+void writeScenarioData(const string& scenario,const unsigned int& nSubjects,
+		const unsigned int& nCovariates,const unsigned int& nClusters,
+		baseGeneratorType& rndGenerator,const string& fileName){
+
+	randomUniform unifRand(0,1);
+	randomNormal normRand(0,1);
+	bool normalOutcome = scenario.compare("NormalNormal")==0;
+	unsigned int nDiscreteCovs = 0;
+	if(scenario.compare("BernoulliDiscrete")==0){
+		nDiscreteCovs = nCovariates;
+	}else if(scenario.compare("BernoulliMixed")==0){
+		nDiscreteCovs = (nCovariates+1)/2;
+	}
+	unsigned int nContinuousCovs = nCovariates-nDiscreteCovs;
+	const unsigned int nFixedEffects = 2;
+	const double fixedEffectsCoeffs[nFixedEffects] = {0.1,-0.5};
+
+	std::ofstream dataFile(fileName.c_str());
+	dataFile << nSubjects << "\n" << nCovariates << "\n";
+	if(nDiscreteCovs>0&&nContinuousCovs>0){
+		dataFile << nDiscreteCovs << "\n" << nContinuousCovs << "\n";
+	}
+	for(unsigned int j=0;j<nCovariates;j++){
+		dataFile << "Variable" << j+1 << "\n";
+	}
+	dataFile << nFixedEffects << "\n";
+	for(unsigned int j=0;j<nFixedEffects;j++){
+		dataFile << "FixedEffects" << j+1 << "\n";
+	}
+	for(unsigned int j=0;j<nDiscreteCovs;j++){
+		dataFile << 3 << "\n";
+	}
+
+	for(unsigned int i=0;i<nSubjects;i++){
+		unsigned int k = (unsigned int)(((unsigned long long int)i*nClusters)/nSubjects);
+		double fraction = nClusters>1?(double)k/(double)(nClusters-1):0.5;
+		double theta = normalOutcome?5.0-10.0*fraction:log(9.0)-2.0*log(9.0)*fraction;
+		vector<unsigned int> digits(nCovariates);
+		unsigned int kDigits = k;
+		for(unsigned int j=0;j<nCovariates;j++){
+			digits[j]=kDigits%3;
+			kDigits/=3;
+		}
+		ostringstream covariates;
+		for(unsigned int j=0;j<nCovariates;j++){
+			if(j<nDiscreteCovs){
+				double u = unifRand(rndGenerator);
+				unsigned int category;
+				if(u<0.8){
+					category = digits[j];
+				}else{
+					category = (digits[j]+(u<0.9?1:2))%3;
+				}
+				covariates << category << " ";
+			}else{
+				covariates << 4.0*digits[j]+normRand(rndGenerator) << " ";
+			}
+		}
+		double linearPredictor = theta;
+		ostringstream fixedEffects;
+		for(unsigned int j=0;j<nFixedEffects;j++){
+			double w = normRand(rndGenerator);
+			linearPredictor+=fixedEffectsCoeffs[j]*w;
+			fixedEffects << w << " ";
+		}
+		if(normalOutcome){
+			dataFile << linearPredictor+normRand(rndGenerator) << " ";
+		}else{
+			double prob = 1.0/(1.0+exp(-linearPredictor));
+			dataFile << (unifRand(rndGenerator)<prob?1:0) << " ";
+		}
+		dataFile << covariates.str() << fixedEffects.str() << "\n";
+	}
+	dataFile.close();
+}
+
+/// \brief Seconds since start
+double secondsSince(const std::chrono::steady_clock::time_point& start){
+	return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+/// \brief Writes the line of results of one kernel
+void reportKernel(const string& scenario,const unsigned int& nSubjects,
+		const unsigned int& nCovariates,const unsigned int& nClusters,
+		const string& kernel,const unsigned int& nCalls,const double& seconds,
+		const double& meanNClusters){
+	double callsPerSec = seconds>0?(double)nCalls/seconds:0.0;
+	printf("%s %u %u %u %s %u %.6g %.6g %.6g %.6g\n",scenario.c_str(),nSubjects,nCovariates,
+			nClusters,kernel.c_str(),nCalls,seconds,1000.0*seconds/(double)nCalls,callsPerSec,
+			callsPerSec*(double)nSubjects*meanNClusters);
+	fflush(stdout);
+}
+
+/// \brief Times gibbsForZ and logCondPostBeta for the response density of
+/// the outcome
+template<pReMiuMLogPYiGivenZiWi logPYiGivenZiWi>
+void timeResponseKernels(benchmarkSampler& sampler,const unsigned int& nCalls,
+		double& zSeconds,double& betaSeconds){
+
+	mcmcChain<pReMiuMParams>& chain = sampler.chain();
+	const mcmcModel<pReMiuMParams,pReMiuMOptions,pReMiuMData>& model = sampler.model();
+	unsigned int nTry=0,nAccept=0;
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	for(unsigned int k=0;k<nCalls;k++){
+		gibbsForZ<logPYiGivenZiWi>(chain,nTry,nAccept,model,sampler.proposalParams(),sampler.rndGenerator());
+	}
+	zSeconds = secondsSince(startTime);
+
+	double sum=0.0;
+	startTime = std::chrono::steady_clock::now();
+	for(unsigned int k=0;k<nCalls;k++){
+		sum+=logCondPostBeta<logPYiGivenZiWi>(chain.currentState().parameters(),model);
+	}
+	betaSeconds = secondsSince(startTime);
+	if(std::isnan(sum)){
+		Rprintf("The log conditional posterior of beta is not a number\n");
+	}
+}
+
+/// \brief Runs the benchmarks for one scenario, number of subjects, of
+/// covariates and of clusters
+void runBenchmark(const benchmarkOptions& benchOptions,const string& scenario,
+		const unsigned int& nSubjects,const unsigned int& nCovariates,
+		const unsigned int& nClusters,baseGeneratorType& rndGenerator){
+
+	if(scenario.compare("BernoulliMixed")==0&&nCovariates<2){
+		Rprintf("The mixed scenario needs at least 2 covariates, p=%u is skipped\n",nCovariates);
+		return;
+	}
+
+	ostringstream stem;
+	stem << benchOptions.dir << "/benchmark_" << scenario << "_" << nSubjects << "_" <<
+			nCovariates << "_" << nClusters;
+	string dataFileName = stem.str()+"_input.txt";
+	writeScenarioData(scenario,nSubjects,nCovariates,nClusters,rndGenerator,dataFileName);
+
+	bool normalOutcome = scenario.compare("NormalNormal")==0;
+	string covariateType = "Discrete";
+	if(scenario.compare("NormalNormal")==0){
+		covariateType = "Normal";
+	}else if(scenario.compare("BernoulliMixed")==0){
+		covariateType = "Mixed";
+	}
+	unsigned int nSweepsTotal = benchOptions.nWarmup+benchOptions.nSweeps;
+	ostringstream inputStr;
+	inputStr << "premiumBenchmark --input=" << dataFileName << " --output=" << stem.str() <<
+			" --yModel=" << (normalOutcome?"Normal":"Bernoulli") << " --xModel=" << covariateType <<
+			" --nSweeps=" << nSweepsTotal << " --nBurn=0 --nClusInit=" << nClusters <<
+			" --seed=" << benchOptions.seed << " --nThreads=" << benchOptions.nThreads;
+	pReMiuMOptions options = processCommandLine(inputStr.str());
+
+	// Reading the data file
+	unsigned int nImports = 3;
+	pReMiuMData dataset;
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	for(unsigned int k=0;k<nImports;k++){
+		dataset = pReMiuMData();
+		dataset.outcomeType(options.outcomeType());
+		dataset.covariateType(options.covariateType());
+		importPReMiuMData(dataFileName,"","",dataset);
+	}
+	double importSeconds = secondsSince(startTime);
+
+	// The sampler is set up as in runPReMiuM
+	benchmarkSampler sampler;
+	sampler.options(options);
+	sampler.model(&importPReMiuMData,&initialisePReMiuM,&pReMiuMLogPost,true);
+	sampler.updateMissingDataFn(&updateMissingPReMiuMData);
+	sampler.userOutputFn(&writePReMiuMOutput);
+	sampler.rndGenerator().engine(options.rngType());
+	sampler.seedGenerator(options.seed());
+	sampler.nSweeps(options.nSweeps());
+	sampler.nBurn(options.nBurn());
+	sampler.nFilter(options.nFilter());
+	sampler.nProgress(options.nProgress());
+	sampler.reportBurnIn(options.reportBurnIn());
+	sampler.reportProgress(false);
+	sampler.importData(dataset,options.inFileName(),options.predictFileName(),options.neighbourFileName());
+	addPReMiuMProposals(sampler,options,dataset);
+	sampler.initialiseOutputFiles(options.outFileStem());
+	sampler.writeLogFile();
+	sampler.initialiseChain();
+	reportKernel(scenario,nSubjects,nCovariates,nClusters,"importPReMiuMData",nImports,importSeconds,
+			(double)sampler.chain().currentState().parameters().maxNClusters());
+
+	// Full sweeps, after the warm up
+	sampler.startRun();
+	sampler.runSweeps(benchOptions.nWarmup);
+	double sweepSeconds=0.0,sumNClusters=0.0;
+	for(unsigned int sweep=benchOptions.nWarmup+1;sweep<=nSweepsTotal;sweep++){
+		startTime = std::chrono::steady_clock::now();
+		sampler.runSweeps(sweep);
+		sweepSeconds+=secondsSince(startTime);
+		sumNClusters+=sampler.chain().currentState().parameters().maxNClusters();
+	}
+	reportKernel(scenario,nSubjects,nCovariates,nClusters,"sweep",benchOptions.nSweeps,sweepSeconds,
+			sumNClusters/(double)benchOptions.nSweeps);
+
+	// The kernels, on the state at the end of the sweeps
+	unsigned int nCalls = benchOptions.nSweeps;
+	double zSeconds=0.0,betaSeconds=0.0;
+	if(normalOutcome){
+		timeResponseKernels<logPYiGivenZiWiNormal>(sampler,nCalls,zSeconds,betaSeconds);
+	}else{
+		timeResponseKernels<logPYiGivenZiWiBernoulli>(sampler,nCalls,zSeconds,betaSeconds);
+	}
+	double meanNClusters = (double)sampler.chain().currentState().parameters().maxNClusters();
+	reportKernel(scenario,nSubjects,nCovariates,nClusters,"gibbsForZ",nCalls,zSeconds,meanNClusters);
+	reportKernel(scenario,nSubjects,nCovariates,nClusters,"logCondPostBeta",nCalls,betaSeconds,meanNClusters);
+
+	startTime = std::chrono::steady_clock::now();
+	double sum=0.0;
+	for(unsigned int k=0;k<nCalls;k++){
+		sum+=pReMiuMLogPost(sampler.chain().currentState().parameters(),sampler.model())[0];
+	}
+	reportKernel(scenario,nSubjects,nCovariates,nClusters,"pReMiuMLogPost",nCalls,secondsSince(startTime),
+			meanNClusters);
+	if(std::isnan(sum)){
+		Rprintf("The log posterior is not a number\n");
+	}
+
+	// The output of the last sweep is written again, after the allocations
+	// read by calcDisSimMat
+	startTime = std::chrono::steady_clock::now();
+	for(unsigned int k=0;k<nCalls;k++){
+		writePReMiuMOutput(sampler,nSweepsTotal);
+	}
+	reportKernel(scenario,nSubjects,nCovariates,nClusters,"writePReMiuMOutput",nCalls,secondsSince(startTime),
+			meanNClusters);
+	sampler.finishRun();
+	sampler.closeOutputFiles();
+
+	// The dissimilarity matrix of the sweeps after the warm up
+	startTime = std::chrono::steady_clock::now();
+	calcDisSimMat(benchmarkArg(stem.str()+"_z.txt"),benchmarkArg((double)benchOptions.nSweeps),
+			benchmarkArg((double)benchOptions.nWarmup),benchmarkArg(1.0),benchmarkArg((double)nSubjects),
+			benchmarkArg(0.0),benchmarkArg(1.0),benchmarkArg((double)benchOptions.nThreads),benchmarkArg(0.0));
+	reportKernel(scenario,nSubjects,nCovariates,nClusters,"calcDisSimMat",1,secondsSince(startTime),
+			sumNClusters/(double)benchOptions.nSweeps);
+}
+
+int main(int argc,char** argv){
+
+	benchmarkOptions options;
+	if(!readBenchmarkOptions(argc,argv,options)){
+		Rprintf("Usage: premiumBenchmark [--scenarios=BernoulliDiscrete,NormalNormal,BernoulliMixed]\n"
+				"\t[--N=1000,10000] [--p=5,20] [--K=5,20] [--nSweeps=100] [--nWarmup=20]\n"
+				"\t[--nThreads=1] [--seed=1] [--dir=.]\n");
+		return 1;
+	}
+
+	baseGeneratorType rndGenerator;
+	rndGenerator.seed(options.seed);
+	printf("scenario N p K kernel calls seconds msPerCall callsPerSec subjectClustersPerSec\n");
+	for(unsigned int s=0;s<options.scenarios.size();s++){
+		for(unsigned int n=0;n<options.N.size();n++){
+			for(unsigned int j=0;j<options.p.size();j++){
+				for(unsigned int k=0;k<options.K.size();k++){
+					runBenchmark(options,options.scenarios[s],options.N[n],options.p[j],options.K[k],rndGenerator);
+				}
+			}
+		}
+	}
+	return 0;
+}